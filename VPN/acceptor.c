@@ -0,0 +1,1000 @@
+#define _GNU_SOURCE		/* pthread_setaffinity_np, CPU_SET, accept4 */
+#include "acceptor.h"
+#include <stdlib.h>		/* calloc, free 		*/
+#include <stdio.h>		/* printf 		*/
+#include <string.h>		/* memset 		*/
+#include <unistd.h>		/* close 		*/
+#include <fcntl.h>		/* fcntl 		*/
+#include <errno.h>		/* EINTR 		*/
+#include <stddef.h>		/* offsetof 		*/
+#include <arpa/inet.h>		/* inet_ntoa 		*/
+#include <sys/socket.h>	/* accept4 		*/
+#include <sys/epoll.h>		/* epoll_wait 		*/
+#include <sys/eventfd.h>	/* eventfd 		*/
+#include <poll.h>		/* poll 		*/
+#include <sched.h>		/* CPU_SET 		*/
+#include <linux/filter.h>	/* sock_filter, SKF_AD_CPU */
+#include <openssl/err.h>	/* ERR_clear_error 	*/
+#include "pmtu.h"		/* PMTU_DEFAULT 	*/
+#include "upgrade.h"		/* HandleUpgrade 	*/
+
+
+/*
+ * Function:  AttachSteering
+ * --------------------
+ *  has the kernel hand each connection to the listening socket of the
+ *  acceptor matching the CPU the connection's packets arrive on, instead
+ *  of hashing the connection's addresses; the socket at position i in the
+ *  SO_REUSEPORT group takes the CPUs c with c % count == i
+ *
+ *  fd:		any of the listening sockets in the group
+ *  count:	number of sockets in the group
+ *
+ *  returns:	0 if successful, or -1 if an error occurred
+ */
+int AttachSteering(int fd, int count)
+{
+	struct sock_filter code[] = {
+		{ BPF_LD | BPF_W | BPF_ABS, 0, 0, SKF_AD_OFF + SKF_AD_CPU },
+		{ BPF_ALU | BPF_MOD | BPF_K, 0, 0, (uint32_t)count },
+		{ BPF_RET | BPF_A, 0, 0, 0 },
+	};
+	struct sock_fprog program;
+
+	program.len = sizeof(code) / sizeof(code[0]);
+	program.filter = code;
+	return setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &program, sizeof(program));
+}
+
+
+/*
+ * Function:  PinAcceptor
+ * --------------------
+ *  pins the calling thread to the CPUs whose connections ACCEPT_STEERING=cpu
+ *  hands to the acceptor, so its handshakes run where the packets arrive;
+ *  an acceptor without CPUs of its own is left unpinned
+ *
+ *  acceptor:	the acceptor running on the calling thread
+ */
+void PinAcceptor(acceptor_t *acceptor)
+{
+	cpu_set_t cpus;
+	long online = sysconf(_SC_NPROCESSORS_ONLN);
+	long cpu = 0;
+
+	CPU_ZERO(&cpus);
+	for(cpu = acceptor->index; cpu < online && cpu < CPU_SETSIZE; cpu += acceptor_count)
+	{
+		CPU_SET(cpu, &cpus);
+	}
+
+	if(0 != CPU_COUNT(&cpus) && 0 != pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus))
+	{
+		printf("Notice: Failed to pin acceptor %d to its CPUs.\n", acceptor->index);
+	}
+}
+
+
+/*
+ * Function:  SetUpAcceptor
+ * --------------------
+ *  creates an acceptor's epoll instance and registers its listening socket
+ *  and its wakeup eventfd (signalled on shutdown, upgrade and by the
+ *  handshake workers) with it
+ *
+ *  server:		the server state
+ *  acceptor:		the acceptor to set up, with listener.fd already set
+ *  index:		the acceptor's position in the server's acceptor array
+ *
+ *  returns:		0 if successful, or -1 if an error occurred
+ */
+int SetUpAcceptor(server_t *server, acceptor_t *acceptor, int index)
+{
+	struct epoll_event event;
+
+	acceptor->index = index;
+	acceptor->server = server;
+	pthread_mutex_init(&acceptor->returned_lock, NULL);
+	acceptor->epoll_fd = epoll_create1(0);
+	acceptor->wakeup.fd = eventfd(0, EFD_NONBLOCK);
+	if(-1 == acceptor->epoll_fd || -1 == acceptor->wakeup.fd)
+	{
+		return -1;
+	}
+
+	acceptor->listener.type = EVENT_LISTENER;
+	event.events = EPOLLIN;
+	event.data.ptr = &acceptor->listener;
+	if(-1 == epoll_ctl(acceptor->epoll_fd, EPOLL_CTL_ADD, acceptor->listener.fd, &event))
+	{
+		return -1;
+	}
+
+	acceptor->wakeup.type = EVENT_WAKEUP;
+	event.events = EPOLLIN;
+	event.data.ptr = &acceptor->wakeup;
+	if(-1 == epoll_ctl(acceptor->epoll_fd, EPOLL_CTL_ADD, acceptor->wakeup.fd, &event))
+	{
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/*
+ * Function:  WakeAcceptor
+ * --------------------
+ *  signals an acceptor's eventfd so it sees that the server is stopping or
+ *  that a new server is taking over
+ *
+ *  acceptor:   the acceptor to wake
+ *
+ *  returns:    no return value
+ */
+void WakeAcceptor(acceptor_t *acceptor)
+{
+	uint64_t one = 1;
+
+	if(-1 == write(acceptor->wakeup.fd, &one, sizeof(one)))
+	{
+		return;		/* the counter is already pending */
+	}
+}
+
+
+/*
+ * Function:  PickWorker
+ * --------------------
+ *  chooses the worker a new session is handed to, the one owning the fewest sessions
+ *
+ *  server:     the server state
+ *
+ *  returns:    the chosen worker
+ */
+static worker_t *PickWorker(server_t *server)
+{
+	worker_t *chosen = &server->workers[0];
+	size_t chosen_count = __atomic_load_n(&chosen->session_count, __ATOMIC_RELAXED);
+	size_t count = 0;
+	int i = 0;
+
+	for(i = 1; i < server->worker_count; ++i)
+	{
+		count = __atomic_load_n(&server->workers[i].session_count, __ATOMIC_RELAXED);
+		if(count < chosen_count)
+		{
+			chosen = &server->workers[i];
+			chosen_count = count;
+		}
+	}
+
+	return chosen;
+}
+
+
+/*
+ * Function:  NewClientSsl
+ * --------------------
+ *  creates the SSL/TLS session of a new client with the current context,
+ *  which a reload may swap while other acceptors create theirs
+ *
+ *  server:     the server state
+ *
+ *  returns:    the session, or NULL if an error occurred
+ */
+static SSL *NewClientSsl(server_t *server)
+{
+	SSL *ssl = NULL;
+
+	pthread_mutex_lock(&server->ctx_lock);
+	ssl = SSL_new(server->ctx);
+	pthread_mutex_unlock(&server->ctx_lock);
+	return ssl;
+}
+
+
+/*
+ * Function:  PauseAccepting
+ * --------------------
+ *  stops watching the listening socket for ACCEPT_PAUSE after accept() failed
+ *  for a reason other than an empty backlog (e.g. out of file descriptors), since
+ *  the pending connection would keep it readable and spin the acceptor
+ *
+ *  acceptor:   the acceptor
+ *
+ *  returns:    no return value
+ */
+static void PauseAccepting(acceptor_t *acceptor)
+{
+	struct epoll_event event;
+
+	if(0 != acceptor->accept_resume)
+	{
+		return;
+	}
+
+	perror("Error: Failed to accept a client, pausing");
+	event.events = 0;
+	event.data.ptr = &acceptor->listener;
+	epoll_ctl(acceptor->epoll_fd, EPOLL_CTL_MOD, acceptor->listener.fd, &event);
+	acceptor->accept_resume = GetMonotonicTime() + ACCEPT_PAUSE;
+}
+
+
+/*
+ * Function:  AcceptStreamClient
+ * --------------------
+ *  accepts an incoming TCP connection and sets up its SSL/TLS session, whose
+ *  secrets are tracked with UPGRADE_SOCKET set
+ *
+ *  acceptor:   the acceptor
+ *  session:    the new session, its peer_addr and ssl are set
+ *
+ *  returns:    the connection's socket file descriptor (non-blocking), or -1 if no 
+ *              connection was pending or an error occurred
+ */
+static int AcceptStreamClient(acceptor_t *acceptor, session_t *session)
+{
+	int conn_fd = 0;
+	socklen_t len;
+
+	len = sizeof(session->peer_addr);
+	conn_fd = accept(acceptor->listener.fd, (struct sockaddr *)&session->peer_addr, &len);
+	if(-1 == conn_fd)
+	{
+		if(EAGAIN != errno && EWOULDBLOCK != errno && EINTR != errno && ECONNABORTED != errno)
+		{
+			PauseAccepting(acceptor);
+		}
+		return -1;
+	}
+
+	fcntl(conn_fd, F_SETFL, fcntl(conn_fd, F_GETFL) | O_NONBLOCK);
+	session->ssl = NewClientSsl(acceptor->server);
+	SSL_set_fd(session->ssl, conn_fd);
+	if('\0' != upgrade_path[0] && NULL != session->ssl)
+	{
+		RecordTrack(session->ssl, &session->secrets);
+	}
+	return conn_fd;
+}
+
+
+/*
+ * Function:  AcceptDatagramClient
+ * --------------------
+ *  answers a ClientHello waiting on the listening UDP socket; once the peer echoes
+ *  a valid cookie, opens a UDP socket bound to the server's port and connected to
+ *  the peer, and moves the peer's SSL/DTLS session onto it
+ *
+ *  acceptor:   the acceptor
+ *  session:    the new session, its peer_addr and ssl are set
+ *
+ *  returns:    the peer's socket file descriptor (non-blocking), or -1 if no
+ *              ClientHello with a valid cookie was pending or an error occurred
+ */
+static int AcceptDatagramClient(acceptor_t *acceptor, session_t *session)
+{
+	int conn_fd = 0;
+	int enable = 1;
+	BIO *bio = NULL;
+	BIO_ADDR *peer = NULL;
+	struct sockaddr_in local_addr;
+
+	session->ssl = NewClientSsl(acceptor->server);
+	bio = BIO_new_dgram(acceptor->listener.fd, BIO_NOCLOSE);
+	peer = BIO_ADDR_new();
+	if(NULL == session->ssl || NULL == bio || NULL == peer)
+	{
+		BIO_free(bio);
+		BIO_ADDR_free(peer);
+		return -1;
+	}
+	SSL_set_bio(session->ssl, bio, bio);
+	SSL_set_options(session->ssl, SSL_OP_COOKIE_EXCHANGE);
+
+	/* stateless until the peer proves it owns its address */
+	if(1 != DTLSv1_listen(session->ssl, peer))
+	{
+		BIO_ADDR_free(peer);
+		return -1;
+	}
+
+	session->peer_addr.sin_family = AF_INET;
+	session->peer_addr.sin_port = BIO_ADDR_rawport(peer);
+	BIO_ADDR_rawaddress(peer, &session->peer_addr.sin_addr, NULL);
+	BIO_ADDR_free(peer);
+
+	local_addr.sin_family = AF_INET;
+	local_addr.sin_addr.s_addr = INADDR_ANY;
+	local_addr.sin_port = htons(port);
+
+	conn_fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+	if(-1 == conn_fd)
+	{
+		return -1;
+	}
+
+	setsockopt(conn_fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+	if(-1 == bind(conn_fd, (struct sockaddr *)&local_addr, sizeof(local_addr)) || 
+	   -1 == connect(conn_fd, (struct sockaddr *)&session->peer_addr, sizeof(session->peer_addr)))
+	{
+		close(conn_fd);
+		return -1;
+	}
+
+	BIO_set_fd(bio, conn_fd, BIO_NOCLOSE);
+	BIO_ctrl(bio, BIO_CTRL_DGRAM_SET_CONNECTED, 0, &session->peer_addr);
+	return conn_fd;
+}
+
+
+/*
+ * Function:  AbortHandshake
+ * --------------------
+ *  gives up on a client whose handshake failed or timed out, and frees it
+ *
+ *  acceptor:   the acceptor
+ *  session:    the session, in the acceptor's list of handshakes
+ *
+ *  returns:    no return value
+ */
+void AbortHandshake(acceptor_t *acceptor, session_t *session)
+{
+	epoll_ctl(acceptor->epoll_fd, EPOLL_CTL_DEL, session->source.fd, NULL);
+	STATS_ADD(acceptor->handshake_stats.in_progress, -1);
+
+	if(NULL != session->prev)
+	{
+		session->prev->next = session->next;
+	}
+	else
+	{
+		acceptor->handshakes = session->next;
+	}
+	if(NULL != session->next)
+	{
+		session->next->prev = session->prev;
+	}
+
+	SSL_free(session->ssl);
+	close(session->source.fd);
+	free(session);
+}
+
+
+/*
+ * Function:  CompleteHandshake
+ * --------------------
+ *  takes a client whose handshake completed off the acceptor, leases it a
+ *  tunnel address and hands it off to the least loaded worker
+ *
+ *  acceptor:   the acceptor
+ *  session:    the session, in the acceptor's list of handshakes
+ *
+ *  returns:    0 if successful, or -1 if an error occurred (the session is freed)
+ */
+static int CompleteHandshake(acceptor_t *acceptor, session_t *session)
+{
+	static int kernel_tls_notified = 0;
+	server_t *server = acceptor->server;
+	int conn_fd = session->source.fd;
+	int result = 0;
+	int ktls = 0;
+	worker_t *worker = NULL;
+
+	epoll_ctl(acceptor->epoll_fd, EPOLL_CTL_DEL, conn_fd, NULL);
+	STATS_ADD(acceptor->handshake_stats.in_progress, -1);
+	if(NULL != session->prev)
+	{
+		session->prev->next = session->next;
+	}
+	else
+	{
+		acceptor->handshakes = session->next;
+	}
+	if(NULL != session->next)
+	{
+		session->next->prev = session->prev;
+	}
+	session->prev = NULL;
+	session->next = NULL;
+
+	/* the connection stays non-blocking, what it doesn't take waits in the session's send queue */
+	SSL_set_mode(session->ssl, SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+	session->source.type = EVENT_SESSION;
+	/* go by the context the session was created with, a reload rewrites kernel_tls on another acceptor meanwhile */
+	ktls = 0 != (SSL_get_options(session->ssl) & SSL_OP_ENABLE_KTLS);
+	session->kernel_send = ktls && BIO_get_ktls_send(SSL_get_wbio(session->ssl));
+	if(ktls && !session->kernel_send && !__atomic_exchange_n(&kernel_tls_notified, 1, __ATOMIC_RELAXED))
+	{
+		printf("Notice: Kernel TLS is unavailable (no 'tls' module or an unsupported cipher), using user-space TLS.\n");
+	}
+
+	pthread_mutex_lock(&server->lease_lock);
+	result = LeasePoolAcquire(&server->leases, &session->inner_addr);
+	pthread_mutex_unlock(&server->lease_lock);
+	if(-1 == result)
+	{
+		printf("Error: No free tunnel address for the client %s.\n", inet_ntoa(session->peer_addr.sin_addr));
+		STATS_ADD(acceptor->handshake_stats.failed, 1);
+		SSL_free(session->ssl);
+		close(conn_fd);
+		free(session);
+		return -1;
+	}
+
+	if(-1 == SendLease(session, tunnel_prefix_length))
+	{
+		STATS_ADD(acceptor->handshake_stats.failed, 1);
+		pthread_mutex_lock(&server->lease_lock);
+		LeasePoolRelease(&server->leases, session->inner_addr);
+		pthread_mutex_unlock(&server->lease_lock);
+		SSL_free(session->ssl);
+		close(conn_fd);
+		free(session);
+		return -1;
+	}
+
+	worker = PickWorker(server);
+	session->worker = worker;
+
+	/* from now on only the worker touches the session, through its datagram rings */
+	if(session->datagram && -1 == SwitchToPacketRing(session, worker))
+	{
+		STATS_ADD(acceptor->handshake_stats.failed, 1);
+		pthread_mutex_lock(&server->lease_lock);
+		LeasePoolRelease(&server->leases, session->inner_addr);
+		pthread_mutex_unlock(&server->lease_lock);
+		SSL_free(session->ssl);
+		close(conn_fd);
+		free(session);
+		return -1;
+	}
+
+	/* the deadline was set HANDSHAKE_TIMEOUT after the connection was accepted */
+	STATS_ADD(acceptor->handshake_stats.completed, 1);
+	STATS_ADD(acceptor->handshake_stats.resumed, SSL_session_reused(session->ssl) ? 1 : 0);
+	STATS_ADD(acceptor->handshake_stats.duration_ms, GetMonotonicTime() - (session->deadline - HANDSHAKE_TIMEOUT));
+
+	pthread_mutex_lock(&worker->handoff_lock);
+	session->next = worker->handoff_sessions;
+	worker->handoff_sessions = session;
+	pthread_mutex_unlock(&worker->handoff_lock);
+	WakeWorker(worker);
+
+	printf("Client %s successfully %s, ", inet_ntoa(session->peer_addr.sin_addr), 
+	       SSL_session_reused(session->ssl) ? "resumed its session" : "connected");
+	printf("leased %s, ", inet_ntoa(*(struct in_addr *)&session->inner_addr));
+	printf("handed to worker %d%s.\n", worker->index, session->kernel_send ? " (kTLS)" : "");
+	return 0;
+}
+
+
+/*
+ * Function:  AdmitHandshake
+ * --------------------
+ *  queues the step after a client's ClientHello (HoldClientHello()) for the
+ *  handshake workers, resumptions ahead of full handshakes; the connection
+ *  leaves the acceptor's epoll set first, not even an error or hang-up is
+ *  reported for it until the step comes back (ReclaimHandshakes()). A full
+ *  handshake is dropped once HANDSHAKE_BACKLOG of them wait already, the
+ *  client retries after its backoff
+ *
+ *  acceptor:   the acceptor
+ *  session:    the session, in the acceptor's list of handshakes
+ *
+ *  returns:    0 if the step was queued, or -1 if the client was dropped (the session is freed)
+ */
+static int AdmitHandshake(acceptor_t *acceptor, session_t *session)
+{
+	epoll_ctl(acceptor->epoll_fd, EPOLL_CTL_DEL, session->source.fd, NULL);
+	session->handshake.ssl = session->ssl;
+	session->handshake.owner = acceptor;
+	session->offloaded = 1;
+	if(-1 == HandshakePoolSubmit(&acceptor->server->handshake_pool, &session->handshake, 
+	                             session->resuming ? HANDSHAKE_RESUMPTION : HANDSHAKE_FULL))
+	{
+		printf("Error: Too many handshakes waiting, dropped the client %s.\n", inet_ntoa(session->peer_addr.sin_addr));
+		STATS_ADD(acceptor->handshake_stats.shed, 1);
+		AbortHandshake(acceptor, session);
+		return -1;
+	}
+
+	acceptor->offloaded++;
+	return 0;
+}
+
+
+/*
+ * Function:  FinishHandshakeStep
+ * --------------------
+ *  carries on after a step of a client's handshake, run on the acceptor or
+ *  on a handshake worker: hands the client off once the handshake completed,
+ *  or waits for the socket to become readable (or writable) again through
+ *  the acceptor's event loop, so a slow client never holds up the others
+ *
+ *  acceptor:   the acceptor
+ *  session:    the session, in the acceptor's list of handshakes
+ *  result:     what SSL_accept() (or SSL_do_handshake()) returned
+ *  error:      SSL_get_error() of it
+ *
+ *  returns:    1 if the handshake completed and the client was handed off, 0 if it
+ *              is still in progress, or -1 if it failed (the session is freed)
+ */
+static int FinishHandshakeStep(acceptor_t *acceptor, session_t *session, int result, int error)
+{
+	struct epoll_event event;
+
+	if(1 == result)
+	{
+		return -1 == CompleteHandshake(acceptor, session) ? -1 : 1;
+	}
+
+	switch(error)
+	{
+		case SSL_ERROR_WANT_READ:
+			event.events = EPOLLIN;
+			break;
+		case SSL_ERROR_WANT_WRITE:
+			event.events = EPOLLOUT;
+			break;
+		case SSL_ERROR_WANT_CLIENT_HELLO_CB:
+			return AdmitHandshake(acceptor, session);
+		default:
+			printf("Error: SSL handshake failed with the client %s.\n", inet_ntoa(session->peer_addr.sin_addr));
+			STATS_ADD(acceptor->handshake_stats.failed, 1);
+			AbortHandshake(acceptor, session);
+			return -1;
+	}
+
+	event.data.ptr = &session->source;
+	epoll_ctl(acceptor->epoll_fd, EPOLL_CTL_MOD, session->source.fd, &event);
+	return 0;
+}
+
+
+/*
+ * Function:  ContinueHandshake
+ * --------------------
+ *  runs a client's handshake as far as the data it sent allows; with
+ *  HANDSHAKE_WORKERS set that is up to a ClientHello, the rest of its
+ *  flight is left to the handshake workers
+ *
+ *  acceptor:   the acceptor
+ *  session:    the session, in the acceptor's list of handshakes
+ *
+ *  returns:    1 if the handshake completed and the client was handed off, 0 if it
+ *              is still in progress, or -1 if it failed (the session is freed)
+ */
+static int ContinueHandshake(acceptor_t *acceptor, session_t *session)
+{
+	int result = SSL_accept(session->ssl);
+
+	return FinishHandshakeStep(acceptor, session, result, SSL_get_error(session->ssl, result));
+}
+
+
+/*
+ * Function:  ReturnHandshake
+ * --------------------
+ *  the handshake pool's done callback, on a handshake worker: hands a step
+ *  it ran back to the acceptor the session belongs to
+ *
+ *  job:        the step, the session's handshake
+ *
+ *  returns:    no return value
+ */
+void ReturnHandshake(handshake_job_t *job)
+{
+	acceptor_t *acceptor = job->owner;
+
+	pthread_mutex_lock(&acceptor->returned_lock);
+	job->next = acceptor->returned;
+	acceptor->returned = job;
+	pthread_mutex_unlock(&acceptor->returned_lock);
+	WakeAcceptor(acceptor);
+}
+
+
+/*
+ * Function:  ReclaimHandshakes
+ * --------------------
+ *  takes back the sessions whose steps the handshake workers ran and
+ *  watches their connections again
+ *
+ *  acceptor:   the acceptor
+ *  proceed:    whether to carry on with their handshakes (FinishHandshakeStep()), or
+ *              only take them back, e.g. to drop them
+ *
+ *  returns:    no return value
+ */
+void ReclaimHandshakes(acceptor_t *acceptor, int proceed)
+{
+	handshake_job_t *job = NULL;
+	session_t *session = NULL;
+	struct epoll_event event;
+
+	pthread_mutex_lock(&acceptor->returned_lock);
+	job = acceptor->returned;
+	acceptor->returned = NULL;
+	pthread_mutex_unlock(&acceptor->returned_lock);
+
+	while(NULL != job)
+	{
+		session = (session_t *)((char *)job - offsetof(session_t, handshake));
+		job = job->next;
+		session->offloaded = 0;
+		acceptor->offloaded--;
+
+		/* registered without events, FinishHandshakeStep() asks for the ones the step waits for */
+		event.events = 0;
+		event.data.ptr = &session->source;
+		epoll_ctl(acceptor->epoll_fd, EPOLL_CTL_ADD, session->source.fd, &event);
+		if(proceed)
+		{
+			FinishHandshakeStep(acceptor, session, session->handshake.result, session->handshake.error);
+		}
+	}
+}
+
+
+/*
+ * Function:  CreateConnection
+ * --------------------
+ *  accepts an incoming client connection (or DTLS association), sets up an SSL/TLS
+ *  session and starts the handshake with the client, which the acceptor's event
+ *  loop drives to completion (see ContinueHandshake())
+ *
+ *  acceptor:   the acceptor
+ *
+ *  returns:    the new session if its handshake already completed, or NULL if it is
+ *              still in progress, no connection was pending or an error occurred
+ */
+static session_t *CreateConnection(acceptor_t *acceptor)
+{
+	int conn_fd = 0;
+	session_t *session = NULL;
+	struct epoll_event event;
+
+	session = calloc(1, sizeof(session_t));
+	if(NULL == session)
+	{
+		return NULL;
+	}
+
+	if(TRANSPORT_UDP == transport)
+	{
+		conn_fd = AcceptDatagramClient(acceptor, session);
+		session->datagram = 1;
+	}
+	else
+	{
+		conn_fd = AcceptStreamClient(acceptor, session);
+	}
+
+	if(-1 == conn_fd)
+	{
+		SSL_free(session->ssl);
+		free(session);
+		return NULL;
+	}
+
+	session->source.type = EVENT_HANDSHAKE;
+	session->source.fd = conn_fd;
+	session->deadline = GetMonotonicTime() + HANDSHAKE_TIMEOUT;
+	SSL_set_app_data(session->ssl, session);		/* for HoldClientHello() */
+	session->mtu = tunnel_mtu < PMTU_DEFAULT ? tunnel_mtu : PMTU_DEFAULT;
+	FrameBatchReset(&session->outgoing);
+	DeframerInit(&session->incoming);
+	SSL_clear_mode(session->ssl, SSL_MODE_AUTO_RETRY);	/* don't block on records without application data */
+
+	event.events = EPOLLIN;
+	event.data.ptr = &session->source;
+	if(-1 == epoll_ctl(acceptor->epoll_fd, EPOLL_CTL_ADD, conn_fd, &event))
+	{
+		SSL_free(session->ssl);
+		close(conn_fd);
+		free(session);
+		return NULL;
+	}
+
+	session->next = acceptor->handshakes;
+	if(NULL != acceptor->handshakes)
+	{
+		acceptor->handshakes->prev = session;
+	}
+	acceptor->handshakes = session;
+	STATS_ADD(acceptor->handshake_stats.in_progress, 1);
+
+	/* the ClientHello (or the rest of a DTLS handshake) is usually already there */
+	if(1 != ContinueHandshake(acceptor, session))
+	{
+		return NULL;
+	}
+
+	return session;
+}
+
+
+/*
+ * Function:  NextAcceptorTimeout
+ * --------------------
+ *  works out how long the acceptor may wait for events: until the earliest
+ *  handshake deadline, DTLS retransmission or end of an accept pause
+ *
+ *  acceptor:   the acceptor
+ *
+ *  returns:    the timeout in milliseconds, or -1 if there is nothing to wait for
+ */
+int NextAcceptorTimeout(acceptor_t *acceptor)
+{
+	uint64_t now = GetMonotonicTime();
+	uint64_t next = acceptor->accept_resume;
+	uint64_t retransmit = 0;
+	session_t *session = NULL;
+	struct timeval timeout;
+
+	for(session = acceptor->handshakes; NULL != session; session = session->next)
+	{
+		/* the handshake workers have it, its deadline is checked once it is back */
+		if(session->offloaded)
+		{
+			continue;
+		}
+
+		if(0 == next || session->deadline < next)
+		{
+			next = session->deadline;
+		}
+
+		if(session->datagram && DTLSv1_get_timeout(session->ssl, &timeout))
+		{
+			retransmit = now + timeout.tv_sec * 1000 + timeout.tv_usec / 1000;
+			if(retransmit < next)
+			{
+				next = retransmit;
+			}
+		}
+	}
+
+	if(0 == next)
+	{
+		return -1;
+	}
+
+	return next > now ? (int)(next - now) : 0;
+}
+
+
+/*
+ * Function:  HandleAcceptorTimers
+ * --------------------
+ *  drops the clients that didn't complete their handshake in HANDSHAKE_TIMEOUT,
+ *  retransmits the DTLS flights that went unanswered and resumes accepting
+ *  at the end of a pause; the sessions the handshake workers have are left alone
+ *
+ *  acceptor:   the acceptor
+ *
+ *  returns:    no return value
+ */
+void HandleAcceptorTimers(acceptor_t *acceptor)
+{
+	uint64_t now = GetMonotonicTime();
+	session_t *session = acceptor->handshakes;
+	session_t *next = NULL;
+	struct epoll_event event;
+	struct timeval timeout;
+
+	if(0 != acceptor->accept_resume && now >= acceptor->accept_resume)
+	{
+		event.events = EPOLLIN;
+		event.data.ptr = &acceptor->listener;
+		epoll_ctl(acceptor->epoll_fd, EPOLL_CTL_MOD, acceptor->listener.fd, &event);
+		acceptor->accept_resume = 0;
+	}
+
+	while(NULL != session)
+	{
+		next = session->next;
+
+		if(session->offloaded)
+		{
+			/* the handshake workers have it, its deadline is checked once it is back */
+		}
+		else if(now >= session->deadline)
+		{
+			printf("Error: The handshake with the client %s timed out.\n", inet_ntoa(session->peer_addr.sin_addr));
+			STATS_ADD(acceptor->handshake_stats.timed_out, 1);
+			AbortHandshake(acceptor, session);
+		}
+		else if(session->datagram && DTLSv1_get_timeout(session->ssl, &timeout) && 
+		        0 == timeout.tv_sec && 0 == timeout.tv_usec && 0 > DTLSv1_handle_timeout(session->ssl))
+		{
+			printf("Error: SSL handshake failed with the client %s.\n", inet_ntoa(session->peer_addr.sin_addr));
+			STATS_ADD(acceptor->handshake_stats.failed, 1);
+			AbortHandshake(acceptor, session);
+		}
+
+		session = next;
+	}
+}
+
+
+/*
+ * Function:  StopAccepting
+ * --------------------
+ *  stops watching the listening socket and drops the handshakes in progress,
+ *  once the handshake workers gave back those they have, while a new server
+ *  takes over; new clients wait in the socket's backlog for whichever server
+ *  serves on, the dropped ones start over
+ *
+ *  acceptor:   the acceptor
+ *
+ *  returns:    no return value
+ */
+void StopAccepting(acceptor_t *acceptor)
+{
+	struct pollfd returned;
+	uint64_t count = 0;
+
+	epoll_ctl(acceptor->epoll_fd, EPOLL_CTL_DEL, acceptor->listener.fd, NULL);
+
+	/* the handshake workers finish the steps they were handed before the sessions are freed */
+	returned.fd = acceptor->wakeup.fd;
+	returned.events = POLLIN;
+	ReclaimHandshakes(acceptor, 0);
+	while(0 != acceptor->offloaded)
+	{
+		if(0 < poll(&returned, 1, -1) && -1 == read(acceptor->wakeup.fd, &count, sizeof(count)))
+		{
+			count = 0;
+		}
+		ReclaimHandshakes(acceptor, 0);
+	}
+
+	while(NULL != acceptor->handshakes)
+	{
+		AbortHandshake(acceptor, acceptor->handshakes);
+	}
+}
+
+
+/*
+ * Function:  ResumeAccepting
+ * --------------------
+ *  watches the listening socket again after StopAccepting(), once the new
+ *  server didn't take over
+ *
+ *  acceptor:   the acceptor
+ *
+ *  returns:    no return value
+ */
+void ResumeAccepting(acceptor_t *acceptor)
+{
+	struct epoll_event event;
+
+	event.events = EPOLLIN;
+	event.data.ptr = &acceptor->listener;
+	epoll_ctl(acceptor->epoll_fd, EPOLL_CTL_ADD, acceptor->listener.fd, &event);
+	acceptor->accept_resume = 0;
+}
+
+
+/*
+ * Function:  HandleAcceptorEvents
+ * --------------------
+ *  dispatches the events an acceptor's epoll instance reported
+ *
+ *  acceptor:	the acceptor
+ *  events:	the events
+ *  ready:	number of events
+ *
+ *  returns:	no return value
+ */
+void HandleAcceptorEvents(acceptor_t *acceptor, struct epoll_event *events, int ready)
+{
+	event_source_t *source = NULL;
+	uint64_t count = 0;
+	int i = 0;
+
+	for(i = 0; i < ready; ++i)
+	{
+		source = events[i].data.ptr;
+		if(EVENT_LISTENER == source->type)
+		{
+			CreateConnection(acceptor);				/* new client */
+		}
+		else if(EVENT_WAKEUP == source->type)
+		{
+			if(-1 == read(source->fd, &count, sizeof(count)))
+			{
+				count = 0;					/* signalled already, nothing lost */
+			}
+			ReclaimHandshakes(acceptor, 1);				/* steps the handshake workers ran, stopping or pausing is checked after the events */
+		}
+		else if(EVENT_UPGRADE == source->type)
+		{
+			HandleUpgrade(acceptor);				/* a new server taking over */
+			break;							/* the handshakes the events left are for were dropped */
+		}
+		else if(!((session_t *)source)->offloaded)
+		{
+			ContinueHandshake(acceptor, (session_t *)source);	/* handshake in progress */
+		}
+	}
+}
+
+
+/*
+ * Function:  PauseAcceptor
+ * --------------------
+ *  stops an acceptor other than the first while a new server takes over,
+ *  once the first asked for it (HandleUpgrade()): it stops accepting and
+ *  waits for the clients to be handed over, or accepts again if they weren't
+ *
+ *  acceptor:	the acceptor
+ *
+ *  returns:	no return value, keep_running is cleared once the clients were handed over
+ */
+static void PauseAcceptor(acceptor_t *acceptor)
+{
+	server_t *server = acceptor->server;
+
+	if(UPGRADE_PAUSED != __atomic_load_n(&server->upgrade_state, __ATOMIC_ACQUIRE))
+	{
+		return;
+	}
+
+	StopAccepting(acceptor);
+	pthread_barrier_wait(&server->upgrade_barrier);		/* the first acceptor may hand over */
+	pthread_barrier_wait(&server->upgrade_barrier);		/* it is done */
+	if(UPGRADE_NONE == __atomic_load_n(&server->upgrade_state, __ATOMIC_ACQUIRE))
+	{
+		ResumeAccepting(acceptor);
+	}
+}
+
+
+/*
+ * Function:  AcceptorLoop
+ * --------------------
+ *  the thread function of every acceptor but the first (which runs in main()):
+ *  accepts clients on its listening socket, runs their handshakes and hands
+ *  them to the workers until the server stops
+ *
+ *  arg:	the acceptor
+ *
+ *  returns:	NULL
+ */
+void *AcceptorLoop(void *arg)
+{
+	acceptor_t *acceptor = arg;
+	struct epoll_event events[MAX_EVENTS];
+	int ready = 0;
+
+	if(accept_steering)
+	{
+		PinAcceptor(acceptor);
+	}
+
+	while(keep_running)
+	{
+		ready = epoll_wait(acceptor->epoll_fd, events, MAX_EVENTS, NextAcceptorTimeout(acceptor));
+		if(-1 == ready)
+		{
+			if(EINTR == errno)
+			{
+				continue;
+			}
+			break;
+		}
+
+		HandleAcceptorEvents(acceptor, events, ready);
+		HandleAcceptorTimers(acceptor);
+		PauseAcceptor(acceptor);
+	}
+
+	return NULL;
+}
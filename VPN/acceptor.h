@@ -0,0 +1,46 @@
+#ifndef ACCEPTOR_H
+#define ACCEPTOR_H
+
+#include <sys/epoll.h>		/* epoll_event 		*/
+#include "server.h"		/* acceptor_t 		*/
+
+/* steers each connection to the acceptor of the CPU it came in on */
+int AttachSteering(int fd, int count);
+
+/* pins the calling thread to the CPUs whose connections its acceptor takes */
+void PinAcceptor(acceptor_t *acceptor);
+
+/* creates an acceptor's epoll instance and registers its listening socket */
+int SetUpAcceptor(server_t *server, acceptor_t *acceptor, int index);
+
+/* signals an acceptor that the server is stopping or a new server is taking over */
+void WakeAcceptor(acceptor_t *acceptor);
+
+/* gives up on a client whose handshake failed or timed out, and frees it */
+void AbortHandshake(acceptor_t *acceptor, session_t *session);
+
+/* the handshake pool's done callback, hands a step back to its acceptor */
+void ReturnHandshake(handshake_job_t *job);
+
+/* takes back the sessions whose steps the handshake workers ran */
+void ReclaimHandshakes(acceptor_t *acceptor, int proceed);
+
+/* returns how long the acceptor may wait for events, in milliseconds */
+int NextAcceptorTimeout(acceptor_t *acceptor);
+
+/* drops the handshakes that timed out and retransmits unanswered DTLS flights */
+void HandleAcceptorTimers(acceptor_t *acceptor);
+
+/* stops accepting and drops the handshakes in progress while a new server takes over */
+void StopAccepting(acceptor_t *acceptor);
+
+/* accepts again once the new server didn't take over */
+void ResumeAccepting(acceptor_t *acceptor);
+
+/* dispatches the events an acceptor's epoll instance reported */
+void HandleAcceptorEvents(acceptor_t *acceptor, struct epoll_event *events, int ready);
+
+/* the thread function of every acceptor but the first */
+void *AcceptorLoop(void *arg);
+
+#endif  /* ACCEPTOR_H */
@@ -0,0 +1,794 @@
+/* ===================== */
+/*      HEADER FILES     */
+/* ===================== */
+#include <stdio.h>		/* printf 		   */
+#include <stdlib.h>		/* atoi, qsort 	   */
+#include <string.h>		/* strcmp, memset 	   */
+#include <stdint.h>		/* uint64_t 		   */
+#include <unistd.h>		/* read, write, close    */
+#include <fcntl.h>		/* fcntl, O_NONBLOCK 	   */
+#include <time.h>		/* clock_gettime 	   */
+#include <poll.h>		/* poll 		   */
+#include <pthread.h>		/* pthread_create 	   */
+#include <arpa/inet.h>		/* htonl, sockaddr_in    */
+#include <sys/socket.h>	/* socketpair 		   */
+#include <openssl/ssl.h>	/* ssl 		   */
+#include <openssl/err.h>	/* ERR_print_errors_fp   */
+#include "pump.h"		/* pump_t 		   */
+
+/* ===================== */
+/*      DEFINITIONS      */
+/* ===================== */
+#define CERT_PATH "server.crt"
+#define KEY_PATH "server.key"
+#define DEFAULT_SECONDS 2
+#define LATENCY_SAMPLES 10000
+#define IDLE_TIMEOUT_MS 1000		/* the sink gives up on packets lost by a datagram tunnel */
+#define ENDPOINT_BUFFER (4 * 1024 * 1024)
+#define NSEC_PER_SEC 1000000000ULL
+#define PACKET_BUFFER 2048
+
+/*** COMPILE WITH -lssl -lcrypto -pthread ***/
+/*** RUN FROM THE VPN DIRECTORY (USES server.crt AND server.key) ***/
+
+/*
+ * the benchmark drives a client pump and a server pump in one process: the
+ * two talk SSL/TLS (or SSL/DTLS) over loopback, and a SOCK_SEQPACKET
+ * socketpair stands in for each side's TUN device, so packets written into
+ * the client's endpoint come out of the server's
+ *
+ *	generator -> [client endpoint] -> client pump ==loopback==> server pump -> [server endpoint] -> sink
+ */
+
+static const size_t packet_sizes[] = {64, 128, 256, 512, 1024, 1400};
+
+static volatile int keep_running = 1;
+
+/*
+ * Struct:  tunnel 
+ * --------------------
+ *  both ends of the benchmarked tunnel
+ */
+typedef struct tunnel
+{
+	int datagram;			/* DTLS over UDP rather than TLS over TCP */
+	SSL_CTX *server_ctx;
+	SSL_CTX *client_ctx;
+	SSL *server_ssl;
+	SSL *client_ssl;
+	int server_socket;
+	int client_socket;
+	int client_pair[2];		/* [0] the generator writes, [1] the client pump's endpoint */
+	int server_pair[2];		/* [0] the sink reads, [1] the server pump's endpoint */
+	size_t crypto_workers;		/* per pump, 0 to seal and open records on the pump's thread */
+	record_secrets_t server_secrets;	/* what the pipelines take the sessions over with */
+	record_secrets_t client_secrets;
+	pump_t server_pump;
+	pump_t client_pump;
+	traffic_counters_t server_traffic;	/* what each pump counted */
+	traffic_counters_t client_traffic;
+	pthread_t server_thread;
+	pthread_t client_thread;
+} tunnel_t;
+
+/*
+ * Struct:  generator 
+ * --------------------
+ *  a thread flooding the client endpoint with packets
+ */
+typedef struct generator
+{
+	int fd;
+	size_t size;
+	uint64_t deadline;		/* when to stop, in CLOCK_MONOTONIC nanoseconds */
+	uint64_t sent;			/* packets written, valid once done is set */
+	int done;
+} generator_t;
+
+
+/* ===================== */
+/*       UTILITIES       */
+/* ===================== */
+
+/*		
+ * Function:  Now 
+ * --------------------
+ *  reads the monotonic clock
+ *
+ *  returns:	the time in nanoseconds
+ */
+static uint64_t Now(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * NSEC_PER_SEC + now.tv_nsec;
+}
+
+
+/*		
+ * Function:  ThreadCpuTime 
+ * --------------------
+ *  reads the CPU time a thread has consumed
+ *
+ *  thread:	the thread
+ *
+ *  returns:	the CPU time in nanoseconds, or 0 if unavailable
+ */
+static uint64_t ThreadCpuTime(pthread_t thread)
+{
+	clockid_t clock = 0;
+	struct timespec used;
+
+	if(0 != pthread_getcpuclockid(thread, &clock) || -1 == clock_gettime(clock, &used))
+	{
+		return 0;
+	}
+
+	return (uint64_t)used.tv_sec * NSEC_PER_SEC + used.tv_nsec;
+}
+
+
+/*		
+ * Function:  CompareSamples 
+ * --------------------
+ *  orders latency samples for qsort
+ *
+ *  returns:	negative, zero or positive as first is below, equal or above second
+ */
+static int CompareSamples(const void *first, const void *second)
+{
+	uint64_t a = *(const uint64_t *)first;
+	uint64_t b = *(const uint64_t *)second;
+
+	return (a > b) - (a < b);
+}
+
+
+/*		
+ * Function:  Percentile 
+ * --------------------
+ *  picks a percentile out of sorted samples
+ *
+ *  samples:	the sorted samples
+ *  count:	number of samples
+ *  fraction:	the percentile, e.g. 0.99
+ *
+ *  returns:	the sample in microseconds
+ */
+static double Percentile(const uint64_t *samples, size_t count, double fraction)
+{
+	size_t index = (size_t)(fraction * count);
+
+	if(0 == count)
+	{
+		return 0;
+	}
+	if(index >= count)
+	{
+		index = count - 1;
+	}
+
+	return samples[index] / 1000.0;
+}
+
+
+/* ===================== */
+/*       THE TUNNEL      */
+/* ===================== */
+
+/*		
+ * Function:  CreateContexts 
+ * --------------------
+ *  creates the server context with the server's certificate and a client
+ *  context that skips verification, the benchmark trusts its own loopback;
+ *  with crypto workers both log their keys for the pipelines
+ *
+ *  tunnel:	the tunnel
+ *
+ *  returns:	0 if successful, or -1 if an error occurred
+ */
+static int CreateContexts(tunnel_t *tunnel)
+{
+	tunnel->server_ctx = SSL_CTX_new(tunnel->datagram ? DTLS_server_method() : TLS_server_method());
+	tunnel->client_ctx = SSL_CTX_new(tunnel->datagram ? DTLS_client_method() : TLS_client_method());
+	if(NULL == tunnel->server_ctx || NULL == tunnel->client_ctx)
+	{
+		ERR_print_errors_fp(stderr);
+		return -1;
+	}
+
+	if(0 >= SSL_CTX_use_certificate_file(tunnel->server_ctx, CERT_PATH, SSL_FILETYPE_PEM) ||
+	   0 >= SSL_CTX_use_PrivateKey_file(tunnel->server_ctx, KEY_PATH, SSL_FILETYPE_PEM))
+	{
+		printf("Error: Could not load %s and %s, run the benchmark from the VPN directory.\n", CERT_PATH, KEY_PATH);
+		return -1;
+	}
+
+	/* WANT_READ has to mean "no data yet" for the pumps */
+	SSL_CTX_clear_mode(tunnel->server_ctx, SSL_MODE_AUTO_RETRY);
+	SSL_CTX_clear_mode(tunnel->client_ctx, SSL_MODE_AUTO_RETRY);
+	SSL_CTX_set_verify(tunnel->client_ctx, SSL_VERIFY_NONE, NULL);
+
+	if(0 != tunnel->crypto_workers)
+	{
+		SSL_CTX_set_keylog_callback(tunnel->server_ctx, RecordKeylog);
+		SSL_CTX_set_keylog_callback(tunnel->client_ctx, RecordKeylog);
+	}
+	return 0;
+}
+
+
+/*		
+ * Function:  ConnectSockets 
+ * --------------------
+ *  connects a server and a client socket over loopback: an accepted TCP
+ *  connection, or two UDP sockets connected to each other
+ *
+ *  tunnel:	the tunnel
+ *
+ *  returns:	0 if successful, or -1 if an error occurred
+ */
+static int ConnectSockets(tunnel_t *tunnel)
+{
+	struct sockaddr_in server_addr;
+	struct sockaddr_in client_addr;
+	socklen_t length = sizeof(struct sockaddr_in);
+	int type = tunnel->datagram ? SOCK_DGRAM : SOCK_STREAM;
+	int listener = -1;
+
+	memset(&server_addr, 0, sizeof(server_addr));
+	server_addr.sin_family = AF_INET;
+	server_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	client_addr = server_addr;
+
+	/* the port is picked by the kernel */
+	listener = socket(AF_INET, type, 0);
+	if(-1 == listener || -1 == bind(listener, (struct sockaddr *)&server_addr, length) ||
+	   -1 == getsockname(listener, (struct sockaddr *)&server_addr, &length))
+	{
+		perror("Error: Could not bind the server socket");
+		return -1;
+	}
+
+	tunnel->client_socket = socket(AF_INET, type, 0);
+	if(-1 == tunnel->client_socket)
+	{
+		perror("Error: Could not create the client socket");
+		close(listener);
+		return -1;
+	}
+
+	if(tunnel->datagram)
+	{
+		if(-1 == bind(tunnel->client_socket, (struct sockaddr *)&client_addr, length) ||
+		   -1 == getsockname(tunnel->client_socket, (struct sockaddr *)&client_addr, &length) ||
+		   -1 == connect(listener, (struct sockaddr *)&client_addr, length) ||
+		   -1 == connect(tunnel->client_socket, (struct sockaddr *)&server_addr, length))
+		{
+			perror("Error: Could not connect the UDP sockets");
+			close(listener);
+			return -1;
+		}
+		tunnel->server_socket = listener;
+		return 0;
+	}
+
+	if(-1 == listen(listener, 1) || -1 == connect(tunnel->client_socket, (struct sockaddr *)&server_addr, length))
+	{
+		perror("Error: Could not connect the TCP sockets");
+		close(listener);
+		return -1;
+	}
+
+	tunnel->server_socket = accept(listener, NULL, NULL);
+	close(listener);
+	if(-1 == tunnel->server_socket)
+	{
+		perror("Error: Could not accept the TCP connection");
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/*		
+ * Function:  AcceptThread 
+ * --------------------
+ *  runs the server side of the handshake while the main thread connects
+ *
+ *  arg:	the server SSL
+ *
+ *  returns:	NULL on success, or non-NULL if the handshake failed
+ */
+static void *AcceptThread(void *arg)
+{
+	return 0 < SSL_accept((SSL *)arg) ? NULL : arg;
+}
+
+
+/*		
+ * Function:  SetDatagramBio 
+ * --------------------
+ *  gives an SSL/DTLS session a datagram BIO on a connected UDP socket
+ *
+ *  ssl:	the session
+ *  fd:		the connected socket
+ *
+ *  returns:	no return value
+ */
+static void SetDatagramBio(SSL *ssl, int fd)
+{
+	struct sockaddr_in peer;
+	socklen_t length = sizeof(peer);
+	BIO *bio = NULL;
+
+	getpeername(fd, (struct sockaddr *)&peer, &length);
+	bio = BIO_new_dgram(fd, BIO_NOCLOSE);
+	BIO_ctrl(bio, BIO_CTRL_DGRAM_SET_CONNECTED, 0, &peer);
+	SSL_set_bio(ssl, bio, bio);
+}
+
+
+/*		
+ * Function:  Handshake 
+ * --------------------
+ *  runs both sides of the SSL/TLS (or SSL/DTLS) handshake over the sockets
+ *
+ *  tunnel:	the tunnel
+ *
+ *  returns:	0 if successful, or -1 if an error occurred
+ */
+static int Handshake(tunnel_t *tunnel)
+{
+	pthread_t acceptor;
+	void *failed = NULL;
+	int result = 0;
+
+	tunnel->server_ssl = SSL_new(tunnel->server_ctx);
+	tunnel->client_ssl = SSL_new(tunnel->client_ctx);
+	if(NULL == tunnel->server_ssl || NULL == tunnel->client_ssl)
+	{
+		return -1;
+	}
+
+	if(tunnel->datagram)
+	{
+		SetDatagramBio(tunnel->server_ssl, tunnel->server_socket);
+		SetDatagramBio(tunnel->client_ssl, tunnel->client_socket);
+	}
+	else
+	{
+		SSL_set_fd(tunnel->server_ssl, tunnel->server_socket);
+		SSL_set_fd(tunnel->client_ssl, tunnel->client_socket);
+	}
+
+	if(0 != tunnel->crypto_workers &&
+	   (-1 == RecordTrack(tunnel->server_ssl, &tunnel->server_secrets) ||
+	    -1 == RecordTrack(tunnel->client_ssl, &tunnel->client_secrets)))
+	{
+		return -1;
+	}
+
+	if(0 != pthread_create(&acceptor, NULL, AcceptThread, tunnel->server_ssl))
+	{
+		return -1;
+	}
+
+	result = SSL_connect(tunnel->client_ssl);
+	pthread_join(acceptor, &failed);
+	if(0 >= result || NULL != failed)
+	{
+		printf("Error: The handshake failed.\n");
+		ERR_print_errors_fp(stderr);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/*		
+ * Function:  CreateEndpoints 
+ * --------------------
+ *  creates the socketpairs standing in for the TUN devices, the pumps' ends
+ *  are non-blocking like the TUN fds and get room for a full burst
+ *
+ *  tunnel:	the tunnel
+ *
+ *  returns:	0 if successful, or -1 if an error occurred
+ */
+static int CreateEndpoints(tunnel_t *tunnel)
+{
+	int size = ENDPOINT_BUFFER;
+	int i = 0;
+
+	if(-1 == socketpair(AF_UNIX, SOCK_SEQPACKET, 0, tunnel->client_pair) ||
+	   -1 == socketpair(AF_UNIX, SOCK_SEQPACKET, 0, tunnel->server_pair))
+	{
+		perror("Error: Could not create the endpoints");
+		return -1;
+	}
+
+	for(i = 0; i < 2; ++i)
+	{
+		setsockopt(tunnel->client_pair[i], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+		setsockopt(tunnel->client_pair[i], SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+		setsockopt(tunnel->server_pair[i], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+		setsockopt(tunnel->server_pair[i], SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+	}
+
+	fcntl(tunnel->client_pair[1], F_SETFL, O_NONBLOCK);
+	fcntl(tunnel->server_pair[1], F_SETFL, O_NONBLOCK);
+	return 0;
+}
+
+
+/*		
+ * Function:  PumpThread 
+ * --------------------
+ *  runs one side's pump until the benchmark ends
+ *
+ *  arg:	the pump
+ *
+ *  returns:	NULL
+ */
+static void *PumpThread(void *arg)
+{
+	if(-1 == PumpRun((pump_t *)arg, &keep_running))
+	{
+		printf("Error: A pump stopped on an error.\n");
+	}
+
+	return NULL;
+}
+
+
+/*		
+ * Function:  OpenTunnel 
+ * --------------------
+ *  connects both ends, sets up their pumps and starts a thread for each
+ *
+ *  tunnel:	the tunnel, with datagram and crypto_workers set
+ *  io_uring:	whether the pumps wait on io_uring instead of select
+ *
+ *  returns:	0 if successful, or -1 if an error occurred
+ */
+static int OpenTunnel(tunnel_t *tunnel, int io_uring)
+{
+	if(-1 == CreateContexts(tunnel) || -1 == ConnectSockets(tunnel) ||
+	   -1 == Handshake(tunnel) || -1 == CreateEndpoints(tunnel))
+	{
+		return -1;
+	}
+
+	PumpInit(&tunnel->client_pump, tunnel->client_pair[1], tunnel->client_socket, tunnel->client_ssl, tunnel->datagram, &tunnel->client_traffic);
+	PumpInit(&tunnel->server_pump, tunnel->server_pair[1], tunnel->server_socket, tunnel->server_ssl, tunnel->datagram, &tunnel->server_traffic);
+
+	if(tunnel->datagram)
+	{
+		fcntl(tunnel->client_socket, F_SETFL, O_NONBLOCK);
+		fcntl(tunnel->server_socket, F_SETFL, O_NONBLOCK);
+		if(-1 == PumpUseRings(&tunnel->client_pump) || -1 == PumpUseRings(&tunnel->server_pump))
+		{
+			printf("Error: Could not allocate the datagram rings.\n");
+			return -1;
+		}
+	}
+
+	if(0 != tunnel->crypto_workers && !tunnel->datagram &&
+	   (-1 == PumpUsePipeline(&tunnel->client_pump, &tunnel->client_secrets, tunnel->crypto_workers) ||
+	    -1 == PumpUsePipeline(&tunnel->server_pump, &tunnel->server_secrets, tunnel->crypto_workers)))
+	{
+		printf("Error: Could not start the crypto pipelines (the session isn't TLS 1.3 with an AEAD they take).\n");
+		return -1;
+	}
+
+	if(io_uring && (-1 == PumpUseUring(&tunnel->client_pump) || -1 == PumpUseUring(&tunnel->server_pump)))
+	{
+		printf("Error: io_uring is unavailable (compiled out or refused by the kernel).\n");
+		return -1;
+	}
+
+	if(0 != pthread_create(&tunnel->client_thread, NULL, PumpThread, &tunnel->client_pump) ||
+	   0 != pthread_create(&tunnel->server_thread, NULL, PumpThread, &tunnel->server_pump))
+	{
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/*		
+ * Function:  CloseTunnel 
+ * --------------------
+ *  stops the pumps and releases everything OpenTunnel() set up
+ *
+ *  tunnel:	the tunnel
+ *
+ *  returns:	no return value
+ */
+static void CloseTunnel(tunnel_t *tunnel)
+{
+	unsigned char wake[64] = {0};
+
+	/* a pump blocked in io_uring only notices the flag on its next packet */
+	keep_running = 0;
+	write(tunnel->client_pair[0], wake, sizeof(wake));
+	write(tunnel->server_pair[0], wake, sizeof(wake));
+	pthread_join(tunnel->client_thread, NULL);
+	pthread_join(tunnel->server_thread, NULL);
+
+	PumpDestroy(&tunnel->client_pump);
+	PumpDestroy(&tunnel->server_pump);
+	SSL_free(tunnel->client_ssl);
+	SSL_free(tunnel->server_ssl);
+	SSL_CTX_free(tunnel->client_ctx);
+	SSL_CTX_free(tunnel->server_ctx);
+	close(tunnel->client_socket);
+	close(tunnel->server_socket);
+	close(tunnel->client_pair[0]);
+	close(tunnel->client_pair[1]);
+	close(tunnel->server_pair[0]);
+	close(tunnel->server_pair[1]);
+}
+
+
+/* ===================== */
+/*      MEASUREMENTS     */
+/* ===================== */
+
+/*		
+ * Function:  GeneratorThread 
+ * --------------------
+ *  writes packets into the client endpoint as fast as it takes them until
+ *  the deadline
+ *
+ *  arg:	the generator
+ *
+ *  returns:	NULL
+ */
+static void *GeneratorThread(void *arg)
+{
+	generator_t *generator = arg;
+	unsigned char packet[PACKET_BUFFER] = {0};
+	uint64_t sent = 0;
+
+	while(Now() < generator->deadline)
+	{
+		if(-1 != write(generator->fd, packet, generator->size))
+		{
+			++sent;
+		}
+	}
+
+	generator->sent = sent;
+	__atomic_store_n(&generator->done, 1, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+
+/*		
+ * Function:  MeasureLatency 
+ * --------------------
+ *  sends one packet at a time through the tunnel and times its way from
+ *  the client endpoint to the server endpoint
+ *
+ *  tunnel:	the tunnel
+ *  size:	packet size
+ *  samples:	filled with up to LATENCY_SAMPLES sorted latencies
+ *
+ *  returns:	the number of samples taken
+ */
+static size_t MeasureLatency(tunnel_t *tunnel, size_t size, uint64_t *samples)
+{
+	unsigned char packet[PACKET_BUFFER] = {0};
+	struct pollfd sink = {tunnel->server_pair[0], POLLIN, 0};
+	uint64_t sent_at = 0;
+	size_t count = 0;
+	size_t i = 0;
+
+	for(i = 0; i < LATENCY_SAMPLES; ++i)
+	{
+		sent_at = Now();
+		if(-1 == write(tunnel->client_pair[0], packet, size))
+		{
+			continue;
+		}
+
+		/* a packet a datagram tunnel lost is no sample */
+		if(0 >= poll(&sink, 1, IDLE_TIMEOUT_MS) || 0 >= read(tunnel->server_pair[0], packet, sizeof(packet)))
+		{
+			continue;
+		}
+
+		samples[count++] = Now() - sent_at;
+	}
+
+	qsort(samples, count, sizeof(uint64_t), CompareSamples);
+	return count;
+}
+
+
+/*		
+ * Function:  MeasureThroughput 
+ * --------------------
+ *  floods the tunnel with packets for the given time and counts what comes out,
+ *  along with the CPU time both pumps spent on it
+ *
+ *  tunnel:	the tunnel
+ *  size:	packet size
+ *  seconds:	how long to flood
+ *  received:	set to the packets that came out
+ *  sent:	set to the packets that went in
+ *  elapsed:	set to the wall time in nanoseconds, until the last packet came out
+ *  cpu:	set to the pumps' CPU time in nanoseconds
+ *
+ *  returns:	0 if successful, or -1 if an error occurred
+ */
+static int MeasureThroughput(tunnel_t *tunnel, size_t size, int seconds, uint64_t *received,
+			     uint64_t *sent, uint64_t *elapsed, uint64_t *cpu)
+{
+	unsigned char packet[PACKET_BUFFER];
+	struct pollfd sink = {tunnel->server_pair[0], POLLIN, 0};
+	generator_t generator = {tunnel->client_pair[0], size, 0, 0, 0};
+	pthread_t thread;
+	uint64_t start = 0;
+	uint64_t last = 0;
+	uint64_t cpu_start = 0;
+
+	*received = 0;
+	cpu_start = ThreadCpuTime(tunnel->client_thread) + ThreadCpuTime(tunnel->server_thread);
+	start = Now();
+	last = start;
+	generator.deadline = start + (uint64_t)seconds * NSEC_PER_SEC;
+	if(0 != pthread_create(&thread, NULL, GeneratorThread, &generator))
+	{
+		return -1;
+	}
+
+	/* until every packet came out, or none did for a while after the generator stopped */
+	while(!__atomic_load_n(&generator.done, __ATOMIC_ACQUIRE) || *received < generator.sent)
+	{
+		if(0 >= poll(&sink, 1, IDLE_TIMEOUT_MS))
+		{
+			if(__atomic_load_n(&generator.done, __ATOMIC_ACQUIRE))
+			{
+				break;
+			}
+			continue;
+		}
+
+		if(0 < read(tunnel->server_pair[0], packet, sizeof(packet)))
+		{
+			++*received;
+			last = Now();
+		}
+	}
+
+	pthread_join(thread, NULL);
+	*sent = generator.sent;
+	*elapsed = last - start;
+	*cpu = ThreadCpuTime(tunnel->client_thread) + ThreadCpuTime(tunnel->server_thread) - cpu_start;
+	return 0;
+}
+
+
+/*		
+ * Function:  RunBenchmark 
+ * --------------------
+ *  measures every packet size and prints a line for each
+ *
+ *  tunnel:	the open tunnel
+ *  seconds:	how long to flood per packet size
+ *
+ *  returns:	0 if successful, or -1 if an error occurred
+ */
+static int RunBenchmark(tunnel_t *tunnel, int seconds)
+{
+	uint64_t *samples = NULL;
+	uint64_t received = 0;
+	uint64_t sent = 0;
+	uint64_t elapsed = 0;
+	uint64_t cpu = 0;
+	size_t count = 0;
+	size_t i = 0;
+	double bytes = 0;
+
+	samples = malloc(LATENCY_SAMPLES * sizeof(uint64_t));
+	if(NULL == samples)
+	{
+		return -1;
+	}
+
+	printf("%6s %12s %9s %9s %9s %9s %11s %7s\n", "size", "packets/s", "Gbit/s", "p50 us", "p99 us", "p999 us", "CPU s/GB", "loss %");
+	for(i = 0; i < sizeof(packet_sizes) / sizeof(packet_sizes[0]); ++i)
+	{
+		count = MeasureLatency(tunnel, packet_sizes[i], samples);
+		if(-1 == MeasureThroughput(tunnel, packet_sizes[i], seconds, &received, &sent, &elapsed, &cpu))
+		{
+			free(samples);
+			return -1;
+		}
+
+		/* payload bytes, the framing and encryption overhead isn't counted */
+		bytes = (double)received * packet_sizes[i];
+		printf("%6zu %12.0f %9.3f %9.1f %9.1f %9.1f %11.2f %7.2f\n", packet_sizes[i],
+		       0 == elapsed ? 0 : received * (double)NSEC_PER_SEC / elapsed,
+		       0 == elapsed ? 0 : bytes * 8 / elapsed,
+		       Percentile(samples, count, 0.50),
+		       Percentile(samples, count, 0.99),
+		       Percentile(samples, count, 0.999),
+		       0 == received ? 0 : (cpu / (double)NSEC_PER_SEC) / (bytes / 1e9),
+		       0 == sent ? 0 : 100.0 * (sent - received) / sent);
+	}
+
+	free(samples);
+	return 0;
+}
+
+
+/* ===================== */
+/*          MAIN         */
+/* ===================== */
+
+/*		
+ * Function:  main 
+ * --------------------
+ *  benchmarks the packet pump over loopback
+ *
+ *  argv[1]:	tcp (TLS, the default) or udp (DTLS)
+ *  argv[2]:	select (the default) or io_uring
+ *  argv[3]:	seconds of flooding per packet size
+ *  argv[4]:	crypto workers per pump (TLS only), 0 (the default) for none
+ *
+ *  returns:	0 if successful, or 1 if an error occurred
+ */
+int main(int argc, char *argv[])
+{
+	tunnel_t tunnel;
+	int io_uring = 0;
+	int seconds = DEFAULT_SECONDS;
+
+	memset(&tunnel, 0, sizeof(tunnel));
+	if(1 < argc)
+	{
+		tunnel.datagram = 0 == strcmp(argv[1], "udp");
+	}
+	if(2 < argc)
+	{
+		io_uring = 0 == strcmp(argv[2], "io_uring");
+	}
+	if(3 < argc && 0 < atoi(argv[3]))
+	{
+		seconds = atoi(argv[3]);
+	}
+	if(4 < argc && 0 < atoi(argv[4]) && PIPELINE_MAX_WORKERS >= atoi(argv[4]))
+	{
+		tunnel.crypto_workers = atoi(argv[4]);
+	}
+
+	if(1 < argc && 0 != strcmp(argv[1], "tcp") && 0 != strcmp(argv[1], "udp"))
+	{
+		printf("Usage: %s [tcp|udp] [select|io_uring] [seconds per size] [crypto workers]\n", argv[0]);
+		return 1;
+	}
+
+	if(-1 == OpenTunnel(&tunnel, io_uring))
+	{
+		return 1;
+	}
+
+	printf("%s over loopback, %s pumps, %d s per size, %zu crypto workers\n", tunnel.datagram ? "DTLS/UDP" : "TLS/TCP",
+	       io_uring ? "io_uring" : "select", seconds, tunnel.datagram ? 0 : tunnel.crypto_workers);
+	if(-1 == RunBenchmark(&tunnel, seconds))
+	{
+		CloseTunnel(&tunnel);
+		return 1;
+	}
+
+	CloseTunnel(&tunnel);
+	return 0;
+}
@@ -0,0 +1,249 @@
+#include "cipher.h"
+#include <stdio.h>		/* printf 		*/
+#include <string.h>		/* strcmp, strncmp 	*/
+#include <time.h>		/* clock_gettime 	*/
+#include <openssl/evp.h>	/* EVP_EncryptUpdate 	*/
+
+#define BENCH_PACKET_SIZE 1400				/* a full tunnel packet */
+#define BENCH_DURATION 10000000L			/* nanoseconds each AEAD is timed for per round */
+#define BENCH_ROUNDS 3
+
+/* the faster AEAD first, the other one stays acceptable for peers lacking it */
+#define SUITES_AES_FIRST "TLS_AES_128_GCM_SHA256:TLS_AES_256_GCM_SHA384:TLS_CHACHA20_POLY1305_SHA256"
+#define SUITES_CHACHA_FIRST "TLS_CHACHA20_POLY1305_SHA256:TLS_AES_128_GCM_SHA256:TLS_AES_256_GCM_SHA384"
+#define CIPHERS_AES_FIRST "ECDHE+AESGCM:ECDHE+CHACHA20"
+#define CIPHERS_CHACHA_FIRST "ECDHE+CHACHA20:ECDHE+AESGCM"
+
+
+/*
+ * Function:  CipherParseMinVersion
+ * --------------------
+ *  parses a TLS_MIN_VERSION configuration value
+ *
+ *  value:		'1.2' or '1.3'
+ *  min_version:	set to TLS1_2_VERSION or TLS1_3_VERSION
+ *
+ *  returns:		0 if successful, -1 if the value is invalid
+ */
+int CipherParseMinVersion(const char *value, int *min_version)
+{
+	if(0 == strcmp(value, "1.2"))
+	{
+		*min_version = TLS1_2_VERSION;
+	}
+	else if(0 == strcmp(value, "1.3"))
+	{
+		*min_version = TLS1_3_VERSION;
+	}
+	else
+	{
+		printf("Error: Invalid TLS_MIN_VERSION. Version should be either '1.2' or '1.3'.\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/*
+ * Function:  MeasureAead
+ * --------------------
+ *  encrypts tunnel sized packets with an AEAD for BENCH_DURATION
+ *
+ *  cipher:	the AEAD
+ *
+ *  returns:	the throughput in bytes per second, or 0 if the AEAD is unavailable
+ */
+static double MeasureAead(const EVP_CIPHER *cipher)
+{
+	unsigned char key[32] = {0};
+	unsigned char iv[12] = {0};
+	unsigned char packet[BENCH_PACKET_SIZE] = {0};
+	unsigned char sealed[BENCH_PACKET_SIZE + EVP_MAX_BLOCK_LENGTH];
+	EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+	struct timespec start;
+	struct timespec now;
+	long elapsed = 0;
+	double bytes = 0;
+	int length = 0;
+
+	if(NULL == ctx || NULL == cipher || 1 != EVP_EncryptInit_ex(ctx, cipher, NULL, key, iv))
+	{
+		EVP_CIPHER_CTX_free(ctx);
+		return 0;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	while(elapsed < BENCH_DURATION)
+	{
+		/* a fresh nonce per packet, like a record */
+		++iv[11];
+		EVP_EncryptInit_ex(ctx, NULL, NULL, NULL, iv);
+		EVP_EncryptUpdate(ctx, sealed, &length, packet, sizeof(packet));
+		EVP_EncryptFinal_ex(ctx, sealed + length, &length);
+		bytes += sizeof(packet);
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		elapsed = (now.tv_sec - start.tv_sec) * 1000000000L + (now.tv_nsec - start.tv_nsec);
+	}
+
+	EVP_CIPHER_CTX_free(ctx);
+	return bytes * 1000000000.0 / elapsed;
+}
+
+
+/*
+ * Function:  PreferChaCha
+ * --------------------
+ *  benchmarks AES-128-GCM against ChaCha20-Poly1305 on this CPU, once; AES-GCM
+ *  wins wherever the CPU has AES instructions, ChaCha20 on CPUs without them
+ *
+ *  returns:	1 if ChaCha20-Poly1305 is faster, 0 if AES-GCM is
+ */
+static int PreferChaCha()
+{
+	static int measured = 0;
+	static int chacha = 0;
+	double aes_rate = 0;
+	double chacha_rate = 0;
+	double rate = 0;
+	int round = 0;
+
+	if(measured)
+	{
+		return chacha;
+	}
+
+	/* interleaved rounds, the best of each, so a frequency ramp or a busy core doesn't decide */
+	for(round = 0; round < BENCH_ROUNDS; ++round)
+	{
+		rate = MeasureAead(EVP_aes_128_gcm());
+		aes_rate = rate > aes_rate ? rate : aes_rate;
+		rate = MeasureAead(EVP_chacha20_poly1305());
+		chacha_rate = rate > chacha_rate ? rate : chacha_rate;
+	}
+	chacha = chacha_rate > aes_rate;
+	measured = 1;
+
+	printf("Cipher auto-selection: AES-128-GCM %.2f GB/s, ChaCha20-Poly1305 %.2f GB/s, preferring %s.\n",
+	       aes_rate / 1e9, chacha_rate / 1e9, chacha ? "ChaCha20-Poly1305" : "AES-GCM");
+	return chacha;
+}
+
+
+/*
+ * Function:  ApplyCipherList
+ * --------------------
+ *  splits a CIPHERS value into its TLS 1.3 suites (TLS_*), which go to
+ *  SSL_CTX_set_ciphersuites(), and the TLS 1.2/DTLS cipher strings, which go
+ *  to SSL_CTX_set_cipher_list(); either part left out keeps its defaults
+ *
+ *  ctx:	the context
+ *  ciphers:	the colon separated list
+ *
+ *  returns:	0 if successful, -1 if the library accepted none of a part
+ */
+static int ApplyCipherList(SSL_CTX *ctx, const char *ciphers)
+{
+	char copy[CIPHER_LIST_LENGTH];
+	char suites[CIPHER_LIST_LENGTH] = {'\0'};
+	char legacy[CIPHER_LIST_LENGTH] = {'\0'};
+	char *name = NULL;
+	char *rest = NULL;
+
+	snprintf(copy, sizeof(copy), "%s", ciphers);
+	for(name = strtok_r(copy, ":", &rest); NULL != name; name = strtok_r(NULL, ":", &rest))
+	{
+		char *part = 0 == strncmp(name, "TLS_", 4) ? suites : legacy;
+
+		if('\0' != part[0])
+		{
+			strncat(part, ":", CIPHER_LIST_LENGTH - strlen(part) - 1);
+		}
+		strncat(part, name, CIPHER_LIST_LENGTH - strlen(part) - 1);
+	}
+
+	if('\0' != suites[0] && 1 != SSL_CTX_set_ciphersuites(ctx, suites))
+	{
+		printf("Error: None of the TLS 1.3 suites in CIPHERS ('%s') is supported.\n", suites);
+		return -1;
+	}
+	if('\0' != legacy[0] && 1 != SSL_CTX_set_cipher_list(ctx, legacy))
+	{
+		printf("Error: None of the ciphers in CIPHERS ('%s') is supported.\n", legacy);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/*
+ * Function:  CipherConfigure
+ * --------------------
+ *  applies the CIPHERS, TLS_MIN_VERSION and GROUPS settings to a context; with
+ *  CIPHERS=auto the AEAD that is faster on this CPU is put first, and a server
+ *  enforces its own order so clients end up on it as well
+ *
+ *  ctx:	the SSL/TLS (or SSL/DTLS) context
+ *  config:	the settings
+ *  datagram:	whether the context is a DTLS one
+ *  server:	whether the context accepts clients
+ *
+ *  returns:	0 if successful, -1 if a setting was rejected
+ */
+int CipherConfigure(SSL_CTX *ctx, const cipher_config_t *config, int datagram, int server)
+{
+	int min_version = config->min_version;
+	int chacha = 0;
+
+	/* DTLS 1.2 is the newest DTLS, and DTLS versions have their own numbers */
+	if(datagram && TLS1_3_VERSION == min_version)
+	{
+		printf("Error: TLS_MIN_VERSION=1.3 isn't available with TRANSPORT=udp, DTLS 1.2 is the newest version.\n");
+		return -1;
+	}
+	if(datagram && TLS1_2_VERSION == min_version)
+	{
+		min_version = DTLS1_2_VERSION;
+	}
+
+	if(0 != min_version && 1 != SSL_CTX_set_min_proto_version(ctx, min_version))
+	{
+		printf("Error: Failed to set the minimal protocol version.\n");
+		return -1;
+	}
+
+	if('\0' != config->groups[0] && 1 != SSL_CTX_set1_groups_list(ctx, config->groups))
+	{
+		printf("Error: Invalid GROUPS '%s'.\n", config->groups);
+		return -1;
+	}
+
+	if('\0' == config->ciphers[0])
+	{
+		return 0;
+	}
+
+	if(0 == strcmp(config->ciphers, CIPHER_AUTO))
+	{
+		chacha = PreferChaCha();
+		if(1 != SSL_CTX_set_ciphersuites(ctx, chacha ? SUITES_CHACHA_FIRST : SUITES_AES_FIRST) ||
+		   1 != SSL_CTX_set_cipher_list(ctx, chacha ? CIPHERS_CHACHA_FIRST : CIPHERS_AES_FIRST))
+		{
+			printf("Error: Failed to set the automatically selected ciphers.\n");
+			return -1;
+		}
+	}
+	else if(-1 == ApplyCipherList(ctx, config->ciphers))
+	{
+		return -1;
+	}
+
+	if(server)
+	{
+		SSL_CTX_set_options(ctx, SSL_OP_CIPHER_SERVER_PREFERENCE);
+	}
+
+	return 0;
+}
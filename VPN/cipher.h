@@ -0,0 +1,30 @@
+#ifndef CIPHER_H
+#define CIPHER_H
+
+#include <openssl/ssl.h>	/* SSL_CTX 	*/
+
+#define CIPHER_AUTO "auto"
+#define CIPHER_LIST_LENGTH 1024
+
+/*
+ * the cipher settings shared by the server and the client configuration files:
+ *  ciphers:	'auto', or a colon separated list mixing TLS 1.3 suites (TLS_*)
+ *		and TLS 1.2/DTLS cipher strings, empty for the library defaults
+ *  min_version:	lowest protocol version accepted, 0 for the library default
+ *  groups:	colon separated key exchange groups, empty for the library defaults
+ */
+typedef struct cipher_config
+{
+	char ciphers[CIPHER_LIST_LENGTH];
+	int min_version;
+	char groups[CIPHER_LIST_LENGTH];
+} cipher_config_t;
+
+
+/* parses a TLS_MIN_VERSION value, '1.2' or '1.3' */
+int CipherParseMinVersion(const char *value, int *min_version);
+
+/* applies the cipher settings to a context, benchmarking the AEADs for 'auto' */
+int CipherConfigure(SSL_CTX *ctx, const cipher_config_t *config, int datagram, int server);
+
+#endif  /* CIPHER_H */
@@ -12,39 +12,102 @@
 #include <sys/select.h>	/* select		   */
 #include <string.h>		/* strstr, strtok, strcmp */
 #include <signal.h>		/* SIGINT 		   */
+#include <errno.h>		/* EAGAIN 		   */
+#include <time.h>		/* nanosleep 		   */
+#include <openssl/pem.h>	/* PEM_write_SSL_SESSION */
+#include "frame.h"		/* frame_batch_t 	   */
+#include "pump.h"		/* pump_t 		   */
+#include "cipher.h"		/* cipher_config_t 	   */
+#include "stats.h"		/* traffic_counters_t 	   */
+#include "compress.h"		/* compress_mode_t 	   */
+#include "netconf.h"		/* NetconfLinkUp 	   */
+#include "pmtu.h"		/* PMTU_DEFAULT 	   */
+#include "offload.h"		/* OffloadEnable 	   */
+#include "pipeline.h"		/* PIPELINE_MAX_WORKERS   */
 
 /* ===================== */
 /*      DEFINITIONS      */
 /* ===================== */
 #define VNIC_NAME "tun0"
-#define MTU 1400
-#define BUFFER_SIZE 1500
 #define MAX_LINE_LENGTH 4096
 #define MIN_PORT 1024
 #define MAX_PORT 65535
-#define CMD_LINE_LENGTH 1024
+#define LEASE_ATTEMPTS 5
+#define RECONNECT_MIN_DELAY 1			/* seconds, doubled after every failed attempt */
+#define RECONNECT_MAX_DELAY 60
+#define DEFAULT_KEEPALIVE_INTERVAL 10		/* seconds between checks on the tunnel */
+#define DEFAULT_KEEPALIVE_TIMEOUT 60		/* seconds without hearing from the server before reconnecting */
+#define MAX_KEEPALIVE 3600
 
-/*** COMPILE WITH -lssl -lcrypto ***/
+/*** COMPILE WITH -lssl -lcrypto -pthread ***/
 /********* RUN USING ROOT *********/
 
 static volatile int keep_running = 1;
 char server_host[16] = {'\0'};
 int port = 0;
 char ca_path[MAX_LINE_LENGTH] = {'\0'};
+char session_path[MAX_LINE_LENGTH] = {'\0'};	/* where the session is kept across restarts, if set */
+int kernel_tls = 0;				/* install the TLS keys in the kernel (SSL_OP_ENABLE_KTLS) */
+cipher_config_t cipher_config;			/* CIPHERS, TLS_MIN_VERSION and GROUPS */
+SSL_SESSION *saved_session = NULL;		/* the last session the server issued, resumed on reconnect */
+char stats_path[STATS_PATH_LENGTH] = {'\0'};	/* the statistics socket, if set */
+compress_mode_t compress_mode = COMPRESS_OFF;	/* compress the packets sent, if the server restores them */
+int tunnel_mtu = PMTU_DEFAULT;			/* the most tun0's MTU may be, over UDP the path may take less */
+size_t vnic_mtu = 0;				/* tun0's MTU as last set */
+int offload = 0;				/* tun0 takes and hands out super-packets behind a virtio_net_hdr (offload.h) */
+int keepalive_interval = DEFAULT_KEEPALIVE_INTERVAL;	/* seconds, 0 when keepalives are off */
+int keepalive_timeout = DEFAULT_KEEPALIVE_TIMEOUT;	/* seconds */
+int crypto_workers = 0;				/* threads sealing and opening the TLS records, 0 to do it on the tunnel's thread */
+record_secrets_t session_secrets;		/* what the crypto workers need of the session, collected during its handshake */
+traffic_counters_t tunnel_traffic;		/* the tunnel's traffic across reconnects, counted by the pump */
 
+/*
+ * Struct:  connection_counters 
+ * --------------------
+ *  the client's connection statistics, only written by the main thread
+ *
+ *  attempts:		connections attempted
+ *  connected:		connections whose handshake completed
+ *  resumed:		the completed handshakes that resumed a session
+ *  handshake_ms:	total time the completed connections and handshakes took
+ *  up:			whether the tunnel is up (gauge)
+ */
+typedef struct connection_counters
+{
+	uint64_t attempts;
+	uint64_t connected;
+	uint64_t resumed;
+	uint64_t handshake_ms;
+	uint64_t up;
+} connection_counters_t;
 
-/* ===================== */
-/*    UTILITY FUNCTIONS  */
-/* ===================== */
-/*		
- * Function:  max 
+connection_counters_t connection_stats;
+
+/*
+ * Enum:  transport 
  * --------------------
- *  returns the maximum value between two integers (x, y)
+ *  how the tunnel is carried between client and server
  */
-int max(int x, int y)
+typedef enum transport
 {
-	return x > y ? x : y;
-}
+	TRANSPORT_TCP,		/* TLS over TCP, frames are coalesced into records */
+	TRANSPORT_UDP		/* DTLS over UDP, one frame (one IP packet) per datagram */
+} transport_t;
+
+transport_t transport = TRANSPORT_TCP;
+
+/*
+ * Enum:  io_backend 
+ * --------------------
+ *  how the client waits for traffic
+ */
+typedef enum io_backend
+{
+	IO_BACKEND_SELECT,	/* select, then one read per TUN packet */
+	IO_BACKEND_IO_URING	/* TUN reads kept posted on an io_uring, the socket polled through it */
+} io_backend_t;
+
+io_backend_t io_backend = IO_BACKEND_SELECT;
 
 
 /* ============================ */
@@ -119,431 +182,1423 @@ int ValidateAndAssignCA(char *value)
 
 
 /*		
- * Function:  ParseConfigFile 
+ * Function:  ValidateAndAssignSessionCache 
  * --------------------
- *  parses the client configuration file to extract key-value pairs
- *  representing server host and port information
+ *  validates and assigns the path of the file the TLS session is kept in,
+ *  so the client resumes its session after a restart as well
  *
- *  config_file:    	pointer to the opened client configuration file
+ *  value:            	session file path to validate and assign
  *
- *  returns:	       0 if successful, -1 if an error occurred
+ *  returns:		0 if successful, -1 if an error occurred
  */
-int ParseConfigFile(FILE *config_file)
+int ValidateAndAssignSessionCache(char *value)
 {
-	char line[MAX_LINE_LENGTH];
-	char *key;
-	char *value;
-	
-	while(fgets(line, sizeof(line), config_file))
+	if(NULL == value || 0 == strlen(value))
 	{
-		key = strtok(line, "=");
-		value = strtok(NULL, "\n");
-		
-		if(0 == strcmp(key, "SERVER_HOST"))
-		{
-			if(-1 == ValidateAndAssignServerHost(value))
-			{
-				return -1;
-			}
-		}
-		else if(0 == strcmp(key, "PORT"))
-		{
-			if(-1 == ValidateAndAssignPort(atoi(value)))
-			{
-				return -1;
-			}
-		}
-		else if(0 == strcmp(key, "CA_PATH"))
-		{
-			if(-1 == ValidateAndAssignCA(value))
-			{
-				return -1;
-			}
-		}
-		else
-		{
-			printf("Error: Invalid configuration in 'client_config_file.txt'.\n");
-			return -1;
-		}
+		printf("Error: SESSION_CACHE should be the path of a file.\n");
+		return -1;
 	}
-	
+
+	strcpy(session_path, value);
 	return 0;
 }
 
 
 /*		
- * Function:  GetConfiguration 
+ * Function:  ValidateAndAssignTransport 
  * --------------------
- *  reads and parses a client configuration file to retrieve server host and port information
+ *  validates and assigns the tunnel transport, 'tcp' (TLS) or 'udp' (DTLS)
  *
- *  returns:	 0 if successful, -1 if an error occurred or the configuration is invalid
+ *  value:            	transport value to validate and assign
+ *
+ *  returns:		0 if successful, -1 if an error occurred
  */
-int GetConfiguration()
+int ValidateAndAssignTransport(char *value)
 {
-	FILE *config_file = NULL;
-	
-	config_file = fopen("client_config_file.txt", "r");
-	if(NULL == config_file)
+	if(0 == strcmp(value, "tcp"))
 	{
-		printf("Error: Unable to open 'server_config_file.txt'. Ensure the file exists and has the appropriate permissions.\n");
-		return -1;
+		transport = TRANSPORT_TCP;
 	}
-	
-	if(-1 == ParseConfigFile(config_file))
+	else if(0 == strcmp(value, "udp"))
 	{
-		fclose(config_file);
+		transport = TRANSPORT_UDP;
+	}
+	else
+	{
+		printf("Error: Invalid TRANSPORT. Transport should be either 'tcp' or 'udp'.\n");
 		return -1;
 	}
-	
-	fclose(config_file);
+
 	return 0;
 }
 
 
-/* ========================== */
-/*    NETWORK SETUP FUNCTIONS */
-/* ========================== */
 /*		
- * Function:  SetUpVictualNIC 
+ * Function:  ValidateAndAssignIoBackend 
  * --------------------
- *  initializes a virtual network interface (TUN device) with the specified name
+ *  validates and assigns how the client waits for traffic, 'select' or 'io_uring'
  *
- *  vnic_name:	the name of the virtual network interface to be created
+ *  value:            	backend value to validate and assign
  *
- *  returns: 	the file descriptor associated with the TUN device if successful,
- *              or -1 if an error occurred during setup
+ *  returns:		0 if successful, -1 if an error occurred
  */
-int SetUpVirtualNIC(char *vnic_name)
+int ValidateAndAssignIoBackend(char *value)
 {
-	struct ifreq ifr;
-	int fd = 0;
-	char cmd[CMD_LINE_LENGTH];
-
-    	system("sudo ip tuntap add mode tun tun0");
-
-    	fd = open("/dev/net/tun", O_RDWR);
-    	if (-1 == fd)
-    	{
-        	return -1;
-    	}
-
-	memset(&ifr, 0, sizeof(ifr));
-	ifr.ifr_flags = IFF_TUN | IFF_NO_PI; /* IFF_NO_PI = dudce IP protocol version from packet, IFF_TUN = tun device (no ethernet header) */
-	strncpy(ifr.ifr_name, vnic_name, IFNAMSIZ);
-
-    	/* ioctl will use ifr_name as the name of TUN interface to open: "tun0", etc. */
-    	if (-1 == ioctl(fd, TUNSETIFF, (void *)&ifr))
-    	{
-    	    close(fd);
-    	    return -1;
-    	}
-    	/* After the ioctl call the fd is "connected" to tun device specified by vnic_name */
+	if(0 == strcmp(value, "select"))
+	{
+		io_backend = IO_BACKEND_SELECT;
+	}
+	else if(0 == strcmp(value, "io_uring"))
+	{
+		io_backend = IO_BACKEND_IO_URING;
+	}
+	else
+	{
+		printf("Error: Invalid IO_BACKEND. Backend should be either 'select' or 'io_uring'.\n");
+		return -1;
+	}
 
-    	system("sudo ip link set dev tun0 up");
-    	snprintf(cmd, sizeof(cmd), "ifconfig tun0 10.8.0.2/24 mtu %d up", MTU);
-    	system(cmd);
-    	
-    	return fd;
+	return 0;
 }
 
 
 /*		
- * Function:  SetUpTCPSocketWithTLS 
+ * Function:  ValidateAndAssignKernelTls 
  * --------------------
- *  sets up a TCP socket and initializes an SSL/TLS context for secure communication
- *  
- *  this function creates a socket, binds it to an IP address and port, and sets up
- *  an SSL/TLS context with the server's certificate and private key
+ *  validates and assigns whether TLS records are encrypted by the kernel (kTLS),
+ *  'on' or 'off'; only applies to TRANSPORT=tcp, and falls back to user-space TLS
+ *  when the kernel lacks the 'tls' module or the negotiated cipher
  *
- *  ctx:	a pointer to a pointer for storing the SSL/TLS context
- *  ssl:	a pointer to a pointer for storing the SSL/TLS session
+ *  value:            	kTLS value to validate and assign
  *
- *  returns:	the socket file descriptor if successful, or -1 if an error occurred
+ *  returns:		0 if successful, -1 if an error occurred
  */
-int SetUpTCPSocketWithTLS(SSL_CTX **ctx, SSL **ssl)
+int ValidateAndAssignKernelTls(char *value)
 {
-	int sockfd = 0;
-    	struct sockaddr_in server_addr;
-    
-    	*ctx = SSL_CTX_new(TLS_client_method());
-    	if(SSL_CTX_use_certificate_file(*ctx, ca_path, SSL_FILETYPE_PEM) != 1)
-    	{
-    		printf("Error: Failed to use the provided certificate file.\n");
-    		return -1;
-    	}
-    	
-
-    	/* Set the address and port of the server to connect to */
-    	server_addr.sin_family = AF_INET;
-    	server_addr.sin_port = htons(port);
-    	server_addr.sin_addr.s_addr = inet_addr(server_host);
+	if(0 == strcmp(value, "on"))
+	{
+		kernel_tls = 1;
+	}
+	else if(0 == strcmp(value, "off"))
+	{
+		kernel_tls = 0;
+	}
+	else
+	{
+		printf("Error: Invalid KTLS. KTLS should be either 'on' or 'off'.\n");
+		return -1;
+	}
 
-    	/* Create a socket and SSL session */
-    	if ((sockfd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
-    	{
-     	   return -1;
-   	}
-    	
-    	*ssl = SSL_new(*ctx);
-    	SSL_set_fd(*ssl, sockfd);
-    
-    	if (-1 == connect(sockfd, (struct sockaddr *)&server_addr, sizeof(server_addr)))
-    	{
-    		printf("Error: Unable to connect to server at '%s:%d'.\n", server_host, port);
-        	return -1;
-    	}
-    
-    	if(0 > SSL_connect(*ssl))
-    	{
-        	printf("Error: SSL handshake with server failed.\n");
-        	return -1;
-    	}
-    
-    	printf("Client connected to server successfully.\n");
-    	return sockfd;
+	return 0;
 }
 
 
 /*		
- * Function:  RouteTrafficToVirtualNIC 
+ * Function:  ValidateAndAssignOffload 
  * --------------------
- *  configures routing rules for directing traffic to the virtual network interface (TUN)
- *  
- *  this function enables IP forwarding, sets up iptables rules to allow traffic to flow
- *  between the TUN interface and the physical network interface, and adds IP route rules
- *  for proper routing of traffic through the TUN interface
+ *  validates and assigns whether tun0 uses segmentation and checksum offloads,
+ *  'on' or 'off'; TCP super-packets then cross the tunnel whole when the server
+ *  takes them over TRANSPORT=tcp, and are cut into plain packets otherwise
  *
- *  returns:	no return value
+ *  value:            	offload value to validate and assign
+ *
+ *  returns:		0 if successful, -1 if an error occurred
  */
-void RouteTrafficToVirtualNIC()
+int ValidateAndAssignOffload(char *value)
 {
-	char cmd[CMD_LINE_LENGTH];
+	if(0 == strcmp(value, "on"))
+	{
+		offload = 1;
+	}
+	else if(0 == strcmp(value, "off"))
+	{
+		offload = 0;
+	}
+	else
+	{
+		printf("Error: Invalid OFFLOAD. OFFLOAD should be either 'on' or 'off'.\n");
+		return -1;
+	}
 
-	system("sysctl -w net.ipv4.ip_forward=1");							/* enable IP forwarding			*/
-	system("iptables -I FORWARD 1 -i tun0 -m state --state RELATED,ESTABLISHED -j ACCEPT");	/* allow incoming traffic			*/
-	system("iptables -I FORWARD 1 -o tun0 -j ACCEPT");						/* route traffic to tun0			*/
-	snprintf(cmd, sizeof(cmd), "iptables -I FORWARD 1 ! -d %s -o tun0 -j ACCEPT", server_host);	/* route all non-local traffic to tun0	*/
-	system(cmd);											/* (same VLAN traffic isn't handled)		*/
-	/* total ip range coverage - equivelant to 0.0.0.0/0 (maybe unsupposted) */
-	system("ip route add 0/1 dev tun0");   							/* 0.0.0.0/1 -> 000000000... - 011111111...	*/
-	system("ip route add 128/1 dev tun0");							/* 128.0.0.0/1 -> 10000000... - 111111111...	*/
+	return 0;
 }
 
 
 /*		
- * Function:  HandleTrafficToServer 
+ * Function:  ValidateAndAssignCiphers 
  * --------------------
- *  handles outgoing traffic from the virtual network interface (TUN) to the server
- *  
- *  this function reads data from the virtual network interface, then writes the
- *  data to the SSL/TLS session for secure transmission to the server
+ *  validates and assigns the ciphers offered to the server, 'auto' to benchmark
+ *  AES-GCM against ChaCha20-Poly1305 at startup and offer the faster one first,
+ *  or a colon separated list of TLS 1.3 suites and TLS 1.2/DTLS ciphers;
+ *  the list itself is checked when the context is created
  *
- *  virtual_nic_fd:	file descriptor of the virtual network interface (TUN)
- *  ssl:		pointer to the SSL/TLS session
+ *  value:            	ciphers value to validate and assign
  *
- *  returns:		0 if successful, or -1 if an error occurred
+ *  returns:		0 if successful, -1 if an error occurred
  */
-int HandleTrafficToServer(int virtual_nic_fd, SSL *ssl)
+int ValidateAndAssignCiphers(char *value)
 {
-    	int result = 0;
-    	char buffer[BUFFER_SIZE];
-    
-    	result = read(virtual_nic_fd, buffer, sizeof(buffer));
-    	if(-1 == result)
-    	{
-    	    	return -1;
-    	}
-    
-    	if(-1 == SSL_write(ssl, buffer, result))
-    	{
-    		return -1;
-    	}
-   
-    	memset(buffer, 0, sizeof(buffer));
-    	return 0;
+	if(strlen(value) >= sizeof(cipher_config.ciphers))
+	{
+		printf("Error: Invalid CIPHERS. The list is too long.\n");
+		return -1;
+	}
+
+	strcpy(cipher_config.ciphers, value);
+	return 0;
 }
 
 
 /*		
- * Function:  HandleTrafficFromServer 
+ * Function:  ValidateAndAssignTlsMinVersion 
  * --------------------
- *  handles incoming traffic from the server to the virtual network interface (TUN)
- *  
- *  this function reads data from the SSL/TLS session, then writes the
- *  data to the virtual network interface (TUN) for further processing
+ *  validates and assigns the lowest protocol version the client accepts
  *
- *  virtual_nic_fd:	file descriptor of the virtual network interface (TUN)
- *  ssl:             	pointer to the SSL/TLS session
+ *  value:            	version value to validate and assign, '1.2' or '1.3'
  *
- *  returns:		0 if successful, or -1 if an error occurred
+ *  returns:		0 if successful, -1 if an error occurred
  */
-int HandleTrafficFromServer(int virtual_nic_fd, SSL *ssl)
+int ValidateAndAssignTlsMinVersion(char *value)
 {
-	int result = 0;
-    	char buffer[BUFFER_SIZE];
-    
-    	result = SSL_read(ssl, buffer, sizeof(buffer));
-    	if(0 >= result)
-    	{
-    		return -1;
-    	}
-    
-    	if(-1 == write(virtual_nic_fd, (const void *)buffer, result))
-    	{
-    		return -1;
-    	}
-   
-    	memset(buffer, 0, sizeof(buffer));
-    	return 0;
+	return CipherParseMinVersion(value, &cipher_config.min_version);
 }
 
 
 /*		
- * Function:  ClearRoutingTable 
+ * Function:  ValidateAndAssignGroups 
  * --------------------
- *  clears the routing table and iptables rules related to traffic routing
+ *  validates and assigns the key exchange groups offered, in preference order
+ *  (for example 'X25519:P-256'); checked when the context is created
  *
- *  returns:  no return value
+ *  value:            	groups value to validate and assign
+ *
+ *  returns:		0 if successful, -1 if an error occurred
  */
-void ClearRoutingTable()
+int ValidateAndAssignGroups(char *value)
 {
-	char cmd[CMD_LINE_LENGTH];
+	if(strlen(value) >= sizeof(cipher_config.groups))
+	{
+		printf("Error: Invalid GROUPS. The list is too long.\n");
+		return -1;
+	}
 
-	system("iptables -D FORWARD -i tun0 -m state --state RELATED,ESTABLISHED -j ACCEPT");
-	snprintf(cmd, sizeof(cmd), "iptables -D FORWARD ! -d %s -o tun0 -j ACCEPT", server_host);
-	system(cmd);
-	system("ip route del 0/1");
-	system("ip route del 128/1");
+	strcpy(cipher_config.groups, value);
+	return 0;
 }
 
 
 /*		
- * Function:  RemoveVirtualNic 
+ * Function:  ValidateAndAssignCompression 
  * --------------------
- *  Removes the virtual network interface (TUN device) from the system
+ *  validates and assigns whether packets are compressed both ways, if the
+ *  server compresses too: 'off', 'on' or 'adaptive' (skips flows that don't compress)
  *
- *  returns:  no return value
+ *  value:            	compression value to validate and assign
+ *
+ *  returns:		0 if successful, -1 if an error occurred
  */
-void RemoveVirtualNic()
+int ValidateAndAssignCompression(char *value)
 {
-	system("sudo ip link delete tun0");
+	return CompressParseMode(value, &compress_mode);
 }
 
 
 /*		
- * Function:  CleanUp 
+ * Function:  ValidateAndAssignMtu 
  * --------------------
- *  closes the network connections, removes the virtual network interface, and releases resources
+ *  validates and assigns the largest tunnel MTU; the server's may be lower,
+ *  and over UDP path MTU discovery settles on what the path takes
  *
- *  virtual_nic_fd:  file descriptor of the virtual network interface 
- *  socket_fd:       file descriptor of the TCP socket
- *  ctx:             SSL context
- *  ssl:             SSL session
+ *  value:            	MTU value to validate and assign
  *
- *  returns:	      no return value
+ *  returns:		0 if successful, -1 if an error occurred
  */
-void CleanUp(int virtual_nic_fd, int socket_fd, SSL_CTX *ctx, SSL *ssl)
+int ValidateAndAssignMtu(int value)
 {
-	ClearRoutingTable();
-	close(virtual_nic_fd);
-	close(socket_fd);
-	SSL_free(ssl);
-	SSL_CTX_free(ctx);
-	RemoveVirtualNic();
+	if(value < PMTU_MIN || value > PMTU_MAX)
+	{
+		printf("Error: Invalid MTU. MTU should be in the range %d-%d.\n", PMTU_MIN, PMTU_MAX);
+		return -1;
+	}
+
+	tunnel_mtu = value;
+	return 0;
 }
 
 
 /*		
- * Function:  HandleCtrlC 
+ * Function:  ValidateAndAssignCryptoWorkers 
  * --------------------
- *  handles the Ctrl+C signal by updating the keep_running flag to terminate the program
+ *  validates and assigns the number of threads that seal and open the TLS
+ *  records of the tunnel, so its encryption isn't bound to one core
  *
- *  dummy:	unused parameter (required by signal handler)
+ *  value:            	number of crypto workers to validate and assign, 0 for none
  *
- *  Returns:	no return value
+ *  returns:		0 if successful, -1 if an error occurred
  */
-void HandleCtrlC(int dummy)
+int ValidateAndAssignCryptoWorkers(int value)
 {
-    keep_running = 0;
+	if(value < 0 || value > PIPELINE_MAX_WORKERS)
+	{
+		printf("Error: Invalid CRYPTO_WORKERS. CRYPTO_WORKERS should be in the range 0-%d.\n", PIPELINE_MAX_WORKERS);
+		return -1;
+	}
+
+	crypto_workers = value;
+	return 0;
 }
 
+
 /*		
- * Function:  main 
+ * Function:  ValidateAndAssignKeepalive 
  * --------------------
- *  the entry point of the client program. sets up the virtual network interface (tun0), 
- *  establishes a TCP connection with the server using SSL/TLS encryption,
- *  and handles incoming and outgoing traffic through the virtual network interface
+ *  validates and assigns how often the client checks on the tunnel, sending
+ *  a keepalive when it had nothing else to send, and how long the server may
+ *  stay silent before the client reconnects; 'off' sends none and waits on a
+ *  silent server for good
+ *
+ *  value:            	'<interval>,<timeout>' in seconds to validate and assign, e.g. '10,60', or 'off'
+ *
+ *  returns:		0 if successful, -1 if an error occurred
  */
-int main()
+int ValidateAndAssignKeepalive(char *value)
 {
-	int virtual_nic_fd = 0;
-	int socket_fd = 0;
-	int maxfdp = 0;
-	fd_set read_fds;
-	SSL_CTX *ctx;
-	SSL *ssl;
-	
-	if(-1 == GetConfiguration())
+	int interval = 0;
+	int timeout = 0;
+	char end = '\0';
+
+	if(0 == strcmp(value, "off"))
 	{
-		return -1;
+		keepalive_interval = 0;
+		return 0;
 	}
 
-	/* set up virtual network interface (tun0) */
-	virtual_nic_fd = SetUpVirtualNIC(VNIC_NAME);
-	if (-1 == virtual_nic_fd)
+	if(2 != sscanf(value, "%d,%d%c", &interval, &timeout, &end) || 1 > interval || interval >= timeout || MAX_KEEPALIVE < timeout)
 	{
+		printf("Error: Invalid KEEPALIVE. It should be 'off' or '<interval>,<timeout>' in seconds, the timeout longer than the interval and at most %d, e.g. '10,60'.\n", MAX_KEEPALIVE);
 		return -1;
 	}
-    	
-	signal(SIGINT, HandleCtrlC);
-	
-	/* route traffic through the virtual network interface */
-	RouteTrafficToVirtualNIC();
 
-	/* set up TCP socket and SSL/TLS connection */
-	socket_fd = SetUpTCPSocketWithTLS(&ctx, &ssl);
-	if (-1 == socket_fd)
+	keepalive_interval = interval;
+	keepalive_timeout = timeout;
+	return 0;
+}
+
+
+/*		
+ * Function:  ValidateAndAssignStatsSocket 
+ * --------------------
+ *  validates and assigns the path of the Unix domain socket the statistics are
+ *  served on, in the Prometheus text format
+ *
+ *  value:            	path value to validate and assign
+ *
+ *  returns:		0 if successful, -1 if an error occurred
+ */
+int ValidateAndAssignStatsSocket(char *value)
+{
+	if(strlen(value) >= sizeof(stats_path))
+	{
+		printf("Error: Invalid STATS_SOCKET. The path should be shorter than %zu characters.\n", sizeof(stats_path));
+		return -1;
+	}
+
+	strcpy(stats_path, value);
+	return 0;
+}
+
+
+/*		
+ * Function:  ParseConfigFile 
+ * --------------------
+ *  parses the client configuration file to extract key-value pairs
+ *  representing server host and port information
+ *
+ *  config_file:    	pointer to the opened client configuration file
+ *
+ *  returns:	       0 if successful, -1 if an error occurred
+ */
+int ParseConfigFile(FILE *config_file)
+{
+	char line[MAX_LINE_LENGTH];
+	char *key;
+	char *value;
+	
+	while(fgets(line, sizeof(line), config_file))
+	{
+		key = strtok(line, "=");
+		value = strtok(NULL, "\n");
+		
+		if(0 == strcmp(key, "SERVER_HOST"))
+		{
+			if(-1 == ValidateAndAssignServerHost(value))
+			{
+				return -1;
+			}
+		}
+		else if(0 == strcmp(key, "PORT"))
+		{
+			if(-1 == ValidateAndAssignPort(atoi(value)))
+			{
+				return -1;
+			}
+		}
+		else if(0 == strcmp(key, "CA_PATH"))
+		{
+			if(-1 == ValidateAndAssignCA(value))
+			{
+				return -1;
+			}
+		}
+		else if(0 == strcmp(key, "TRANSPORT"))
+		{
+			if(-1 == ValidateAndAssignTransport(value))
+			{
+				return -1;
+			}
+		}
+		else if(0 == strcmp(key, "IO_BACKEND"))
+		{
+			if(-1 == ValidateAndAssignIoBackend(value))
+			{
+				return -1;
+			}
+		}
+		else if(0 == strcmp(key, "KTLS"))
+		{
+			if(-1 == ValidateAndAssignKernelTls(value))
+			{
+				return -1;
+			}
+		}
+		else if(0 == strcmp(key, "OFFLOAD"))
+		{
+			if(-1 == ValidateAndAssignOffload(value))
+			{
+				return -1;
+			}
+		}
+		else if(0 == strcmp(key, "CIPHERS"))
+		{
+			if(-1 == ValidateAndAssignCiphers(value))
+			{
+				return -1;
+			}
+		}
+		else if(0 == strcmp(key, "TLS_MIN_VERSION"))
+		{
+			if(-1 == ValidateAndAssignTlsMinVersion(value))
+			{
+				return -1;
+			}
+		}
+		else if(0 == strcmp(key, "GROUPS"))
+		{
+			if(-1 == ValidateAndAssignGroups(value))
+			{
+				return -1;
+			}
+		}
+		else if(0 == strcmp(key, "KEEPALIVE"))
+		{
+			if(-1 == ValidateAndAssignKeepalive(value))
+			{
+				return -1;
+			}
+		}
+		else if(0 == strcmp(key, "STATS_SOCKET"))
+		{
+			if(-1 == ValidateAndAssignStatsSocket(value))
+			{
+				return -1;
+			}
+		}
+		else if(0 == strcmp(key, "COMPRESSION"))
+		{
+			if(-1 == ValidateAndAssignCompression(value))
+			{
+				return -1;
+			}
+		}
+		else if(0 == strcmp(key, "MTU"))
+		{
+			if(-1 == ValidateAndAssignMtu(atoi(value)))
+			{
+				return -1;
+			}
+		}
+		else if(0 == strcmp(key, "CRYPTO_WORKERS"))
+		{
+			if(-1 == ValidateAndAssignCryptoWorkers(atoi(value)))
+			{
+				return -1;
+			}
+		}
+		else if(0 == strcmp(key, "SESSION_CACHE"))
+		{
+			if(-1 == ValidateAndAssignSessionCache(value))
+			{
+				return -1;
+			}
+		}
+		else
+		{
+			printf("Error: Invalid configuration in 'client_config_file.txt'.\n");
+			return -1;
+		}
+	}
+	
+	return 0;
+}
+
+
+/*		
+ * Function:  GetConfiguration 
+ * --------------------
+ *  reads and parses a client configuration file to retrieve server host and port information
+ *
+ *  returns:	 0 if successful, -1 if an error occurred or the configuration is invalid
+ */
+int GetConfiguration()
+{
+	FILE *config_file = NULL;
+	
+	config_file = fopen("client_config_file.txt", "r");
+	if(NULL == config_file)
+	{
+		printf("Error: Unable to open 'server_config_file.txt'. Ensure the file exists and has the appropriate permissions.\n");
+		return -1;
+	}
+	
+	if(-1 == ParseConfigFile(config_file))
+	{
+		fclose(config_file);
+		return -1;
+	}
+	
+	fclose(config_file);
+	return 0;
+}
+
+
+/* ========================== */
+/*    NETWORK SETUP FUNCTIONS */
+/* ========================== */
+/*		
+ * Function:  SetUpVictualNIC 
+ * --------------------
+ *  initializes a virtual network interface (TUN device) with the specified name,
+ *  which isn't persistent and goes away once the client closes it; with
+ *  OFFLOAD=on it is opened with IFF_VNET_HDR and its offloads enabled, its
+ *  super-packets capped to what fits a frame
+ *
+ *  vnic_name:		the name of the virtual network interface to be created
+ *  addr:		the tunnel address leased by the server
+ *  prefix_length:	the tunnel network prefix length
+ *  mtu:		the tunnel MTU
+ *
+ *  returns: 	the file descriptor associated with the TUN device if successful,
+ *              or -1 if an error occurred during setup
+ */
+int SetUpVirtualNIC(char *vnic_name, struct in_addr addr, int prefix_length, size_t mtu)
+{
+	struct ifreq ifr;
+	int fd = 0;
+
+    	fd = open("/dev/net/tun", O_RDWR | O_NONBLOCK);	/* lets a batch stop at the last queued packet */
+    	if (-1 == fd)
+    	{
+        	return -1;
+    	}
+
+	memset(&ifr, 0, sizeof(ifr));
+	ifr.ifr_flags = IFF_TUN | IFF_NO_PI; /* IFF_NO_PI = dudce IP protocol version from packet, IFF_TUN = tun device (no ethernet header) */
+	ifr.ifr_flags |= offload ? IFF_VNET_HDR : 0;	/* a virtio_net_hdr before every packet */
+	strncpy(ifr.ifr_name, vnic_name, IFNAMSIZ);
+
+    	/* ioctl will use ifr_name as the name of TUN interface to open: "tun0", etc. */
+    	if (-1 == ioctl(fd, TUNSETIFF, (void *)&ifr))
+    	{
+    	    close(fd);
+    	    return -1;
+    	}
+    	/* After the ioctl call the fd is "connected" to tun device specified by vnic_name */
+
+	if(-1 == NetconfSetAddress(vnic_name, addr, prefix_length) || -1 == NetconfLinkUp(vnic_name, mtu) ||
+	   (offload && (-1 == NetconfLinkLimitGso(vnic_name, OFFLOAD_MAX_LENGTH) || -1 == OffloadEnable(fd))))
+	{
+		printf("Error: Failed to configure %s: %s.\n", vnic_name, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	vnic_mtu = mtu;
+    	
+    	return fd;
+}
+
+
+/*		
+ * Function:  SaveSession 
+ * --------------------
+ *  new session callback, keeps the session (or session ticket) the server just
+ *  issued so the next connection resumes it, and writes it to the session file
+ *  if one is configured; the file holds the session's secrets and is only
+ *  readable by its owner
+ *
+ *  ssl:	the SSL/TLS session the ticket arrived on
+ *  session:	the new session
+ *
+ *  returns:	1, the reference to the session is kept
+ */
+int SaveSession(SSL *ssl, SSL_SESSION *session)
+{
+	int fd = 0;
+	FILE *file = NULL;
+
+	(void)ssl;
+	SSL_SESSION_free(saved_session);
+	saved_session = session;
+
+	if('\0' == session_path[0])
+	{
+		return 1;
+	}
+
+	fd = open(session_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if(-1 == fd)
+	{
+		return 1;
+	}
+
+	file = fdopen(fd, "w");
+	if(NULL == file)
+	{
+		close(fd);
+		return 1;
+	}
+
+	PEM_write_SSL_SESSION(file, session);
+	fclose(file);
+	return 1;
+}
+
+
+/*		
+ * Function:  LoadSession 
+ * --------------------
+ *  loads the session kept in the session file by an earlier run, if any;
+ *  the server falls back to a full handshake when it no longer accepts it
+ *
+ *  returns:	no return value
+ */
+void LoadSession()
+{
+	FILE *file = NULL;
+
+	if('\0' == session_path[0])
+	{
+		return;
+	}
+
+	file = fopen(session_path, "r");
+	if(NULL == file)
+	{
+		return;
+	}
+
+	saved_session = PEM_read_SSL_SESSION(file, NULL, NULL, NULL);
+	fclose(file);
+}
+
+
+/*		
+ * Function:  CreateContext 
+ * --------------------
+ *  creates the SSL/TLS (or SSL/DTLS) context every connection to the server is
+ *  made with, which hands the sessions the server issues to SaveSession()
+ *
+ *  returns:	the context if successful, or NULL if an error occurred
+ */
+SSL_CTX *CreateContext()
+{
+	SSL_CTX *ctx = NULL;
+
+	ctx = SSL_CTX_new(TRANSPORT_UDP == transport ? DTLS_client_method() : TLS_client_method());
+	if(NULL == ctx)
+	{
+		return NULL;
+	}
+
+	if(SSL_CTX_use_certificate_file(ctx, ca_path, SSL_FILETYPE_PEM) != 1)
+	{
+		printf("Error: Failed to use the provided certificate file.\n");
+		SSL_CTX_free(ctx);
+		return NULL;
+	}
+
+	if(-1 == CipherConfigure(ctx, &cipher_config, TRANSPORT_UDP == transport, 0))
+	{
+		SSL_CTX_free(ctx);
+		return NULL;
+	}
+
+	if(kernel_tls && TRANSPORT_TCP == transport)
+	{
+		SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+	}
+
+	/* the crypto workers take the traffic secrets from the keylog */
+	if(0 != crypto_workers && TRANSPORT_TCP == transport)
+	{
+		SSL_CTX_set_keylog_callback(ctx, RecordKeylog);
+	}
+
+	/* the client only resumes the last session, no need for OpenSSL's cache */
+	SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+	SSL_CTX_sess_set_new_cb(ctx, SaveSession);
+	return ctx;
+}
+
+
+/*		
+ * Function:  SetUpTCPSocketWithTLS 
+ * --------------------
+ *  sets up a TCP socket connected to the server and an SSL/TLS session over it,
+ *  resuming the last session the server issued if there is one
+ *
+ *  ctx:	the SSL/TLS context
+ *  ssl:	a pointer to a pointer for storing the SSL/TLS session
+ *
+ *  returns:	the socket file descriptor if successful, or -1 if an error occurred
+ */
+int SetUpTCPSocketWithTLS(SSL_CTX *ctx, SSL **ssl)
+{
+	int sockfd = 0;
+    	struct sockaddr_in server_addr;
+
+    	/* Set the address and port of the server to connect to */
+    	server_addr.sin_family = AF_INET;
+    	server_addr.sin_port = htons(port);
+    	server_addr.sin_addr.s_addr = inet_addr(server_host);
+
+    	/* Create a socket and SSL session */
+    	if ((sockfd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+    	{
+     	   return -1;
+   	}
+    	
+    	*ssl = SSL_new(ctx);
+    	SSL_set_fd(*ssl, sockfd);
+    	if(0 != crypto_workers)
+    	{
+    		RecordTrack(*ssl, &session_secrets);
+    	}
+    	if(NULL != saved_session)
+    	{
+    		SSL_set_session(*ssl, saved_session);
+    	}
+    
+    	if (-1 == connect(sockfd, (struct sockaddr *)&server_addr, sizeof(server_addr)))
+    	{
+    		printf("Error: Unable to connect to server at '%s:%d'.\n", server_host, port);
+    		SSL_free(*ssl);
+    		close(sockfd);
+        	return -1;
+    	}
+    
+    	if(0 >= SSL_connect(*ssl))
+    	{
+        	printf("Error: SSL handshake with server failed.\n");
+        	SSL_free(*ssl);
+        	close(sockfd);
+        	return -1;
+    	}
+
+    	/* let SSL_read() return on records without application data (e.g. session tickets) */
+    	SSL_clear_mode(*ssl, SSL_MODE_AUTO_RETRY);
+    
+    	printf("Client connected to server successfully%s.\n", SSL_session_reused(*ssl) ? " (session resumed)" : "");
+    	return sockfd;
+}
+
+
+/*		
+ * Function:  SetUpUDPSocketWithDTLS 
+ * --------------------
+ *  sets up a UDP socket connected to the server and an SSL/DTLS session over it,
+ *  resuming the last session the server issued if there is one, so every IP
+ *  packet travels in its own datagram
+ *
+ *  ctx:	the SSL/DTLS context
+ *  ssl:	a pointer to a pointer for storing the SSL/DTLS session
+ *
+ *  returns:	the socket file descriptor if successful, or -1 if an error occurred
+ */
+int SetUpUDPSocketWithDTLS(SSL_CTX *ctx, SSL **ssl)
+{
+	int sockfd = 0;
+	BIO *bio = NULL;
+	struct sockaddr_in server_addr;
+
+	/* Set the address and port of the server to connect to */
+	server_addr.sin_family = AF_INET;
+	server_addr.sin_port = htons(port);
+	server_addr.sin_addr.s_addr = inet_addr(server_host);
+
+	/* Create a socket and SSL session */
+	if((sockfd = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+	{
+		return -1;
+	}
+
+	if(-1 == connect(sockfd, (struct sockaddr *)&server_addr, sizeof(server_addr)))
+	{
+		printf("Error: Unable to connect to server at '%s:%d'.\n", server_host, port);
+		close(sockfd);
+		return -1;
+	}
+
+	bio = BIO_new_dgram(sockfd, BIO_NOCLOSE);
+	BIO_ctrl(bio, BIO_CTRL_DGRAM_SET_CONNECTED, 0, &server_addr);
+	*ssl = SSL_new(ctx);
+	SSL_set_bio(*ssl, bio, bio);
+	if(NULL != saved_session)
+	{
+		SSL_set_session(*ssl, saved_session);
+	}
+
+	if(0 >= SSL_connect(*ssl))
+	{
+		printf("Error: DTLS handshake with server failed.\n");
+		SSL_free(*ssl);
+		close(sockfd);
+		return -1;
+	}
+
+	/* let SSL_read() return on records without application data */
+	SSL_clear_mode(*ssl, SSL_MODE_AUTO_RETRY);
+
+	printf("Client connected to server successfully (DTLS%s).\n", SSL_session_reused(*ssl) ? ", session resumed" : "");
+	return sockfd;
+}
+
+
+/*		
+ * Function:  ReceiveLease 
+ * --------------------
+ *  waits for the tunnel address the server leases to the client right after the handshake
+ *
+ *  the lease frame carries the leased address (network order) followed by
+ *  one byte holding the tunnel network prefix length, and is preceded by the
+ *  server's MTU; over DTLS the datagram carrying it may be lost, so the client
+ *  asks again every second
+ *
+ *  socket_fd:		file descriptor of the socket connected to the server
+ *  ssl:		pointer to the SSL/TLS session
+ *  deframer:		reassembles the frames received from the server
+ *  addr:		set to the leased tunnel address
+ *  prefix_length:	set to the tunnel network prefix length
+ *  flags:		set to the lease's flags: FRAME_FLAG_COMPRESSED if the server compresses
+ *			for clients that ask for it, FRAME_FLAG_OFFLOAD if it takes super-packets,
+ *			FRAME_FLAG_KEEPALIVE if it sends keepalives
+ *  server_mtu:		set to the server's MTU, or 0 if it didn't tell (it doesn't echo probes either)
+ *
+ *  returns:		0 if successful, or -1 if an error occurred
+ */
+int ReceiveLease(int socket_fd, SSL *ssl, deframer_t *deframer, struct in_addr *addr, int *prefix_length, unsigned char *flags, size_t *server_mtu)
+{
+	int attempts = 0;
+	int result = 0;
+	size_t room = 0;
+	unsigned char *space = NULL;
+	unsigned char request[FRAME_HEADER_SIZE] = {0, 0, FRAME_LEASE, 0};
+	struct timeval timeout;
+	fd_set read_fds;
+	frame_t frame;
+
+	*server_mtu = 0;
+	while(attempts < LEASE_ATTEMPTS)
+	{
+		if(0 == SSL_pending(ssl))
+		{
+			FD_ZERO(&read_fds);
+			FD_SET(socket_fd, &read_fds);
+			timeout.tv_sec = 1;
+			timeout.tv_usec = 0;
+
+			if(0 >= select(socket_fd + 1, &read_fds, NULL, NULL, &timeout))
+			{
+				++attempts;
+				if(TRANSPORT_UDP == transport && 0 >= SSL_write(ssl, request, sizeof(request)))
+				{
+					break;
+				}
+				continue;
+			}
+		}
+
+		space = DeframerSpace(deframer, &room);
+		result = SSL_read(ssl, space, room);
+		if(0 >= result)
+		{
+			/* the record carried no application data */
+			if(SSL_ERROR_WANT_READ == SSL_get_error(ssl, result))
+			{
+				continue;
+			}
+			break;
+		}
+		DeframerCommit(deframer, result);
+
+		while(1 == DeframerNext(deframer, &frame))
+		{
+			if(FRAME_MTU == frame.type && MTU_PAYLOAD_SIZE == frame.length)
+			{
+				*server_mtu = (frame.payload[0] << 8) | frame.payload[1];
+			}
+
+			if(FRAME_LEASE == frame.type && LEASE_PAYLOAD_SIZE == frame.length)
+			{
+				memcpy(&addr->s_addr, frame.payload, sizeof(addr->s_addr));
+				*prefix_length = frame.payload[4];
+				*flags = frame.flags;
+				return 0;
+			}
+		}
+
+		if(TRANSPORT_UDP == transport)
+		{
+			DeframerInit(deframer);
+		}
+	}
+
+	printf("Error: The server didn't lease a tunnel address.\n");
+	return -1;
+}
+
+
+/*		
+ * Function:  ReplaceTunnelRoutes 
+ * --------------------
+ *  routes all traffic through the TUN interface with two routes that together
+ *  cover every address; each is more specific than the default route, which
+ *  stays in place for when the tunnel is gone
+ *
+ *  returns:	0 if successful, or -1 if an error occurred
+ */
+int ReplaceTunnelRoutes()
+{
+	struct in_addr half;
+
+	half.s_addr = htonl(0x00000000);					/* 0.0.0.0/1 -> 000000000... - 011111111...	*/
+	if(-1 == NetconfRouteReplace(half, 1, VNIC_NAME))
+	{
+		return -1;
+	}
+
+	half.s_addr = htonl(0x80000000);					/* 128.0.0.0/1 -> 10000000... - 111111111...	*/
+	return NetconfRouteReplace(half, 1, VNIC_NAME);
+}
+
+
+/*		
+ * Function:  RouteTrafficToVirtualNIC 
+ * --------------------
+ *  configures routing rules for directing traffic to the virtual network interface (TUN)
+ *  
+ *  this function enables IP forwarding, sets up nftables rules to allow traffic to flow
+ *  between the TUN interface and the physical network interface, and adds IP route rules
+ *  for proper routing of traffic through the TUN interface
+ *
+ *  returns:	no return value
+ */
+void RouteTrafficToVirtualNIC()
+{
+	if(-1 == NetconfEnableForwarding())					/* enable IP forwarding			*/
+	{
+		printf("Error: Failed to enable IP forwarding: %s.\n", strerror(errno));
+	}
+	if(-1 == NetconfAcceptForwarding(VNIC_NAME))				/* forward to tun0 and back		*/
+	{
+		printf("Error: Failed to accept forwarding through %s: %s.\n", VNIC_NAME, strerror(errno));
+	}
+	if(-1 == ReplaceTunnelRoutes())
+	{
+		printf("Error: Failed to route traffic through %s: %s.\n", VNIC_NAME, strerror(errno));
+	}
+}
+
+
+/*		
+ * Function:  ClearRoutingTable 
+ * --------------------
+ *  clears the routing table and nftables rules related to traffic routing
+ *
+ *  returns:  no return value
+ */
+void ClearRoutingTable()
+{
+	struct in_addr half;
+
+	NetconfRemoveRules();
+	half.s_addr = htonl(0x00000000);
+	NetconfRouteDelete(half, 1, VNIC_NAME);
+	half.s_addr = htonl(0x80000000);
+	NetconfRouteDelete(half, 1, VNIC_NAME);
+}
+
+
+/*		
+ * Function:  RemoveVirtualNic 
+ * --------------------
+ *  Removes the virtual network interface (TUN device) from the system
+ *
+ *  returns:  no return value
+ */
+void RemoveVirtualNic()
+{
+	NetconfLinkDelete(VNIC_NAME);
+}
+
+
+/*		
+ * Function:  ReassignVirtualNicAddress 
+ * --------------------
+ *  moves tun0 to the address the server leased on a reconnect, when it differs
+ *  from the previous lease; replacing the interface's only address drops the
+ *  routes through it, so they are put back
+ *
+ *  addr:		the tunnel address leased by the server
+ *  prefix_length:	the tunnel network prefix length
+ *
+ *  returns:		no return value
+ */
+void ReassignVirtualNicAddress(struct in_addr addr, int prefix_length)
+{
+	if(-1 == NetconfSetAddress(VNIC_NAME, addr, prefix_length) || -1 == NetconfLinkUp(VNIC_NAME, vnic_mtu) ||
+	   -1 == ReplaceTunnelRoutes())
+	{
+		printf("Error: Failed to move %s to %s: %s.\n", VNIC_NAME, inet_ntoa(addr), strerror(errno));
+	}
+}
+
+
+/*		
+ * Function:  ResizeVirtualNic 
+ * --------------------
+ *  sets tun0's MTU to the tunnel MTU, when it moved; the kernel then answers
+ *  larger packets that may not be fragmented with ICMP errors itself
+ *
+ *  mtu:	the tunnel MTU
+ *  arg:	unused, as a path MTU search callback
+ *
+ *  returns:	no return value
+ */
+void ResizeVirtualNic(size_t mtu, void *arg)
+{
+	(void)arg;
+
+	if(mtu == vnic_mtu)
+	{
+		return;
+	}
+
+	if(-1 == NetconfLinkUp(VNIC_NAME, mtu))
+	{
+		printf("Error: Failed to set the MTU of %s to %zu: %s.\n", VNIC_NAME, mtu, strerror(errno));
+		return;
+	}
+
+	printf("Notice: The tunnel MTU is now %zu.\n", mtu);
+	vnic_mtu = mtu;
+}
+
+
+/*		
+ * Function:  CleanUp 
+ * --------------------
+ *  removes the virtual network interface and its routes, and releases the resources
+ *  kept across connections
+ *
+ *  virtual_nic_fd:  file descriptor of the virtual network interface, or -1 if never set up
+ *  ctx:             SSL context
+ *
+ *  returns:	      no return value
+ */
+void CleanUp(int virtual_nic_fd, SSL_CTX *ctx)
+{
+	if(-1 != virtual_nic_fd)
 	{
-	    	close(virtual_nic_fd);
 		ClearRoutingTable();
-	    	RemoveVirtualNic();
+		close(virtual_nic_fd);
+		RemoveVirtualNic();
+	}
+	SSL_SESSION_free(saved_session);
+	SSL_CTX_free(ctx);
+}
+
+
+/*		
+ * Function:  GetMonotonicTime 
+ * --------------------
+ *  reads the monotonic clock
+ *
+ *  returns:	the time in milliseconds
+ */
+uint64_t GetMonotonicTime()
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+
+/*		
+ * Function:  RenderStats 
+ * --------------------
+ *  renders the client's statistics in the Prometheus text format, called on
+ *  the statistics socket's thread while the pump keeps counting
+ *
+ *  buffer:     the buffer
+ *  arg:        unused
+ *
+ *  returns:    no return value
+ */
+void RenderStats(stats_buffer_t *buffer, void *arg)
+{
+	traffic_sample_t total;
+	uint64_t connected = STATS_GET(connection_stats.connected);
+
+	(void)arg;
+	memset(&total, 0, sizeof(total));
+	StatsAccumulate(&total, &tunnel_traffic);
+
+	StatsMetric(buffer, "vpn_tunnel_up", "gauge", "Whether the tunnel is up.");
+	StatsPrintf(buffer, "vpn_tunnel_up %llu\n", (unsigned long long)STATS_GET(connection_stats.up));
+	StatsMetric(buffer, "vpn_connection_attempts_total", "counter", "Connections to the server attempted.");
+	StatsPrintf(buffer, "vpn_connection_attempts_total %llu\n", (unsigned long long)STATS_GET(connection_stats.attempts));
+	StatsMetric(buffer, "vpn_handshakes_total", "counter", "Handshakes with the server that completed.");
+	StatsPrintf(buffer, "vpn_handshakes_total %llu\n", (unsigned long long)connected);
+	StatsMetric(buffer, "vpn_handshakes_resumed_total", "counter", "Completed handshakes that resumed a session.");
+	StatsPrintf(buffer, "vpn_handshakes_resumed_total %llu\n", (unsigned long long)STATS_GET(connection_stats.resumed));
+	StatsMetric(buffer, "vpn_handshake_duration_seconds", "summary", "Time from connecting to the server to a completed handshake.");
+	StatsPrintf(buffer, "vpn_handshake_duration_seconds_sum %.3f\n", STATS_GET(connection_stats.handshake_ms) / 1000.0);
+	StatsPrintf(buffer, "vpn_handshake_duration_seconds_count %llu\n", (unsigned long long)connected);
+
+	StatsWriteTraffic(buffer, "vpn", &total, 1);
+}
+
+
+/*		
+ * Function:  HandleCtrlC 
+ * --------------------
+ *  handles the Ctrl+C signal by updating the keep_running flag to terminate the program
+ *
+ *  dummy:	unused parameter (required by signal handler)
+ *
+ *  Returns:	no return value
+ */
+void HandleCtrlC(int dummy)
+{
+    (void)dummy;
+    keep_running = 0;
+}
+
+
+/*		
+ * Function:  RunTunnel 
+ * --------------------
+ *  receives the lease over a fresh connection and forwards traffic until the
+ *  connection is lost or the client is stopped; the virtual network interface
+ *  is set up on the first connection and kept across reconnects
+ *
+ *  socket_fd:		file descriptor of the socket connected to the server
+ *  ssl:		the SSL/TLS session with the server
+ *  virtual_nic_fd:	the virtual network interface, set up if still -1
+ *  tunnel_addr:	the tunnel address of the previous connection, updated
+ *  prefix_length:	the tunnel network prefix length, updated
+ *
+ *  returns:		1 if the tunnel was up, 0 if the connection was lost before
+ *			that, or -1 if the virtual network interface couldn't be set up
+ */
+int RunTunnel(int socket_fd, SSL *ssl, int *virtual_nic_fd, struct in_addr *tunnel_addr, int *prefix_length)
+{
+	struct in_addr leased_addr;
+	int leased_prefix_length = 0;
+	unsigned char lease_flags = 0;
+	unsigned char compression_request[FRAME_HEADER_SIZE] = {0, 0, FRAME_COMPRESSION, 0};
+	unsigned char offload_request[FRAME_HEADER_SIZE] = {0, 0, FRAME_OFFLOAD, 0};
+	unsigned char keepalive[FRAME_HEADER_SIZE] = {0, 0, FRAME_KEEPALIVE, 0};
+	size_t server_mtu = 0;
+	size_t mtu = 0;
+	pump_t pump;
+
+	PumpInit(&pump, *virtual_nic_fd, socket_fd, ssl, TRANSPORT_UDP == transport, &tunnel_traffic);
+	if(kernel_tls && TRANSPORT_TCP == transport && !pump.kernel_send)
+	{
+		printf("Notice: Kernel TLS is unavailable (no 'tls' module or an unsupported cipher), using user-space TLS.\n");
+	}
+	if (-1 == ReceiveLease(socket_fd, ssl, &pump.incoming, &leased_addr, &leased_prefix_length, &lease_flags, &server_mtu))
+	{
+		return 0;
+	}
+	printf("Leased tunnel address %s/%d.\n", inet_ntoa(leased_addr), leased_prefix_length);
+
+	/* compression is used both ways only when both sides turned it on */
+	if(COMPRESS_OFF != compress_mode && (FRAME_FLAG_COMPRESSED & lease_flags))
+	{
+		if(0 >= SSL_write(ssl, compression_request, sizeof(compression_request)))
+		{
+			return 0;
+		}
+		PumpUseCompression(&pump, compress_mode);
+	}
+	else if(COMPRESS_OFF != compress_mode)
+	{
+		printf("Notice: The server doesn't compress, packets are sent uncompressed.\n");
+	}
+
+	/* a silent server only counts as gone if it sends keepalives, the first one goes out at once */
+	if(0 != keepalive_interval && (FRAME_FLAG_KEEPALIVE & lease_flags))
+	{
+		if(0 >= SSL_write(ssl, keepalive, sizeof(keepalive)) || -1 == PumpUseKeepalive(&pump, keepalive_interval, keepalive_timeout))
+		{
+			PumpDestroy(&pump);
+			return 0;
+		}
+	}
+	else if(0 != keepalive_interval)
+	{
+		printf("Notice: The server doesn't send keepalives, a server that went silent isn't noticed.\n");
+	}
+
+	if(TRANSPORT_UDP == transport && -1 == PumpUseRings(&pump))
+	{
+		printf("Error: Failed to allocate the datagram rings.\n");
+		PumpDestroy(&pump);
+		return 0;
+	}
+
+	/* the tunnel MTU is the smaller of both sides' MTU, over UDP the path may take less; a server that doesn't tell had 1400 */
+	if(0 == server_mtu)
+	{
+		mtu = tunnel_mtu < PMTU_DEFAULT ? tunnel_mtu : PMTU_DEFAULT;
+		PumpSetMtu(&pump, mtu);
+		printf("Notice: The server doesn't discover the path MTU, the tunnel MTU is %zu.\n", mtu);
+	}
+	else
+	{
+		mtu = server_mtu < (size_t)tunnel_mtu ? server_mtu : (size_t)tunnel_mtu;
+		PumpSetMtu(&pump, mtu);
+		if(TRANSPORT_UDP == transport && -1 == PumpUsePathMtu(&pump, mtu, ResizeVirtualNic, NULL))
+		{
+			printf("Error: Failed to start path MTU discovery.\n");
+			PumpDestroy(&pump);
+			return 0;
+		}
+		if(-1 == PumpSendMtu(&pump))
+		{
+			PumpDestroy(&pump);
+			return 0;
+		}
+	}
+
+	/* super-packets cross whole only when the server's tun0 takes them too, otherwise they are cut here */
+	if(offload && (FRAME_FLAG_OFFLOAD & lease_flags) && 0 >= SSL_write(ssl, offload_request, sizeof(offload_request)))
+	{
+		PumpDestroy(&pump);
+		return 0;
+	}
+	if(offload && -1 == PumpUseOffload(&pump, FRAME_FLAG_OFFLOAD & lease_flags))
+	{
+		printf("Error: Failed to allocate the offload buffers.\n");
+		PumpDestroy(&pump);
+		return 0;
+	}
+	if(offload && TRANSPORT_TCP == transport && !(FRAME_FLAG_OFFLOAD & lease_flags))
+	{
+		printf("Notice: The server doesn't take super-packets, they are segmented before they are sent.\n");
+	}
+
+	/* set up virtual network interface (tun0) and route traffic through it */
+	if(-1 == *virtual_nic_fd)
+	{
+		*virtual_nic_fd = SetUpVirtualNIC(VNIC_NAME, leased_addr, leased_prefix_length, pump.mtu);
+		if (-1 == *virtual_nic_fd)
+		{
+			PumpDestroy(&pump);
+			return -1;
+		}
+		RouteTrafficToVirtualNIC();
+	}
+	else
+	{
+		if(leased_addr.s_addr != tunnel_addr->s_addr || leased_prefix_length != *prefix_length)
+		{
+			ReassignVirtualNicAddress(leased_addr, leased_prefix_length);
+		}
+		ResizeVirtualNic(pump.mtu, NULL);
+	}
+	*tunnel_addr = leased_addr;
+	*prefix_length = leased_prefix_length;
+	pump.endpoint_fd = *virtual_nic_fd;
+
+	/* wait on an io_uring when asked to and available, on select otherwise */
+	if(IO_BACKEND_IO_URING == io_backend && -1 == PumpUseUring(&pump))
+	{
+		printf("Notice: io_uring is unavailable, falling back to select.\n");
+		fcntl(pump.endpoint_fd, F_SETFL, fcntl(pump.endpoint_fd, F_GETFL) | O_NONBLOCK);
+	}
+
+	/* hand the records to the crypto workers when asked to and the session allows it */
+	if(0 != crypto_workers && TRANSPORT_TCP == transport)
+	{
+		if(-1 == PumpUsePipeline(&pump, &session_secrets, crypto_workers))
+		{
+			printf("Notice: The crypto workers need TLS 1.3 with AES-GCM or ChaCha20-Poly1305 in user space, records are encrypted on the tunnel's thread.\n");
+		}
+		OPENSSL_cleanse(&session_secrets, sizeof(session_secrets));
+	}
+	else if(0 != crypto_workers)
+	{
+		printf("Notice: The crypto workers only take TLS over TCP, DTLS records are encrypted on the tunnel's thread.\n");
+	}
+
+	STATS_SET(connection_stats.up, 1);
+	if(-1 == PumpRun(&pump, &keep_running))
+	{
+		printf("Error: Lost the connection to the server.\n");
+	}
+	STATS_SET(connection_stats.up, 0);
+
+	PumpDestroy(&pump);
+	return 1;
+}
+
+
+/*		
+ * Function:  WaitToReconnect 
+ * --------------------
+ *  sleeps before the next connection attempt, for a random time between half
+ *  the delay and the whole of it so clients cut off together don't all come
+ *  back at once, then doubles the delay up to RECONNECT_MAX_DELAY
+ *
+ *  delay:	the current delay in seconds, doubled
+ *
+ *  returns:	no return value
+ */
+void WaitToReconnect(int *delay)
+{
+	struct timespec pause;
+	long milliseconds = *delay * 500L + rand() % (*delay * 500L + 1);
+
+	printf("Reconnecting in %ld.%03ld seconds.\n", milliseconds / 1000, milliseconds % 1000);
+	pause.tv_sec = milliseconds / 1000;
+	pause.tv_nsec = (milliseconds % 1000) * 1000000L;
+	nanosleep(&pause, NULL);		/* cut short by Ctrl+C */
+
+	*delay = *delay * 2 > RECONNECT_MAX_DELAY ? RECONNECT_MAX_DELAY : *delay * 2;
+}
+
+
+/*		
+ * Function:  main 
+ * --------------------
+ *  the entry point of the client program. establishes a TCP connection with the
+ *  server using SSL/TLS encryption (or a DTLS association over UDP), sets up the
+ *  virtual network interface (tun0) with the leased address, and handles incoming
+ *  and outgoing traffic through it; a lost connection is re-established with
+ *  exponential backoff, resuming the previous session
+ */
+int main()
+{
+	int virtual_nic_fd = -1;
+	int socket_fd = 0;
+	int prefix_length = 0;
+	int delay = RECONNECT_MIN_DELAY;
+	int result = 0;
+	uint64_t started = 0;
+	struct in_addr tunnel_addr;
+	stats_endpoint_t stats;
+	sigset_t signals;
+	SSL_CTX *ctx;
+	SSL *ssl;
+	
+	if(-1 == GetConfiguration())
+	{
 		return -1;
 	}
-    
-	while(keep_running)
+
+	ctx = CreateContext();
+	if(NULL == ctx)
 	{
-		FD_ZERO(&read_fds);			
-		FD_SET(virtual_nic_fd, &read_fds);
-		FD_SET(socket_fd, &read_fds);
+		return -1;
+	}
+	LoadSession();
+	srand(time(NULL) ^ getpid());
+	tunnel_addr.s_addr = INADDR_ANY;
 
-		maxfdp = max(virtual_nic_fd, socket_fd);
-		
-		/* wait for activity on the file descriptors */
-		select(maxfdp + 1, &read_fds, NULL, NULL, NULL);
+	signal(SIGINT, HandleCtrlC);
+	signal(SIGPIPE, SIG_IGN);		/* a server gone away is noticed by SSL_write() */
+
+	/* serve the statistics from a thread started with Ctrl+C blocked, so it always interrupts the main thread */
+	stats.fd = -1;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	pthread_sigmask(SIG_BLOCK, &signals, NULL);
+	if('\0' != stats_path[0] && -1 == StatsStart(&stats, stats_path, RenderStats, NULL))
+	{
+		printf("Error: Failed to serve the statistics on '%s'.\n", stats_path);
+		keep_running = 0;
+	}
+	pthread_sigmask(SIG_UNBLOCK, &signals, NULL);
+
+	while(keep_running)
+	{
+		/* set up TCP socket and SSL/TLS connection (or UDP socket and SSL/DTLS) */
+		STATS_ADD(connection_stats.attempts, 1);
+		started = GetMonotonicTime();
+		if(TRANSPORT_UDP == transport)
+		{
+			socket_fd = SetUpUDPSocketWithDTLS(ctx, &ssl);
+		}
+		else
+		{
+			socket_fd = SetUpTCPSocketWithTLS(ctx, &ssl);
+		}
 
-		if(FD_ISSET(virtual_nic_fd, &read_fds))	/* outgoing */
+		if(-1 != socket_fd)
 		{
-			if(-1 == HandleTrafficToServer(virtual_nic_fd, ssl))
+			STATS_ADD(connection_stats.connected, 1);
+			STATS_ADD(connection_stats.resumed, SSL_session_reused(ssl) ? 1 : 0);
+			STATS_ADD(connection_stats.handshake_ms, GetMonotonicTime() - started);
+
+			result = RunTunnel(socket_fd, ssl, &virtual_nic_fd, &tunnel_addr, &prefix_length);
+			close(socket_fd);
+			SSL_free(ssl);
+			if(-1 == result)
 			{
-				CleanUp(virtual_nic_fd, socket_fd, ctx, ssl);
-				printf("Error: Failed to handle outgoing traffic to the server.\n");
+				StatsStop(&stats);
+				CleanUp(virtual_nic_fd, ctx);
 				return -1;
-            		}
-        	}
-        
-        	if(FD_ISSET(socket_fd, &read_fds))		/* incoming */
-        	{
-			if(-1 == HandleTrafficFromServer(virtual_nic_fd, ssl))
-            		{
-                		CleanUp(virtual_nic_fd, socket_fd, ctx, ssl);
-            			printf("Error: Failed to handle incoming traffic from the server.\n");
-            			return -1;
-            		}
-        	}
-    	}
+			}
+
+			/* a connection that carried traffic starts the backoff over */
+			if(1 == result)
+			{
+				delay = RECONNECT_MIN_DELAY;
+			}
+		}
+
+		if(keep_running)
+		{
+			WaitToReconnect(&delay);
+		}
+	}
 
-	CleanUp(virtual_nic_fd, socket_fd, ctx, ssl);
+	StatsStop(&stats);
+	CleanUp(virtual_nic_fd, ctx);
 	
 	return 0;
 }
-
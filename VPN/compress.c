@@ -0,0 +1,435 @@
+#include "compress.h"
+#include <stdio.h>		/* printf 		*/
+#include <string.h>		/* memcpy, memset 	*/
+
+/*
+ * packets are compressed into LZ4 blocks: sequences of a token (literal count,
+ * match length - 4, a nibble each, 15 continued by bytes adding up to 255 each),
+ * the literals, and a 2 byte little-endian offset back to the match
+ */
+#define HASH_LOG 10					/* 1024 positions remembered, enough for a packet */
+#define MIN_MATCH 4
+#define LAST_LITERALS 5					/* a block always ends on literals */
+#define MATCH_LIMIT 12					/* no match starts closer to the end */
+#define MIN_LENGTH 64					/* smaller packets are mostly headers */
+
+#define SAMPLE_PACKETS 16				/* packets per adaptive sample */
+#define MIN_SAVING 8					/* percent a sample has to save */
+#define BACKOFF_MIN 64					/* packets an incompressible slot skips at first */
+#define BACKOFF_MAX 8192
+
+
+/*
+ * Function:  CompressParseMode
+ * --------------------
+ *  parses a COMPRESSION configuration value
+ *
+ *  value:	'off', 'on' or 'adaptive'
+ *  mode:	set to the mode
+ *
+ *  returns:	0 if successful, -1 if the value is invalid
+ */
+int CompressParseMode(const char *value, compress_mode_t *mode)
+{
+	if(0 == strcmp(value, "off"))
+	{
+		*mode = COMPRESS_OFF;
+	}
+	else if(0 == strcmp(value, "on"))
+	{
+		*mode = COMPRESS_ON;
+	}
+	else if(0 == strcmp(value, "adaptive"))
+	{
+		*mode = COMPRESS_ADAPTIVE;
+	}
+	else
+	{
+		printf("Error: Invalid COMPRESSION. Compression should be 'off', 'on' or 'adaptive'.\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/*
+ * Function:  CompressorInit
+ * --------------------
+ *  starts a compressor, every flow is sampled from its first packets
+ *
+ *  compressor:	the compressor
+ *  mode:	when to compress
+ *
+ *  returns:	no return value
+ */
+void CompressorInit(compressor_t *compressor, compress_mode_t mode)
+{
+	memset(compressor, 0, sizeof(compressor_t));
+	compressor->mode = mode;
+}
+
+
+/*
+ * Function:  Read32
+ * --------------------
+ *  reads 4 bytes at any alignment
+ *
+ *  p:		the bytes
+ *
+ *  returns:	the bytes as a host order integer
+ */
+static uint32_t Read32(const unsigned char *p)
+{
+	uint32_t value = 0;
+
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+
+/*
+ * Function:  WriteLength
+ * --------------------
+ *  writes what a 15 in a token nibble continues with
+ *
+ *  out:	where to write, the room was checked by the caller
+ *  length:	the length beyond 15
+ *
+ *  returns:	where the next byte goes
+ */
+static unsigned char *WriteLength(unsigned char *out, size_t length)
+{
+	while(length >= 255)
+	{
+		*out++ = 255;
+		length -= 255;
+	}
+	*out++ = (unsigned char)length;
+
+	return out;
+}
+
+
+/*
+ * Function:  ReadLength
+ * --------------------
+ *  adds the bytes continuing a 15 in a token nibble to a length
+ *
+ *  in:		the next byte, advanced
+ *  end:	the end of the block
+ *  length:	the length, added to
+ *
+ *  returns:	0 if successful, -1 if the block ends first
+ */
+static int ReadLength(const unsigned char **in, const unsigned char *end, size_t *length)
+{
+	unsigned char byte = 0;
+
+	do
+	{
+		if(*in >= end)
+		{
+			return -1;
+		}
+		byte = *(*in)++;
+		*length += byte;
+	} while(255 == byte);
+
+	return 0;
+}
+
+
+/*
+ * Function:  CompressBlock
+ * --------------------
+ *  compresses a packet into an LZ4 block with a single pass over a hash
+ *  table of recent positions; it gives up once the block outgrows the room
+ *
+ *  source:	the packet, no longer than 64 KB
+ *  length:	packet length
+ *  block:	where the block goes
+ *  room:	how long the block may be
+ *
+ *  returns:	the block length, or 0 if it doesn't fit the room
+ */
+static size_t CompressBlock(const unsigned char *source, size_t length, unsigned char *block, size_t room)
+{
+	uint16_t table[1 << HASH_LOG];
+	const unsigned char *in = source;
+	const unsigned char *anchor = source;
+	const unsigned char *end = source + length;
+	const unsigned char *reference = NULL;
+	unsigned char *out = block;
+	unsigned char *token = NULL;
+	uint32_t sequence = 0;
+	uint32_t hash = 0;
+	size_t literals = 0;
+	size_t match = 0;
+
+	memset(table, 0, sizeof(table));
+
+	while(in + MATCH_LIMIT <= end)
+	{
+		sequence = Read32(in);
+		hash = (sequence * 2654435761U) >> (32 - HASH_LOG);
+		reference = source + table[hash];
+		table[hash] = (uint16_t)(in - source);
+
+		if(reference >= in || Read32(reference) != sequence)
+		{
+			++in;
+			continue;
+		}
+
+		/* the match may start before the 4 bytes that were hashed */
+		while(in > anchor && reference > source && in[-1] == reference[-1])
+		{
+			--in;
+			--reference;
+		}
+		for(match = MIN_MATCH; in + match < end - LAST_LITERALS && in[match] == reference[match]; ++match);
+
+		literals = in - anchor;
+		if(out + 1 + literals / 255 + 1 + literals + 2 + (match - MIN_MATCH) / 255 + 1 > block + room)
+		{
+			return 0;
+		}
+
+		token = out++;
+		*token = (unsigned char)((literals >= 15 ? 15 : literals) << 4);
+		if(literals >= 15)
+		{
+			out = WriteLength(out, literals - 15);
+		}
+		memcpy(out, anchor, literals);
+		out += literals;
+
+		*out++ = (unsigned char)(in - reference);
+		*out++ = (unsigned char)((in - reference) >> 8);
+		*token |= (unsigned char)(match - MIN_MATCH >= 15 ? 15 : match - MIN_MATCH);
+		if(match - MIN_MATCH >= 15)
+		{
+			out = WriteLength(out, match - MIN_MATCH - 15);
+		}
+
+		in += match;
+		anchor = in;
+	}
+
+	literals = end - anchor;
+	if(out + 1 + literals / 255 + 1 + literals > block + room)
+	{
+		return 0;
+	}
+
+	token = out++;
+	*token = (unsigned char)((literals >= 15 ? 15 : literals) << 4);
+	if(literals >= 15)
+	{
+		out = WriteLength(out, literals - 15);
+	}
+	memcpy(out, anchor, literals);
+	out += literals;
+
+	return out - block;
+}
+
+
+/*
+ * Function:  FindFlow
+ * --------------------
+ *  finds the adaptive state slot of an IPv4 packet's flow, by its addresses,
+ *  protocol and, for TCP and UDP, its ports
+ *
+ *  compressor:	the compressor
+ *  packet:	the packet
+ *  length:	packet length
+ *
+ *  returns:	the slot
+ */
+static compress_flow_t *FindFlow(compressor_t *compressor, const unsigned char *packet, size_t length)
+{
+	size_t header_length = 0;
+	uint32_t key = 0;
+
+	if(length >= 20 && 4 == packet[0] >> 4)
+	{
+		key = Read32(packet + 12) ^ (Read32(packet + 16) * 31) ^ packet[9];
+		header_length = (packet[0] & 0x0f) * 4;
+		if((6 == packet[9] || 17 == packet[9]) && length >= header_length + 4)
+		{
+			key ^= Read32(packet + header_length) * 2654435761U;
+		}
+	}
+
+	return &compressor->flows[((key * 2654435761U) >> 16) % COMPRESS_FLOWS];
+}
+
+
+/*
+ * Function:  SampleFlow
+ * --------------------
+ *  adds a packet to its slot's sample; a full sample that saved less than
+ *  MIN_SAVING percent makes the slot skip compression for a while
+ *
+ *  flow:	the slot
+ *  original:	packet length
+ *  packed:	what the packet was sent as
+ *
+ *  returns:	no return value
+ */
+static void SampleFlow(compress_flow_t *flow, size_t original, size_t packed)
+{
+	flow->original += original;
+	flow->packed += packed;
+	if(++flow->sampled < SAMPLE_PACKETS)
+	{
+		return;
+	}
+
+	if(100 * (uint64_t)flow->packed > (100 - MIN_SAVING) * (uint64_t)flow->original)
+	{
+		flow->backoff = 0 == flow->backoff ? BACKOFF_MIN : flow->backoff * 2;
+		flow->backoff = flow->backoff > BACKOFF_MAX ? BACKOFF_MAX : flow->backoff;
+		flow->skip = flow->backoff;
+	}
+	else
+	{
+		flow->backoff = 0;
+	}
+
+	flow->sampled = 0;
+	flow->original = 0;
+	flow->packed = 0;
+}
+
+
+/*
+ * Function:  CompressPacket
+ * --------------------
+ *  compresses an IP packet in place, if the mode and (in adaptive mode) its
+ *  flow's recent packets say it's worth trying and the result is smaller
+ *
+ *  compressor:	the sender's compressor
+ *  packet:	the packet, overwritten with the compressed block
+ *  length:	packet length
+ *  compressed:	set to whether the packet was compressed
+ *
+ *  returns:	the length to send, the packet's own if it wasn't compressed
+ */
+size_t CompressPacket(compressor_t *compressor, unsigned char *packet, size_t length, int *compressed)
+{
+	unsigned char block[COMPRESS_MAX_LENGTH];
+	compress_flow_t *flow = NULL;
+	size_t size = 0;
+
+	*compressed = 0;
+	if(COMPRESS_OFF == compressor->mode || length < MIN_LENGTH || length > COMPRESS_MAX_LENGTH)
+	{
+		return length;
+	}
+
+	if(COMPRESS_ADAPTIVE == compressor->mode)
+	{
+		flow = FindFlow(compressor, packet, length);
+		if(0 < flow->skip)
+		{
+			--flow->skip;
+			return length;
+		}
+	}
+
+	size = CompressBlock(packet, length, block, length - 1);
+	if(NULL != flow)
+	{
+		SampleFlow(flow, length, 0 == size ? length : size);
+	}
+	if(0 == size)
+	{
+		return length;
+	}
+
+	memcpy(packet, block, size);
+	*compressed = 1;
+	return size;
+}
+
+
+/*
+ * Function:  DecompressPacket
+ * --------------------
+ *  restores a packet from an LZ4 block, checking every length and offset
+ *  against the block and the room, since the block comes from the peer
+ *
+ *  data:	the block
+ *  length:	block length
+ *  packet:	where the packet goes
+ *  room:	how long the packet may be
+ *
+ *  returns:	the packet length, or -1 if the block is malformed or too long
+ */
+int DecompressPacket(const unsigned char *data, size_t length, unsigned char *packet, size_t room)
+{
+	const unsigned char *in = data;
+	const unsigned char *end = data + length;
+	unsigned char *out = packet;
+	unsigned char token = 0;
+	size_t literals = 0;
+	size_t match = 0;
+	size_t offset = 0;
+
+	while(in < end)
+	{
+		token = *in++;
+
+		literals = token >> 4;
+		if(15 == literals && -1 == ReadLength(&in, end, &literals))
+		{
+			return -1;
+		}
+		if(literals > (size_t)(end - in) || literals > room - (size_t)(out - packet))
+		{
+			return -1;
+		}
+		memcpy(out, in, literals);
+		out += literals;
+		in += literals;
+
+		/* the last sequence has no match */
+		if(in == end)
+		{
+			break;
+		}
+
+		if(2 > end - in)
+		{
+			return -1;
+		}
+		offset = in[0] | ((size_t)in[1] << 8);
+		in += 2;
+		if(0 == offset || offset > (size_t)(out - packet))
+		{
+			return -1;
+		}
+
+		match = token & 0x0f;
+		if(15 == match && -1 == ReadLength(&in, end, &match))
+		{
+			return -1;
+		}
+		match += MIN_MATCH;
+		if(match > room - (size_t)(out - packet))
+		{
+			return -1;
+		}
+
+		/* byte by byte, a match may overlap what it copies */
+		for(; 0 < match; --match, ++out)
+		{
+			*out = out[-offset];
+		}
+	}
+
+	return out - packet;
+}
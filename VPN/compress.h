@@ -0,0 +1,58 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <stddef.h>		/* size_t 	*/
+#include <stdint.h>		/* uint32_t 	*/
+
+#define COMPRESS_FLOWS 64				/* adaptive state slots per session, flows hash into them */
+#define COMPRESS_MAX_LENGTH 4096			/* larger packets are sent as they are */
+
+/* when a sender compresses the packets it sends */
+typedef enum compress_mode
+{
+	COMPRESS_OFF,		/* never, compressed frames from the peer are still accepted */
+	COMPRESS_ON,		/* every packet that gets smaller */
+	COMPRESS_ADAPTIVE	/* like 'on', but flows whose packets don't compress (e.g. HTTPS) are skipped */
+} compress_mode_t;
+
+/*
+ * what COMPRESS_ADAPTIVE learnt about the flows hashing into a slot: a sample
+ * of their packets is compressed, and if it saved too little the slot skips
+ * compression for a while, twice as long every time it stays incompressible
+ *
+ *  skip:	packets left to send as they are before the next sample
+ *  backoff:	how many packets the last skip lasted, 0 while the flows compress
+ *  sampled:	packets in the current sample
+ *  original:	their bytes
+ *  packed:	what they were sent as
+ */
+typedef struct compress_flow
+{
+	uint32_t skip;
+	uint32_t backoff;
+	uint32_t sampled;
+	uint32_t original;
+	uint32_t packed;
+} compress_flow_t;
+
+/* a sender's compression state, one per session */
+typedef struct compressor
+{
+	compress_mode_t mode;
+	compress_flow_t flows[COMPRESS_FLOWS];
+} compressor_t;
+
+
+/* parses a COMPRESSION value, 'off', 'on' or 'adaptive' */
+int CompressParseMode(const char *value, compress_mode_t *mode);
+
+/* starts a compressor with every flow compressed */
+void CompressorInit(compressor_t *compressor, compress_mode_t mode);
+
+/* compresses an IP packet in place when that makes it smaller, returns its length to send */
+size_t CompressPacket(compressor_t *compressor, unsigned char *packet, size_t length, int *compressed);
+
+/* restores a compressed packet, returns its length or -1 if the data is malformed */
+int DecompressPacket(const unsigned char *data, size_t length, unsigned char *packet, size_t room);
+
+#endif  /* COMPRESS_H */
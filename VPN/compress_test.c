@@ -0,0 +1,191 @@
+#include <string.h>	/* memcmp, memcpy, memset */
+#include "compress.h"
+#include "utilities.h"
+
+#define PACKET_LENGTH 1400
+#define SAMPLE_PACKETS 16	/* as in compress.c */
+#define BACKOFF_MIN 64
+
+/* fills bytes that don't compress, a xorshift generator from a seed */
+static void FillRandom(unsigned char *bytes, size_t length, uint32_t seed)
+{
+	size_t i = 0;
+
+	for(i = 0; i < length; ++i)
+	{
+		seed ^= seed << 13;
+		seed ^= seed >> 17;
+		seed ^= seed << 5;
+		bytes[i] = (unsigned char)seed;
+	}
+}
+
+/* writes the IPv4 and UDP headers of a flow in front of a payload */
+static void WriteHeaders(unsigned char *packet, unsigned char source_port)
+{
+	memset(packet, 0, 28);
+	packet[0] = 0x45;
+	packet[9] = 17;
+	packet[12] = 10;
+	packet[15] = 2;
+	packet[16] = 10;
+	packet[19] = 1;
+	packet[21] = source_port;
+	packet[23] = 53;
+}
+
+/* a packet whose payload is text, which compresses */
+static void FillText(unsigned char *packet, size_t length, unsigned char source_port)
+{
+	static const char text[] = "GET /index.html HTTP/1.1\r\nHost: 10.8.0.1\r\nAccept: */*\r\n";
+	size_t i = 0;
+
+	for(i = 28; i < length; ++i)
+	{
+		packet[i] = (unsigned char)text[i % (sizeof(text) - 1)];
+	}
+	WriteHeaders(packet, source_port);
+}
+
+int main()
+{
+	compressor_t compressor;
+	compress_mode_t mode = COMPRESS_OFF;
+	unsigned char original[PACKET_LENGTH];
+	unsigned char packet[PACKET_LENGTH];
+	unsigned char restored[PACKET_LENGTH];
+	unsigned char block[PACKET_LENGTH + 16];
+	size_t length = 0;
+	size_t i = 0;
+	int compressed = 0;
+	int skipped = 0;
+
+
+	/***** CompressParseMode *****/
+	printf("\n\n----- CompressParseMode -----\n\n");
+	TESTS(0 == CompressParseMode("adaptive", &mode) && COMPRESS_ADAPTIVE == mode);
+	TESTS(0 == CompressParseMode("on", &mode) && COMPRESS_ON == mode);
+	TESTS(-1 == CompressParseMode("lz4", &mode));
+
+
+	/***** CompressPacket - round trip *****/
+	printf("\n\n----- CompressPacket - round trip -----\n\n");
+	CompressorInit(&compressor, COMPRESS_ON);
+	FillText(original, PACKET_LENGTH, 1);
+	memcpy(packet, original, PACKET_LENGTH);
+	length = CompressPacket(&compressor, packet, PACKET_LENGTH, &compressed);
+	TESTS(1 == compressed && PACKET_LENGTH / 4 > length);
+	TESTS(PACKET_LENGTH == DecompressPacket(packet, length, restored, sizeof(restored)));
+	TESTS(0 == memcmp(original, restored, PACKET_LENGTH));
+
+	/* a run of one byte, its matches overlap what they copy */
+	memset(original + 28, 'a', PACKET_LENGTH - 28);
+	memcpy(packet, original, PACKET_LENGTH);
+	length = CompressPacket(&compressor, packet, PACKET_LENGTH, &compressed);
+	TESTS(1 == compressed && 64 > length);
+	TESTS(PACKET_LENGTH == DecompressPacket(packet, length, restored, sizeof(restored)));
+	TESTS(0 == memcmp(original, restored, PACKET_LENGTH));
+
+	/* literals long enough to take length bytes, then a match */
+	FillRandom(original, 1000, 7);
+	memset(original + 1000, 0, PACKET_LENGTH - 1000);
+	memcpy(packet, original, PACKET_LENGTH);
+	length = CompressPacket(&compressor, packet, PACKET_LENGTH, &compressed);
+	TESTS(1 == compressed && PACKET_LENGTH > length);
+	TESTS(PACKET_LENGTH == DecompressPacket(packet, length, restored, sizeof(restored)));
+	TESTS(0 == memcmp(original, restored, PACKET_LENGTH));
+
+
+	/***** CompressPacket - incompressible input *****/
+	printf("\n\n----- CompressPacket - incompressible input -----\n\n");
+	FillRandom(original, PACKET_LENGTH, 11);
+	memcpy(packet, original, PACKET_LENGTH);
+	length = CompressPacket(&compressor, packet, PACKET_LENGTH, &compressed);
+	TESTS(0 == compressed && PACKET_LENGTH == length);
+	TESTS(0 == memcmp(original, packet, PACKET_LENGTH));
+
+	/* the same bytes as a block of literals only, the way LZ4 stores what doesn't compress */
+	block[0] = 0xf0;
+	length = 1;
+	for(i = PACKET_LENGTH - 15; i >= 255; i -= 255)
+	{
+		block[length++] = 255;
+	}
+	block[length++] = (unsigned char)i;
+	memcpy(block + length, original, PACKET_LENGTH);
+	length += PACKET_LENGTH;
+	TESTS(PACKET_LENGTH == DecompressPacket(block, length, restored, sizeof(restored)));
+	TESTS(0 == memcmp(original, restored, PACKET_LENGTH));
+
+	/* and not into less room than the packet takes */
+	TESTS(-1 == DecompressPacket(block, length, restored, PACKET_LENGTH - 1));
+
+	/* short packets and the 'off' mode are sent as they are */
+	FillText(packet, PACKET_LENGTH, 1);
+	length = CompressPacket(&compressor, packet, 40, &compressed);
+	TESTS(0 == compressed && 40 == length);
+	CompressorInit(&compressor, COMPRESS_OFF);
+	length = CompressPacket(&compressor, packet, PACKET_LENGTH, &compressed);
+	TESTS(0 == compressed && PACKET_LENGTH == length);
+
+
+	/***** DecompressPacket - malformed blocks *****/
+	printf("\n\n----- DecompressPacket - malformed blocks -----\n\n");
+	/* literals past the end of the block */
+	block[0] = 0x50;
+	memcpy(block + 1, "abc", 3);
+	TESTS(-1 == DecompressPacket(block, 4, restored, sizeof(restored)));
+
+	/* an offset of 0, and one before the start of the packet */
+	block[0] = 0x40;
+	memcpy(block + 1, "abcd", 4);
+	block[5] = 0;
+	block[6] = 0;
+	TESTS(-1 == DecompressPacket(block, 7, restored, sizeof(restored)));
+	block[5] = 5;
+	TESTS(-1 == DecompressPacket(block, 7, restored, sizeof(restored)));
+
+	/* a match cut before its offset */
+	TESTS(-1 == DecompressPacket(block, 6, restored, sizeof(restored)));
+
+	/* a valid offset */
+	block[5] = 4;
+	TESTS(8 == DecompressPacket(block, 7, restored, sizeof(restored)));
+	TESTS(0 == memcmp(restored, "abcdabcd", 8));
+
+
+	/***** CompressPacket - adaptive *****/
+	printf("\n\n----- CompressPacket - adaptive -----\n\n");
+	CompressorInit(&compressor, COMPRESS_ADAPTIVE);
+
+	/* a sample of a flow that doesn't compress */
+	for(i = 0; i < SAMPLE_PACKETS; ++i)
+	{
+		FillRandom(packet, PACKET_LENGTH, 100 + i);
+		WriteHeaders(packet, 1);
+		CompressPacket(&compressor, packet, PACKET_LENGTH, &compressed);
+	}
+
+	/* the flow is skipped, even its packets that would compress */
+	skipped = 0;
+	for(i = 0; i < BACKOFF_MIN; ++i)
+	{
+		FillText(packet, PACKET_LENGTH, 1);
+		CompressPacket(&compressor, packet, PACKET_LENGTH, &compressed);
+		skipped += 0 == compressed;
+	}
+	TESTS(BACKOFF_MIN == skipped);
+
+	/* another flow still compresses */
+	FillText(packet, PACKET_LENGTH, 2);
+	CompressPacket(&compressor, packet, PACKET_LENGTH, &compressed);
+	TESTS(1 == compressed);
+
+	/* after the skip the flow is sampled again */
+	FillText(packet, PACKET_LENGTH, 1);
+	CompressPacket(&compressor, packet, PACKET_LENGTH, &compressed);
+	TESTS(1 == compressed);
+
+
+	return 0 != failures;
+}
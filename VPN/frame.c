@@ -0,0 +1,292 @@
+#include "frame.h"
+#include <string.h>	/* memcpy, memmove */
+#include <unistd.h>	/* write */
+#include <errno.h>	/* EINTR */
+
+
+/*		
+ * Function:  FrameWriteHeader 
+ * --------------------
+ *  writes a frame header in front of a payload that is already in place,
+ *  so a packet read with headroom is framed without being copied
+ *
+ *  header:	the FRAME_HEADER_SIZE bytes right before the payload
+ *  type:	the kind of payload
+ *  flags:	FRAME_FLAG_* bits
+ *  length:	payload length
+ *
+ *  returns:	no return value
+ */
+void FrameWriteHeader(unsigned char *header, frame_type_t type, unsigned char flags, size_t length)
+{
+	header[0] = (unsigned char)(length >> 8);
+	header[1] = (unsigned char)length;
+	header[2] = (unsigned char)type;
+	header[3] = flags;
+}
+
+
+/*		
+ * Function:  FrameBatchReset 
+ * --------------------
+ *  empties a batch so it can collect the frames of the next record
+ *
+ *  batch:	the batch to empty
+ *
+ *  returns:	no return value
+ */
+void FrameBatchReset(frame_batch_t *batch)
+{
+	batch->length = 0;
+	batch->count = 0;
+}
+
+
+/*		
+ * Function:  FrameBatchSpace 
+ * --------------------
+ *  returns where the payload of the next frame goes, right after its header,
+ *  so a packet can be read straight into the batch without an extra copy
+ *
+ *  batch:	the batch
+ *  room:	set to the largest payload the batch can still take (0 if full)
+ *
+ *  returns:	pointer to the payload area of the next frame
+ */
+unsigned char *FrameBatchSpace(frame_batch_t *batch, size_t *room)
+{
+	if(batch->length + FRAME_HEADER_SIZE >= FRAME_BATCH_SIZE)
+	{
+		*room = 0;
+		return batch->data + batch->length;
+	}
+
+	*room = FRAME_BATCH_SIZE - batch->length - FRAME_HEADER_SIZE;
+	return batch->data + batch->length + FRAME_HEADER_SIZE;
+}
+
+
+/*		
+ * Function:  FrameBatchCommit 
+ * --------------------
+ *  writes the header of the frame whose payload was placed at FrameBatchSpace()
+ *  and appends the frame to the batch
+ *
+ *  batch:	the batch
+ *  type:	the kind of payload
+ *  flags:	FRAME_FLAG_* bits
+ *  length:	payload length, no more than the room FrameBatchSpace() reported
+ *
+ *  returns:	no return value
+ */
+void FrameBatchCommit(frame_batch_t *batch, frame_type_t type, unsigned char flags, size_t length)
+{
+	FrameWriteHeader(batch->data + batch->length, type, flags, length);
+
+	batch->length += FRAME_HEADER_SIZE + length;
+	++batch->count;
+}
+
+
+/*		
+ * Function:  FrameBatchAppend 
+ * --------------------
+ *  copies a payload into the batch as a new frame
+ *
+ *  batch:	the batch
+ *  type:	the kind of payload
+ *  flags:	FRAME_FLAG_* bits
+ *  payload:	the payload to copy
+ *  length:	payload length
+ *
+ *  returns:	0 if successful, -1 if the batch has no room for the frame
+ */
+int FrameBatchAppend(frame_batch_t *batch, frame_type_t type, unsigned char flags, const void *payload, size_t length)
+{
+	size_t room = 0;
+	unsigned char *space = FrameBatchSpace(batch, &room);
+
+	if(length > room)
+	{
+		return -1;
+	}
+
+	memcpy(space, payload, length);
+	FrameBatchCommit(batch, type, flags, length);
+	return 0;
+}
+
+
+/*		
+ * Function:  FrameBatchWrite 
+ * --------------------
+ *  writes a batch to a socket with kernel TLS transmit offload, the kernel
+ *  cuts the plain bytes into records and encrypts them, so the batch skips
+ *  the copy and the encryption SSL_write() would do in user space
+ *
+ *  batch:	the batch
+ *  fd:		the blocking socket, SSL_get_wbio() reported BIO_get_ktls_send()
+ *
+ *  returns:	the number of writes the socket only took part of, or -1 if an error occurred
+ */
+int FrameBatchWrite(const frame_batch_t *batch, int fd)
+{
+	size_t written = 0;
+	ssize_t result = 0;
+	int short_writes = 0;
+
+	while(written < batch->length)
+	{
+		result = write(fd, batch->data + written, batch->length - written);
+		if(-1 == result)
+		{
+			if(EINTR == errno)
+			{
+				continue;
+			}
+			return -1;
+		}
+		written += result;
+		short_writes += written < batch->length;
+	}
+
+	return short_writes;
+}
+
+
+/*		
+ * Function:  FrameBatchNext 
+ * --------------------
+ *  iterates the frames of a batch
+ *
+ *  batch:	the batch
+ *  offset:	where the next frame starts, 0 for the first one; advanced past the returned frame
+ *  frame:	set to the frame found at offset, its payload points into the batch
+ *
+ *  returns:	1 if a frame was found, 0 at the end of the batch
+ */
+int FrameBatchNext(const frame_batch_t *batch, size_t *offset, frame_t *frame)
+{
+	const unsigned char *header = batch->data + *offset;
+
+	if(*offset + FRAME_HEADER_SIZE > batch->length)
+	{
+		return 0;
+	}
+
+	frame->length = ((size_t)header[0] << 8) | header[1];
+	frame->type = (frame_type_t)header[2];
+	frame->flags = header[3];
+	frame->payload = (unsigned char *)header + FRAME_HEADER_SIZE;
+
+	*offset += FRAME_HEADER_SIZE + frame->length;
+	return 1;
+}
+
+
+/*		
+ * Function:  DeframerInit 
+ * --------------------
+ *  initializes a deframer with an empty buffer
+ *
+ *  deframer:	the deframer to initialize
+ *
+ *  returns:	no return value
+ */
+void DeframerInit(deframer_t *deframer)
+{
+	deframer->start = 0;
+	deframer->end = 0;
+}
+
+
+/*		
+ * Function:  DeframerSpace 
+ * --------------------
+ *  returns where newly received stream bytes go, moving a partial frame
+ *  back to the beginning of the buffer once the tail runs short of room
+ *
+ *  deframer:	the deframer
+ *  room:	set to the number of bytes that can be received
+ *
+ *  returns:	pointer to the free area of the buffer
+ */
+unsigned char *DeframerSpace(deframer_t *deframer, size_t *room)
+{
+	if(deframer->start == deframer->end)
+	{
+		deframer->start = 0;
+		deframer->end = 0;
+	}
+	else if(DEFRAMER_SIZE - deframer->end < FRAME_BATCH_SIZE)
+	{
+		memmove(deframer->data, deframer->data + deframer->start, deframer->end - deframer->start);
+		deframer->end -= deframer->start;
+		deframer->start = 0;
+	}
+
+	*room = DEFRAMER_SIZE - deframer->end;
+	return deframer->data + deframer->end;
+}
+
+
+/*		
+ * Function:  DeframerCommit 
+ * --------------------
+ *  accounts for stream bytes written at DeframerSpace()
+ *
+ *  deframer:	the deframer
+ *  length:	the number of bytes written
+ *
+ *  returns:	no return value
+ */
+void DeframerCommit(deframer_t *deframer, size_t length)
+{
+	deframer->end += length;
+}
+
+
+/*		
+ * Function:  DeframerNext 
+ * --------------------
+ *  extracts the next complete frame from the received bytes
+ *
+ *  the returned payload points into the deframer's buffer and stays valid
+ *  until the next call to DeframerSpace()
+ *
+ *  deframer:	the deframer
+ *  frame:	set to the extracted frame
+ *
+ *  returns:	1 if a frame was extracted, 0 if more bytes are needed,
+ *		or -1 if the stream is malformed
+ */
+int DeframerNext(deframer_t *deframer, frame_t *frame)
+{
+	unsigned char *header = deframer->data + deframer->start;
+	size_t available = deframer->end - deframer->start;
+	size_t length = 0;
+
+	if(available < FRAME_HEADER_SIZE)
+	{
+		return 0;
+	}
+
+	length = ((size_t)header[0] << 8) | header[1];
+	if(length > FRAME_MAX_PAYLOAD)
+	{
+		return -1;
+	}
+
+	if(available < FRAME_HEADER_SIZE + length)
+	{
+		return 0;
+	}
+
+	frame->type = (frame_type_t)header[2];
+	frame->flags = header[3];
+	frame->payload = header + FRAME_HEADER_SIZE;
+	frame->length = length;
+
+	deframer->start += FRAME_HEADER_SIZE + length;
+	return 1;
+}
@@ -0,0 +1,97 @@
+#ifndef FRAME_H
+#define FRAME_H
+
+#include <stddef.h>	/* size_t */
+
+#define FRAME_HEADER_SIZE 4
+#define FRAME_BATCH_SIZE 16384					/* largest TLS record payload */
+#define FRAME_MAX_PAYLOAD (FRAME_BATCH_SIZE - FRAME_HEADER_SIZE)
+#define DEFRAMER_SIZE (2 * FRAME_BATCH_SIZE)
+#define LEASE_PAYLOAD_SIZE 5					/* address (network order), prefix length */
+#define MTU_PAYLOAD_SIZE 2					/* tunnel MTU (network order) */
+
+/* the kind of payload a frame carries */
+typedef enum frame_type
+{
+	FRAME_PACKET = 0,	/* an IP packet */
+	FRAME_LEASE = 1,	/* server: leased address and prefix length, client: empty lease request */
+	FRAME_COMPRESSION = 2,	/* client, empty: it restores FRAME_FLAG_COMPRESSED packets, so the server may send them */
+	FRAME_MTU = 3,		/* the largest packet the sender takes: the server's MTU before the lease, the client's tunnel MTU */
+	FRAME_PROBE = 4,	/* client, padding as long as the tunnel MTU probed for (pmtu.h) */
+	FRAME_PROBE_ACK = 5,	/* server, a probe echoed at its size */
+	FRAME_OFFLOAD = 6,	/* client, empty: its TUN device takes FRAME_FLAG_OFFLOAD packets, so the server may send them */
+	FRAME_KEEPALIVE = 7	/* either side, empty: the sender is alive, sent when it had nothing else to send for a while */
+} frame_type_t;
+
+/* frame header flags */
+#define FRAME_FLAG_COMPRESSED 0x01				/* packet: an LZ4 block (compress.h), lease: the server offers compression */
+#define FRAME_FLAG_OFFLOAD 0x02					/* packet: a virtio_net_hdr and a super-packet (offload.h), lease: the server takes them */
+#define FRAME_FLAG_KEEPALIVE 0x04				/* lease: the server sends keepalives, and closes silent clients that send them */
+
+/*
+ * every frame on the tunnel stream starts with a 4 byte header:
+ *  length:	payload length, 2 bytes in network order
+ *  type:	one of frame_type_t, 1 byte
+ *  flags:	FRAME_FLAG_* bits, 1 byte
+ */
+
+/* a single decoded frame, payload points into the deframer's buffer */
+typedef struct frame
+{
+	frame_type_t type;
+	unsigned char flags;
+	unsigned char *payload;
+	size_t length;
+} frame_t;
+
+/* frames coalesced into one TLS record */
+typedef struct frame_batch
+{
+	unsigned char data[FRAME_BATCH_SIZE];
+	size_t length;
+	size_t count;
+} frame_batch_t;
+
+/* reassembles frames from an arbitrarily segmented stream */
+typedef struct deframer
+{
+	unsigned char data[DEFRAMER_SIZE];
+	size_t start;
+	size_t end;
+} deframer_t;
+
+
+/* writes a frame header in the FRAME_HEADER_SIZE bytes before a payload */
+void FrameWriteHeader(unsigned char *header, frame_type_t type, unsigned char flags, size_t length);
+
+/* empties a batch */
+void FrameBatchReset(frame_batch_t *batch);
+
+/* returns where the next frame's payload goes and how much room it has */
+unsigned char *FrameBatchSpace(frame_batch_t *batch, size_t *room);
+
+/* completes the frame whose payload was written at FrameBatchSpace() */
+void FrameBatchCommit(frame_batch_t *batch, frame_type_t type, unsigned char flags, size_t length);
+
+/* copies a payload into the batch as a new frame */
+int FrameBatchAppend(frame_batch_t *batch, frame_type_t type, unsigned char flags, const void *payload, size_t length);
+
+/* writes a batch straight to a socket the kernel encrypts for (kTLS) */
+int FrameBatchWrite(const frame_batch_t *batch, int fd);
+
+/* iterates the frames of a batch, starting from offset 0 */
+int FrameBatchNext(const frame_batch_t *batch, size_t *offset, frame_t *frame);
+
+/* initializes a deframer with an empty buffer */
+void DeframerInit(deframer_t *deframer);
+
+/* returns where newly received stream bytes go and how much room is left */
+unsigned char *DeframerSpace(deframer_t *deframer, size_t *room);
+
+/* accounts for stream bytes written at DeframerSpace() */
+void DeframerCommit(deframer_t *deframer, size_t length);
+
+/* extracts the next complete frame, if any */
+int DeframerNext(deframer_t *deframer, frame_t *frame);
+
+#endif  /* FRAME_H */
@@ -0,0 +1,146 @@
+#include <string.h>	/* memcmp, memset */
+#include "frame.h"
+#include "utilities.h"
+
+/* copies bytes into the deframer the way a read from the TLS stream would */
+static void Receive(deframer_t *deframer, const unsigned char *bytes, size_t length)
+{
+	size_t room = 0;
+	unsigned char *space = DeframerSpace(deframer, &room);
+
+	memcpy(space, bytes, length);
+	DeframerCommit(deframer, length);
+}
+
+int main()
+{
+	static frame_batch_t batch;
+	static deframer_t deframer;
+	static unsigned char stream[3 * FRAME_BATCH_SIZE];
+	unsigned char payload[100];
+	unsigned char *space = NULL;
+	frame_t frame;
+	size_t offset = 0;
+	size_t room = 0;
+	size_t length = 0;
+	size_t i = 0;
+	int result = 0;
+
+	for(i = 0; i < sizeof(payload); ++i)
+	{
+		payload[i] = (unsigned char)i;
+	}
+
+
+	/***** FrameBatchAppend *****/
+	printf("\n\n----- FrameBatchAppend -----\n\n");
+	FrameBatchReset(&batch);
+	TESTS(0 == FrameBatchAppend(&batch, FRAME_PACKET, 0, payload, sizeof(payload)));
+	TESTS(0 == FrameBatchAppend(&batch, FRAME_KEEPALIVE, 0, NULL, 0));
+	TESTS(2 == batch.count);
+	TESTS(2 * FRAME_HEADER_SIZE + sizeof(payload) == batch.length);
+
+	/* a payload longer than the room left */
+	space = FrameBatchSpace(&batch, &room);
+	TESTS(FRAME_BATCH_SIZE - batch.length - FRAME_HEADER_SIZE == room);
+	TESTS(-1 == FrameBatchAppend(&batch, FRAME_PACKET, 0, stream, room + 1));
+	TESTS(2 == batch.count);
+
+	/* fill the batch to the last byte */
+	memset(space, 0xab, room);
+	FrameBatchCommit(&batch, FRAME_PACKET, FRAME_FLAG_COMPRESSED, room);
+	TESTS(FRAME_BATCH_SIZE == batch.length);
+	FrameBatchSpace(&batch, &room);
+	TESTS(0 == room);
+
+
+	/***** FrameBatchNext *****/
+	printf("\n\n----- FrameBatchNext -----\n\n");
+	offset = 0;
+	TESTS(1 == FrameBatchNext(&batch, &offset, &frame));
+	TESTS(FRAME_PACKET == frame.type && 0 == frame.flags);
+	TESTS(sizeof(payload) == frame.length && 0 == memcmp(payload, frame.payload, sizeof(payload)));
+	TESTS(1 == FrameBatchNext(&batch, &offset, &frame));
+	TESTS(FRAME_KEEPALIVE == frame.type && 0 == frame.length);
+	TESTS(1 == FrameBatchNext(&batch, &offset, &frame));
+	TESTS(FRAME_FLAG_COMPRESSED == frame.flags && 0xab == frame.payload[frame.length - 1]);
+	TESTS(0 == FrameBatchNext(&batch, &offset, &frame));
+
+
+	/***** DeframerNext - split frames *****/
+	printf("\n\n----- DeframerNext - split frames -----\n\n");
+	DeframerInit(&deframer);
+	FrameWriteHeader(stream, FRAME_PACKET, FRAME_FLAG_OFFLOAD, sizeof(payload));
+	memcpy(stream + FRAME_HEADER_SIZE, payload, sizeof(payload));
+	length = FRAME_HEADER_SIZE + sizeof(payload);
+
+	/* one byte at a time, the header split too: no frame until its last byte arrives */
+	result = 0;
+	for(i = 0; i < length - 1; ++i)
+	{
+		Receive(&deframer, stream + i, 1);
+		result |= DeframerNext(&deframer, &frame);
+	}
+	TESTS(0 == result);
+	Receive(&deframer, stream + length - 1, 1);
+	TESTS(1 == DeframerNext(&deframer, &frame));
+	TESTS(FRAME_PACKET == frame.type && FRAME_FLAG_OFFLOAD == frame.flags);
+	TESTS(sizeof(payload) == frame.length && 0 == memcmp(payload, frame.payload, sizeof(payload)));
+	TESTS(0 == DeframerNext(&deframer, &frame));
+
+	/* three frames in one read, the third cut after its header */
+	FrameWriteHeader(stream + length, FRAME_MTU, 0, MTU_PAYLOAD_SIZE);
+	stream[length + FRAME_HEADER_SIZE] = 0x05;
+	stream[length + FRAME_HEADER_SIZE + 1] = 0xdc;
+	FrameWriteHeader(stream + length + FRAME_HEADER_SIZE + MTU_PAYLOAD_SIZE, FRAME_PACKET, 0, sizeof(payload));
+	Receive(&deframer, stream, length + 2 * FRAME_HEADER_SIZE + MTU_PAYLOAD_SIZE);
+	TESTS(1 == DeframerNext(&deframer, &frame));
+	TESTS(sizeof(payload) == frame.length);
+	TESTS(1 == DeframerNext(&deframer, &frame));
+	TESTS(FRAME_MTU == frame.type && 1500 == ((frame.payload[0] << 8) | frame.payload[1]));
+	TESTS(0 == DeframerNext(&deframer, &frame));
+	Receive(&deframer, payload, sizeof(payload));
+	TESTS(1 == DeframerNext(&deframer, &frame));
+	TESTS(0 == memcmp(payload, frame.payload, sizeof(payload)));
+
+
+	/***** DeframerSpace - a partial frame at the tail *****/
+	printf("\n\n----- DeframerSpace - a partial frame at the tail -----\n\n");
+	DeframerInit(&deframer);
+	FrameWriteHeader(stream, FRAME_PACKET, 0, FRAME_MAX_PAYLOAD);
+	memset(stream + FRAME_HEADER_SIZE, 0x11, FRAME_MAX_PAYLOAD);
+	FrameWriteHeader(stream + FRAME_BATCH_SIZE, FRAME_PACKET, 0, FRAME_MAX_PAYLOAD);
+	memset(stream + FRAME_BATCH_SIZE + FRAME_HEADER_SIZE, 0x22, FRAME_MAX_PAYLOAD);
+
+	/* a full frame and most of a second one, less room than a record is left */
+	Receive(&deframer, stream, FRAME_BATCH_SIZE + FRAME_BATCH_SIZE / 2);
+	TESTS(1 == DeframerNext(&deframer, &frame));
+	TESTS(FRAME_MAX_PAYLOAD == frame.length && 0x11 == frame.payload[FRAME_MAX_PAYLOAD - 1]);
+	TESTS(0 == DeframerNext(&deframer, &frame));
+
+	/* the partial frame moves to the front and the rest of it still fits */
+	space = DeframerSpace(&deframer, &room);
+	TESTS(0 == deframer.start);
+	TESTS(DEFRAMER_SIZE - FRAME_BATCH_SIZE / 2 == room);
+	memcpy(space, stream + FRAME_BATCH_SIZE + FRAME_BATCH_SIZE / 2, FRAME_BATCH_SIZE / 2);
+	DeframerCommit(&deframer, FRAME_BATCH_SIZE / 2);
+	TESTS(1 == DeframerNext(&deframer, &frame));
+	TESTS(FRAME_MAX_PAYLOAD == frame.length && 0x22 == frame.payload[0] && 0x22 == frame.payload[FRAME_MAX_PAYLOAD - 1]);
+
+
+	/***** DeframerNext - oversized frames *****/
+	printf("\n\n----- DeframerNext - oversized frames -----\n\n");
+	DeframerInit(&deframer);
+	FrameWriteHeader(stream, FRAME_PACKET, 0, FRAME_MAX_PAYLOAD + 1);
+	Receive(&deframer, stream, FRAME_HEADER_SIZE);
+	TESTS(-1 == DeframerNext(&deframer, &frame));
+
+	/* rejected from the header alone, before the payload is waited for */
+	DeframerInit(&deframer);
+	FrameWriteHeader(stream, FRAME_PACKET, 0, 0xffff);
+	Receive(&deframer, stream, FRAME_HEADER_SIZE);
+	TESTS(-1 == DeframerNext(&deframer, &frame));
+
+
+	return 0 != failures;
+}
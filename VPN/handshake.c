@@ -0,0 +1,276 @@
+#include "handshake.h"
+#include <stdlib.h>		/* calloc, free 	*/
+#include <string.h>		/* memset 		*/
+#include <unistd.h>		/* read, write, close 	*/
+#include <errno.h>		/* EINTR 		*/
+#include <stdint.h>		/* uint64_t 		*/
+#include <sys/eventfd.h>	/* eventfd 		*/
+#include <openssl/err.h>	/* ERR_clear_error 	*/
+
+
+/*
+ * Function:  HandshakePoolTake
+ * --------------------
+ *  takes the job at the head of the first lane that has one
+ *
+ *  pool:	the pool, locked
+ *
+ *  returns:	the job, or NULL if every lane is empty
+ */
+static handshake_job_t *HandshakePoolTake(handshake_pool_t *pool)
+{
+	handshake_job_t *job = NULL;
+	int i = 0;
+
+	for(i = 0; i < HANDSHAKE_PRIORITIES; ++i)
+	{
+		job = pool->heads[i];
+		if(NULL == job)
+		{
+			continue;
+		}
+
+		pool->heads[i] = job->next;
+		if(NULL == pool->heads[i])
+		{
+			pool->tails[i] = NULL;
+		}
+		__atomic_sub_fetch(&pool->waiting[i], 1, __ATOMIC_RELAXED);
+		job->next = NULL;
+		return job;
+	}
+
+	return NULL;
+}
+
+
+/*
+ * Function:  HandshakePoolRun
+ * --------------------
+ *  a pool thread: sleeps on the eventfd until a job is queued, runs the
+ *  handshake step and hands the job back through the done callback
+ *
+ *  arg:	the pool
+ *
+ *  returns:	NULL once the pool stops
+ */
+static void *HandshakePoolRun(void *arg)
+{
+	handshake_pool_t *pool = arg;
+	handshake_job_t *job = NULL;
+	uint64_t token = 0;
+
+	while(1)
+	{
+		if(-1 == read(pool->wake_fd, &token, sizeof(token)))
+		{
+			if(EINTR == errno)
+			{
+				continue;
+			}
+			break;
+		}
+
+		pthread_mutex_lock(&pool->lock);
+		job = pool->running ? HandshakePoolTake(pool) : NULL;
+		pthread_mutex_unlock(&pool->lock);
+		if(NULL == job)
+		{
+			if(!__atomic_load_n(&pool->running, __ATOMIC_ACQUIRE))
+			{
+				break;
+			}
+			continue;
+		}
+
+		/* the error queue is per thread, whatever an earlier step left behind would be read as this one's */
+		ERR_clear_error();
+		job->result = SSL_do_handshake(job->ssl);
+		job->error = SSL_get_error(job->ssl, job->result);
+		pool->done(job);
+	}
+
+	return NULL;
+}
+
+
+/*
+ * Function:  HandshakePoolStart
+ * --------------------
+ *  starts the threads of a pool
+ *
+ *  pool:	the pool
+ *  count:	number of threads, up to HANDSHAKE_MAX_WORKERS
+ *  backlog:	full handshakes the admission queue holds at most
+ *  done:	called with every job run, on the thread that ran it
+ *
+ *  returns:	0 if successful, or -1 if an error occurred
+ */
+int HandshakePoolStart(handshake_pool_t *pool, size_t count, size_t backlog, handshake_done_t done)
+{
+	size_t i = 0;
+
+	memset(pool, 0, sizeof(handshake_pool_t));
+	pool->backlog = backlog;
+	pool->done = done;
+	pool->running = 1;
+	pool->wake_fd = eventfd(0, EFD_SEMAPHORE | EFD_CLOEXEC);
+	pool->threads = calloc(count, sizeof(pthread_t));
+	if(-1 == pool->wake_fd || NULL == pool->threads || 0 != pthread_mutex_init(&pool->lock, NULL))
+	{
+		if(-1 != pool->wake_fd)
+		{
+			close(pool->wake_fd);
+		}
+		free(pool->threads);
+		return -1;
+	}
+
+	for(i = 0; i < count; ++i)
+	{
+		if(0 != pthread_create(&pool->threads[i], NULL, HandshakePoolRun, pool))
+		{
+			break;
+		}
+		pool->count++;
+	}
+
+	if(count != pool->count)
+	{
+		HandshakePoolStop(pool);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/*
+ * Function:  HandshakePoolStop
+ * --------------------
+ *  stops the threads once they finished the step they are running and
+ *  releases the pool; the jobs still waiting are neither run nor handed
+ *  back, their owners release them
+ *
+ *  pool:	the pool
+ *
+ *  returns:	no return value
+ */
+void HandshakePoolStop(handshake_pool_t *pool)
+{
+	uint64_t tokens = pool->count;
+	size_t i = 0;
+
+	if(NULL == pool->threads)
+	{
+		return;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	__atomic_store_n(&pool->running, 0, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&pool->lock);
+
+	if(0 != tokens && -1 == write(pool->wake_fd, &tokens, sizeof(tokens)))
+	{
+		tokens = 0;		/* the counter can't overflow, the threads see running cleared as they wake */
+	}
+
+	for(i = 0; i < pool->count; ++i)
+	{
+		pthread_join(pool->threads[i], NULL);
+	}
+
+	close(pool->wake_fd);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool->threads);
+	pool->threads = NULL;
+	pool->count = 0;
+}
+
+
+/*
+ * Function:  HandshakePoolSubmit
+ * --------------------
+ *  queues a job at the tail of a priority's lane and wakes a thread for it;
+ *  a full handshake is turned away once backlog of them wait, so a storm of
+ *  new clients can't crowd out the ones resuming or take unbounded memory
+ *
+ *  pool:	the pool
+ *  job:	the job, its ssl and owner set
+ *  priority:	its lane
+ *
+ *  returns:	0 if successful, or -1 if the lane is full and the job wasn't queued
+ */
+int HandshakePoolSubmit(handshake_pool_t *pool, handshake_job_t *job, handshake_priority_t priority)
+{
+	uint64_t one = 1;
+
+	pthread_mutex_lock(&pool->lock);
+	if(HANDSHAKE_FULL == priority && pool->waiting[priority] >= pool->backlog)
+	{
+		pthread_mutex_unlock(&pool->lock);
+		return -1;
+	}
+
+	job->next = NULL;
+	if(NULL != pool->tails[priority])
+	{
+		pool->tails[priority]->next = job;
+	}
+	else
+	{
+		pool->heads[priority] = job;
+	}
+	pool->tails[priority] = job;
+	__atomic_add_fetch(&pool->waiting[priority], 1, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&pool->lock);
+
+	if(-1 == write(pool->wake_fd, &one, sizeof(one)))
+	{
+		return 0;		/* the counter can't overflow, a thread takes the job with another token */
+	}
+
+	return 0;
+}
+
+
+/*
+ * Function:  HandshakePoolWaiting
+ * --------------------
+ *  returns how many jobs wait in a priority's lane, e.g. for statistics
+ *
+ *  pool:	the pool
+ *  priority:	the lane
+ *
+ *  returns:	the number of jobs
+ */
+size_t HandshakePoolWaiting(handshake_pool_t *pool, handshake_priority_t priority)
+{
+	return __atomic_load_n(&pool->waiting[priority], __ATOMIC_RELAXED);
+}
+
+
+/*
+ * Function:  HandshakeIsResumption
+ * --------------------
+ *  tells whether the ClientHello being processed offers a session to
+ *  resume: a TLS 1.3 pre-shared key or a TLS 1.2 session ticket. Only
+ *  valid inside a client hello callback (SSL_CTX_set_client_hello_cb())
+ *
+ *  ssl:	the session
+ *
+ *  returns:	1 if the client offers a session, 0 otherwise
+ */
+int HandshakeIsResumption(SSL *ssl)
+{
+	const unsigned char *data = NULL;
+	size_t length = 0;
+
+	if(1 == SSL_client_hello_get0_ext(ssl, TLSEXT_TYPE_psk, &data, &length))
+	{
+		return 1;
+	}
+
+	/* an empty ticket extension only asks for a ticket */
+	return 1 == SSL_client_hello_get0_ext(ssl, TLSEXT_TYPE_session_ticket, &data, &length) && 0 != length;
+}
@@ -0,0 +1,69 @@
+#ifndef HANDSHAKE_H
+#define HANDSHAKE_H
+
+#include <stddef.h>		/* size_t 		*/
+#include <pthread.h>		/* pthread_t 		*/
+#include <openssl/ssl.h>	/* SSL 			*/
+
+#define HANDSHAKE_MAX_WORKERS 64
+
+/* the lanes of the admission queue, the first that has a handshake waiting goes first */
+typedef enum handshake_priority
+{
+	HANDSHAKE_RESUMPTION,		/* the client offers a session to resume, no signature to compute */
+	HANDSHAKE_FULL,			/* a full handshake, the key exchange and the certificate's signature */
+	HANDSHAKE_PRIORITIES
+} handshake_priority_t;
+
+/*
+ * a step of a handshake run on the pool: SSL_do_handshake() once more, on
+ * a session that isn't touched anywhere else until the pool hands it back
+ */
+typedef struct handshake_job
+{
+	SSL *ssl;
+	void *owner;			/* whoever submitted it, for the done callback */
+	int result;			/* what SSL_do_handshake() returned */
+	int error;			/* SSL_get_error() of it, read on the thread that ran it */
+	struct handshake_job *next;
+} handshake_job_t;
+
+/* called on a pool thread with every job it ran */
+typedef void (*handshake_done_t)(handshake_job_t *job);
+
+/*
+ * a pool of threads running the expensive steps of handshakes, taking them
+ * from an admission queue with a lane per priority; full handshakes beyond
+ * the backlog are turned away, resumptions never are
+ */
+typedef struct handshake_pool
+{
+	pthread_mutex_t lock;
+	handshake_job_t *heads[HANDSHAKE_PRIORITIES];
+	handshake_job_t *tails[HANDSHAKE_PRIORITIES];
+	size_t waiting[HANDSHAKE_PRIORITIES];	/* jobs in each lane (atomic accesses) */
+	size_t backlog;				/* full handshakes waiting at most */
+	int wake_fd;				/* semaphore eventfd, a count per job queued (or per thread to stop) */
+	int running;
+	size_t count;				/* threads */
+	pthread_t *threads;
+	handshake_done_t done;
+} handshake_pool_t;
+
+
+/* starts the threads of a pool */
+int HandshakePoolStart(handshake_pool_t *pool, size_t count, size_t backlog, handshake_done_t done);
+
+/* stops the threads and releases the pool, jobs still waiting are left to their owners */
+void HandshakePoolStop(handshake_pool_t *pool);
+
+/* queues a job in a priority's lane */
+int HandshakePoolSubmit(handshake_pool_t *pool, handshake_job_t *job, handshake_priority_t priority);
+
+/* returns how many jobs wait in a priority's lane */
+size_t HandshakePoolWaiting(handshake_pool_t *pool, handshake_priority_t priority);
+
+/* tells from a client hello callback whether the client offers a session to resume */
+int HandshakeIsResumption(SSL *ssl);
+
+#endif  /* HANDSHAKE_H */
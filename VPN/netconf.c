@@ -0,0 +1,907 @@
+#include "netconf.h"
+#include <stdint.h>					/* uint32_t 		*/
+#include <string.h>					/* memset, memcpy 	*/
+#include <unistd.h>					/* close, write 	*/
+#include <fcntl.h>					/* open 		*/
+#include <errno.h>					/* EADDRNOTAVAIL 	*/
+#include <arpa/inet.h>					/* htonl 		*/
+#include <net/if.h>					/* if_nametoindex 	*/
+#include <sys/socket.h>					/* socket, sendto 	*/
+#include <sys/time.h>					/* struct timeval 	*/
+#include <linux/netlink.h>				/* nlmsghdr, nlattr 	*/
+#include <linux/rtnetlink.h>				/* ifinfomsg, rtmsg 	*/
+#include <linux/netfilter.h>				/* NF_ACCEPT 		*/
+#include <linux/netfilter/nfnetlink.h>			/* nfgenmsg 		*/
+#include <linux/netfilter/nf_tables.h>			/* NFT_MSG_NEWRULE 	*/
+#include <linux/netfilter/nf_conntrack_common.h>	/* NF_CT_STATE_BIT 	*/
+
+#define NETLINK_BUFFER_SIZE 4096			/* holds any of the requests built here */
+#define NETLINK_TIMEOUT 1				/* seconds to wait for the kernel's answers */
+#define NAT_PRIORITY 100				/* source NAT, after filtering (NF_IP_PRI_NAT_SRC) */
+#define FILTER_PRIORITY 0				/* NF_IP_PRI_FILTER */
+
+/*
+ * Struct:  netlink_request
+ * --------------------
+ *  netlink messages built back to back, sent to the kernel at once
+ *
+ *  data:	the messages
+ *  length:	their length
+ *  message:	the message attributes are added to
+ *  sequence:	the last sequence number given out
+ *  acks:	how many of the messages ask for an acknowledgement
+ */
+typedef struct netlink_request
+{
+	char data[NETLINK_BUFFER_SIZE] __attribute__((aligned(NLMSG_ALIGNTO)));
+	size_t length;
+	struct nlmsghdr *message;
+	uint32_t sequence;
+	int acks;
+} netlink_request_t;
+
+
+/*
+ * Function:  ResetRequest
+ * --------------------
+ *  empties a request
+ *
+ *  request:	the request
+ *
+ *  returns:	no return value
+ */
+static void ResetRequest(netlink_request_t *request)
+{
+	request->length = 0;
+	request->message = NULL;
+	request->sequence = 0;
+	request->acks = 0;
+}
+
+
+/*
+ * Function:  BeginMessage
+ * --------------------
+ *  starts a message at the end of a request
+ *
+ *  request:	the request
+ *  type:	the message type, e.g. RTM_NEWROUTE
+ *  flags:	NLM_F_* flags, NLM_F_REQUEST is always set
+ *  header:	the family header following the message header
+ *  length:	its length
+ *
+ *  returns:	no return value
+ */
+static void BeginMessage(netlink_request_t *request, uint16_t type, uint16_t flags, const void *header, size_t length)
+{
+	struct nlmsghdr *message = (struct nlmsghdr *)(request->data + request->length);
+
+	memset(message, 0, NLMSG_SPACE(length));
+	message->nlmsg_len = NLMSG_LENGTH(length);
+	message->nlmsg_type = type;
+	message->nlmsg_flags = NLM_F_REQUEST | flags;
+	message->nlmsg_seq = ++request->sequence;
+	memcpy(NLMSG_DATA(message), header, length);
+
+	request->message = message;
+	request->length += NLMSG_ALIGN(message->nlmsg_len);
+	if(NLM_F_ACK & flags)
+	{
+		++request->acks;
+	}
+}
+
+
+/*
+ * Function:  AddAttribute
+ * --------------------
+ *  adds an attribute to the message being built
+ *
+ *  request:	the request
+ *  type:	the attribute type
+ *  data:	its payload
+ *  length:	payload length
+ *
+ *  returns:	the attribute
+ */
+static struct nlattr *AddAttribute(netlink_request_t *request, uint16_t type, const void *data, size_t length)
+{
+	struct nlattr *attribute = (struct nlattr *)(request->data + request->length);
+
+	attribute->nla_type = type;
+	attribute->nla_len = NLA_HDRLEN + length;
+	memset((char *)attribute + NLA_HDRLEN, 0, NLA_ALIGN(length));
+	if(0 < length)
+	{
+		memcpy((char *)attribute + NLA_HDRLEN, data, length);
+	}
+
+	request->length += NLA_ALIGN(attribute->nla_len);
+	request->message->nlmsg_len = request->data + request->length - (char *)request->message;
+	return attribute;
+}
+
+
+/*
+ * Function:  AddString
+ * --------------------
+ *  adds a string attribute, with its terminating '\0'
+ *
+ *  request:	the request
+ *  type:	the attribute type
+ *  value:	the string
+ *
+ *  returns:	no return value
+ */
+static void AddString(netlink_request_t *request, uint16_t type, const char *value)
+{
+	AddAttribute(request, type, value, strlen(value) + 1);
+}
+
+
+/*
+ * Function:  AddNumber
+ * --------------------
+ *  adds a 32 bit attribute in network order, as nftables takes them
+ *
+ *  request:	the request
+ *  type:	the attribute type
+ *  value:	the number
+ *
+ *  returns:	no return value
+ */
+static void AddNumber(netlink_request_t *request, uint16_t type, uint32_t value)
+{
+	value = htonl(value);
+	AddAttribute(request, type, &value, sizeof(value));
+}
+
+
+/*
+ * Function:  BeginNest
+ * --------------------
+ *  starts an attribute holding the attributes added until EndNest()
+ *
+ *  request:	the request
+ *  type:	the attribute type
+ *
+ *  returns:	the attribute, to be passed to EndNest()
+ */
+static struct nlattr *BeginNest(netlink_request_t *request, uint16_t type)
+{
+	return AddAttribute(request, NLA_F_NESTED | type, NULL, 0);
+}
+
+
+/*
+ * Function:  EndNest
+ * --------------------
+ *  completes an attribute started by BeginNest()
+ *
+ *  request:	the request
+ *  nest:	the attribute
+ *
+ *  returns:	no return value
+ */
+static void EndNest(netlink_request_t *request, struct nlattr *nest)
+{
+	nest->nla_len = request->data + request->length - (char *)nest;
+}
+
+
+/*
+ * Function:  SendRequest
+ * --------------------
+ *  sends a request to the kernel over a fresh netlink socket and waits for
+ *  every acknowledgement it asked for, or for the first error
+ *
+ *  protocol:	NETLINK_ROUTE or NETLINK_NETFILTER
+ *  request:	the request
+ *
+ *  returns:	0 if successful, or -1 with errno set to the kernel's error
+ */
+static int SendRequest(int protocol, netlink_request_t *request)
+{
+	char reply[2 * NETLINK_BUFFER_SIZE] __attribute__((aligned(NLMSG_ALIGNTO)));
+	struct sockaddr_nl kernel;
+	struct timeval timeout = {NETLINK_TIMEOUT, 0};
+	struct nlmsghdr *message = NULL;
+	struct nlmsgerr *status = NULL;
+	int acks = request->acks;
+	int error = 0;
+	int received = 0;
+	int fd = -1;
+
+	memset(&kernel, 0, sizeof(kernel));
+	kernel.nl_family = AF_NETLINK;
+
+	fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, protocol);
+	if(-1 == fd)
+	{
+		return -1;
+	}
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+	if(-1 == sendto(fd, request->data, request->length, 0, (struct sockaddr *)&kernel, sizeof(kernel)))
+	{
+		error = errno;
+	}
+
+	/* a failed nftables batch is aborted, acknowledgements may stop at its error */
+	while(0 == error && 0 < acks)
+	{
+		received = recv(fd, reply, sizeof(reply), 0);
+		if(-1 == received)
+		{
+			if(EINTR != errno)
+			{
+				error = errno;
+			}
+			continue;
+		}
+
+		for(message = (struct nlmsghdr *)reply; NLMSG_OK(message, (unsigned int)received); message = NLMSG_NEXT(message, received))
+		{
+			if(NLMSG_ERROR != message->nlmsg_type)
+			{
+				continue;
+			}
+
+			status = (struct nlmsgerr *)NLMSG_DATA(message);
+			--acks;
+			if(0 != status->error && 0 == error)
+			{
+				error = -status->error;
+			}
+		}
+	}
+
+	close(fd);
+	if(0 != error)
+	{
+		errno = error;
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/* ====================== */
+/*    LINKS AND ROUTES    */
+/* ====================== */
+/*
+ * Function:  NetconfLinkUp
+ * --------------------
+ *  sets a link's MTU and brings it up (ip link set dev <name> mtu <mtu> up)
+ *
+ *  name:	the link
+ *  mtu:	its MTU
+ *
+ *  returns:	0 if successful, or -1 if an error occurred
+ */
+int NetconfLinkUp(const char *name, int mtu)
+{
+	netlink_request_t request;
+	struct ifinfomsg link;
+	uint32_t value = mtu;
+
+	memset(&link, 0, sizeof(link));
+	link.ifi_family = AF_UNSPEC;
+	link.ifi_index = if_nametoindex(name);
+	link.ifi_flags = IFF_UP;
+	link.ifi_change = IFF_UP;
+	if(0 == link.ifi_index)
+	{
+		return -1;
+	}
+
+	ResetRequest(&request);
+	BeginMessage(&request, RTM_NEWLINK, NLM_F_ACK, &link, sizeof(link));
+	AddAttribute(&request, IFLA_MTU, &value, sizeof(value));
+
+	return SendRequest(NETLINK_ROUTE, &request);
+}
+
+
+/*
+ * Function:  NetconfLinkLimitGso
+ * --------------------
+ *  caps the packets the kernel hands a link as one segmentation offload
+ *  super-packet (ip link set dev <name> gso_max_size <size>); larger ones are
+ *  segmented before they reach it
+ *
+ *  name:	the link
+ *  size:	the largest super-packet, IP header included
+ *
+ *  returns:	0 if successful, or -1 if an error occurred
+ */
+int NetconfLinkLimitGso(const char *name, size_t size)
+{
+	netlink_request_t request;
+	struct ifinfomsg link;
+	uint32_t value = size;
+
+	memset(&link, 0, sizeof(link));
+	link.ifi_family = AF_UNSPEC;
+	link.ifi_index = if_nametoindex(name);
+	if(0 == link.ifi_index)
+	{
+		return -1;
+	}
+
+	ResetRequest(&request);
+	BeginMessage(&request, RTM_NEWLINK, NLM_F_ACK, &link, sizeof(link));
+	AddAttribute(&request, IFLA_GSO_MAX_SIZE, &value, sizeof(value));
+
+	return SendRequest(NETLINK_ROUTE, &request);
+}
+
+
+/*
+ * Function:  NetconfLinkDelete
+ * --------------------
+ *  deletes a link (ip link delete <name>); a TUN device that isn't persistent
+ *  is already gone once its last queue was closed, which is no error
+ *
+ *  name:	the link
+ *
+ *  returns:	0 if successful, or -1 if an error occurred
+ */
+int NetconfLinkDelete(const char *name)
+{
+	netlink_request_t request;
+	struct ifinfomsg link;
+
+	memset(&link, 0, sizeof(link));
+	link.ifi_family = AF_UNSPEC;
+	link.ifi_index = if_nametoindex(name);
+	if(0 == link.ifi_index)
+	{
+		return ENODEV == errno ? 0 : -1;
+	}
+
+	ResetRequest(&request);
+	BeginMessage(&request, RTM_DELLINK, NLM_F_ACK, &link, sizeof(link));
+
+	if(-1 == SendRequest(NETLINK_ROUTE, &request))
+	{
+		return ENODEV == errno ? 0 : -1;
+	}
+
+	return 0;
+}
+
+
+/*
+ * Function:  NetconfSetAddress
+ * --------------------
+ *  gives a link a single IPv4 address (ip addr flush dev <name>, then
+ *  ip addr add <addr>/<prefix_length> brd + dev <name>); note that removing an
+ *  address removes the routes through it too
+ *
+ *  name:		the link
+ *  addr:		the address
+ *  prefix_length:	the prefix length of its network
+ *
+ *  returns:		0 if successful, or -1 if an error occurred
+ */
+int NetconfSetAddress(const char *name, struct in_addr addr, int prefix_length)
+{
+	netlink_request_t request;
+	struct ifaddrmsg address;
+	struct in_addr broadcast;
+
+	memset(&address, 0, sizeof(address));
+	address.ifa_family = AF_INET;
+	address.ifa_scope = RT_SCOPE_UNIVERSE;
+	address.ifa_index = if_nametoindex(name);
+	if(0 == address.ifa_index)
+	{
+		return -1;
+	}
+
+	/* a request naming no address deletes the link's first one, until none is left */
+	do
+	{
+		ResetRequest(&request);
+		BeginMessage(&request, RTM_DELADDR, NLM_F_ACK, &address, sizeof(address));
+	} while(0 == SendRequest(NETLINK_ROUTE, &request));
+
+	if(EADDRNOTAVAIL != errno)
+	{
+		return -1;
+	}
+
+	broadcast.s_addr = addr.s_addr;
+	if(prefix_length < 31)
+	{
+		broadcast.s_addr |= htonl(0xffffffffU >> prefix_length);
+	}
+
+	address.ifa_prefixlen = prefix_length;
+	ResetRequest(&request);
+	BeginMessage(&request, RTM_NEWADDR, NLM_F_ACK | NLM_F_CREATE | NLM_F_REPLACE, &address, sizeof(address));
+	AddAttribute(&request, IFA_LOCAL, &addr.s_addr, sizeof(addr.s_addr));
+	AddAttribute(&request, IFA_ADDRESS, &addr.s_addr, sizeof(addr.s_addr));
+	AddAttribute(&request, IFA_BROADCAST, &broadcast.s_addr, sizeof(broadcast.s_addr));
+
+	return SendRequest(NETLINK_ROUTE, &request);
+}
+
+
+/*
+ * Function:  ChangeRoute
+ * --------------------
+ *  adds, replaces or deletes a route in the main table straight through a
+ *  link, with no gateway
+ *
+ *  type:		RTM_NEWROUTE or RTM_DELROUTE
+ *  flags:		NLM_F_* flags for RTM_NEWROUTE
+ *  destination:	the destination network
+ *  prefix_length:	its prefix length
+ *  name:		the link
+ *
+ *  returns:		0 if successful, or -1 if an error occurred
+ */
+static int ChangeRoute(uint16_t type, uint16_t flags, struct in_addr destination, int prefix_length, const char *name)
+{
+	netlink_request_t request;
+	struct rtmsg route;
+	uint32_t index = if_nametoindex(name);
+
+	if(0 == index)
+	{
+		return -1;
+	}
+
+	memset(&route, 0, sizeof(route));
+	route.rtm_family = AF_INET;
+	route.rtm_dst_len = prefix_length;
+	route.rtm_table = RT_TABLE_MAIN;
+	route.rtm_type = RTN_UNICAST;
+	if(RTM_NEWROUTE == type)
+	{
+		route.rtm_protocol = RTPROT_BOOT;
+		route.rtm_scope = RT_SCOPE_LINK;
+	}
+	else
+	{
+		route.rtm_scope = RT_SCOPE_NOWHERE;		/* matches any scope */
+	}
+
+	ResetRequest(&request);
+	BeginMessage(&request, type, NLM_F_ACK | flags, &route, sizeof(route));
+	AddAttribute(&request, RTA_DST, &destination.s_addr, sizeof(destination.s_addr));
+	AddAttribute(&request, RTA_OIF, &index, sizeof(index));
+
+	return SendRequest(NETLINK_ROUTE, &request);
+}
+
+
+/*
+ * Function:  NetconfRouteReplace
+ * --------------------
+ *  routes a network through a link (ip route replace <destination>/<prefix_length> dev <name>)
+ *
+ *  destination:	the destination network
+ *  prefix_length:	its prefix length
+ *  name:		the link
+ *
+ *  returns:		0 if successful, or -1 if an error occurred
+ */
+int NetconfRouteReplace(struct in_addr destination, int prefix_length, const char *name)
+{
+	return ChangeRoute(RTM_NEWROUTE, NLM_F_CREATE | NLM_F_REPLACE, destination, prefix_length, name);
+}
+
+
+/*
+ * Function:  NetconfRouteDelete
+ * --------------------
+ *  deletes a route through a link (ip route del <destination>/<prefix_length> dev <name>)
+ *
+ *  destination:	the destination network
+ *  prefix_length:	its prefix length
+ *  name:		the link
+ *
+ *  returns:		0 if successful, or -1 if an error occurred
+ */
+int NetconfRouteDelete(struct in_addr destination, int prefix_length, const char *name)
+{
+	return ChangeRoute(RTM_DELROUTE, 0, destination, prefix_length, name);
+}
+
+
+/*
+ * Function:  NetconfEnableForwarding
+ * --------------------
+ *  turns on IPv4 forwarding, writing the sysctl's file directly
+ *  (sysctl -w net.ipv4.ip_forward=1)
+ *
+ *  returns:	0 if successful, or -1 if an error occurred
+ */
+int NetconfEnableForwarding()
+{
+	int fd = open("/proc/sys/net/ipv4/ip_forward", O_WRONLY | O_CLOEXEC);
+	ssize_t written = 0;
+
+	if(-1 == fd)
+	{
+		return -1;
+	}
+
+	written = write(fd, "1", 1);
+	close(fd);
+
+	return 1 == written ? 0 : -1;
+}
+
+
+/* ====================== */
+/*    NFTABLES RULES      */
+/* ====================== */
+/*
+ * Function:  BeginBatch
+ * --------------------
+ *  starts an nftables batch, whose messages the kernel applies all or none
+ *
+ *  request:	the request, empty
+ *  type:	NFNL_MSG_BATCH_BEGIN, or NFNL_MSG_BATCH_END to close the batch
+ *
+ *  returns:	no return value
+ */
+static void BeginBatch(netlink_request_t *request, uint16_t type)
+{
+	struct nfgenmsg header;
+
+	memset(&header, 0, sizeof(header));
+	header.nfgen_family = AF_UNSPEC;
+	header.version = NFNETLINK_V0;
+	header.res_id = htons(NFNL_SUBSYS_NFTABLES);
+
+	BeginMessage(request, type, 0, &header, sizeof(header));
+}
+
+
+/*
+ * Function:  BeginTableMessage
+ * --------------------
+ *  starts an nftables message about NETCONF_TABLE, an IPv4 table
+ *
+ *  request:	the request
+ *  command:	NFT_MSG_NEWTABLE, NFT_MSG_NEWRULE, ...
+ *  flags:	NLM_F_* flags
+ *
+ *  returns:	no return value
+ */
+static void BeginTableMessage(netlink_request_t *request, int command, uint16_t flags)
+{
+	struct nfgenmsg header;
+
+	memset(&header, 0, sizeof(header));
+	header.nfgen_family = NFPROTO_IPV4;
+	header.version = NFNETLINK_V0;
+
+	BeginMessage(request, (NFNL_SUBSYS_NFTABLES << 8) | command, NLM_F_ACK | flags, &header, sizeof(header));
+	AddString(request, NFT_MSG_NEWTABLE == command || NFT_MSG_DELTABLE == command ? NFTA_TABLE_NAME :
+		  NFT_MSG_NEWCHAIN == command ? NFTA_CHAIN_TABLE : NFTA_RULE_TABLE, NETCONF_TABLE);
+}
+
+
+/*
+ * Function:  AddFreshTable
+ * --------------------
+ *  creates NETCONF_TABLE, deleting what an earlier run may have left in it
+ *  (nft add table ip vpn; delete table ip vpn; add table ip vpn)
+ *
+ *  request:	the batch
+ *
+ *  returns:	no return value
+ */
+static void AddFreshTable(netlink_request_t *request)
+{
+	BeginTableMessage(request, NFT_MSG_NEWTABLE, NLM_F_CREATE);
+	BeginTableMessage(request, NFT_MSG_DELTABLE, 0);
+	BeginTableMessage(request, NFT_MSG_NEWTABLE, NLM_F_CREATE);
+}
+
+
+/*
+ * Function:  AddBaseChain
+ * --------------------
+ *  creates a chain in NETCONF_TABLE attached to a netfilter hook
+ *
+ *  request:	the batch
+ *  name:	the chain
+ *  type:	'filter' or 'nat'
+ *  hook:	NF_INET_FORWARD, NF_INET_POST_ROUTING, ...
+ *  priority:	where among the hook's chains it runs
+ *
+ *  returns:	no return value
+ */
+static void AddBaseChain(netlink_request_t *request, const char *name, const char *type, int hook, int priority)
+{
+	struct nlattr *nest = NULL;
+
+	BeginTableMessage(request, NFT_MSG_NEWCHAIN, NLM_F_CREATE);
+	AddString(request, NFTA_CHAIN_NAME, name);
+	nest = BeginNest(request, NFTA_CHAIN_HOOK);
+	AddNumber(request, NFTA_HOOK_HOOKNUM, hook);
+	AddNumber(request, NFTA_HOOK_PRIORITY, priority);
+	EndNest(request, nest);
+	AddString(request, NFTA_CHAIN_TYPE, type);
+}
+
+
+/*
+ * Function:  BeginRule
+ * --------------------
+ *  starts a rule appended to a chain of NETCONF_TABLE, its expressions follow
+ *
+ *  request:	the batch
+ *  chain:	the chain
+ *
+ *  returns:	the list of expressions, to be passed to EndNest()
+ */
+static struct nlattr *BeginRule(netlink_request_t *request, const char *chain)
+{
+	BeginTableMessage(request, NFT_MSG_NEWRULE, NLM_F_CREATE | NLM_F_APPEND);
+	AddString(request, NFTA_RULE_CHAIN, chain);
+
+	return BeginNest(request, NFTA_RULE_EXPRESSIONS);
+}
+
+
+/*
+ * Function:  BeginExpression
+ * --------------------
+ *  starts an expression of a rule, its attributes follow
+ *
+ *  request:	the batch
+ *  name:	the expression, e.g. 'meta' or 'cmp'
+ *  element:	set to the list element, to be passed to EndNest() after data
+ *
+ *  returns:	the expression's data, to be passed to EndNest()
+ */
+static struct nlattr *BeginExpression(netlink_request_t *request, const char *name, struct nlattr **element)
+{
+	*element = BeginNest(request, NFTA_LIST_ELEM);
+	AddString(request, NFTA_EXPR_NAME, name);
+
+	return BeginNest(request, NFTA_EXPR_DATA);
+}
+
+
+/*
+ * Function:  EndExpression
+ * --------------------
+ *  completes an expression started by BeginExpression()
+ *
+ *  request:	the batch
+ *  element:	the list element
+ *  data:	the expression's data
+ *
+ *  returns:	no return value
+ */
+static void EndExpression(netlink_request_t *request, struct nlattr *element, struct nlattr *data)
+{
+	EndNest(request, data);
+	EndNest(request, element);
+}
+
+
+/*
+ * Function:  AddCompare
+ * --------------------
+ *  adds an expression comparing register 1 to a value
+ *
+ *  request:	the batch
+ *  operator:	NFT_CMP_EQ or NFT_CMP_NEQ
+ *  value:	the value
+ *  length:	its length
+ *
+ *  returns:	no return value
+ */
+static void AddCompare(netlink_request_t *request, int operator, const void *value, size_t length)
+{
+	struct nlattr *element = NULL;
+	struct nlattr *data = BeginExpression(request, "cmp", &element);
+	struct nlattr *nest = NULL;
+
+	AddNumber(request, NFTA_CMP_SREG, NFT_REG_1);
+	AddNumber(request, NFTA_CMP_OP, operator);
+	nest = BeginNest(request, NFTA_CMP_DATA);
+	AddAttribute(request, NFTA_DATA_VALUE, value, length);
+	EndNest(request, nest);
+	EndExpression(request, element, data);
+}
+
+
+/*
+ * Function:  AddInterfaceMatch
+ * --------------------
+ *  adds the expressions matching packets by interface (iifname/oifname <name>)
+ *
+ *  request:	the batch
+ *  key:	NFT_META_IIFNAME or NFT_META_OIFNAME
+ *  name:	the interface
+ *
+ *  returns:	no return value
+ */
+static void AddInterfaceMatch(netlink_request_t *request, int key, const char *name)
+{
+	char padded[IFNAMSIZ];
+	struct nlattr *element = NULL;
+	struct nlattr *data = BeginExpression(request, "meta", &element);
+
+	AddNumber(request, NFTA_META_KEY, key);
+	AddNumber(request, NFTA_META_DREG, NFT_REG_1);
+	EndExpression(request, element, data);
+
+	memset(padded, 0, sizeof(padded));
+	strncpy(padded, name, IFNAMSIZ - 1);
+	AddCompare(request, NFT_CMP_EQ, padded, sizeof(padded));
+}
+
+
+/*
+ * Function:  AddReplyMatch
+ * --------------------
+ *  adds the expressions matching the packets of connections that were
+ *  already let through (ct state established,related)
+ *
+ *  request:	the batch
+ *
+ *  returns:	no return value
+ */
+static void AddReplyMatch(netlink_request_t *request)
+{
+	uint32_t mask = NF_CT_STATE_BIT(IP_CT_ESTABLISHED) | NF_CT_STATE_BIT(IP_CT_RELATED);
+	uint32_t zero = 0;
+	struct nlattr *element = NULL;
+	struct nlattr *data = BeginExpression(request, "ct", &element);
+	struct nlattr *nest = NULL;
+
+	AddNumber(request, NFTA_CT_KEY, NFT_CT_STATE);
+	AddNumber(request, NFTA_CT_DREG, NFT_REG_1);
+	EndExpression(request, element, data);
+
+	/* the state is a bitmask in host order */
+	data = BeginExpression(request, "bitwise", &element);
+	AddNumber(request, NFTA_BITWISE_SREG, NFT_REG_1);
+	AddNumber(request, NFTA_BITWISE_DREG, NFT_REG_1);
+	AddNumber(request, NFTA_BITWISE_LEN, sizeof(mask));
+	nest = BeginNest(request, NFTA_BITWISE_MASK);
+	AddAttribute(request, NFTA_DATA_VALUE, &mask, sizeof(mask));
+	EndNest(request, nest);
+	nest = BeginNest(request, NFTA_BITWISE_XOR);
+	AddAttribute(request, NFTA_DATA_VALUE, &zero, sizeof(zero));
+	EndNest(request, nest);
+	EndExpression(request, element, data);
+
+	AddCompare(request, NFT_CMP_NEQ, &zero, sizeof(zero));
+}
+
+
+/*
+ * Function:  AddAccept
+ * --------------------
+ *  adds the expression accepting the packet
+ *
+ *  request:	the batch
+ *
+ *  returns:	no return value
+ */
+static void AddAccept(netlink_request_t *request)
+{
+	struct nlattr *element = NULL;
+	struct nlattr *data = BeginExpression(request, "immediate", &element);
+	struct nlattr *value = NULL;
+	struct nlattr *verdict = NULL;
+
+	AddNumber(request, NFTA_IMMEDIATE_DREG, NFT_REG_VERDICT);
+	value = BeginNest(request, NFTA_IMMEDIATE_DATA);
+	verdict = BeginNest(request, NFTA_DATA_VERDICT);
+	AddNumber(request, NFTA_VERDICT_CODE, NF_ACCEPT);
+	EndNest(request, verdict);
+	EndNest(request, value);
+	EndExpression(request, element, data);
+}
+
+
+/*
+ * Function:  NetconfMasquerade
+ * --------------------
+ *  masquerades the traffic leaving through an interface, in a fresh
+ *  NETCONF_TABLE table, so the rule is gone with the table
+ *  (nft add rule ip vpn postrouting oifname <interface> masquerade)
+ *
+ *  interface:	the interface
+ *
+ *  returns:	0 if successful, or -1 if an error occurred
+ */
+int NetconfMasquerade(const char *interface)
+{
+	netlink_request_t request;
+	struct nlattr *expressions = NULL;
+	struct nlattr *element = NULL;
+
+	ResetRequest(&request);
+	BeginBatch(&request, NFNL_MSG_BATCH_BEGIN);
+	AddFreshTable(&request);
+	AddBaseChain(&request, "postrouting", "nat", NF_INET_POST_ROUTING, NAT_PRIORITY);
+
+	expressions = BeginRule(&request, "postrouting");
+	AddInterfaceMatch(&request, NFT_META_OIFNAME, interface);
+	element = BeginNest(&request, NFTA_LIST_ELEM);
+	AddString(&request, NFTA_EXPR_NAME, "masq");
+	EndNest(&request, element);
+	EndNest(&request, expressions);
+
+	BeginBatch(&request, NFNL_MSG_BATCH_END);
+	return SendRequest(NETLINK_NETFILTER, &request);
+}
+
+
+/*
+ * Function:  NetconfAcceptForwarding
+ * --------------------
+ *  accepts forwarding packets to a link and the replies coming back from it,
+ *  in a fresh NETCONF_TABLE table, so the rules are gone with the table
+ *  (nft add rule ip vpn forward oifname <name> accept, and
+ *  iifname <name> ct state established,related accept)
+ *
+ *  name:	the link
+ *
+ *  returns:	0 if successful, or -1 if an error occurred
+ */
+int NetconfAcceptForwarding(const char *name)
+{
+	netlink_request_t request;
+	struct nlattr *expressions = NULL;
+
+	ResetRequest(&request);
+	BeginBatch(&request, NFNL_MSG_BATCH_BEGIN);
+	AddFreshTable(&request);
+	AddBaseChain(&request, "forward", "filter", NF_INET_FORWARD, FILTER_PRIORITY);
+
+	expressions = BeginRule(&request, "forward");
+	AddInterfaceMatch(&request, NFT_META_OIFNAME, name);
+	AddAccept(&request);
+	EndNest(&request, expressions);
+
+	expressions = BeginRule(&request, "forward");
+	AddInterfaceMatch(&request, NFT_META_IIFNAME, name);
+	AddReplyMatch(&request);
+	AddAccept(&request);
+	EndNest(&request, expressions);
+
+	BeginBatch(&request, NFNL_MSG_BATCH_END);
+	return SendRequest(NETLINK_NETFILTER, &request);
+}
+
+
+/*
+ * Function:  NetconfRemoveRules
+ * --------------------
+ *  deletes NETCONF_TABLE with its chains and rules (nft delete table ip vpn)
+ *
+ *  returns:	0 if successful or there was no table, or -1 if an error occurred
+ */
+int NetconfRemoveRules()
+{
+	netlink_request_t request;
+
+	ResetRequest(&request);
+	BeginBatch(&request, NFNL_MSG_BATCH_BEGIN);
+	BeginTableMessage(&request, NFT_MSG_DELTABLE, 0);
+	BeginBatch(&request, NFNL_MSG_BATCH_END);
+
+	if(-1 == SendRequest(NETLINK_NETFILTER, &request))
+	{
+		return ENOENT == errno ? 0 : -1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,46 @@
+#ifndef NETCONF_H
+#define NETCONF_H
+
+#include <stddef.h>		/* size_t 		*/
+#include <netinet/in.h>		/* struct in_addr 	*/
+
+#define NETCONF_TABLE "vpn"				/* the nftables table holding the tunnel's rules */
+
+/*
+ * configures links, addresses, routes and firewall rules by talking netlink to
+ * the kernel directly (rtnetlink, and nfnetlink for nftables), so nothing is
+ * forked and no tools have to be installed; every function returns 0 if
+ * successful or -1 with errno set to what the kernel answered
+ */
+
+/* sets a link's MTU and brings it up */
+int NetconfLinkUp(const char *name, int mtu);
+
+/* caps the segmentation offload super-packets the kernel hands a link */
+int NetconfLinkLimitGso(const char *name, size_t size);
+
+/* deletes a link, a link that is already gone is no error */
+int NetconfLinkDelete(const char *name);
+
+/* gives a link a single IPv4 address, removing the ones it had */
+int NetconfSetAddress(const char *name, struct in_addr addr, int prefix_length);
+
+/* adds a route through a link, or replaces the route to the same destination */
+int NetconfRouteReplace(struct in_addr destination, int prefix_length, const char *name);
+
+/* deletes a route through a link */
+int NetconfRouteDelete(struct in_addr destination, int prefix_length, const char *name);
+
+/* turns on IPv4 forwarding (net.ipv4.ip_forward) */
+int NetconfEnableForwarding();
+
+/* masquerades the traffic leaving through an interface, in a fresh NETCONF_TABLE table */
+int NetconfMasquerade(const char *interface);
+
+/* accepts forwarding to a link and the replies coming back, in a fresh NETCONF_TABLE table */
+int NetconfAcceptForwarding(const char *name);
+
+/* deletes the NETCONF_TABLE table and its rules, a missing table is no error */
+int NetconfRemoveRules();
+
+#endif  /* NETCONF_H */
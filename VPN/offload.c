@@ -0,0 +1,243 @@
+#include "offload.h"
+#include <stdint.h>		/* uint64_t 		*/
+#include <string.h>		/* memcpy 		*/
+#include <arpa/inet.h>		/* htons, ntohl 	*/
+#include <netinet/ip.h>	/* iphdr 		*/
+#include <netinet/tcp.h>	/* tcphdr, TH_FIN 	*/
+#include <sys/ioctl.h>		/* ioctl 		*/
+#include <sys/uio.h>		/* writev 		*/
+#include <linux/if_tun.h>	/* TUNSETOFFLOAD 	*/
+
+#define TCP_FLAGS_OFFSET 13				/* the byte of a TCP header holding its flags */
+#define TCP_FLAG_CWR 0x80				/* congestion window reduced (RFC 3168), TH_* lacks it */
+
+
+/*
+ * Function:  OffloadEnable
+ * --------------------
+ *  lets the kernel hand a TUN device TCP/IPv4 super-packets (TSO) and packets
+ *  whose checksum is still to be completed, both described by the
+ *  virtio_net_hdr in front of them
+ *
+ *  fd:		any queue of a TUN device opened with IFF_VNET_HDR
+ *
+ *  returns:	0 if successful, or -1 if the kernel refused
+ */
+int OffloadEnable(int fd)
+{
+	return ioctl(fd, TUNSETOFFLOAD, TUN_F_CSUM | TUN_F_TSO4);
+}
+
+
+/*
+ * Function:  Sum
+ * --------------------
+ *  adds bytes to an Internet checksum (RFC 1071) a word at a time, in host
+ *  order, which the folded checksum is in as well
+ *
+ *  data:	the bytes, starting at an even offset of what is checksummed
+ *  length:	their count
+ *  sum:	the sum so far
+ *
+ *  returns:	the new sum, unfolded
+ */
+static uint64_t Sum(const unsigned char *data, size_t length, uint64_t sum)
+{
+	uint32_t word = 0;
+	uint16_t half = 0;
+	unsigned char last[2] = {0, 0};
+
+	for(; length >= sizeof(word); data += sizeof(word), length -= sizeof(word))
+	{
+		memcpy(&word, data, sizeof(word));
+		sum += word;
+	}
+
+	if(length >= sizeof(half))
+	{
+		memcpy(&half, data, sizeof(half));
+		sum += half;
+		data += sizeof(half);
+		length -= sizeof(half);
+	}
+
+	/* an odd byte is padded with a zero */
+	if(1 == length)
+	{
+		last[0] = data[0];
+		memcpy(&half, last, sizeof(half));
+		sum += half;
+	}
+
+	return sum;
+}
+
+
+/*
+ * Function:  Fold
+ * --------------------
+ *  turns a sum into the checksum stored in a header
+ *
+ *  sum:	the sum of Sum()
+ *
+ *  returns:	the checksum, ready to be stored as it is
+ */
+static uint16_t Fold(uint64_t sum)
+{
+	while(sum >> 16)
+	{
+		sum = (sum & 0xffff) + (sum >> 16);
+	}
+
+	return (uint16_t)~sum;
+}
+
+
+/*
+ * Function:  OffloadCompleteChecksum
+ * --------------------
+ *  finishes the checksum of a packet the kernel left it to the device for
+ *  (VIRTIO_NET_HDR_F_NEEDS_CSUM): the checksum field already holds the
+ *  pseudo-header's sum, and the sum from csum_start to the end is stored
+ *  csum_offset bytes past it
+ *
+ *  header:	the packet's virtio_net_hdr
+ *  packet:	the packet
+ *  length:	packet length
+ *
+ *  returns:	0 if successful, or -1 if the header points outside the packet
+ */
+int OffloadCompleteChecksum(const struct virtio_net_hdr *header, unsigned char *packet, size_t length)
+{
+	size_t start = header->csum_start;
+	size_t offset = header->csum_offset;
+	uint16_t checksum = 0;
+
+	if(!(VIRTIO_NET_HDR_F_NEEDS_CSUM & header->flags))
+	{
+		return 0;
+	}
+
+	if(start + offset + sizeof(checksum) > length)
+	{
+		return -1;
+	}
+
+	checksum = Fold(Sum(packet + start, length - start, 0));
+	memcpy(packet + start + offset, &checksum, sizeof(checksum));
+	return 0;
+}
+
+
+/*
+ * Function:  OffloadSegment
+ * --------------------
+ *  cuts one plain packet out of a TCP/IPv4 super-packet, the way the kernel
+ *  would have: gso_size bytes of payload behind a copy of the headers, with
+ *  its own length, IP id, sequence number and checksums; FIN and PSH only
+ *  stay on the last segment, CWR only on the first
+ *
+ *  header:	the super-packet's virtio_net_hdr
+ *  packet:	the super-packet
+ *  length:	super-packet length
+ *  index:	which segment, from 0
+ *  segment:	where the segment goes
+ *  room:	how long the segment may be
+ *
+ *  returns:	the segment's length, or 0 past the last segment or if the
+ *		super-packet is malformed or its segments don't fit the room
+ */
+size_t OffloadSegment(const struct virtio_net_hdr *header, const unsigned char *packet, size_t length,
+		      size_t index, unsigned char *segment, size_t room)
+{
+	const struct iphdr *ip = (const struct iphdr *)packet;
+	const struct tcphdr *tcp = NULL;
+	struct iphdr *segment_ip = (struct iphdr *)segment;
+	struct tcphdr *segment_tcp = NULL;
+	unsigned char pseudo[12];
+	size_t ip_length = 0;
+	size_t headers = 0;
+	size_t mss = header->gso_size;
+	size_t offset = 0;
+	size_t chunk = 0;
+	uint16_t tcp_length = 0;
+
+	if(VIRTIO_NET_HDR_GSO_TCPV4 != (header->gso_type & ~VIRTIO_NET_HDR_GSO_ECN) ||
+	   length < sizeof(struct iphdr) || 4 != ip->version || IPPROTO_TCP != ip->protocol || ntohs(ip->tot_len) != length)
+	{
+		return 0;
+	}
+
+	ip_length = ip->ihl * 4;
+	tcp = (const struct tcphdr *)(packet + ip_length);
+	if(length < ip_length + sizeof(struct tcphdr))
+	{
+		return 0;
+	}
+
+	headers = ip_length + tcp->doff * 4;
+	offset = index * mss;
+	if(length < headers || 0 == mss || headers + mss > room || offset >= length - headers)
+	{
+		return 0;
+	}
+	chunk = length - headers - offset < mss ? length - headers - offset : mss;
+
+	memcpy(segment, packet, headers);
+	memcpy(segment + headers, packet + headers + offset, chunk);
+
+	segment_ip->tot_len = htons(headers + chunk);
+	segment_ip->id = htons(ntohs(ip->id) + index);
+	segment_ip->check = 0;
+	segment_ip->check = Fold(Sum(segment, ip_length, 0));
+
+	segment_tcp = (struct tcphdr *)(segment + ip_length);
+	segment_tcp->seq = htonl(ntohl(tcp->seq) + offset);
+	if(offset + chunk < length - headers)
+	{
+		segment[ip_length + TCP_FLAGS_OFFSET] &= ~(TH_FIN | TH_PUSH);
+	}
+	if(0 != index)
+	{
+		segment[ip_length + TCP_FLAGS_OFFSET] &= ~TCP_FLAG_CWR;
+	}
+
+	/* the pseudo-header: addresses, zero, protocol and TCP length */
+	tcp_length = htons(headers - ip_length + chunk);
+	memcpy(pseudo, &ip->saddr, 4);
+	memcpy(pseudo + 4, &ip->daddr, 4);
+	pseudo[8] = 0;
+	pseudo[9] = IPPROTO_TCP;
+	memcpy(pseudo + 10, &tcp_length, sizeof(tcp_length));
+
+	segment_tcp->check = 0;
+	segment_tcp->check = Fold(Sum(segment + ip_length, headers - ip_length + chunk, Sum(pseudo, sizeof(pseudo), 0)));
+
+	return headers + chunk;
+}
+
+
+/*
+ * Function:  OffloadWrite
+ * --------------------
+ *  writes a plain packet to a TUN device opened with IFF_VNET_HDR, gathering
+ *  an empty virtio_net_hdr (no offload, the checksums are complete) with it
+ *
+ *  fd:		the TUN queue
+ *  packet:	the packet
+ *  length:	packet length
+ *
+ *  returns:	what writev() returns
+ */
+ssize_t OffloadWrite(int fd, const void *packet, size_t length)
+{
+	static const struct virtio_net_hdr plain;
+	struct iovec vectors[2];
+
+	vectors[0].iov_base = (void *)&plain;
+	vectors[0].iov_len = sizeof(plain);
+	vectors[1].iov_base = (void *)packet;
+	vectors[1].iov_len = length;
+
+	return writev(fd, vectors, 2);
+}
@@ -0,0 +1,34 @@
+#ifndef OFFLOAD_H
+#define OFFLOAD_H
+
+#include <stddef.h>		/* size_t 		*/
+#include <sys/types.h>		/* ssize_t 		*/
+#include <linux/virtio_net.h>	/* virtio_net_hdr 	*/
+#include "frame.h"		/* FRAME_MAX_PAYLOAD 	*/
+
+#define OFFLOAD_HEADER_SIZE sizeof(struct virtio_net_hdr)		/* precedes every packet on the TUN device */
+#define OFFLOAD_MAX_LENGTH (FRAME_MAX_PAYLOAD - OFFLOAD_HEADER_SIZE)	/* the largest super-packet, a frame with its header */
+
+/*
+ * a TUN device opened with IFF_VNET_HDR precedes every packet with a
+ * virtio_net_hdr; once offloads are enabled the kernel hands out TCP
+ * super-packets of many segments (TSO) and packets whose checksum it left
+ * to the device, and takes them back the same way, so they can cross the
+ * tunnel whole to a peer whose TUN device takes them too, and are cut into
+ * plain packets at the tunnel boundary for any other peer
+ */
+
+/* lets the kernel hand a TUN device opened with IFF_VNET_HDR super-packets and unfinished checksums */
+int OffloadEnable(int fd);
+
+/* finishes the checksum of a packet the kernel left it to, in place */
+int OffloadCompleteChecksum(const struct virtio_net_hdr *header, unsigned char *packet, size_t length);
+
+/* cuts the index-th plain packet out of a TCP super-packet, returns its length or 0 past the last */
+size_t OffloadSegment(const struct virtio_net_hdr *header, const unsigned char *packet, size_t length,
+		      size_t index, unsigned char *segment, size_t room);
+
+/* writes a plain packet to a TUN device opened with IFF_VNET_HDR, behind an empty header */
+ssize_t OffloadWrite(int fd, const void *packet, size_t length);
+
+#endif  /* OFFLOAD_H */
@@ -0,0 +1,600 @@
+#include "pipeline.h"
+#include <stdio.h>		/* printf 		*/
+#include <stdlib.h>		/* calloc, malloc, free */
+#include <string.h>		/* memcpy, memmove 	*/
+#include <unistd.h>		/* read, write, close 	*/
+#include <errno.h>		/* EAGAIN 		*/
+#include <poll.h>		/* poll 		*/
+#include <sys/uio.h>		/* writev 		*/
+#include <sys/socket.h>	/* recv 		*/
+#include <sys/eventfd.h>	/* eventfd 		*/
+#include <openssl/evp.h>	/* EVP_CIPHER_CTX_new 	*/
+
+#define PIPELINE_VECTORS 64				/* sealed records written with one writev() at most */
+
+
+/*
+ * Function:  PipelineSealRecord
+ * --------------------
+ *  turns a slot's content into a TLS 1.3 application data record, in place
+ *
+ *  ctx:	the worker's sealing context, keyed
+ *  iv:		the traffic IV
+ *  sequence:	the record's sequence number
+ *  slot:	the slot, its content RECORD_HEADER_SIZE bytes in
+ *
+ *  returns:	no return value, slot->type is -1 if sealing failed
+ */
+static void PipelineSealRecord(EVP_CIPHER_CTX *ctx, const unsigned char *iv, uint64_t sequence, pipeline_slot_t *slot)
+{
+	size_t length = RecordSeal(ctx, iv, sequence, slot->data, slot->length, SSL3_RT_APPLICATION_DATA);
+
+	slot->type = 0 == length ? -1 : SSL3_RT_APPLICATION_DATA;
+	slot->length = 0 == length ? slot->length : length;
+}
+
+
+/*
+ * Function:  PipelineOpenRecord
+ * --------------------
+ *  decrypts a TLS 1.3 record in place and strips its padding, leaving its
+ *  content RECORD_HEADER_SIZE bytes into the slot
+ *
+ *  ctx:	the worker's opening context, keyed
+ *  iv:		the traffic IV
+ *  sequence:	the record's sequence number
+ *  slot:	the slot, holding the record
+ *
+ *  returns:	no return value, slot->type is the inner content type, or -1
+ *		if the record didn't open
+ */
+static void PipelineOpenRecord(EVP_CIPHER_CTX *ctx, const unsigned char *iv, uint64_t sequence, pipeline_slot_t *slot)
+{
+	slot->type = RecordOpen(ctx, iv, sequence, slot->data, &slot->length);
+}
+
+
+/*
+ * Function:  PipelinePending
+ * --------------------
+ *  tells whether the I/O thread submitted a record a worker didn't take yet
+ *
+ *  worker:	the worker
+ *
+ *  returns:	1 if it did, 0 otherwise
+ */
+static int PipelinePending(pipeline_worker_t *worker)
+{
+	return worker->seal.done != __atomic_load_n(&worker->seal.submitted, __ATOMIC_SEQ_CST) ||
+	       worker->open.done != __atomic_load_n(&worker->open.submitted, __ATOMIC_SEQ_CST);
+}
+
+
+/*
+ * Function:  PipelineWork
+ * --------------------
+ *  seals or opens the oldest record submitted on a lane, if there is one,
+ *  and tells the I/O thread it is done
+ *
+ *  worker:	the worker
+ *  lane:	one of its lanes
+ *  seal:	whether it is the sealing lane
+ *
+ *  returns:	1 if a record was done, 0 if the lane was empty
+ */
+static int PipelineWork(pipeline_worker_t *worker, pipeline_lane_t *lane, int seal)
+{
+	pipeline_t *pipeline = worker->pipeline;
+	uint64_t position = lane->done;
+	uint64_t sequence = position * pipeline->count + worker->index;
+	uint64_t one = 1;
+
+	if(position == __atomic_load_n(&lane->submitted, __ATOMIC_ACQUIRE))
+	{
+		return 0;
+	}
+
+	if(seal)
+	{
+		PipelineSealRecord(worker->sealer, pipeline->seal_iv, pipeline->seal_base + sequence, &lane->slots[position % PIPELINE_DEPTH]);
+	}
+	else
+	{
+		PipelineOpenRecord(worker->opener, pipeline->open_iv, pipeline->open_base + sequence, &lane->slots[position % PIPELINE_DEPTH]);
+	}
+
+	__atomic_store_n(&lane->done, position + 1, __ATOMIC_RELEASE);
+	write(pipeline->fd, &one, sizeof(one));
+	return 1;
+}
+
+
+/*
+ * Function:  PipelineWorkerRun
+ * --------------------
+ *  a crypto worker: takes turns between its lanes while either has records,
+ *  and sleeps on its eventfd while both are empty
+ *
+ *  arg:	the worker
+ *
+ *  returns:	NULL once the pipeline stops
+ */
+static void *PipelineWorkerRun(void *arg)
+{
+	pipeline_worker_t *worker = arg;
+	uint64_t wakes = 0;
+	int worked = 0;
+
+	while(__atomic_load_n(&worker->pipeline->running, __ATOMIC_ACQUIRE))
+	{
+		worked = PipelineWork(worker, &worker->seal, 1);
+		worked |= PipelineWork(worker, &worker->open, 0);
+		if(worked)
+		{
+			continue;
+		}
+
+		/* a record submitted after the lanes were checked again sees idle set and wakes the worker */
+		__atomic_store_n(&worker->idle, 1, __ATOMIC_SEQ_CST);
+		if(PipelinePending(worker) || !__atomic_load_n(&worker->pipeline->running, __ATOMIC_ACQUIRE))
+		{
+			__atomic_store_n(&worker->idle, 0, __ATOMIC_SEQ_CST);
+			continue;
+		}
+		read(worker->wake_fd, &wakes, sizeof(wakes));
+	}
+
+	return NULL;
+}
+
+
+/*
+ * Function:  PipelineWake
+ * --------------------
+ *  wakes a worker up for a record just submitted, if it sleeps
+ *
+ *  worker:	the worker
+ *
+ *  returns:	no return value
+ */
+static void PipelineWake(pipeline_worker_t *worker)
+{
+	uint64_t one = 1;
+
+	if(__atomic_exchange_n(&worker->idle, 0, __ATOMIC_SEQ_CST))
+	{
+		write(worker->wake_fd, &one, sizeof(one));
+	}
+}
+
+
+/*
+ * Function:  PipelineStart
+ * --------------------
+ *  takes the record layer of an established TLS 1.3 session over: derives
+ *  the traffic keys from the secrets RecordTrack() collected and starts
+ *  the workers, each with AEAD contexts of its own; records are written to
+ *  and read from the socket here from now on, the session must neither
+ *  write nor read again nor hold a record it read but didn't return
+ *
+ *  pipeline:	the pipeline
+ *  ssl:	the session, TLS 1.3 with an AES-GCM or ChaCha20-Poly1305 suite
+ *  secrets:	what RecordTrack() collected of it
+ *  socket_fd:	the session's socket, blocking
+ *  count:	workers, up to PIPELINE_MAX_WORKERS
+ *
+ *  returns:	0 if successful, or -1 if the session can't be taken over or
+ *		an error occurred
+ */
+int PipelineStart(pipeline_t *pipeline, SSL *ssl, const record_secrets_t *secrets, int socket_fd, size_t count)
+{
+	record_keys_t seal;
+	record_keys_t open;
+	pipeline_worker_t *worker = NULL;
+	size_t i = 0;
+
+	memset(pipeline, 0, sizeof(pipeline_t));
+	pipeline->fd = -1;
+
+	if(0 == count || PIPELINE_MAX_WORKERS < count || -1 == RecordDeriveKeys(ssl, secrets, &seal, &open))
+	{
+		return -1;
+	}
+
+	pipeline->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	pipeline->stream = malloc(PIPELINE_STREAM_SIZE);
+	pipeline->workers = calloc(count, sizeof(pipeline_worker_t));
+	if(-1 == pipeline->fd || NULL == pipeline->stream || NULL == pipeline->workers)
+	{
+		OPENSSL_cleanse(&seal, sizeof(seal));
+		OPENSSL_cleanse(&open, sizeof(open));
+		PipelineStop(pipeline);
+		return -1;
+	}
+
+	pipeline->count = count;
+	pipeline->socket_fd = socket_fd;
+	memcpy(pipeline->seal_iv, seal.iv, RECORD_IV_SIZE);
+	memcpy(pipeline->open_iv, open.iv, RECORD_IV_SIZE);
+	pipeline->seal_base = seal.sequence;
+	pipeline->open_base = open.sequence;
+	pipeline->running = 1;
+	for(i = 0; i < count; ++i)
+	{
+		pipeline->workers[i].wake_fd = -1;
+	}
+
+	for(i = 0; i < count; ++i)
+	{
+		worker = &pipeline->workers[i];
+		worker->index = i;
+		worker->pipeline = pipeline;
+		worker->sealer = EVP_CIPHER_CTX_new();
+		worker->opener = EVP_CIPHER_CTX_new();
+		worker->wake_fd = eventfd(0, EFD_CLOEXEC);
+		if(NULL == worker->sealer || NULL == worker->opener || -1 == worker->wake_fd ||
+		   -1 == RecordInitCipher(worker->sealer, &seal, 1) ||
+		   -1 == RecordInitCipher(worker->opener, &open, 0) ||
+		   0 != pthread_create(&worker->thread, NULL, PipelineWorkerRun, worker))
+		{
+			break;
+		}
+		worker->started = 1;
+	}
+
+	OPENSSL_cleanse(&seal, sizeof(seal));
+	OPENSSL_cleanse(&open, sizeof(open));
+	if(i != count)
+	{
+		PipelineStop(pipeline);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/*
+ * Function:  PipelineStop
+ * --------------------
+ *  stops the workers and releases the pipeline; records still in it are
+ *  lost, and the session it took over is out of step with the peer
+ *
+ *  pipeline:	the pipeline, started or not
+ *
+ *  returns:	no return value
+ */
+void PipelineStop(pipeline_t *pipeline)
+{
+	uint64_t one = 1;
+	size_t i = 0;
+
+	__atomic_store_n(&pipeline->running, 0, __ATOMIC_RELEASE);
+	for(i = 0; i < pipeline->count; ++i)
+	{
+		if(pipeline->workers[i].started)
+		{
+			write(pipeline->workers[i].wake_fd, &one, sizeof(one));
+			pthread_join(pipeline->workers[i].thread, NULL);
+		}
+	}
+
+	for(i = 0; i < pipeline->count; ++i)
+	{
+		EVP_CIPHER_CTX_free(pipeline->workers[i].sealer);
+		EVP_CIPHER_CTX_free(pipeline->workers[i].opener);
+		if(-1 != pipeline->workers[i].wake_fd)
+		{
+			close(pipeline->workers[i].wake_fd);
+		}
+	}
+
+	if(-1 != pipeline->fd)
+	{
+		close(pipeline->fd);
+	}
+	free(pipeline->workers);
+	free(pipeline->stream);
+	OPENSSL_cleanse(pipeline, sizeof(pipeline_t));
+	pipeline->fd = -1;
+}
+
+
+/*
+ * Function:  PipelineWait
+ * --------------------
+ *  clears the eventfd the workers signal finished records on
+ *
+ *  pipeline:	the pipeline
+ *  block:	whether to wait for a worker to finish a record first
+ *
+ *  returns:	0 if successful, or -1 if an error occurred
+ */
+int PipelineWait(pipeline_t *pipeline, int block)
+{
+	struct pollfd ready;
+	uint64_t finished = 0;
+
+	ready.fd = pipeline->fd;
+	ready.events = POLLIN;
+	if(block && -1 == poll(&ready, 1, -1) && EINTR != errno)
+	{
+		return -1;
+	}
+
+	if(-1 == read(pipeline->fd, &finished, sizeof(finished)) && EAGAIN != errno && EINTR != errno)
+	{
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/*
+ * Function:  PipelineFlush
+ * --------------------
+ *  writes every sealed record that is next in sequence to the socket, as few
+ *  writev() calls as it takes, and frees their slots; the first record not
+ *  sealed yet stops it
+ *
+ *  pipeline:	the pipeline
+ *
+ *  returns:	0 if successful, or -1 if an error occurred
+ */
+int PipelineFlush(pipeline_t *pipeline)
+{
+	struct iovec vectors[PIPELINE_VECTORS];
+	pipeline_lane_t *lane = NULL;
+	pipeline_slot_t *slot = NULL;
+	uint64_t record = 0;
+	uint64_t position = 0;
+	ssize_t result = 0;
+	int count = 0;
+	int i = 0;
+
+	while(1)
+	{
+		count = 0;
+		for(record = pipeline->written; record < pipeline->sent && count < PIPELINE_VECTORS; ++record)
+		{
+			lane = &pipeline->workers[record % pipeline->count].seal;
+			position = record / pipeline->count;
+			if(position >= __atomic_load_n(&lane->done, __ATOMIC_ACQUIRE))
+			{
+				break;
+			}
+
+			slot = &lane->slots[position % PIPELINE_DEPTH];
+			if(-1 == slot->type)
+			{
+				printf("Error: A record failed to seal.\n");
+				return -1;
+			}
+			vectors[count].iov_base = slot->data;
+			vectors[count].iov_len = slot->length;
+			++count;
+		}
+
+		if(0 == count)
+		{
+			return 0;
+		}
+
+		/* the socket may have taken part of the first one already */
+		vectors[0].iov_base = (unsigned char *)vectors[0].iov_base + pipeline->written_bytes;
+		vectors[0].iov_len -= pipeline->written_bytes;
+
+		result = writev(pipeline->socket_fd, vectors, count);
+		if(-1 == result)
+		{
+			if(EINTR == errno)
+			{
+				continue;
+			}
+			return -1;
+		}
+
+		for(i = 0; i < count && (size_t)result >= vectors[i].iov_len; ++i)
+		{
+			result -= vectors[i].iov_len;
+			++pipeline->workers[pipeline->written % pipeline->count].seal.consumed;
+			++pipeline->written;
+			pipeline->written_bytes = 0;
+		}
+		pipeline->written_bytes += result;
+	}
+}
+
+
+/*
+ * Function:  PipelineSend
+ * --------------------
+ *  copies a record's content into the next worker's sealing lane and wakes
+ *  it; a full lane is first freed by writing the sealed records before its
+ *  oldest one, waiting for the workers as long as that takes
+ *
+ *  pipeline:	the pipeline
+ *  data:	the content
+ *  length:	its length, up to FRAME_BATCH_SIZE
+ *
+ *  returns:	0 if successful, or -1 if an error occurred
+ */
+int PipelineSend(pipeline_t *pipeline, const void *data, size_t length)
+{
+	pipeline_worker_t *worker = &pipeline->workers[pipeline->sent % pipeline->count];
+	pipeline_lane_t *lane = &worker->seal;
+	pipeline_slot_t *slot = NULL;
+
+	while(PIPELINE_DEPTH <= lane->submitted - lane->consumed)
+	{
+		if(-1 == PipelineFlush(pipeline))
+		{
+			return -1;
+		}
+		if(PIPELINE_DEPTH <= lane->submitted - lane->consumed && -1 == PipelineWait(pipeline, 1))
+		{
+			return -1;
+		}
+	}
+
+	slot = &lane->slots[lane->submitted % PIPELINE_DEPTH];
+	memcpy(slot->data + RECORD_HEADER_SIZE, data, length);
+	slot->length = length;
+	__atomic_store_n(&lane->submitted, lane->submitted + 1, __ATOMIC_SEQ_CST);
+	++pipeline->sent;
+
+	PipelineWake(worker);
+	return 0;
+}
+
+
+/*
+ * Function:  PipelineReceive
+ * --------------------
+ *  reads what the socket holds, without blocking, and hands every whole
+ *  record read to the next worker's opening lane while it has a free slot
+ *
+ *  pipeline:	the pipeline
+ *
+ *  returns:	0 if successful, 1 if whole records wait for a lane to free
+ *		a slot, or -1 if the peer closed the connection or an error
+ *		occurred
+ */
+int PipelineReceive(pipeline_t *pipeline)
+{
+	pipeline_worker_t *worker = NULL;
+	pipeline_lane_t *lane = NULL;
+	pipeline_slot_t *slot = NULL;
+	unsigned char *header = NULL;
+	ssize_t result = 0;
+	size_t offset = 0;
+	size_t length = 0;
+	int stalled = 0;
+
+	if(PIPELINE_STREAM_SIZE != pipeline->stream_length)
+	{
+		result = recv(pipeline->socket_fd, pipeline->stream + pipeline->stream_length,
+			      PIPELINE_STREAM_SIZE - pipeline->stream_length, MSG_DONTWAIT);
+		if(0 == result)
+		{
+			return -1;
+		}
+		if(-1 == result)
+		{
+			if(EAGAIN != errno && EWOULDBLOCK != errno && EINTR != errno)
+			{
+				return -1;
+			}
+			result = 0;
+		}
+		pipeline->stream_length += result;
+	}
+
+	while(RECORD_HEADER_SIZE <= pipeline->stream_length - offset)
+	{
+		header = pipeline->stream + offset;
+		length = RECORD_HEADER_SIZE + ((size_t)header[3] << 8 | header[4]);
+		if(RECORD_MAX_SIZE < length)
+		{
+			printf("Error: A record from the peer is too long.\n");
+			return -1;
+		}
+		if(length > pipeline->stream_length - offset)
+		{
+			break;
+		}
+
+		worker = &pipeline->workers[pipeline->received % pipeline->count];
+		lane = &worker->open;
+		if(PIPELINE_DEPTH <= lane->submitted - lane->consumed)
+		{
+			stalled = 1;
+			break;
+		}
+
+		slot = &lane->slots[lane->submitted % PIPELINE_DEPTH];
+		memcpy(slot->data, header, length);
+		slot->length = length;
+		__atomic_store_n(&lane->submitted, lane->submitted + 1, __ATOMIC_SEQ_CST);
+		++pipeline->received;
+		offset += length;
+		PipelineWake(worker);
+	}
+
+	memmove(pipeline->stream, pipeline->stream + offset, pipeline->stream_length - offset);
+	pipeline->stream_length -= offset;
+	return stalled;
+}
+
+
+/*
+ * Function:  PipelineNext
+ * --------------------
+ *  returns the application data of the next record in sequence once a
+ *  worker opened it; session tickets the peer sent late are skipped, any
+ *  other handshake message (a key update) can't be followed here
+ *
+ *  pipeline:	the pipeline
+ *  data:	set to the data, valid until PipelineRelease()
+ *  length:	set to its length
+ *
+ *  returns:	1 if there is a record, 0 if the next one isn't open yet, or
+ *		-1 if the peer closed the session or a record didn't open
+ */
+int PipelineNext(pipeline_t *pipeline, unsigned char **data, size_t *length)
+{
+	pipeline_lane_t *lane = NULL;
+	pipeline_slot_t *slot = NULL;
+	uint64_t position = 0;
+
+	while(pipeline->delivered < pipeline->received)
+	{
+		lane = &pipeline->workers[pipeline->delivered % pipeline->count].open;
+		position = pipeline->delivered / pipeline->count;
+		if(position >= __atomic_load_n(&lane->done, __ATOMIC_ACQUIRE))
+		{
+			return 0;
+		}
+
+		slot = &lane->slots[position % PIPELINE_DEPTH];
+		switch(slot->type)
+		{
+			case SSL3_RT_APPLICATION_DATA:
+				*data = slot->data + RECORD_HEADER_SIZE;
+				*length = slot->length;
+				return 1;
+			case SSL3_RT_HANDSHAKE:
+				if(0 != slot->length && SSL3_MT_NEWSESSION_TICKET == slot->data[RECORD_HEADER_SIZE])
+				{
+					PipelineRelease(pipeline);
+					continue;
+				}
+				printf("Error: The peer sent a handshake message the crypto pipeline can't follow.\n");
+				return -1;
+			case SSL3_RT_ALERT:
+				return -1;
+			default:
+				printf("Error: A record from the peer failed to open.\n");
+				return -1;
+		}
+	}
+
+	return 0;
+}
+
+
+/*
+ * Function:  PipelineRelease
+ * --------------------
+ *  frees the slot of the record PipelineNext() returned
+ *
+ *  pipeline:	the pipeline
+ *
+ *  returns:	no return value
+ */
+void PipelineRelease(pipeline_t *pipeline)
+{
+	++pipeline->workers[pipeline->delivered % pipeline->count].open.consumed;
+	++pipeline->delivered;
+}
@@ -0,0 +1,107 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stddef.h>		/* size_t 		*/
+#include <stdint.h>		/* uint64_t 		*/
+#include <pthread.h>		/* pthread_t 		*/
+#include <openssl/ssl.h>	/* SSL, EVP_CIPHER_CTX 	*/
+#include "record.h"		/* record_secrets_t 	*/
+
+#define PIPELINE_MAX_WORKERS 16
+#define PIPELINE_DEPTH 8					/* records in flight per worker and direction */
+#define PIPELINE_STREAM_SIZE (4 * RECORD_MAX_SIZE)		/* bytes read from the socket at most, whole records are handed out */
+#define PIPELINE_CACHE_LINE 64
+
+/* a record handed to a worker, sealed or opened in place */
+typedef struct pipeline_slot
+{
+	unsigned char data[RECORD_MAX_SIZE];
+	size_t length;			/* of the record, or once opened of its content, which starts RECORD_HEADER_SIZE in */
+	int type;			/* opened: the inner content type, or -1 if the record didn't open */
+} pipeline_slot_t;
+
+/*
+ * a single producer, single consumer ring of records between the I/O thread
+ * and one worker, both ways: the I/O thread fills slots and moves submitted
+ * on, the worker protects them in order and moves done on, and the I/O
+ * thread takes them back in order, which frees their slots
+ */
+typedef struct pipeline_lane
+{
+	pipeline_slot_t slots[PIPELINE_DEPTH];
+	uint64_t submitted __attribute__((aligned(PIPELINE_CACHE_LINE)));	/* written by the I/O thread */
+	uint64_t done __attribute__((aligned(PIPELINE_CACHE_LINE)));		/* written by the worker */
+	uint64_t consumed __attribute__((aligned(PIPELINE_CACHE_LINE)));	/* the I/O thread's own */
+} pipeline_lane_t;
+
+struct pipeline;
+
+/* a crypto worker, its own AEAD contexts and a lane each way */
+typedef struct pipeline_worker
+{
+	pipeline_lane_t seal;
+	pipeline_lane_t open;
+	EVP_CIPHER_CTX *sealer;
+	EVP_CIPHER_CTX *opener;
+	int wake_fd;			/* eventfd the worker sleeps on while its lanes are empty */
+	int idle;			/* set while it sleeps or is about to, a submission has to wake it */
+	size_t index;			/* the worker takes the records whose sequence numbers are index modulo the workers */
+	struct pipeline *pipeline;
+	pthread_t thread;
+	int started;
+} pipeline_worker_t;
+
+/*
+ * takes the record layer of an established TLS 1.3 session off OpenSSL and
+ * spreads it over a pool of crypto workers: the I/O thread hands the records
+ * out round-robin, record n to worker n modulo the workers, each worker
+ * seals or opens its records with the sequence number that follows from
+ * their position, and the I/O thread takes them back in the order they were
+ * handed out, so records go to the socket and to the endpoint in sequence
+ */
+typedef struct pipeline
+{
+	int fd;				/* eventfd, readable whenever a worker finished a record, -1 unless started */
+	int socket_fd;
+	int running;
+	size_t count;			/* workers */
+	pipeline_worker_t *workers;
+	unsigned char seal_iv[RECORD_IV_SIZE];
+	unsigned char open_iv[RECORD_IV_SIZE];
+	uint64_t seal_base;		/* the sequence number of the first record sealed here */
+	uint64_t open_base;		/* and of the first record opened here */
+	uint64_t sent;			/* records handed out to be sealed */
+	uint64_t written;		/* sealed records the socket took */
+	size_t written_bytes;		/* of the next sealed record, when the socket took part of it */
+	uint64_t received;		/* records handed out to be opened */
+	uint64_t delivered;		/* opened records taken back */
+	unsigned char *stream;		/* bytes read from the socket that aren't a record handed out yet */
+	size_t stream_length;
+} pipeline_t;
+
+
+/* takes the record layer of an established TLS 1.3 session over with a number of workers */
+int PipelineStart(pipeline_t *pipeline, SSL *ssl, const record_secrets_t *secrets, int socket_fd, size_t count);
+
+/* stops the workers and releases everything, the session can't be used any more */
+void PipelineStop(pipeline_t *pipeline);
+
+/* hands a record's content to a worker to be sealed, writing older records first when its lane is full */
+int PipelineSend(pipeline_t *pipeline, const void *data, size_t length);
+
+/* writes the sealed records that are next in sequence to the socket */
+int PipelineFlush(pipeline_t *pipeline);
+
+/* reads from the socket and hands the whole records to the workers to be opened */
+int PipelineReceive(pipeline_t *pipeline);
+
+/* returns the application data of the next opened record in sequence, if it is done */
+int PipelineNext(pipeline_t *pipeline, unsigned char **data, size_t *length);
+
+/* frees the record PipelineNext() returned */
+void PipelineRelease(pipeline_t *pipeline);
+
+/* clears pipeline->fd, first waiting for a worker to finish a record if block is set */
+int PipelineWait(pipeline_t *pipeline, int block);
+
+#endif  /* PIPELINE_H */
@@ -0,0 +1,248 @@
+#include "pmtu.h"
+#include <string.h>		/* memcpy, memset 	*/
+#include <arpa/inet.h>		/* htons 		*/
+#include <netinet/ip.h>	/* iphdr, IP_DF 	*/
+#include <netinet/ip_icmp.h>	/* icmphdr 		*/
+
+#define PROBE_TIMEOUT 1000				/* milliseconds a probe's echo may take */
+#define PROBE_ATTEMPTS 3				/* probes of a size before it counts as lost */
+#define RESOLUTION 8					/* the search stops once the range is this narrow */
+#define SEARCH_INTERVAL 600000				/* milliseconds between searches, RFC 8899's PMTU_RAISE_TIMER */
+
+
+/*
+ * Function:  PmtuSearchInit
+ * --------------------
+ *  starts a search for the largest tunnel MTU up to a maximum; until it
+ *  settles, the tunnel MTU is PMTU_DEFAULT (or the maximum, if smaller)
+ *
+ *  search:	the search
+ *  maximum:	the largest tunnel MTU to probe for, at least PMTU_MIN
+ *  now:	the time (monotonic milliseconds)
+ *
+ *  returns:	no return value
+ */
+void PmtuSearchInit(pmtu_search_t *search, size_t maximum, uint64_t now)
+{
+	search->maximum = maximum;
+	search->mtu = maximum < PMTU_DEFAULT ? maximum : PMTU_DEFAULT;
+	search->low = PMTU_MIN;
+	search->high = maximum + 1;
+	search->probe = 0;
+	search->attempts = 0;
+	search->deadline = now;
+}
+
+
+/*
+ * Function:  Settle
+ * --------------------
+ *  ends a search on the largest size that passed, until the next one
+ *
+ *  search:	the search
+ *  now:	the time (monotonic milliseconds)
+ *
+ *  returns:	no return value
+ */
+static void Settle(pmtu_search_t *search, uint64_t now)
+{
+	search->mtu = search->low;
+	search->probe = 0;
+	search->deadline = now + SEARCH_INTERVAL;
+}
+
+
+/*
+ * Function:  PmtuSearchNext
+ * --------------------
+ *  moves a search on once its deadline passed: a probe without an echo is
+ *  sent again, or after PROBE_ATTEMPTS counts as lost and lowers the range;
+ *  a settled search starts over
+ *
+ *  search:	the search
+ *  now:	the time (monotonic milliseconds)
+ *
+ *  returns:	the size of the probe to send, or 0 if none is due
+ */
+size_t PmtuSearchNext(pmtu_search_t *search, uint64_t now)
+{
+	if(0 == search->maximum || now < search->deadline)
+	{
+		return 0;
+	}
+
+	if(0 != search->probe)
+	{
+		if(search->attempts < PROBE_ATTEMPTS)
+		{
+			++search->attempts;
+			search->deadline = now + PROBE_TIMEOUT;
+			return search->probe;
+		}
+		search->high = search->probe;
+		search->probe = 0;
+	}
+	else if(search->low + RESOLUTION >= search->high)
+	{
+		/* the path may take more (or less) by now */
+		search->low = PMTU_MIN;
+		search->high = search->maximum + 1;
+	}
+
+	if(search->low + RESOLUTION >= search->high)
+	{
+		Settle(search, now);
+		return 0;
+	}
+
+	/* the maximum first, most paths take it */
+	search->probe = search->high > search->maximum ? search->maximum : (search->low + search->high) / 2;
+	search->attempts = 1;
+	search->deadline = now + PROBE_TIMEOUT;
+	return search->probe;
+}
+
+
+/*
+ * Function:  PmtuSearchAcked
+ * --------------------
+ *  raises a search's range to a size the peer echoed; the next probe is
+ *  due at once, unless the range is narrow enough to settle on
+ *
+ *  search:	the search
+ *  size:	the echoed probe's size
+ *  now:	the time (monotonic milliseconds)
+ *
+ *  returns:	no return value
+ */
+void PmtuSearchAcked(pmtu_search_t *search, size_t size, uint64_t now)
+{
+	/* a late echo of a size already given up on still passed */
+	if(0 == search->maximum || size <= search->low || size >= search->high)
+	{
+		return;
+	}
+
+	search->low = size;
+	if(search->probe <= size)
+	{
+		search->probe = 0;
+		search->deadline = now;
+	}
+
+	if(0 == search->probe && search->low + RESOLUTION >= search->high)
+	{
+		Settle(search, now);
+	}
+}
+
+
+/*
+ * Function:  Checksum
+ * --------------------
+ *  computes the Internet checksum (RFC 1071)
+ *
+ *  data:	the bytes
+ *  length:	their count
+ *
+ *  returns:	the checksum, in network order
+ */
+static uint16_t Checksum(const void *data, size_t length)
+{
+	const unsigned char *bytes = data;
+	uint32_t sum = 0;
+
+	for(; length > 1; bytes += 2, length -= 2)
+	{
+		sum += (bytes[0] << 8) | bytes[1];
+	}
+	if(1 == length)
+	{
+		sum += bytes[0] << 8;
+	}
+
+	while(sum >> 16)
+	{
+		sum = (sum & 0xffff) + (sum >> 16);
+	}
+
+	return htons((uint16_t)~sum);
+}
+
+
+/*
+ * Function:  PmtuFragmentationNeeded
+ * --------------------
+ *  builds the ICMP 'fragmentation needed' error (type 3, code 4, RFC 1191)
+ *  a router sends for an IPv4 packet larger than the next hop's MTU that may
+ *  not be fragmented; it comes from the packet's destination, the tunnel
+ *  endpoint, and quotes as much of the packet as fits PMTU_ICMP_SIZE
+ *
+ *  no error is built for packets that fit or may be fragmented, for later
+ *  fragments, for ICMP errors and for sources that aren't a single host
+ *
+ *  packet:	the IPv4 packet
+ *  length:	packet length
+ *  mtu:	the MTU it exceeds
+ *  reply:	where the error goes, PMTU_ICMP_SIZE bytes
+ *
+ *  returns:	the error's length, or 0 if the packet gets none
+ */
+size_t PmtuFragmentationNeeded(const unsigned char *packet, size_t length, size_t mtu, unsigned char *reply)
+{
+	const struct iphdr *original = (const struct iphdr *)packet;
+	struct iphdr *header = (struct iphdr *)reply;
+	struct icmphdr *icmp = (struct icmphdr *)(reply + sizeof(struct iphdr));
+	size_t header_length = 0;
+	size_t quoted = 0;
+	uint8_t type = 0;
+
+	if(length <= mtu || length < sizeof(struct iphdr) || 4 != original->version)
+	{
+		return 0;
+	}
+
+	if(!(ntohs(original->frag_off) & IP_DF) || 0 != (ntohs(original->frag_off) & IP_OFFMASK))
+	{
+		return 0;
+	}
+
+	header_length = original->ihl * 4;
+	if(IPPROTO_ICMP == original->protocol && length > header_length)
+	{
+		type = packet[header_length];
+		if(ICMP_DEST_UNREACH == type || ICMP_SOURCE_QUENCH == type || ICMP_REDIRECT == type ||
+		   ICMP_TIME_EXCEEDED == type || ICMP_PARAMETERPROB == type)
+		{
+			return 0;
+		}
+	}
+
+	type = packet[12];						/* the source's first byte */
+	if(0 == type || 224 <= type)
+	{
+		return 0;
+	}
+
+	quoted = PMTU_ICMP_SIZE - sizeof(struct iphdr) - sizeof(struct icmphdr);
+	quoted = length < quoted ? length : quoted;
+
+	memset(reply, 0, sizeof(struct iphdr) + sizeof(struct icmphdr));
+	header->version = 4;
+	header->ihl = sizeof(struct iphdr) / 4;
+	header->tos = IPTOS_PREC_INTERNETCONTROL;
+	header->tot_len = htons(sizeof(struct iphdr) + sizeof(struct icmphdr) + quoted);
+	header->ttl = IPDEFTTL;
+	header->protocol = IPPROTO_ICMP;
+	header->saddr = original->daddr;
+	header->daddr = original->saddr;
+	header->check = Checksum(header, sizeof(struct iphdr));
+
+	icmp->type = ICMP_DEST_UNREACH;
+	icmp->code = ICMP_FRAG_NEEDED;
+	icmp->un.frag.mtu = htons((uint16_t)mtu);
+	memcpy(reply + sizeof(struct iphdr) + sizeof(struct icmphdr), packet, quoted);
+	icmp->checksum = Checksum(icmp, sizeof(struct icmphdr) + quoted);
+
+	return sizeof(struct iphdr) + sizeof(struct icmphdr) + quoted;
+}
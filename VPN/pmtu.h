@@ -0,0 +1,51 @@
+#ifndef PMTU_H
+#define PMTU_H
+
+#include <stddef.h>		/* size_t 	*/
+#include <stdint.h>		/* uint64_t 	*/
+
+#define PMTU_MIN 576					/* every IPv4 host takes 576 byte datagrams */
+#define PMTU_DEFAULT 1400				/* the tunnel MTU until a search settles */
+#define PMTU_MAX 9000					/* jumbo frames */
+#define PMTU_ICMP_SIZE 576				/* largest ICMP error, as routers send them */
+
+/*
+ * a path MTU search (packetization layer PMTUD, RFC 8899): probes of a
+ * candidate tunnel MTU are sent through the tunnel and echoed by the peer,
+ * the maximum is tried first and a lost probe (after a few attempts) halves
+ * the range the next one is taken from; the search runs again every so often
+ * in case the path changed
+ *
+ *  maximum:	the largest tunnel MTU probed for, 0 if no search runs
+ *  mtu:	the tunnel MTU in use, the result of the last search
+ *  low:	the largest size known to pass
+ *  high:	the smallest size known not to pass, maximum + 1 before any was lost
+ *  probe:	the size of the probe in flight, 0 if none
+ *  attempts:	times it was sent
+ *  deadline:	when the probe counts as lost, or the next search starts (monotonic milliseconds)
+ */
+typedef struct pmtu_search
+{
+	size_t maximum;
+	size_t mtu;
+	size_t low;
+	size_t high;
+	size_t probe;
+	int attempts;
+	uint64_t deadline;
+} pmtu_search_t;
+
+
+/* starts a search up to a maximum, the first probe is due at once */
+void PmtuSearchInit(pmtu_search_t *search, size_t maximum, uint64_t now);
+
+/* returns the size of a probe to send now or 0 if none is due, search->deadline is when to call again */
+size_t PmtuSearchNext(pmtu_search_t *search, uint64_t now);
+
+/* counts an echoed probe, search->mtu changes once the search settles */
+void PmtuSearchAcked(pmtu_search_t *search, size_t size, uint64_t now);
+
+/* builds the ICMP 'fragmentation needed' error for an IPv4 packet over the MTU, returns 0 if it gets none */
+size_t PmtuFragmentationNeeded(const unsigned char *packet, size_t length, size_t mtu, unsigned char *reply);
+
+#endif  /* PMTU_H */
@@ -0,0 +1,168 @@
+#include <string.h>	/* memset */
+#include "pmtu.h"
+#include "utilities.h"
+
+#define RESOLUTION 8		/* as in pmtu.c */
+#define PROBE_ATTEMPTS 3
+#define SEARCH_INTERVAL 600000
+#define MAX_PROBES 40		/* a search of 576 to 9000 halves its range about 11 times */
+
+/*
+ * runs a search over a path that echoes the probes up to a size and drops the
+ * larger ones without a word, until it settles; returns the tunnel MTU found
+ */
+static size_t Converge(pmtu_search_t *search, size_t path, uint64_t *now, int *probes)
+{
+	size_t size = 0;
+
+	for(*probes = 0; MAX_PROBES >= *probes; )
+	{
+		size = PmtuSearchNext(search, *now);
+		if(0 != size)
+		{
+			++*probes;
+			if(size <= path)
+			{
+				*now += 20;
+				PmtuSearchAcked(search, size, *now);
+			}
+		}
+
+		/* settled until the next search */
+		if(0 == search->probe && search->deadline > *now)
+		{
+			return search->mtu;
+		}
+		*now = search->deadline > *now ? search->deadline : *now;
+	}
+
+	return 0;
+}
+
+/* checksums a header the way a receiver verifies it, 0 if it is intact */
+static unsigned int Verify(const unsigned char *bytes, size_t length)
+{
+	unsigned int sum = 0;
+
+	for(; length > 1; bytes += 2, length -= 2)
+	{
+		sum += (bytes[0] << 8) | bytes[1];
+	}
+	while(sum >> 16)
+	{
+		sum = (sum & 0xffff) + (sum >> 16);
+	}
+
+	return 0xffff & ~sum;
+}
+
+int main()
+{
+	static const size_t paths[] = {PMTU_MIN + RESOLUTION, 1280, 1400, 1500, 4000, 8999};
+	pmtu_search_t search;
+	unsigned char packet[1500];
+	unsigned char reply[PMTU_ICMP_SIZE];
+	uint64_t now = 1000;
+	size_t mtu = 0;
+	size_t i = 0;
+	int probes = 0;
+	int converged = 1;
+
+
+	/***** PmtuSearchNext - convergence *****/
+	printf("\n\n----- PmtuSearchNext - convergence -----\n\n");
+	PmtuSearchInit(&search, PMTU_MAX, now);
+	TESTS(PMTU_DEFAULT == search.mtu);
+
+	/* the maximum passes: one probe and the search settles on it */
+	TESTS(PMTU_MAX == Converge(&search, PMTU_MAX, &now, &probes));
+	TESTS(1 == probes);
+
+	/* every path settles within the resolution, never above it */
+	for(i = 0; i < sizeof(paths) / sizeof(paths[0]); ++i)
+	{
+		PmtuSearchInit(&search, PMTU_MAX, now);
+		mtu = Converge(&search, paths[i], &now, &probes);
+		converged &= mtu <= paths[i] && mtu + RESOLUTION >= paths[i] && MAX_PROBES > probes;
+	}
+	TESTS(1 == converged);
+
+	/* a settled search sends nothing until it runs again */
+	TESTS(0 == PmtuSearchNext(&search, now + SEARCH_INTERVAL - 1));
+
+	/* the path grew meanwhile, the next search finds it */
+	now += SEARCH_INTERVAL;
+	mtu = Converge(&search, 9000, &now, &probes);
+	TESTS(PMTU_MAX == mtu);
+
+	/* and shrank */
+	now += SEARCH_INTERVAL;
+	mtu = Converge(&search, 1400, &now, &probes);
+	TESTS(1400 >= mtu && 1400 - RESOLUTION <= mtu);
+
+	/* a maximum below the default is the MTU until the search settles */
+	PmtuSearchInit(&search, 1200, now);
+	TESTS(1200 == search.mtu);
+
+	/* no maximum, no search */
+	PmtuSearchInit(&search, 0, now);
+	TESTS(0 == PmtuSearchNext(&search, now));
+
+
+	/***** PmtuSearchNext - black holes *****/
+	printf("\n\n----- PmtuSearchNext - black holes -----\n\n");
+	PmtuSearchInit(&search, 1500, now);
+
+	/* a lost probe is sent PROBE_ATTEMPTS times, once per timeout */
+	TESTS(1500 == PmtuSearchNext(&search, now));
+	TESTS(0 == PmtuSearchNext(&search, now + 1));
+	TESTS(1500 == PmtuSearchNext(&search, search.deadline));
+	TESTS(1500 == PmtuSearchNext(&search, search.deadline));
+	now = search.deadline;
+
+	/* then a smaller one is tried */
+	mtu = PmtuSearchNext(&search, now);
+	TESTS(PMTU_MIN < mtu && 1500 > mtu);
+	TESTS(1500 == search.high);
+
+	/* a late echo of the size given up on doesn't count */
+	PmtuSearchAcked(&search, 1500, now);
+	TESTS(PMTU_MIN == search.low);
+
+	/* a path that drops every probe settles on the size every host takes */
+	mtu = Converge(&search, 0, &now, &probes);
+	TESTS(PMTU_MIN == mtu);
+	TESTS(MAX_PROBES > probes);
+
+	/* and searches again later */
+	now += SEARCH_INTERVAL;
+	TESTS(1500 == PmtuSearchNext(&search, now));
+
+
+	/***** PmtuFragmentationNeeded *****/
+	printf("\n\n----- PmtuFragmentationNeeded -----\n\n");
+	memset(packet, 0, sizeof(packet));
+	packet[0] = 0x45;
+	packet[2] = sizeof(packet) >> 8;
+	packet[3] = sizeof(packet) & 0xff;
+	packet[6] = 0x40;		/* don't fragment */
+	packet[9] = 6;
+	packet[12] = 10;
+	packet[15] = 2;
+	packet[16] = 8;
+	packet[19] = 8;
+
+	TESTS(PMTU_ICMP_SIZE == PmtuFragmentationNeeded(packet, sizeof(packet), 1400, reply));
+	TESTS(3 == reply[20] && 4 == reply[21]);
+	TESTS(1400 == ((reply[26] << 8) | reply[27]));
+	TESTS(8 == reply[12] && 10 == reply[16] && 2 == reply[19]);
+	TESTS(0 == Verify(reply, 20) && 0 == Verify(reply + 20, PMTU_ICMP_SIZE - 20));
+
+	/* packets that fit, or may be fragmented, get none */
+	TESTS(0 == PmtuFragmentationNeeded(packet, sizeof(packet), 1500, reply));
+	packet[6] = 0;
+	TESTS(0 == PmtuFragmentationNeeded(packet, sizeof(packet), 1400, reply));
+
+
+	return 0 != failures;
+}
@@ -0,0 +1,1469 @@
+#include "pump.h"
+#include "offload.h"		/* OffloadSegment 	*/
+#include <stdio.h>		/* printf 		*/
+#include <stdlib.h>		/* calloc, malloc, free */
+#include <string.h>		/* memset 		*/
+#include <unistd.h>		/* read, write 		*/
+#include <fcntl.h>		/* fcntl 		*/
+#include <errno.h>		/* EAGAIN 		*/
+#include <time.h>		/* clock_gettime 	*/
+#include <arpa/inet.h>		/* htons 		*/
+#include <netinet/in.h>	/* IP_MTU_DISCOVER 	*/
+#include <sys/select.h>	/* select 		*/
+#include <sys/timerfd.h>	/* timerfd_create 	*/
+#include <linux/virtio_net.h>	/* virtio_net_hdr 	*/
+
+#define DEFAULT_MTU 1500				/* the largest packet read until PumpSetMtu() */
+#define URING_TAG_SOCKET RING_SLOTS			/* endpoint reads are tagged with their slot */
+#define URING_TAG_TIMER (RING_SLOTS + 1)
+#define URING_TAG_KEEPALIVE (RING_SLOTS + 2)
+#define URING_TAG_PIPELINE (RING_SLOTS + 3)
+
+
+/*		
+ * Function:  PumpInit 
+ * --------------------
+ *  initializes a pump over an established session
+ *
+ *  pump:		the pump
+ *  endpoint_fd:	the packet endpoint, or -1 to set pump->endpoint_fd later
+ *  socket_fd:		the socket connected to the peer
+ *  ssl:		the session with the peer
+ *  datagram:		whether the session runs over DTLS
+ *  traffic:		the counters the pump's traffic is added to
+ *
+ *  returns:		no return value
+ */
+void PumpInit(pump_t *pump, int endpoint_fd, int socket_fd, SSL *ssl, int datagram, traffic_counters_t *traffic)
+{
+	pump->endpoint_fd = endpoint_fd;
+	pump->socket_fd = socket_fd;
+	pump->ssl = ssl;
+	pump->datagram = datagram;
+	pump->kernel_send = !datagram && BIO_get_ktls_send(SSL_get_wbio(ssl));
+	pump->traffic = traffic;
+	FrameBatchReset(&pump->outgoing);
+	DeframerInit(&pump->incoming);
+
+	memset(&pump->packets, 0, sizeof(packet_ring_t));
+	memset(&pump->inbound, 0, sizeof(packet_ring_t));
+	memset(&pump->outbound, 0, sizeof(packet_ring_t));
+	memset(&pump->uring, 0, sizeof(uring_t));
+	pump->uring.fd = -1;
+	CompressorInit(&pump->compressor, COMPRESS_OFF);
+
+	pump->mtu = DEFAULT_MTU;
+	memset(&pump->pmtu, 0, sizeof(pmtu_search_t));
+	pump->timer_fd = -1;
+	pump->probe = NULL;
+	pump->mtu_changed = NULL;
+	pump->mtu_arg = NULL;
+	pump->offload = 0;
+	pump->offload_peer = 0;
+	pump->segment = NULL;
+	pump->keepalive_fd = -1;
+	pump->keepalive_limit = 0;
+	pump->silent_intervals = 0;
+	pump->seen_rx_records = 0;
+	pump->seen_tx_records = 0;
+	memset(&pump->pipeline, 0, sizeof(pipeline_t));
+	pump->pipeline.fd = -1;
+}
+
+
+/*		
+ * Function:  PumpNow 
+ * --------------------
+ *  reads the monotonic clock
+ *
+ *  returns:		the time in milliseconds
+ */
+static uint64_t PumpNow()
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+
+/*		
+ * Function:  PumpWrite 
+ * --------------------
+ *  sends data to the peer in a record of its own, through the pipeline once
+ *  it took the session over
+ *
+ *  pump:		the pump
+ *  data:		the data
+ *  length:		its length, up to FRAME_BATCH_SIZE
+ *
+ *  returns:		0 if successful, or -1 if an error occurred
+ */
+static int PumpWrite(pump_t *pump, const void *data, size_t length)
+{
+	if(-1 != pump->pipeline.fd)
+	{
+		return PipelineSend(&pump->pipeline, data, length);
+	}
+
+	return 0 < SSL_write(pump->ssl, data, length) ? 0 : -1;
+}
+
+
+/*		
+ * Function:  PumpUseRings 
+ * --------------------
+ *  allocates the datagram rings and moves the established SSL/DTLS session from
+ *  its datagram socket BIO to a BIO on them, so bursts of datagrams are sent and
+ *  received with one system call each
+ *
+ *  pump:		the pump
+ *
+ *  returns:		0 if successful, or -1 if an error occurred
+ */
+int PumpUseRings(pump_t *pump)
+{
+	BIO *bio = NULL;
+
+	if(-1 == PacketRingInit(&pump->packets, -1) ||
+	   -1 == PacketRingInit(&pump->inbound, -1) ||
+	   -1 == PacketRingInit(&pump->outbound, pump->socket_fd))
+	{
+		return -1;
+	}
+
+	bio = PacketRingBioNew(&pump->outbound, NULL);
+	if(NULL == bio)
+	{
+		return -1;
+	}
+
+	SSL_set_bio(pump->ssl, bio, bio);
+	return 0;
+}
+
+
+/*		
+ * Function:  PumpUseCompression 
+ * --------------------
+ *  compresses the packets sent from now on, once the peer said it restores
+ *  FRAME_FLAG_COMPRESSED packets (compressed packets are always accepted)
+ *
+ *  pump:		the pump
+ *  mode:		when to compress
+ *
+ *  returns:		no return value
+ */
+void PumpUseCompression(pump_t *pump, compress_mode_t mode)
+{
+	CompressorInit(&pump->compressor, mode);
+}
+
+
+/*		
+ * Function:  PumpSetMtu 
+ * --------------------
+ *  sets the tunnel MTU, which is what a read from the endpoint takes at most
+ *
+ *  pump:		the pump
+ *  mtu:		the tunnel MTU
+ *
+ *  returns:		no return value
+ */
+void PumpSetMtu(pump_t *pump, size_t mtu)
+{
+	pump->mtu = mtu;
+}
+
+
+/*		
+ * Function:  PumpSendMtu 
+ * --------------------
+ *  tells the peer the tunnel MTU, the largest packet it may send through
+ *  the tunnel, with a FRAME_MTU of its own
+ *
+ *  pump:		the pump
+ *
+ *  returns:		0 if successful, or -1 if an error occurred
+ */
+int PumpSendMtu(pump_t *pump)
+{
+	unsigned char frame[FRAME_HEADER_SIZE + MTU_PAYLOAD_SIZE];
+	uint16_t mtu = htons((uint16_t)pump->mtu);
+
+	FrameWriteHeader(frame, FRAME_MTU, 0, MTU_PAYLOAD_SIZE);
+	memcpy(frame + FRAME_HEADER_SIZE, &mtu, MTU_PAYLOAD_SIZE);
+	if(-1 == PumpWrite(pump, frame, sizeof(frame)))
+	{
+		STATS_ADD(pump->traffic->errors, 1);
+		return -1;
+	}
+
+	if(pump->datagram)
+	{
+		PacketRingSend(&pump->outbound);
+	}
+	return 0;
+}
+
+
+/*		
+ * Function:  PumpUsePathMtu 
+ * --------------------
+ *  searches the path of a DTLS session for the largest tunnel MTU up to a
+ *  maximum, with probes the peer echoes (pmtu.h); the socket sends every
+ *  datagram unfragmented whatever the kernel learnt about the path, so a
+ *  probe too large for it is lost rather than fragmented
+ *
+ *  pump:		the pump, with its rings
+ *  maximum:		the largest tunnel MTU, the peer's and the client's MTU
+ *  changed:		called with the new tunnel MTU whenever the search moves it
+ *  arg:		passed to changed()
+ *
+ *  returns:		0 if successful, or -1 if an error occurred
+ */
+int PumpUsePathMtu(pump_t *pump, size_t maximum, void (*changed)(size_t mtu, void *arg), void *arg)
+{
+	int discover = IP_PMTUDISC_PROBE;
+
+	pump->probe = calloc(1, FRAME_HEADER_SIZE + maximum);
+	pump->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+	if(NULL == pump->probe || -1 == pump->timer_fd ||
+	   -1 == setsockopt(pump->socket_fd, IPPROTO_IP, IP_MTU_DISCOVER, &discover, sizeof(discover)))
+	{
+		return -1;
+	}
+
+	PmtuSearchInit(&pump->pmtu, maximum, PumpNow());
+	pump->mtu = pump->pmtu.mtu;
+	pump->mtu_changed = changed;
+	pump->mtu_arg = arg;
+	return 0;
+}
+
+
+/*		
+ * Function:  PumpUseOffload 
+ * --------------------
+ *  reads and writes the endpoint's packets behind a virtio_net_hdr, for a TUN
+ *  device opened with IFF_VNET_HDR and its offloads enabled (offload.h):
+ *  super-packets read from it are framed whole for a peer that takes them,
+ *  or cut into plain packets at the tunnel boundary otherwise; packets read
+ *  go through the packet ring, whose slots take a whole super-packet
+ *
+ *  pump:		the pump
+ *  peer:		whether the peer takes FRAME_FLAG_OFFLOAD packets
+ *
+ *  returns:		0 if successful, or -1 if an error occurred
+ */
+int PumpUseOffload(pump_t *pump, int peer)
+{
+	if(NULL == pump->packets.slots && -1 == PacketRingInit(&pump->packets, -1))
+	{
+		return -1;
+	}
+
+	pump->segment = malloc(FRAME_HEADER_SIZE + PMTU_MAX);
+	if(NULL == pump->segment)
+	{
+		return -1;
+	}
+
+	pump->offload = 1;
+	pump->offload_peer = peer;
+	return 0;
+}
+
+
+/*		
+ * Function:  PumpUseKeepalive 
+ * --------------------
+ *  checks on the tunnel every keepalive interval: a peer that was sent no
+ *  record during the interval is sent a FRAME_KEEPALIVE, and one that sent
+ *  no record for the timeout (in whole intervals) counts as gone; the checks
+ *  only compare the traffic counters, the packets pay nothing for them
+ *
+ *  pump:		the pump
+ *  interval:		seconds between checks
+ *  timeout:		seconds the peer may stay silent
+ *
+ *  returns:		0 if successful, or -1 if an error occurred
+ */
+int PumpUseKeepalive(pump_t *pump, int interval, int timeout)
+{
+	struct itimerspec timer;
+
+	pump->keepalive_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+	if(-1 == pump->keepalive_fd)
+	{
+		return -1;
+	}
+
+	memset(&timer, 0, sizeof(timer));
+	timer.it_value.tv_sec = interval;
+	timer.it_interval.tv_sec = interval;
+	if(-1 == timerfd_settime(pump->keepalive_fd, 0, &timer, NULL))
+	{
+		return -1;
+	}
+
+	pump->keepalive_limit = (timeout + interval - 1) / interval;
+	pump->silent_intervals = 0;
+	pump->seen_rx_records = STATS_GET(pump->traffic->rx_records);
+	pump->seen_tx_records = STATS_GET(pump->traffic->tx_records);
+	return 0;
+}
+
+
+/*		
+ * Function:  PumpUsePipeline 
+ * --------------------
+ *  moves the record layer of a TLS 1.3 session onto a pool of crypto workers
+ *  (pipeline.h), so a single tunnel seals and opens records on more than one
+ *  core while the pump's thread only reads, writes and frames; the session
+ *  is left in step with nothing, it must not send a close_notify
+ *
+ *  pump:		the pump, over TLS in user space
+ *  secrets:		what RecordTrack() collected of the session
+ *  workers:		crypto workers, up to PIPELINE_MAX_WORKERS
+ *
+ *  returns:		0 if successful, or -1 if the session can't be taken over
+ *			(e.g. TLS 1.2) or an error occurred
+ */
+int PumpUsePipeline(pump_t *pump, const record_secrets_t *secrets, size_t workers)
+{
+	int result = 0;
+	size_t room = 0;
+	unsigned char *space = NULL;
+
+	if(pump->datagram || pump->kernel_send || BIO_get_ktls_recv(SSL_get_rbio(pump->ssl)))
+	{
+		return -1;
+	}
+
+	/* what the session decrypted and nobody read yet goes to the deframer, bytes it read ahead can't be taken over */
+	while(0 < SSL_pending(pump->ssl))
+	{
+		space = DeframerSpace(&pump->incoming, &room);
+		result = SSL_read(pump->ssl, space, room);
+		if(0 >= result)
+		{
+			return -1;
+		}
+		DeframerCommit(&pump->incoming, result);
+	}
+
+	if(SSL_has_pending(pump->ssl) || -1 == PipelineStart(&pump->pipeline, pump->ssl, secrets, pump->socket_fd, workers))
+	{
+		return -1;
+	}
+
+	SSL_set_shutdown(pump->ssl, SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN);
+	return 0;
+}
+
+
+/*		
+ * Function:  PumpUseUring 
+ * --------------------
+ *  sets up the io_uring PumpRun() waits on, with the packet ring as its
+ *  registered buffer
+ *
+ *  pump:		the pump, with its endpoint set
+ *
+ *  returns:		0 if successful, or -1 if io_uring is unavailable
+ */
+int PumpUseUring(pump_t *pump)
+{
+	if(-1 == UringInit(&pump->uring, URING_ENTRIES))
+	{
+		return -1;
+	}
+
+	if(NULL == pump->packets.slots && -1 == PacketRingInit(&pump->packets, -1))
+	{
+		UringDestroy(&pump->uring);
+		return -1;
+	}
+
+	/* io_uring only waits for data on blocking files */
+	fcntl(pump->endpoint_fd, F_SETFL, fcntl(pump->endpoint_fd, F_GETFL) & ~O_NONBLOCK);
+	UringRegisterBuffer(&pump->uring, pump->packets.slots, RING_SLOTS * RING_SLOT_SIZE);
+	return 0;
+}
+
+
+/*		
+ * Function:  PumpDestroy 
+ * --------------------
+ *  releases the pump's io_uring, rings, path MTU search, segment buffer,
+ *  keepalive timer and pipeline, the session and the descriptors stay with
+ *  the caller
+ *
+ *  pump:		the pump
+ *
+ *  returns:		no return value
+ */
+void PumpDestroy(pump_t *pump)
+{
+	UringDestroy(&pump->uring);
+	PacketRingDestroy(&pump->packets);
+	PacketRingDestroy(&pump->inbound);
+	PacketRingDestroy(&pump->outbound);
+
+	if(-1 != pump->timer_fd)
+	{
+		close(pump->timer_fd);
+		pump->timer_fd = -1;
+	}
+	free(pump->probe);
+	pump->probe = NULL;
+	free(pump->segment);
+	pump->segment = NULL;
+
+	if(-1 != pump->keepalive_fd)
+	{
+		close(pump->keepalive_fd);
+		pump->keepalive_fd = -1;
+	}
+
+	if(-1 != pump->pipeline.fd)
+	{
+		PipelineStop(&pump->pipeline);
+	}
+}
+
+
+/*		
+ * Function:  PumpWriteBatch 
+ * --------------------
+ *  sends a batch of frames to the peer as a single TLS record, handing it
+ *  to the kernel as it is when the kernel encrypts for the socket (kTLS),
+ *  or to a crypto worker when the pipeline took the session over
+ *
+ *  pump:		the pump
+ *  batch:		the batch
+ *
+ *  returns:		0 if successful, or -1 if an error occurred
+ */
+static int PumpWriteBatch(pump_t *pump, const frame_batch_t *batch)
+{
+	int short_writes = 0;
+
+	if(pump->kernel_send)
+	{
+		short_writes = FrameBatchWrite(batch, pump->socket_fd);
+		if(-1 == short_writes)
+		{
+			STATS_ADD(pump->traffic->errors, 1);
+			return -1;
+		}
+		STATS_ADD(pump->traffic->short_writes, short_writes);
+	}
+	else if(-1 == PumpWrite(pump, batch->data, batch->length))
+	{
+		STATS_ADD(pump->traffic->errors, 1);
+		return -1;
+	}
+
+	STATS_ADD(pump->traffic->tx_records, 1);
+	return 0;
+}
+
+
+/*		
+ * Function:  PumpCompress 
+ * --------------------
+ *  compresses a packet in place before it is framed, if that pays off
+ *
+ *  pump:		the pump
+ *  packet:		the packet
+ *  length:		packet length, set to the length to frame
+ *
+ *  returns:		the frame's flags
+ */
+static unsigned char PumpCompress(pump_t *pump, unsigned char *packet, size_t *length)
+{
+	int compressed = 0;
+	size_t size = CompressPacket(&pump->compressor, packet, *length, &compressed);
+
+	if(!compressed)
+	{
+		return 0;
+	}
+
+	STATS_ADD(pump->traffic->compression_saved, *length - size);
+	*length = size;
+	return FRAME_FLAG_COMPRESSED;
+}
+
+
+/*		
+ * Function:  PumpBatchToPeer 
+ * --------------------
+ *  reads every packet that is immediately available from the endpoint straight
+ *  into a batch of frames, then writes the whole batch to the SSL/TLS session
+ *  as a single record
+ *
+ *  pump:		the pump
+ *
+ *  returns:		0 if successful, or -1 if an error occurred
+ */
+static int PumpBatchToPeer(pump_t *pump)
+{
+	frame_batch_t *batch = &pump->outgoing;
+	int result = 0;
+	size_t room = 0;
+	size_t length = 0;
+	unsigned char flags = 0;
+	unsigned char *space = NULL;
+
+	FrameBatchReset(batch);
+
+	/* stop once the batch can't take a full sized packet */
+	space = FrameBatchSpace(batch, &room);
+	while(room >= pump->mtu)
+	{
+		result = read(pump->endpoint_fd, space, pump->mtu);
+		if(-1 == result)
+		{
+			if(EAGAIN == errno || EWOULDBLOCK == errno)
+			{
+				break;
+			}
+			return -1;
+		}
+
+		length = result;
+		flags = PumpCompress(pump, space, &length);
+		FrameBatchCommit(batch, FRAME_PACKET, flags, length);
+		STATS_ADD(pump->traffic->tx_packets, 1);
+		STATS_ADD(pump->traffic->tx_bytes, result);
+		space = FrameBatchSpace(batch, &room);
+	}
+
+	if(0 == batch->length)
+	{
+		return 0;
+	}
+
+	return PumpWriteBatch(pump, batch);
+}
+
+
+/*		
+ * Function:  PumpDatagramsToPeer 
+ * --------------------
+ *  reads a burst of packets from the endpoint into the packet ring, frames each
+ *  in place and encrypts it into its own datagram, then sends all the datagrams
+ *  with a single sendmmsg()
+ *
+ *  pump:		the pump
+ *
+ *  returns:		0 if successful, or -1 if an error occurred
+ */
+static int PumpDatagramsToPeer(pump_t *pump)
+{
+	int count = 0;
+	int i = 0;
+	size_t length = 0;
+	unsigned char flags = 0;
+	unsigned char *packet = NULL;
+
+	count = PacketRingRead(&pump->packets, pump->endpoint_fd);
+	if(-1 == count)
+	{
+		return -1;
+	}
+
+	/* one IP packet per datagram */
+	for(i = 0; i < count; ++i)
+	{
+		packet = PacketRingSlot(&pump->packets, i);
+		length = pump->packets.lengths[i];
+		flags = PumpCompress(pump, packet, &length);
+		FrameWriteHeader(packet - FRAME_HEADER_SIZE, FRAME_PACKET, flags, length);
+		if(0 >= SSL_write(pump->ssl, packet - FRAME_HEADER_SIZE, length + FRAME_HEADER_SIZE))
+		{
+			STATS_ADD(pump->traffic->errors, 1);
+			return -1;
+		}
+		STATS_ADD(pump->traffic->tx_packets, 1);
+		STATS_ADD(pump->traffic->tx_bytes, pump->packets.lengths[i]);
+		STATS_ADD(pump->traffic->tx_records, 1);
+	}
+
+	PacketRingSend(&pump->outbound);
+	return 0;
+}
+
+
+/*		
+ * Function:  PumpQueue 
+ * --------------------
+ *  frames a packet read from the endpoint for the peer: over TLS it is copied
+ *  into the outgoing batch, which is written as one record first if it has no
+ *  room left; over DTLS it is framed in place and encrypted into its own
+ *  datagram, which waits in the outbound ring
+ *
+ *  pump:		the pump
+ *  packet:		the packet, preceded by FRAME_HEADER_SIZE bytes of headroom
+ *  length:		packet length
+ *  flags:		FRAME_FLAG_OFFLOAD for a virtio_net_hdr and its packet, which
+ *			isn't compressed, or 0 for a plain packet
+ *
+ *  returns:		0 if successful, or -1 if an error occurred
+ */
+static int PumpQueue(pump_t *pump, unsigned char *packet, size_t length, unsigned char flags)
+{
+	frame_batch_t *batch = &pump->outgoing;
+
+	STATS_ADD(pump->traffic->tx_packets, 1);
+	STATS_ADD(pump->traffic->tx_bytes, length);
+	if(!(FRAME_FLAG_OFFLOAD & flags))
+	{
+		flags = PumpCompress(pump, packet, &length);
+	}
+
+	if(pump->datagram)
+	{
+		FrameWriteHeader(packet - FRAME_HEADER_SIZE, FRAME_PACKET, flags, length);
+		if(0 >= SSL_write(pump->ssl, packet - FRAME_HEADER_SIZE, length + FRAME_HEADER_SIZE))
+		{
+			STATS_ADD(pump->traffic->errors, 1);
+			return -1;
+		}
+		STATS_ADD(pump->traffic->tx_records, 1);
+		return 0;
+	}
+
+	if(-1 == FrameBatchAppend(batch, FRAME_PACKET, flags, packet, length))
+	{
+		if(-1 == PumpWriteBatch(pump, batch))
+		{
+			return -1;
+		}
+		FrameBatchReset(batch);
+		FrameBatchAppend(batch, FRAME_PACKET, flags, packet, length);
+	}
+
+	return 0;
+}
+
+
+/*		
+ * Function:  PumpFlush 
+ * --------------------
+ *  sends what PumpQueue() collected: the outgoing batch as one TLS record,
+ *  or every queued datagram with a single sendmmsg()
+ *
+ *  pump:		the pump
+ *
+ *  returns:		0 if successful, or -1 if an error occurred
+ */
+static int PumpFlush(pump_t *pump)
+{
+	if(pump->datagram)
+	{
+		PacketRingSend(&pump->outbound);
+		return 0;
+	}
+
+	if(0 == pump->outgoing.length)
+	{
+		return 0;
+	}
+
+	if(-1 == PumpWriteBatch(pump, &pump->outgoing))
+	{
+		return -1;
+	}
+
+	FrameBatchReset(&pump->outgoing);
+	return 0;
+}
+
+
+/*		
+ * Function:  PumpQueueRead 
+ * --------------------
+ *  queues what a read from the endpoint returned for the peer: a plain
+ *  packet as it is, and with offloads a virtio_net_hdr and its packet, which
+ *  crosses whole when the peer takes it, gets its checksum completed in place
+ *  when it is a single packet and is cut into plain packets otherwise
+ *
+ *  pump:		the pump
+ *  data:		what was read, preceded by FRAME_HEADER_SIZE bytes of headroom
+ *  length:		its length
+ *
+ *  returns:		0 if successful, or -1 if an error occurred
+ */
+static int PumpQueueRead(pump_t *pump, unsigned char *data, size_t length)
+{
+	struct virtio_net_hdr header;
+	unsigned char *packet = data + OFFLOAD_HEADER_SIZE;
+	size_t size = 0;
+	size_t i = 0;
+
+	if(!pump->offload)
+	{
+		return PumpQueue(pump, data, length, 0);
+	}
+
+	if(length < OFFLOAD_HEADER_SIZE)
+	{
+		STATS_ADD(pump->traffic->errors, 1);
+		return 0;
+	}
+
+	if(pump->offload_peer)
+	{
+		return PumpQueue(pump, data, length, FRAME_FLAG_OFFLOAD);
+	}
+
+	/* the header is headroom enough for the frame's */
+	memcpy(&header, data, OFFLOAD_HEADER_SIZE);
+	length -= OFFLOAD_HEADER_SIZE;
+	if(VIRTIO_NET_HDR_GSO_NONE == header.gso_type)
+	{
+		if(-1 == OffloadCompleteChecksum(&header, packet, length))
+		{
+			STATS_ADD(pump->traffic->errors, 1);
+			return 0;
+		}
+		return PumpQueue(pump, packet, length, 0);
+	}
+
+	for(i = 0; 0 != (size = OffloadSegment(&header, packet, length, i, pump->segment + FRAME_HEADER_SIZE, PMTU_MAX)); ++i)
+	{
+		if(-1 == PumpQueue(pump, pump->segment + FRAME_HEADER_SIZE, size, 0))
+		{
+			return -1;
+		}
+	}
+
+	/* a super-packet of no segments was malformed */
+	if(0 == i)
+	{
+		STATS_ADD(pump->traffic->errors, 1);
+	}
+	return 0;
+}
+
+
+/*		
+ * Function:  PumpOffloadToPeer 
+ * --------------------
+ *  reads a burst of packets and super-packets from the endpoint into the
+ *  packet ring and queues them all for the peer, then sends them
+ *
+ *  pump:		the pump, with offloads
+ *
+ *  returns:		0 if successful, or -1 if an error occurred
+ */
+static int PumpOffloadToPeer(pump_t *pump)
+{
+	int count = 0;
+	int i = 0;
+
+	count = PacketRingRead(&pump->packets, pump->endpoint_fd);
+	if(-1 == count)
+	{
+		return -1;
+	}
+
+	for(i = 0; i < count; ++i)
+	{
+		if(-1 == PumpQueueRead(pump, PacketRingSlot(&pump->packets, i), pump->packets.lengths[i]))
+		{
+			return -1;
+		}
+	}
+
+	return PumpFlush(pump);
+}
+
+
+/*		
+ * Function:  PumpToPeer 
+ * --------------------
+ *  moves the packets waiting on the endpoint to the peer
+ *
+ *  pump:		the pump
+ *
+ *  returns:		0 if successful, or -1 if an error occurred
+ */
+int PumpToPeer(pump_t *pump)
+{
+	if(pump->offload)
+	{
+		return PumpOffloadToPeer(pump);
+	}
+
+	if(pump->datagram)
+	{
+		return PumpDatagramsToPeer(pump);
+	}
+
+	return PumpBatchToPeer(pump);
+}
+
+
+/*		
+ * Function:  PumpProbePath 
+ * --------------------
+ *  moves the path MTU search on: counts an echoed probe, sends the probe
+ *  that is due, if any, tells the peer and the endpoint's owner when the
+ *  tunnel MTU moved, and sets the timer for the search's next deadline
+ *
+ *  pump:		the pump, with a search
+ *  acked:		the size of the probe the peer echoed, 0 if none
+ *
+ *  returns:		0 if successful, or -1 if an error occurred
+ */
+static int PumpProbePath(pump_t *pump, size_t acked)
+{
+	uint64_t now = PumpNow();
+	size_t size = 0;
+	struct itimerspec timer;
+
+	if(0 != acked)
+	{
+		PmtuSearchAcked(&pump->pmtu, acked, now);
+	}
+
+	size = PmtuSearchNext(&pump->pmtu, now);
+	if(0 != size)
+	{
+		FrameWriteHeader(pump->probe, FRAME_PROBE, 0, size);
+		if(0 >= SSL_write(pump->ssl, pump->probe, size + FRAME_HEADER_SIZE))
+		{
+			STATS_ADD(pump->traffic->errors, 1);
+			return -1;
+		}
+		PacketRingSend(&pump->outbound);
+	}
+
+	if(pump->pmtu.mtu != pump->mtu)
+	{
+		pump->mtu = pump->pmtu.mtu;
+		if(-1 == PumpSendMtu(pump))
+		{
+			return -1;
+		}
+		if(NULL != pump->mtu_changed)
+		{
+			pump->mtu_changed(pump->mtu, pump->mtu_arg);
+		}
+	}
+
+	memset(&timer, 0, sizeof(timer));
+	timer.it_value.tv_sec = pump->pmtu.deadline / 1000;
+	timer.it_value.tv_nsec = (pump->pmtu.deadline % 1000) * 1000000L;
+	timerfd_settime(pump->timer_fd, TFD_TIMER_ABSTIME, &timer, NULL);
+	return 0;
+}
+
+
+/*		
+ * Function:  PumpTimerExpired 
+ * --------------------
+ *  moves the path MTU search on once its timer fired
+ *
+ *  pump:		the pump, with a search
+ *
+ *  returns:		0 if successful, or -1 if an error occurred
+ */
+static int PumpTimerExpired(pump_t *pump)
+{
+	uint64_t expirations = 0;
+
+	if(-1 == read(pump->timer_fd, &expirations, sizeof(expirations)) && EAGAIN != errno)
+	{
+		return -1;
+	}
+
+	return PumpProbePath(pump, 0);
+}
+
+
+/*		
+ * Function:  PumpKeepaliveExpired 
+ * --------------------
+ *  checks on the tunnel once a keepalive interval passed: counts it as
+ *  silent if no record came from the peer, giving up after keepalive_limit
+ *  of them in a row, and sends a keepalive if no record went to the peer
+ *
+ *  pump:		the pump, with keepalives
+ *
+ *  returns:		0 if successful, or -1 if the peer is gone or an error occurred
+ */
+static int PumpKeepaliveExpired(pump_t *pump)
+{
+	unsigned char keepalive[FRAME_HEADER_SIZE] = {0, 0, FRAME_KEEPALIVE, 0};
+	uint64_t expirations = 0;
+	uint64_t rx_records = STATS_GET(pump->traffic->rx_records);
+
+	if(-1 == read(pump->keepalive_fd, &expirations, sizeof(expirations)))
+	{
+		return EAGAIN == errno ? 0 : -1;
+	}
+
+	pump->silent_intervals = rx_records == pump->seen_rx_records ? pump->silent_intervals + 1 : 0;
+	pump->seen_rx_records = rx_records;
+	if(pump->silent_intervals >= pump->keepalive_limit)
+	{
+		printf("Error: Nothing came from the peer for %d keepalive intervals.\n", pump->silent_intervals);
+		return -1;
+	}
+
+	if(STATS_GET(pump->traffic->tx_records) == pump->seen_tx_records)
+	{
+		if(-1 == PumpWrite(pump, keepalive, sizeof(keepalive)))
+		{
+			STATS_ADD(pump->traffic->errors, 1);
+			return -1;
+		}
+		STATS_ADD(pump->traffic->tx_records, 1);
+		if(pump->datagram)
+		{
+			PacketRingSend(&pump->outbound);
+		}
+	}
+	pump->seen_tx_records = STATS_GET(pump->traffic->tx_records);
+
+	return 0;
+}
+
+
+/*		
+ * Function:  PumpDeliverFrames 
+ * --------------------
+ *  takes every whole frame out of the deframer, writing the packets to the
+ *  endpoint and handing probe echoes to the path MTU search
+ *
+ *  pump:		the pump
+ *
+ *  returns:		0 if successful, or -1 if an error occurred
+ */
+static int PumpDeliverFrames(pump_t *pump)
+{
+	int result = 0;
+	int inflated_length = 0;
+	ssize_t written = 0;
+	unsigned char inflated[FRAME_MAX_PAYLOAD];
+	frame_t frame;
+
+	/* a full endpoint drops the packet, like a TUN device with a full queue */
+	while(1 == (result = DeframerNext(&pump->incoming, &frame)))
+	{
+		if(FRAME_PROBE_ACK == frame.type && -1 != pump->timer_fd)
+		{
+			if(-1 == PumpProbePath(pump, frame.length))
+			{
+				return -1;
+			}
+			continue;
+		}
+
+		if(FRAME_PACKET != frame.type)
+		{
+			continue;
+		}
+
+		if(FRAME_FLAG_COMPRESSED & frame.flags)
+		{
+			inflated_length = DecompressPacket(frame.payload, frame.length, inflated, sizeof(inflated));
+			if(-1 == inflated_length)
+			{
+				STATS_ADD(pump->traffic->errors, 1);
+				continue;
+			}
+			frame.payload = inflated;
+			frame.length = inflated_length;
+		}
+
+		/* a super-packet goes to the endpoint with its header, a plain packet behind an empty one */
+		if(FRAME_FLAG_OFFLOAD & frame.flags)
+		{
+			if(!pump->offload || frame.length < OFFLOAD_HEADER_SIZE)
+			{
+				STATS_ADD(pump->traffic->errors, 1);
+				continue;
+			}
+			written = write(pump->endpoint_fd, frame.payload, frame.length);
+		}
+		else if(pump->offload)
+		{
+			written = OffloadWrite(pump->endpoint_fd, frame.payload, frame.length);
+		}
+		else
+		{
+			written = write(pump->endpoint_fd, frame.payload, frame.length);
+		}
+
+		if(-1 != written)
+		{
+			STATS_ADD(pump->traffic->rx_packets, 1);
+			STATS_ADD(pump->traffic->rx_bytes, frame.length);
+		}
+		else if(EAGAIN == errno || EWOULDBLOCK == errno)
+		{
+			STATS_ADD(pump->traffic->drops, 1);
+		}
+		else
+		{
+			STATS_ADD(pump->traffic->errors, 1);
+			return -1;
+		}
+	}
+
+	if(-1 == result)
+	{
+		printf("Error: Malformed frame from the peer.\n");
+		STATS_ADD(pump->traffic->errors, 1);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/*		
+ * Function:  PumpRecordsFromPeer 
+ * --------------------
+ *  reads data from the SSL/TLS session, reassembles the frames it carries
+ *  and writes every packet to the endpoint, handing probe echoes to the
+ *  path MTU search
+ *
+ *  pump:		the pump
+ *
+ *  returns:		0 if successful, or -1 if an error occurred
+ */
+static int PumpRecordsFromPeer(pump_t *pump)
+{
+	int result = 0;
+	size_t room = 0;
+	unsigned char *space = NULL;
+
+	/* SSL may hold more than one decrypted record, which select won't report */
+	do
+	{
+		space = DeframerSpace(&pump->incoming, &room);
+		result = SSL_read(pump->ssl, space, room);
+		if(0 >= result)
+		{
+			/* the record carried no application data */
+			switch(SSL_get_error(pump->ssl, result))
+			{
+				case SSL_ERROR_WANT_READ:
+					return 0;
+				case SSL_ERROR_ZERO_RETURN:
+					return -1;
+				default:
+					STATS_ADD(pump->traffic->errors, 1);
+					return -1;
+			}
+		}
+		DeframerCommit(&pump->incoming, result);
+		STATS_ADD(pump->traffic->rx_records, 1);
+
+		if(-1 == PumpDeliverFrames(pump))
+		{
+			return -1;
+		}
+
+		/* every datagram holds whole frames, never keep a truncated one for the next */
+		if(pump->datagram)
+		{
+			DeframerInit(&pump->incoming);
+		}
+	} while(pump->datagram || 0 < SSL_pending(pump->ssl));	/* a datagram may hold more than one record */
+
+	return 0;
+}
+
+
+/*		
+ * Function:  PumpDatagramsFromPeer 
+ * --------------------
+ *  receives every datagram waiting on the socket with a single recvmmsg()
+ *  and decrypts them one by one straight from their slots
+ *
+ *  pump:		the pump
+ *
+ *  returns:		0 if successful, or -1 if an error occurred
+ */
+static int PumpDatagramsFromPeer(pump_t *pump)
+{
+	int count = 0;
+	int i = 0;
+
+	count = PacketRingReceive(&pump->inbound, pump->socket_fd);
+	if(-1 == count)
+	{
+		return -1;
+	}
+
+	for(i = 0; i < count; ++i)
+	{
+		PacketRingBioFeed(SSL_get_rbio(pump->ssl), PacketRingSlot(&pump->inbound, i), pump->inbound.lengths[i]);
+		if(-1 == PumpRecordsFromPeer(pump))
+		{
+			return -1;
+		}
+	}
+
+	/* anything the session answered (e.g. a retransmitted handshake flight) */
+	PacketRingSend(&pump->outbound);
+	return 0;
+}
+
+
+/*		
+ * Function:  PumpPipelineDeliver 
+ * --------------------
+ *  takes the records the workers opened back in sequence and delivers the
+ *  frames they carry, for as long as the next one is open
+ *
+ *  pump:		the pump, with a pipeline
+ *
+ *  returns:		0 if successful, or -1 if the peer closed the session or
+ *			an error occurred
+ */
+static int PumpPipelineDeliver(pump_t *pump)
+{
+	int result = 0;
+	size_t length = 0;
+	size_t room = 0;
+	size_t chunk = 0;
+	unsigned char *data = NULL;
+	unsigned char *space = NULL;
+
+	while(1 == (result = PipelineNext(&pump->pipeline, &data, &length)))
+	{
+		STATS_ADD(pump->traffic->rx_records, 1);
+
+		/* a record fills up the deframer at most once its whole frames were taken out */
+		while(0 != length)
+		{
+			space = DeframerSpace(&pump->incoming, &room);
+			chunk = length < room ? length : room;
+			memcpy(space, data, chunk);
+			DeframerCommit(&pump->incoming, chunk);
+			data += chunk;
+			length -= chunk;
+			if(-1 == PumpDeliverFrames(pump))
+			{
+				return -1;
+			}
+		}
+		PipelineRelease(&pump->pipeline);
+	}
+
+	if(-1 == result)
+	{
+		STATS_ADD(pump->traffic->errors, 1);
+	}
+	return result;
+}
+
+
+/*		
+ * Function:  PumpPipelineFromPeer 
+ * --------------------
+ *  hands what the socket holds to the crypto workers and delivers what they
+ *  opened; when the workers are a full lane behind, the pump waits for them
+ *  rather than read on
+ *
+ *  pump:		the pump, with a pipeline
+ *
+ *  returns:		0 if successful, or -1 if an error occurred
+ */
+static int PumpPipelineFromPeer(pump_t *pump)
+{
+	uint64_t delivered = 0;
+	int stalled = 0;
+
+	do
+	{
+		stalled = PipelineReceive(&pump->pipeline);
+		delivered = pump->pipeline.delivered;
+		if(-1 == stalled || -1 == PumpPipelineDeliver(pump))
+		{
+			return -1;
+		}
+
+		/* the record next in sequence isn't open yet if none was delivered */
+		if(1 == stalled && delivered == pump->pipeline.delivered && -1 == PipelineWait(&pump->pipeline, 1))
+		{
+			return -1;
+		}
+	} while(1 == stalled);
+
+	return 0;
+}
+
+
+/*		
+ * Function:  PumpPipelineDone 
+ * --------------------
+ *  catches up with the crypto workers once they signalled finished records:
+ *  writes the sealed ones to the socket and delivers the opened ones
+ *
+ *  pump:		the pump, with a pipeline
+ *
+ *  returns:		0 if successful, or -1 if an error occurred
+ */
+static int PumpPipelineDone(pump_t *pump)
+{
+	if(-1 == PipelineWait(&pump->pipeline, 0) || -1 == PipelineFlush(&pump->pipeline))
+	{
+		STATS_ADD(pump->traffic->errors, 1);
+		return -1;
+	}
+
+	return PumpPipelineDeliver(pump);
+}
+
+
+/*		
+ * Function:  PumpFromPeer 
+ * --------------------
+ *  moves the packets waiting on the socket to the endpoint
+ *
+ *  pump:		the pump
+ *
+ *  returns:		0 if successful, or -1 if an error occurred
+ */
+int PumpFromPeer(pump_t *pump)
+{
+	if(-1 != pump->pipeline.fd)
+	{
+		return PumpPipelineFromPeer(pump);
+	}
+
+	if(pump->datagram)
+	{
+		return PumpDatagramsFromPeer(pump);
+	}
+
+	return PumpRecordsFromPeer(pump);
+}
+
+
+/*		
+ * Function:  PumpRunUring 
+ * --------------------
+ *  pumps with io_uring: URING_POSTED_READS reads stay posted on the endpoint,
+ *  each into its slot of the registered packet ring, and the socket (and the
+ *  path MTU search's and the keepalive timers, and the pipeline's eventfd)
+ *  is polled through the same io_uring, so a whole burst of packets completes per io_uring_enter()
+ *
+ *  pump:		the pump
+ *  running:		cleared to stop the pump
+ *
+ *  returns:		0 once stopped, or -1 if an error occurred
+ */
+static int PumpRunUring(pump_t *pump, volatile int *running)
+{
+	uint64_t tag = 0;
+	int result = 0;
+	int socket_ready = 0;
+
+	for(tag = 0; tag < URING_POSTED_READS; ++tag)
+	{
+		UringPrepareRead(&pump->uring, pump->endpoint_fd, PacketRingSlot(&pump->packets, tag), RING_PAYLOAD_SIZE, tag);
+	}
+	UringPreparePoll(&pump->uring, pump->socket_fd, URING_TAG_SOCKET);
+	if(-1 != pump->timer_fd)
+	{
+		UringPreparePoll(&pump->uring, pump->timer_fd, URING_TAG_TIMER);
+	}
+	if(-1 != pump->keepalive_fd)
+	{
+		UringPreparePoll(&pump->uring, pump->keepalive_fd, URING_TAG_KEEPALIVE);
+	}
+	if(-1 != pump->pipeline.fd)
+	{
+		UringPreparePoll(&pump->uring, pump->pipeline.fd, URING_TAG_PIPELINE);
+	}
+
+	FrameBatchReset(&pump->outgoing);
+	while(*running)
+	{
+		if(-1 == UringWait(&pump->uring))
+		{
+			return -1;
+		}
+
+		/* the slot a completed read filled is posted again as soon as its packet was framed */
+		socket_ready = 0;
+		while(UringNextCompletion(&pump->uring, &tag, &result))
+		{
+			if(URING_TAG_SOCKET == tag)
+			{
+				socket_ready = 1;
+				continue;
+			}
+
+			if(URING_TAG_TIMER == tag)
+			{
+				if(-1 == PumpTimerExpired(pump))
+				{
+					return -1;
+				}
+				UringPreparePoll(&pump->uring, pump->timer_fd, URING_TAG_TIMER);
+				continue;
+			}
+
+			if(URING_TAG_KEEPALIVE == tag)
+			{
+				if(-1 == PumpKeepaliveExpired(pump))
+				{
+					return -1;
+				}
+				UringPreparePoll(&pump->uring, pump->keepalive_fd, URING_TAG_KEEPALIVE);
+				continue;
+			}
+
+			if(URING_TAG_PIPELINE == tag)
+			{
+				if(-1 == PumpPipelineDone(pump))
+				{
+					return -1;
+				}
+				UringPreparePoll(&pump->uring, pump->pipeline.fd, URING_TAG_PIPELINE);
+				continue;
+			}
+
+			if(0 < result)
+			{
+				if(-1 == PumpQueueRead(pump, PacketRingSlot(&pump->packets, tag), result))
+				{
+					return -1;
+				}
+			}
+			else if(-EINTR != result && -EAGAIN != result)
+			{
+				return -1;
+			}
+			UringPrepareRead(&pump->uring, pump->endpoint_fd, PacketRingSlot(&pump->packets, tag), RING_PAYLOAD_SIZE, tag);
+		}
+
+		if(-1 == PumpFlush(pump))				/* outgoing */
+		{
+			return -1;
+		}
+
+		if(socket_ready)					/* incoming */
+		{
+			if(-1 == PumpFromPeer(pump))
+			{
+				return -1;
+			}
+			UringPreparePoll(&pump->uring, pump->socket_fd, URING_TAG_SOCKET);
+		}
+	}
+
+	return 0;
+}
+
+
+/*		
+ * Function:  PumpRun 
+ * --------------------
+ *  pumps packets both ways until *running is cleared, waiting on the pump's
+ *  io_uring if PumpUseUring() set one up and on select otherwise (which wakes
+ *  up every second to notice a cleared flag on an idle tunnel)
+ *
+ *  pump:		the pump
+ *  running:		cleared to stop the pump
+ *
+ *  returns:		0 once stopped, or -1 if an error occurred
+ */
+int PumpRun(pump_t *pump, volatile int *running)
+{
+	int maxfdp = pump->endpoint_fd > pump->socket_fd ? pump->endpoint_fd : pump->socket_fd;
+	struct timeval timeout;
+	fd_set read_fds;
+
+	/* the first probe goes out at once */
+	if(-1 != pump->timer_fd)
+	{
+		maxfdp = pump->timer_fd > maxfdp ? pump->timer_fd : maxfdp;
+		if(-1 == PumpProbePath(pump, 0))
+		{
+			return -1;
+		}
+	}
+
+	if(-1 != pump->keepalive_fd)
+	{
+		maxfdp = pump->keepalive_fd > maxfdp ? pump->keepalive_fd : maxfdp;
+	}
+
+	if(-1 != pump->pipeline.fd)
+	{
+		maxfdp = pump->pipeline.fd > maxfdp ? pump->pipeline.fd : maxfdp;
+	}
+
+	if(-1 != pump->uring.fd)
+	{
+		return PumpRunUring(pump, running);
+	}
+
+	while(*running)
+	{
+		FD_ZERO(&read_fds);
+		FD_SET(pump->endpoint_fd, &read_fds);
+		FD_SET(pump->socket_fd, &read_fds);
+		if(-1 != pump->timer_fd)
+		{
+			FD_SET(pump->timer_fd, &read_fds);
+		}
+		if(-1 != pump->keepalive_fd)
+		{
+			FD_SET(pump->keepalive_fd, &read_fds);
+		}
+		if(-1 != pump->pipeline.fd)
+		{
+			FD_SET(pump->pipeline.fd, &read_fds);
+		}
+		timeout.tv_sec = 1;
+		timeout.tv_usec = 0;
+
+		/* wait for activity on the file descriptors */
+		if(0 >= select(maxfdp + 1, &read_fds, NULL, NULL, &timeout))
+		{
+			continue;
+		}
+
+		if(FD_ISSET(pump->endpoint_fd, &read_fds) && -1 == PumpToPeer(pump))		/* outgoing */
+		{
+			return -1;
+		}
+
+		if(FD_ISSET(pump->socket_fd, &read_fds) && -1 == PumpFromPeer(pump))		/* incoming */
+		{
+			return -1;
+		}
+
+		if(-1 != pump->timer_fd && FD_ISSET(pump->timer_fd, &read_fds) && -1 == PumpTimerExpired(pump))
+		{
+			return -1;
+		}
+
+		if(-1 != pump->keepalive_fd && FD_ISSET(pump->keepalive_fd, &read_fds) && -1 == PumpKeepaliveExpired(pump))
+		{
+			return -1;
+		}
+
+		if(-1 != pump->pipeline.fd && FD_ISSET(pump->pipeline.fd, &read_fds) && -1 == PumpPipelineDone(pump))
+		{
+			return -1;
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,93 @@
+#ifndef PUMP_H
+#define PUMP_H
+
+#include <openssl/ssl.h>	/* SSL 		*/
+#include "frame.h"		/* frame_batch_t 	*/
+#include "ring.h"		/* packet_ring_t 	*/
+#include "uring.h"		/* uring_t 		*/
+#include "stats.h"		/* traffic_counters_t 	*/
+#include "compress.h"		/* compressor_t 	*/
+#include "pmtu.h"		/* pmtu_search_t 	*/
+#include "pipeline.h"		/* pipeline_t 		*/
+
+/*
+ * moves packets between a packet endpoint and an SSL/TLS (or SSL/DTLS) peer;
+ * the endpoint is anything handing out one packet per read and taking one per
+ * write: the TUN device, or a SOCK_SEQPACKET socketpair standing in for it
+ */
+typedef struct pump
+{
+	int endpoint_fd;		/* the packet endpoint, non-blocking */
+	int socket_fd;			/* the socket connected to the peer */
+	SSL *ssl;			/* the session with the peer */
+	int datagram;			/* DTLS, one frame per datagram through the rings */
+	int kernel_send;		/* the kernel encrypts for the socket (kTLS), batches skip SSL_write() */
+	frame_batch_t outgoing;		/* packets for the peer waiting to be sent as one TLS record */
+	deframer_t incoming;		/* reassembles the frames received from the peer */
+	packet_ring_t packets;		/* packets read from the endpoint, framed and encrypted in place */
+	packet_ring_t inbound;		/* datagrams received from the peer */
+	packet_ring_t outbound;		/* datagrams waiting to be sent to the peer */
+	uring_t uring;			/* uring.fd is -1 unless PumpUseUring() succeeded */
+	traffic_counters_t *traffic;	/* counted on by the pump's thread, may outlive the pump */
+	compressor_t compressor;	/* off unless PumpUseCompression() was called */
+	size_t mtu;			/* the tunnel MTU, the largest packet the endpoint hands out */
+	pmtu_search_t pmtu;		/* pmtu.maximum is 0 unless PumpUsePathMtu() was called */
+	int timer_fd;			/* wakes the path MTU search, -1 without one */
+	unsigned char *probe;		/* the probe frame, zero padding after the header */
+	void (*mtu_changed)(size_t mtu, void *arg);	/* told the tunnel MTU the search settled on */
+	void *mtu_arg;
+	int offload;			/* the endpoint is a TUN device with a virtio_net_hdr before every packet */
+	int offload_peer;		/* the peer takes FRAME_FLAG_OFFLOAD packets, super-packets cross whole */
+	unsigned char *segment;		/* a super-packet is cut into plain packets here for any other peer */
+	int keepalive_fd;		/* fires every keepalive interval, -1 without keepalives */
+	int keepalive_limit;		/* intervals in a row without a record from the peer before it counts as gone */
+	int silent_intervals;		/* intervals in a row nothing came from the peer */
+	uint64_t seen_rx_records;	/* traffic->rx_records and tx_records as of the last interval */
+	uint64_t seen_tx_records;
+	pipeline_t pipeline;		/* pipeline.fd is -1 unless PumpUsePipeline() succeeded */
+} pump_t;
+
+
+/* initializes a pump over an established session, the endpoint may be set later */
+void PumpInit(pump_t *pump, int endpoint_fd, int socket_fd, SSL *ssl, int datagram, traffic_counters_t *traffic);
+
+/* moves a DTLS session onto the pump's rings */
+int PumpUseRings(pump_t *pump);
+
+/* compresses the packets sent to a peer that restores them */
+void PumpUseCompression(pump_t *pump, compress_mode_t mode);
+
+/* sets the tunnel MTU, the largest packet read from the endpoint */
+void PumpSetMtu(pump_t *pump, size_t mtu);
+
+/* tells the peer the tunnel MTU with a FRAME_MTU */
+int PumpSendMtu(pump_t *pump);
+
+/* searches a DTLS session's path for the largest tunnel MTU up to a maximum, calling changed() when it moves */
+int PumpUsePathMtu(pump_t *pump, size_t maximum, void (*changed)(size_t mtu, void *arg), void *arg);
+
+/* reads and writes the endpoint's packets behind a virtio_net_hdr, peer is whether it takes super-packets */
+int PumpUseOffload(pump_t *pump, int peer);
+
+/* sends a keepalive every interval seconds without traffic to the peer, gives up on a peer silent for timeout seconds */
+int PumpUseKeepalive(pump_t *pump, int interval, int timeout);
+
+/* seals and opens a TLS 1.3 session's records on a pool of crypto workers, fails when the session doesn't allow it */
+int PumpUsePipeline(pump_t *pump, const record_secrets_t *secrets, size_t workers);
+
+/* sets up an io_uring for PumpRun() to wait on, fails when io_uring is unavailable */
+int PumpUseUring(pump_t *pump);
+
+/* releases the pump's rings, io_uring, search, segment buffer, keepalive timer and pipeline (not the session or the descriptors) */
+void PumpDestroy(pump_t *pump);
+
+/* moves the packets waiting on the endpoint to the peer */
+int PumpToPeer(pump_t *pump);
+
+/* moves the packets waiting on the socket to the endpoint */
+int PumpFromPeer(pump_t *pump);
+
+/* pumps both ways until *running is cleared */
+int PumpRun(pump_t *pump, volatile int *running);
+
+#endif  /* PUMP_H */
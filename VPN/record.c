@@ -0,0 +1,787 @@
+#include "record.h"
+#include <stdio.h>		/* sscanf, printf 	*/
+#include <stdlib.h>		/* calloc, free 	*/
+#include <string.h>		/* memcpy, memmove 	*/
+#include <errno.h>		/* EAGAIN 		*/
+#include <pthread.h>		/* pthread_once 	*/
+#include <sys/socket.h>	/* recv, send 		*/
+#include <openssl/evp.h>	/* EVP_EncryptUpdate 	*/
+#include <openssl/kdf.h>	/* EVP_PKEY_CTX_set_hkdf_mode */
+
+#define RECORD_LABEL_PREFIX "tls13 "			/* HKDF-Expand-Label's (RFC 8446 7.1) */
+#define RECORD_LOGGED_CLIENT 0x01
+#define RECORD_LOGGED_SERVER 0x02
+
+static int secrets_index = -1;				/* the ex_data index tracked sessions keep their secrets at */
+static pthread_once_t secrets_once = PTHREAD_ONCE_INIT;
+
+
+/*
+ * Function:  RecordKeylog
+ * --------------------
+ *  catches the application traffic secrets of a tracked session from the
+ *  lines OpenSSL logs for it ('<label> <client random> <secret>' in hex)
+ *
+ *  ssl:	the session
+ *  line:	the line
+ *
+ *  returns:	no return value
+ */
+void RecordKeylog(const SSL *ssl, const char *line)
+{
+	record_secrets_t *secrets = -1 == secrets_index ? NULL : SSL_get_ex_data(ssl, secrets_index);
+	char label[64];
+	char hex[2 * EVP_MAX_MD_SIZE + 1];
+	unsigned char *secret = NULL;
+	size_t length = 0;
+	size_t i = 0;
+	int logged = 0;
+
+	if(NULL == secrets || 2 != sscanf(line, "%63s %*s %128s", label, hex))
+	{
+		return;
+	}
+
+	if(0 == strcmp(label, "CLIENT_TRAFFIC_SECRET_0"))
+	{
+		secret = secrets->client;
+		logged = RECORD_LOGGED_CLIENT;
+	}
+	else if(0 == strcmp(label, "SERVER_TRAFFIC_SECRET_0"))
+	{
+		secret = secrets->server;
+		logged = RECORD_LOGGED_SERVER;
+	}
+	else
+	{
+		return;
+	}
+
+	length = strlen(hex) / 2;
+	for(i = 0; i < length; ++i)
+	{
+		if(1 != sscanf(hex + 2 * i, "%2hhx", &secret[i]))
+		{
+			return;
+		}
+	}
+
+	secrets->length = length;
+	secrets->logged |= logged;
+}
+
+
+/*
+ * Function:  RecordCountRecord
+ * --------------------
+ *  the message callback of a tracked session, counting the records it
+ *  writes and reads once its handshake is done, and noticing a key update
+ *  either way, after which the secrets no longer protect its records
+ *
+ *  write_p:	whether the record is written
+ *  content_type:	SSL3_RT_HEADER for a record header, SSL3_RT_HANDSHAKE
+ *		for a handshake message
+ *  buf:	the header or message
+ *  len:	its length
+ *  arg:	the session's secrets
+ *
+ *  returns:	no return value
+ */
+static void RecordCountRecord(int write_p, int version, int content_type, const void *buf, size_t len, SSL *ssl, void *arg)
+{
+	record_secrets_t *secrets = arg;
+
+	(void)version;
+	(void)ssl;
+
+	if(!secrets->established)
+	{
+		return;
+	}
+
+	if(SSL3_RT_HANDSHAKE == content_type && 0 != len && SSL3_MT_KEY_UPDATE == *(const unsigned char *)buf)
+	{
+		secrets->updated = 1;
+		return;
+	}
+
+	if(SSL3_RT_HEADER != content_type)
+	{
+		return;
+	}
+
+	if(write_p)
+	{
+		++secrets->sent;
+	}
+	else
+	{
+		++secrets->received;
+	}
+}
+
+
+/*
+ * Function:  RecordHandshakeDone
+ * --------------------
+ *  the info callback of a tracked session, noticing the end of its
+ *  handshake: every record from then on is protected with the application
+ *  traffic keys
+ *
+ *  ssl:	the session
+ *  where:	what happened
+ *
+ *  returns:	no return value
+ */
+static void RecordHandshakeDone(const SSL *ssl, int where, int ret)
+{
+	record_secrets_t *secrets = SSL_get_ex_data(ssl, secrets_index);
+
+	(void)ret;
+
+	if((SSL_CB_HANDSHAKE_DONE & where) && NULL != secrets)
+	{
+		secrets->established = 1;
+	}
+}
+
+
+/*
+ * Function:  RecordCreateIndex
+ * --------------------
+ *  reserves the ex_data index of the secrets, once for every thread that
+ *  tracks sessions
+ *
+ *  returns:	no return value, secrets_index stays -1 if an error occurred
+ */
+static void RecordCreateIndex(void)
+{
+	secrets_index = SSL_get_ex_new_index(0, NULL, NULL, NULL, NULL);
+}
+
+
+/*
+ * Function:  RecordTrack
+ * --------------------
+ *  starts collecting the secrets and sequence numbers RecordDeriveKeys()
+ *  needs of a session, whose context logs keys to RecordKeylog(); the
+ *  session's message and info callbacks are taken for it
+ *
+ *  ssl:	the session, before its handshake
+ *  secrets:	where they are collected, which must outlive the session
+ *
+ *  returns:	0 if successful, or -1 if an error occurred
+ */
+int RecordTrack(SSL *ssl, record_secrets_t *secrets)
+{
+	pthread_once(&secrets_once, RecordCreateIndex);
+	if(-1 == secrets_index)
+	{
+		return -1;
+	}
+
+	memset(secrets, 0, sizeof(record_secrets_t));
+	if(!SSL_set_ex_data(ssl, secrets_index, secrets))
+	{
+		return -1;
+	}
+
+	SSL_set_msg_callback(ssl, RecordCountRecord);
+	SSL_set_msg_callback_arg(ssl, secrets);
+	SSL_set_info_callback(ssl, RecordHandshakeDone);
+	return 0;
+}
+
+
+/*
+ * Function:  RecordCipher
+ * --------------------
+ *  maps a TLS 1.3 suite to its AEAD, for the suites whose tag is
+ *  RECORD_TAG_SIZE bytes and nonce RECORD_IV_SIZE
+ *
+ *  suite:	SSL_CIPHER_get_id() of the suite
+ *
+ *  returns:	the AEAD, or NULL for any other suite
+ */
+static const EVP_CIPHER *RecordCipher(uint32_t suite)
+{
+	switch(suite)
+	{
+		case TLS1_3_CK_AES_128_GCM_SHA256:
+			return EVP_aes_128_gcm();
+		case TLS1_3_CK_AES_256_GCM_SHA384:
+			return EVP_aes_256_gcm();
+		case TLS1_3_CK_CHACHA20_POLY1305_SHA256:
+			return EVP_chacha20_poly1305();
+		default:
+			return NULL;
+	}
+}
+
+
+/*
+ * Function:  RecordExpandLabel
+ * --------------------
+ *  derives a traffic key or IV from a traffic secret with HKDF-Expand-Label
+ *  and an empty context (RFC 8446 7.1 and 7.3)
+ *
+ *  digest:	the suite's hash
+ *  secret:	the traffic secret
+ *  secret_length:	its length
+ *  label:	"key" or "iv"
+ *  out:	where the derived bytes go
+ *  length:	how many of them
+ *
+ *  returns:	0 if successful, or -1 if an error occurred
+ */
+static int RecordExpandLabel(const EVP_MD *digest, const unsigned char *secret, size_t secret_length,
+			     const char *label, unsigned char *out, size_t length)
+{
+	unsigned char info[2 + 1 + 255 + 1];
+	size_t label_length = strlen(RECORD_LABEL_PREFIX) + strlen(label);
+	EVP_PKEY_CTX *ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_HKDF, NULL);
+	int result = -1;
+
+	/* the output length, the prefixed label and an empty context */
+	info[0] = (unsigned char)(length >> 8);
+	info[1] = (unsigned char)length;
+	info[2] = (unsigned char)label_length;
+	memcpy(info + 3, RECORD_LABEL_PREFIX, strlen(RECORD_LABEL_PREFIX));
+	memcpy(info + 3 + strlen(RECORD_LABEL_PREFIX), label, strlen(label));
+	info[3 + label_length] = 0;
+
+	if(NULL != ctx && 0 < EVP_PKEY_derive_init(ctx) &&
+	   0 < EVP_PKEY_CTX_set_hkdf_mode(ctx, EVP_PKEY_HKDEF_MODE_EXPAND_ONLY) &&
+	   0 < EVP_PKEY_CTX_set_hkdf_md(ctx, digest) &&
+	   0 < EVP_PKEY_CTX_set1_hkdf_key(ctx, secret, secret_length) &&
+	   0 < EVP_PKEY_CTX_add1_hkdf_info(ctx, info, 4 + label_length) &&
+	   0 < EVP_PKEY_derive(ctx, out, &length))
+	{
+		result = 0;
+	}
+
+	EVP_PKEY_CTX_free(ctx);
+	return result;
+}
+
+
+/*
+ * Function:  RecordDeriveKeys
+ * --------------------
+ *  derives the traffic keys and IVs of an established TLS 1.3 session from
+ *  the secrets RecordTrack() collected, each with the sequence number of
+ *  the next record; the session must not be holding a record it read but
+ *  didn't return, nor part of one it was writing
+ *
+ *  ssl:	the session, TLS 1.3 with an AES-GCM or ChaCha20-Poly1305 suite
+ *  secrets:	what RecordTrack() collected of it
+ *  seal:	set to the keys of the records the session writes
+ *  open:	set to the keys of the records it reads
+ *
+ *  returns:	0 if successful, or -1 if the session's records can't be
+ *		protected outside of OpenSSL or an error occurred
+ */
+int RecordDeriveKeys(SSL *ssl, const record_secrets_t *secrets, record_keys_t *seal, record_keys_t *open)
+{
+	const SSL_CIPHER *suite = SSL_get_current_cipher(ssl);
+	const EVP_CIPHER *cipher = NULL;
+	const EVP_MD *digest = NULL;
+	const unsigned char *seal_secret = SSL_is_server(ssl) ? secrets->server : secrets->client;
+	const unsigned char *open_secret = SSL_is_server(ssl) ? secrets->client : secrets->server;
+
+	if(TLS1_3_VERSION != SSL_version(ssl) || NULL == suite || !secrets->established || secrets->updated ||
+	   (RECORD_LOGGED_CLIENT | RECORD_LOGGED_SERVER) != secrets->logged)
+	{
+		return -1;
+	}
+
+	cipher = RecordCipher(SSL_CIPHER_get_id(suite));
+	digest = SSL_CIPHER_get_handshake_digest(suite);
+	if(NULL == cipher || NULL == digest)
+	{
+		return -1;
+	}
+
+	seal->suite = SSL_CIPHER_get_id(suite);
+	seal->sequence = secrets->sent;
+	open->suite = seal->suite;
+	open->sequence = secrets->received;
+	if(-1 == RecordExpandLabel(digest, seal_secret, secrets->length, "key", seal->key, EVP_CIPHER_key_length(cipher)) ||
+	   -1 == RecordExpandLabel(digest, seal_secret, secrets->length, "iv", seal->iv, RECORD_IV_SIZE) ||
+	   -1 == RecordExpandLabel(digest, open_secret, secrets->length, "key", open->key, EVP_CIPHER_key_length(cipher)) ||
+	   -1 == RecordExpandLabel(digest, open_secret, secrets->length, "iv", open->iv, RECORD_IV_SIZE))
+	{
+		OPENSSL_cleanse(seal, sizeof(record_keys_t));
+		OPENSSL_cleanse(open, sizeof(record_keys_t));
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/*
+ * Function:  RecordInitCipher
+ * --------------------
+ *  keys an AEAD context with a direction's traffic key, the nonce is set
+ *  for every record
+ *
+ *  ctx:	the context
+ *  keys:	the direction's keys
+ *  seal:	whether the context seals, or opens
+ *
+ *  returns:	0 if successful, or -1 if the suite is unknown or an error occurred
+ */
+int RecordInitCipher(EVP_CIPHER_CTX *ctx, const record_keys_t *keys, int seal)
+{
+	const EVP_CIPHER *cipher = RecordCipher(keys->suite);
+
+	if(NULL == cipher)
+	{
+		return -1;
+	}
+
+	if(seal)
+	{
+		return 0 < EVP_EncryptInit_ex(ctx, cipher, NULL, keys->key, NULL) ? 0 : -1;
+	}
+	return 0 < EVP_DecryptInit_ex(ctx, cipher, NULL, keys->key, NULL) ? 0 : -1;
+}
+
+
+/*
+ * Function:  RecordNonce
+ * --------------------
+ *  makes a record's nonce: the IV with the sequence number, in network
+ *  order, xored into its last 8 bytes (RFC 8446 5.3)
+ *
+ *  iv:		the traffic IV
+ *  sequence:	the record's sequence number
+ *  nonce:	where the nonce goes
+ *
+ *  returns:	no return value
+ */
+static void RecordNonce(const unsigned char *iv, uint64_t sequence, unsigned char *nonce)
+{
+	int i = 0;
+
+	memcpy(nonce, iv, RECORD_IV_SIZE);
+	for(i = RECORD_IV_SIZE - 1; i >= RECORD_IV_SIZE - 8; --i)
+	{
+		nonce[i] ^= (unsigned char)sequence;
+		sequence >>= 8;
+	}
+}
+
+
+/*
+ * Function:  RecordSeal
+ * --------------------
+ *  turns content into a TLS 1.3 record, in place: the header in front of
+ *  it, the inner content type and the tag behind it
+ *
+ *  ctx:	the sealing context, keyed
+ *  iv:		the traffic IV
+ *  sequence:	the record's sequence number
+ *  record:	the buffer, the content RECORD_HEADER_SIZE bytes in and room
+ *		for 1 + RECORD_TAG_SIZE bytes behind it
+ *  length:	of the content
+ *  type:	the inner content type, SSL3_RT_APPLICATION_DATA or SSL3_RT_ALERT
+ *
+ *  returns:	the length of the record, or 0 if sealing failed
+ */
+size_t RecordSeal(EVP_CIPHER_CTX *ctx, const unsigned char *iv, uint64_t sequence, unsigned char *record, size_t length, int type)
+{
+	unsigned char nonce[RECORD_IV_SIZE];
+	unsigned char *body = record + RECORD_HEADER_SIZE;
+	int written = 0;
+
+	body[length++] = (unsigned char)type;
+	record[0] = SSL3_RT_APPLICATION_DATA;
+	record[1] = TLS1_2_VERSION >> 8;
+	record[2] = TLS1_2_VERSION & 0xff;
+	record[3] = (unsigned char)((length + RECORD_TAG_SIZE) >> 8);
+	record[4] = (unsigned char)(length + RECORD_TAG_SIZE);
+
+	/* the header is the additional data */
+	RecordNonce(iv, sequence, nonce);
+	if(0 >= EVP_EncryptInit_ex(ctx, NULL, NULL, NULL, nonce) ||
+	   0 >= EVP_EncryptUpdate(ctx, NULL, &written, record, RECORD_HEADER_SIZE) ||
+	   0 >= EVP_EncryptUpdate(ctx, body, &written, body, length) ||
+	   0 >= EVP_EncryptFinal_ex(ctx, body + written, &written) ||
+	   0 >= EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_GET_TAG, RECORD_TAG_SIZE, body + length))
+	{
+		return 0;
+	}
+
+	return RECORD_HEADER_SIZE + length + RECORD_TAG_SIZE;
+}
+
+
+/*
+ * Function:  RecordOpen
+ * --------------------
+ *  decrypts a TLS 1.3 record in place and strips its padding, leaving its
+ *  content RECORD_HEADER_SIZE bytes into the buffer
+ *
+ *  ctx:	the opening context, keyed
+ *  iv:		the traffic IV
+ *  sequence:	the record's sequence number
+ *  record:	the record
+ *  length:	its length, set to the length of its content
+ *
+ *  returns:	the inner content type, or -1 if the record didn't open
+ */
+int RecordOpen(EVP_CIPHER_CTX *ctx, const unsigned char *iv, uint64_t sequence, unsigned char *record, size_t *length)
+{
+	unsigned char nonce[RECORD_IV_SIZE];
+	unsigned char *body = record + RECORD_HEADER_SIZE;
+	size_t content = *length - RECORD_HEADER_SIZE;
+	int written = 0;
+
+	if(SSL3_RT_APPLICATION_DATA != record[0] || content <= RECORD_TAG_SIZE)
+	{
+		return -1;
+	}
+	content -= RECORD_TAG_SIZE;
+
+	RecordNonce(iv, sequence, nonce);
+	if(0 >= EVP_DecryptInit_ex(ctx, NULL, NULL, NULL, nonce) ||
+	   0 >= EVP_DecryptUpdate(ctx, NULL, &written, record, RECORD_HEADER_SIZE) ||
+	   0 >= EVP_DecryptUpdate(ctx, body, &written, body, content) ||
+	   0 >= EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_TAG, RECORD_TAG_SIZE, body + content) ||
+	   0 >= EVP_DecryptFinal_ex(ctx, body + written, &written))
+	{
+		return -1;
+	}
+
+	/* the content type is the last byte that isn't padding */
+	while(0 != content && 0 == body[content - 1])
+	{
+		--content;
+	}
+	if(0 == content)
+	{
+		return -1;
+	}
+
+	*length = content - 1;
+	return body[content - 1];
+}
+
+
+/*
+ * Function:  RecordStreamCreate
+ * --------------------
+ *  sets up a stream carrying a TLS 1.3 session on from the keys, and the
+ *  sequence numbers, the session was at each way
+ *
+ *  seal:	the keys of the records written
+ *  open:	the keys of the records read
+ *  unread:	bytes read from the socket before, the start of the next record
+ *		(RecordStreamUnread()), or NULL
+ *  length:	their length, up to RECORD_INPUT_SIZE
+ *
+ *  returns:	the stream, or NULL if an error occurred
+ */
+record_stream_t *RecordStreamCreate(const record_keys_t *seal, const record_keys_t *open, const unsigned char *unread, size_t length)
+{
+	record_stream_t *stream = NULL;
+
+	if(RECORD_INPUT_SIZE < length || NULL == (stream = calloc(1, sizeof(record_stream_t))))
+	{
+		return NULL;
+	}
+
+	if(0 != length)
+	{
+		memcpy(stream->in, unread, length);
+		stream->in_length = length;
+	}
+
+	stream->seal = *seal;
+	stream->open = *open;
+	stream->sealer = EVP_CIPHER_CTX_new();
+	stream->opener = EVP_CIPHER_CTX_new();
+	if(NULL == stream->sealer || NULL == stream->opener ||
+	   -1 == RecordInitCipher(stream->sealer, seal, 1) || -1 == RecordInitCipher(stream->opener, open, 0))
+	{
+		RecordStreamFree(stream);
+		return NULL;
+	}
+
+	return stream;
+}
+
+
+/*
+ * Function:  RecordStreamFree
+ * --------------------
+ *  releases a stream and wipes its keys
+ *
+ *  stream:	the stream, or NULL
+ *
+ *  returns:	no return value
+ */
+void RecordStreamFree(record_stream_t *stream)
+{
+	if(NULL == stream)
+	{
+		return;
+	}
+
+	EVP_CIPHER_CTX_free(stream->sealer);
+	EVP_CIPHER_CTX_free(stream->opener);
+	OPENSSL_cleanse(stream, sizeof(record_stream_t));
+	free(stream);
+}
+
+
+/*
+ * Function:  RecordStreamNext
+ * --------------------
+ *  opens the whole record at the front of the stream's input, if there is
+ *  one and the last one's content was all returned; session tickets are
+ *  skipped, any other handshake message (a key update) can't be followed
+ *
+ *  stream:	the stream
+ *
+ *  returns:	1 if a record with application data was opened, 0 if no whole
+ *		record is there, -1 if the peer closed the session, or -2 if a
+ *		record didn't open or can't be followed
+ */
+static int RecordStreamNext(record_stream_t *stream)
+{
+	unsigned char *content = stream->in + RECORD_HEADER_SIZE;
+	size_t length = 0;
+	int type = 0;
+
+	while(1)
+	{
+		/* the last record is done with */
+		if(0 != stream->opened && 0 == stream->content_length)
+		{
+			memmove(stream->in, stream->in + stream->opened, stream->in_length - stream->opened);
+			stream->in_length -= stream->opened;
+			stream->opened = 0;
+		}
+		if(0 != stream->opened)
+		{
+			return 1;
+		}
+
+		if(RECORD_HEADER_SIZE > stream->in_length)
+		{
+			return 0;
+		}
+		length = RECORD_HEADER_SIZE + ((size_t)stream->in[3] << 8 | stream->in[4]);
+		if(RECORD_MAX_SIZE < length)
+		{
+			printf("Error: A record from the peer is too long.\n");
+			return -2;
+		}
+		if(length > stream->in_length)
+		{
+			return 0;
+		}
+
+		stream->opened = length;
+		type = RecordOpen(stream->opener, stream->open.iv, stream->open.sequence++, stream->in, &length);
+		stream->content_offset = 0;
+		stream->content_length = 0;
+		switch(type)
+		{
+			case SSL3_RT_APPLICATION_DATA:
+				stream->content_length = length;
+				continue;
+			case SSL3_RT_HANDSHAKE:
+				if(0 != length && SSL3_MT_NEWSESSION_TICKET == content[0])
+				{
+					continue;
+				}
+				printf("Error: The peer sent a handshake message the carried over session can't follow.\n");
+				return -2;
+			case SSL3_RT_ALERT:
+				return -1;
+			default:
+				printf("Error: A record from the peer failed to open.\n");
+				return -2;
+		}
+	}
+}
+
+
+/*
+ * Function:  RecordStreamRead
+ * --------------------
+ *  returns application data from the next record, reading from the socket
+ *  as long as no whole record is buffered; like SSL_read(), a call returns
+ *  the content of one record at most
+ *
+ *  stream:	the stream
+ *  fd:		the session's socket, non-blocking
+ *  data:	where the data goes
+ *  size:	room there
+ *
+ *  returns:	the number of bytes returned, 0 if the socket has nothing more
+ *		now, -1 if the peer closed the session, or -2 if an error occurred
+ */
+int RecordStreamRead(record_stream_t *stream, int fd, unsigned char *data, size_t size)
+{
+	ssize_t result = 0;
+	size_t length = 0;
+	int next = 0;
+
+	while(0 == (next = RecordStreamNext(stream)))
+	{
+		result = recv(fd, stream->in + stream->in_length, sizeof(stream->in) - stream->in_length, MSG_DONTWAIT);
+		if(0 == result)
+		{
+			return -1;
+		}
+		if(-1 == result && EINTR == errno)
+		{
+			continue;
+		}
+		if(-1 == result)
+		{
+			return EAGAIN == errno || EWOULDBLOCK == errno ? 0 : -2;
+		}
+		stream->in_length += result;
+	}
+
+	if(1 != next)
+	{
+		return next;
+	}
+
+	length = stream->content_length < size ? stream->content_length : size;
+	memcpy(data, stream->in + RECORD_HEADER_SIZE + stream->content_offset, length);
+	stream->content_offset += length;
+	stream->content_length -= length;
+	return (int)length;
+}
+
+
+/*
+ * Function:  RecordStreamWrite
+ * --------------------
+ *  seals data into a record and writes it to the socket; a record the
+ *  socket didn't take all of stays in the stream and the call must be
+ *  repeated with the same data, like SSL_write()
+ *
+ *  stream:	the stream
+ *  fd:		the session's socket, non-blocking
+ *  data:	the data
+ *  length:	its length, up to FRAME_BATCH_SIZE
+ *
+ *  returns:	1 if the record was written, 0 if the socket can't take (all
+ *		of) it now, or -1 if an error occurred
+ */
+int RecordStreamWrite(record_stream_t *stream, int fd, const unsigned char *data, size_t length)
+{
+	ssize_t result = 0;
+
+	if(0 == stream->out_length)
+	{
+		memcpy(stream->out + RECORD_HEADER_SIZE, data, length);
+		stream->out_length = RecordSeal(stream->sealer, stream->seal.iv, stream->seal.sequence, stream->out, length, SSL3_RT_APPLICATION_DATA);
+		if(0 == stream->out_length)
+		{
+			return -1;
+		}
+		++stream->seal.sequence;
+		stream->out_sent = 0;
+	}
+
+	while(stream->out_sent < stream->out_length)
+	{
+		result = send(fd, stream->out + stream->out_sent, stream->out_length - stream->out_sent, MSG_DONTWAIT | MSG_NOSIGNAL);
+		if(-1 == result && EINTR == errno)
+		{
+			continue;
+		}
+		if(-1 == result)
+		{
+			return EAGAIN == errno || EWOULDBLOCK == errno ? 0 : -1;
+		}
+		stream->out_sent += result;
+	}
+
+	stream->out_length = 0;
+	return 1;
+}
+
+
+/*
+ * Function:  RecordStreamPending
+ * --------------------
+ *  tells whether data can be read from the stream without the socket:
+ *  content of the last record left, or another whole record buffered
+ *
+ *  stream:	the stream
+ *
+ *  returns:	1 if there is, 0 otherwise
+ */
+int RecordStreamPending(const record_stream_t *stream)
+{
+	size_t rest = stream->in_length - stream->opened;
+	const unsigned char *header = stream->in + stream->opened;
+
+	if(0 != stream->content_length)
+	{
+		return 1;
+	}
+
+	return RECORD_HEADER_SIZE <= rest && RECORD_HEADER_SIZE + ((size_t)header[3] << 8 | header[4]) <= rest;
+}
+
+
+/*
+ * Function:  RecordStreamUnread
+ * --------------------
+ *  returns the bytes read from the socket that no record was opened from
+ *  yet, e.g. the start of a record the peer is in the middle of sending, for
+ *  a stream carrying the session on elsewhere to start from
+ *
+ *  stream:	the stream
+ *  unread:	set to where the bytes start
+ *
+ *  returns:	their length
+ */
+size_t RecordStreamUnread(const record_stream_t *stream, const unsigned char **unread)
+{
+	*unread = stream->in + stream->opened;
+	return stream->in_length - stream->opened;
+}
+
+
+/*
+ * Function:  RecordStreamClose
+ * --------------------
+ *  tells the peer the session is closing with a close_notify alert, unless
+ *  the socket still holds part of a record; it isn't retried
+ *
+ *  stream:	the stream
+ *  fd:		the session's socket
+ *
+ *  returns:	no return value
+ */
+void RecordStreamClose(record_stream_t *stream, int fd)
+{
+	unsigned char alert[RECORD_HEADER_SIZE + 2 + 1 + RECORD_TAG_SIZE];
+	size_t length = 0;
+
+	if(0 != stream->out_length)
+	{
+		return;
+	}
+
+	alert[RECORD_HEADER_SIZE] = SSL3_AL_WARNING;
+	alert[RECORD_HEADER_SIZE + 1] = SSL_AD_CLOSE_NOTIFY;
+	length = RecordSeal(stream->sealer, stream->seal.iv, stream->seal.sequence++, alert, 2, SSL3_RT_ALERT);
+	if(0 != length)
+	{
+		send(fd, alert, length, MSG_DONTWAIT | MSG_NOSIGNAL);
+	}
+}
@@ -0,0 +1,114 @@
+#ifndef RECORD_H
+#define RECORD_H
+
+#include <stddef.h>		/* size_t 		*/
+#include <stdint.h>		/* uint64_t 		*/
+#include <openssl/ssl.h>	/* SSL, EVP_CIPHER_CTX 	*/
+#include "frame.h"		/* FRAME_BATCH_SIZE 	*/
+
+#define RECORD_HEADER_SIZE 5					/* a TLS record header */
+#define RECORD_TAG_SIZE 16					/* the AEAD tag ending every record */
+#define RECORD_MAX_SIZE (RECORD_HEADER_SIZE + FRAME_BATCH_SIZE + 256)	/* the largest record a peer may send (RFC 8446 5.2) */
+#define RECORD_IV_SIZE 12
+#define RECORD_INPUT_SIZE (2 * RECORD_MAX_SIZE)				/* the socket's bytes a stream buffers */
+
+/*
+ * what a TLS 1.3 session has to give away for its records to be protected
+ * outside of OpenSSL: the application traffic secrets, which come through
+ * the context's keylog callback, and the sequence numbers they are at,
+ * which are the records counted each way since the handshake was done
+ *
+ *  client, server:	the secrets each side protects its records with
+ *  length:		of each secret, the size of the suite's hash
+ *  logged:		bit 0 once the client's secret came, bit 1 the server's
+ *  established:	the handshake is done, records are counted from then on
+ *  updated:		a key update passed since, the secrets are stale
+ *  sent, received:	records protected with the secrets so far
+ */
+typedef struct record_secrets
+{
+	unsigned char client[EVP_MAX_MD_SIZE];
+	unsigned char server[EVP_MAX_MD_SIZE];
+	size_t length;
+	int logged;
+	int established;
+	int updated;
+	uint64_t sent;
+	uint64_t received;
+} record_secrets_t;
+
+/*
+ * the traffic key of one direction of a TLS 1.3 session, derived from its
+ * secret, and the sequence number of the next record protected with it
+ */
+typedef struct record_keys
+{
+	uint32_t suite;				/* SSL_CIPHER_get_id() of the session's suite */
+	unsigned char key[EVP_MAX_KEY_LENGTH];
+	unsigned char iv[RECORD_IV_SIZE];
+	uint64_t sequence;
+} record_keys_t;
+
+/*
+ * the record layer of a TLS 1.3 session carried on without OpenSSL, on a
+ * non-blocking stream socket: records are sealed and opened one at a time
+ * with the keys the session was at, e.g. by a process the session's socket
+ * was passed to
+ */
+typedef struct record_stream
+{
+	EVP_CIPHER_CTX *sealer;
+	EVP_CIPHER_CTX *opener;
+	record_keys_t seal;
+	record_keys_t open;
+	unsigned char in[RECORD_INPUT_SIZE];	/* bytes read from the socket, the first record opened in place */
+	size_t in_length;
+	size_t opened;				/* length of the opened record in front of in, 0 if none */
+	size_t content_offset;			/* of its content not returned yet, from RECORD_HEADER_SIZE in */
+	size_t content_length;
+	unsigned char out[RECORD_MAX_SIZE];	/* the sealed record the socket didn't take all of */
+	size_t out_length;
+	size_t out_sent;
+} record_stream_t;
+
+
+/* the keylog callback (SSL_CTX_set_keylog_callback) catching the secrets of tracked sessions */
+void RecordKeylog(const SSL *ssl, const char *line);
+
+/* starts collecting what RecordDeriveKeys() needs of a session, before its handshake */
+int RecordTrack(SSL *ssl, record_secrets_t *secrets);
+
+/* derives the traffic keys an established TLS 1.3 session is at, each way */
+int RecordDeriveKeys(SSL *ssl, const record_secrets_t *secrets, record_keys_t *seal, record_keys_t *open);
+
+/* keys an AEAD context to seal or open with */
+int RecordInitCipher(EVP_CIPHER_CTX *ctx, const record_keys_t *keys, int seal);
+
+/* seals the content RECORD_HEADER_SIZE bytes into a buffer into a record, in place */
+size_t RecordSeal(EVP_CIPHER_CTX *ctx, const unsigned char *iv, uint64_t sequence, unsigned char *record, size_t length, int type);
+
+/* opens a record in place, leaving its content RECORD_HEADER_SIZE bytes in */
+int RecordOpen(EVP_CIPHER_CTX *ctx, const unsigned char *iv, uint64_t sequence, unsigned char *record, size_t *length);
+
+/* sets up a stream carrying a session on from the keys it was at */
+record_stream_t *RecordStreamCreate(const record_keys_t *seal, const record_keys_t *open, const unsigned char *unread, size_t length);
+
+/* releases a stream */
+void RecordStreamFree(record_stream_t *stream);
+
+/* reads the application data of the next record from the socket, without blocking */
+int RecordStreamRead(record_stream_t *stream, int fd, unsigned char *data, size_t size);
+
+/* seals data into a record and writes it to the socket, without blocking */
+int RecordStreamWrite(record_stream_t *stream, int fd, const unsigned char *data, size_t length);
+
+/* tells whether application data or a whole record waits in the stream */
+int RecordStreamPending(const record_stream_t *stream);
+
+/* returns the bytes read from the socket that no record was opened from yet */
+size_t RecordStreamUnread(const record_stream_t *stream, const unsigned char **unread);
+
+/* sends a close_notify alert, as far as the socket takes it */
+void RecordStreamClose(record_stream_t *stream, int fd);
+
+#endif  /* RECORD_H */
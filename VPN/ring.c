@@ -0,0 +1,463 @@
+#define _GNU_SOURCE		/* recvmmsg, sendmmsg */
+#include "ring.h"
+#include <stdlib.h>		/* malloc, calloc */
+#include <string.h>		/* memcpy 	*/
+#include <unistd.h>		/* read 		*/
+#include <errno.h>		/* EAGAIN 	*/
+#include <sys/socket.h>	/* mmsghdr 	*/
+#include <sys/uio.h>		/* iovec 		*/
+
+/*
+ * the state of a BIO created by PacketRingBioNew()
+ *
+ *  ring:		where written datagrams are queued
+ *  peer:		their destination, unused on a connected socket
+ *  connected:		whether the ring's socket is connected to the peer
+ *  datagram:		the received datagram the next read returns, NULL if none
+ *  datagram_length:	its length
+ */
+typedef struct ring_bio
+{
+	packet_ring_t *ring;
+	struct sockaddr_in peer;
+	int connected;
+	const unsigned char *datagram;
+	size_t datagram_length;
+} ring_bio_t;
+
+static BIO_METHOD *ring_bio_method = NULL;
+
+
+/*		
+ * Function:  PacketRingInit 
+ * --------------------
+ *  allocates the slots of a ring and the message headers pointing at them,
+ *  once, so bursts are moved without allocating or clearing anything
+ *
+ *  ring:	the ring
+ *  fd:		the socket PacketRingSend() sends from, -1 for a ring only read into
+ *
+ *  returns:	0 if successful, -1 if no memory is available
+ */
+int PacketRingInit(packet_ring_t *ring, int fd)
+{
+	size_t i = 0;
+
+	ring->fd = fd;
+	ring->count = 0;
+	ring->slots = malloc(RING_SLOTS * RING_SLOT_SIZE);
+	ring->peers = calloc(RING_SLOTS, sizeof(struct sockaddr_in));
+	ring->vectors = calloc(RING_SLOTS, sizeof(struct iovec));
+	ring->messages = calloc(RING_SLOTS, sizeof(struct mmsghdr));
+	if(NULL == ring->slots || NULL == ring->peers || NULL == ring->vectors || NULL == ring->messages)
+	{
+		PacketRingDestroy(ring);
+		return -1;
+	}
+
+	for(i = 0; i < RING_SLOTS; ++i)
+	{
+		ring->vectors[i].iov_base = PacketRingSlot(ring, i);
+		ring->messages[i].msg_hdr.msg_iov = &ring->vectors[i];
+		ring->messages[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	return 0;
+}
+
+
+/*		
+ * Function:  PacketRingDestroy 
+ * --------------------
+ *  releases the buffers of a ring
+ *
+ *  ring:	the ring
+ *
+ *  returns:	no return value
+ */
+void PacketRingDestroy(packet_ring_t *ring)
+{
+	free(ring->slots);
+	free(ring->peers);
+	free(ring->vectors);
+	free(ring->messages);
+	ring->slots = NULL;
+	ring->peers = NULL;
+	ring->vectors = NULL;
+	ring->messages = NULL;
+	ring->count = 0;
+}
+
+
+/*		
+ * Function:  PacketRingSlot 
+ * --------------------
+ *  returns where the payload of a slot starts, RING_HEADROOM bytes into it
+ *  so a frame header can be written in front of the packet in place
+ *
+ *  ring:	the ring
+ *  index:	the slot, below RING_SLOTS
+ *
+ *  returns:	pointer to the slot's payload, RING_PAYLOAD_SIZE bytes long
+ */
+unsigned char *PacketRingSlot(packet_ring_t *ring, size_t index)
+{
+	return ring->slots + index * RING_SLOT_SIZE + RING_HEADROOM;
+}
+
+
+/*		
+ * Function:  PacketRingRead 
+ * --------------------
+ *  reads every packet immediately available from a non-blocking TUN queue,
+ *  up to a full ring, each straight into its own slot; a TUN queue hands out
+ *  exactly one packet per read, so there is nothing to gain from readv()
+ *
+ *  ring:	the ring, emptied first
+ *  fd:		the TUN queue
+ *
+ *  returns:	the number of packets read, or -1 if reading failed before any packet
+ */
+int PacketRingRead(packet_ring_t *ring, int fd)
+{
+	ssize_t result = 0;
+
+	for(ring->count = 0; ring->count < RING_SLOTS; ++ring->count)
+	{
+		result = read(fd, PacketRingSlot(ring, ring->count), RING_PAYLOAD_SIZE);
+		if(-1 == result)
+		{
+			if(EAGAIN == errno || EWOULDBLOCK == errno || 0 < ring->count)
+			{
+				break;
+			}
+			return -1;
+		}
+		ring->lengths[ring->count] = result;
+	}
+
+	return ring->count;
+}
+
+
+/*		
+ * Function:  PacketRingReceive 
+ * --------------------
+ *  receives the datagrams waiting on a socket, up to a full ring, with a single
+ *  recvmmsg() call, each datagram into its own slot
+ *
+ *  ring:	the ring, emptied first
+ *  fd:		the socket
+ *
+ *  returns:	the number of datagrams received, or -1 if an error occurred
+ */
+int PacketRingReceive(packet_ring_t *ring, int fd)
+{
+	int result = 0;
+	int i = 0;
+
+	ring->count = 0;
+	for(i = 0; i < RING_SLOTS; ++i)
+	{
+		ring->vectors[i].iov_len = RING_PAYLOAD_SIZE;
+		ring->messages[i].msg_hdr.msg_name = NULL;
+		ring->messages[i].msg_hdr.msg_namelen = 0;
+	}
+
+	result = recvmmsg(fd, ring->messages, RING_SLOTS, MSG_DONTWAIT, NULL);
+	if(-1 == result)
+	{
+		if(EAGAIN == errno || EWOULDBLOCK == errno || EINTR == errno)
+		{
+			return 0;
+		}
+		return -1;
+	}
+
+	for(i = 0; i < result; ++i)
+	{
+		ring->lengths[i] = ring->messages[i].msg_len;
+	}
+	ring->count = result;
+
+	return result;
+}
+
+
+/*		
+ * Function:  PacketRingQueue 
+ * --------------------
+ *  copies a datagram into the next free slot, sending the whole ring first
+ *  if it is full
+ *
+ *  ring:	the ring
+ *  peer:	the datagram's destination, NULL if the ring's socket is connected
+ *  data:	the datagram
+ *  length:	datagram length
+ *
+ *  returns:	0 if successful, -1 if the datagram doesn't fit a slot
+ */
+int PacketRingQueue(packet_ring_t *ring, const struct sockaddr_in *peer, const void *data, size_t length)
+{
+	struct msghdr *header = NULL;
+
+	if(length > RING_PAYLOAD_SIZE)
+	{
+		return -1;
+	}
+
+	if(RING_SLOTS == ring->count)
+	{
+		PacketRingSend(ring);
+	}
+
+	header = &ring->messages[ring->count].msg_hdr;
+	if(NULL != peer)
+	{
+		ring->peers[ring->count] = *peer;
+		header->msg_name = &ring->peers[ring->count];
+		header->msg_namelen = sizeof(struct sockaddr_in);
+	}
+	else
+	{
+		header->msg_name = NULL;
+		header->msg_namelen = 0;
+	}
+
+	memcpy(PacketRingSlot(ring, ring->count), data, length);
+	ring->lengths[ring->count] = length;
+	++ring->count;
+
+	return 0;
+}
+
+
+/*		
+ * Function:  PacketRingSend 
+ * --------------------
+ *  sends every queued datagram from the ring's socket with as few sendmmsg()
+ *  calls as possible and empties the ring
+ *
+ *  like any lost datagram, the rest of the ring is dropped when the socket
+ *  buffer is full, and a datagram the kernel refuses is skipped
+ *
+ *  ring:	the ring
+ *
+ *  returns:	the number of datagrams sent
+ */
+int PacketRingSend(packet_ring_t *ring)
+{
+	size_t sent = 0;
+	size_t i = 0;
+	int result = 0;
+
+	for(i = 0; i < ring->count; ++i)
+	{
+		ring->vectors[i].iov_len = ring->lengths[i];
+	}
+
+	while(sent < ring->count)
+	{
+		result = sendmmsg(ring->fd, ring->messages + sent, ring->count - sent, MSG_DONTWAIT);
+		if(-1 == result)
+		{
+			if(EINTR == errno)
+			{
+				continue;
+			}
+			if(EAGAIN == errno || EWOULDBLOCK == errno)
+			{
+				break;
+			}
+			result = 1;		/* skip the datagram the error belongs to */
+		}
+		sent += result;
+	}
+
+	result = sent;
+	ring->count = 0;
+	return result;
+}
+
+
+/* ============================ */
+/*       PACKET RING BIO        */
+/* ============================ */
+/*		
+ * Function:  RingBioWrite 
+ * --------------------
+ *  queues a datagram SSL/DTLS wrote (one or more whole records) on the ring
+ *
+ *  returns:	the number of bytes written, or -1 if the datagram was too long
+ */
+static int RingBioWrite(BIO *bio, const char *data, int length)
+{
+	ring_bio_t *state = BIO_get_data(bio);
+
+	BIO_clear_retry_flags(bio);
+	if(-1 == PacketRingQueue(state->ring, state->connected ? NULL : &state->peer, data, length))
+	{
+		return -1;
+	}
+
+	return length;
+}
+
+
+/*		
+ * Function:  RingBioRead 
+ * --------------------
+ *  returns the datagram handed to the BIO by PacketRingBioFeed(), truncated
+ *  to the buffer like a datagram socket would
+ *
+ *  returns:	the number of bytes read, or -1 (retry) if no datagram is waiting
+ */
+static int RingBioRead(BIO *bio, char *buffer, int size)
+{
+	ring_bio_t *state = BIO_get_data(bio);
+	size_t length = 0;
+
+	BIO_clear_retry_flags(bio);
+	if(NULL == state->datagram)
+	{
+		BIO_set_retry_read(bio);
+		return -1;
+	}
+
+	length = state->datagram_length < (size_t)size ? state->datagram_length : (size_t)size;
+	memcpy(buffer, state->datagram, length);
+	state->datagram = NULL;
+
+	return length;
+}
+
+
+/*		
+ * Function:  RingBioCtrl 
+ * --------------------
+ *  answers the few controls SSL/DTLS issues on an established session
+ *
+ *  returns:	the control's result, 0 for unsupported controls
+ */
+static long RingBioCtrl(BIO *bio, int command, long number, void *pointer)
+{
+	(void)bio;
+	(void)number;
+	(void)pointer;
+
+	switch(command)
+	{
+		case BIO_CTRL_FLUSH:
+			return 1;
+		case BIO_CTRL_DGRAM_QUERY_MTU:
+			return RING_LINK_MTU;
+		case BIO_CTRL_DGRAM_GET_MTU_OVERHEAD:
+			return RING_MTU_OVERHEAD;
+		default:
+			return 0;
+	}
+}
+
+
+/*		
+ * Function:  RingBioCreate 
+ * --------------------
+ *  marks a new BIO initialized, its state is attached by PacketRingBioNew()
+ *
+ *  returns:	1
+ */
+static int RingBioCreate(BIO *bio)
+{
+	BIO_set_init(bio, 1);
+	return 1;
+}
+
+
+/*		
+ * Function:  RingBioDestroy 
+ * --------------------
+ *  releases the state of a BIO
+ *
+ *  returns:	1
+ */
+static int RingBioDestroy(BIO *bio)
+{
+	free(BIO_get_data(bio));
+	BIO_set_data(bio, NULL);
+	return 1;
+}
+
+
+/*		
+ * Function:  PacketRingBioNew 
+ * --------------------
+ *  creates a BIO for an established SSL/DTLS session that queues every datagram
+ *  the session writes on a ring, so the datagrams of a whole burst (of every
+ *  session sharing the ring) leave in one sendmmsg(), and that reads the datagrams
+ *  received into another ring with recvmmsg()
+ *
+ *  the BIO method is created on first use, which must not race with another thread
+ *
+ *  ring:	the ring written datagrams are queued on
+ *  peer:	their destination, NULL if the ring's socket is connected to the peer
+ *
+ *  returns:	the BIO, or NULL if an error occurred
+ */
+BIO *PacketRingBioNew(packet_ring_t *ring, const struct sockaddr_in *peer)
+{
+	BIO *bio = NULL;
+	ring_bio_t *state = NULL;
+
+	if(NULL == ring_bio_method)
+	{
+		ring_bio_method = BIO_meth_new(BIO_get_new_index() | BIO_TYPE_SOURCE_SINK, "packet ring");
+		if(NULL == ring_bio_method)
+		{
+			return NULL;
+		}
+		BIO_meth_set_write(ring_bio_method, RingBioWrite);
+		BIO_meth_set_read(ring_bio_method, RingBioRead);
+		BIO_meth_set_ctrl(ring_bio_method, RingBioCtrl);
+		BIO_meth_set_create(ring_bio_method, RingBioCreate);
+		BIO_meth_set_destroy(ring_bio_method, RingBioDestroy);
+	}
+
+	state = calloc(1, sizeof(ring_bio_t));
+	bio = BIO_new(ring_bio_method);
+	if(NULL == state || NULL == bio)
+	{
+		free(state);
+		BIO_free(bio);
+		return NULL;
+	}
+
+	state->ring = ring;
+	state->connected = (NULL == peer);
+	if(NULL != peer)
+	{
+		state->peer = *peer;
+	}
+	BIO_set_data(bio, state);
+
+	return bio;
+}
+
+
+/*		
+ * Function:  PacketRingBioFeed 
+ * --------------------
+ *  hands a received datagram to a BIO, the next SSL_read() decrypts it
+ *
+ *  bio:	a BIO created by PacketRingBioNew()
+ *  datagram:	the datagram, which must stay in place until it was read
+ *  length:	datagram length
+ *
+ *  returns:	no return value
+ */
+void PacketRingBioFeed(BIO *bio, const unsigned char *datagram, size_t length)
+{
+	ring_bio_t *state = BIO_get_data(bio);
+
+	state->datagram = datagram;
+	state->datagram_length = length;
+}
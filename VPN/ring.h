@@ -0,0 +1,62 @@
+#ifndef RING_H
+#define RING_H
+
+#include <stddef.h>		/* size_t 	*/
+#include <netinet/in.h>	/* sockaddr_in 	*/
+#include <openssl/bio.h>	/* BIO 		*/
+#include "frame.h"		/* FRAME_HEADER_SIZE, FRAME_BATCH_SIZE */
+
+#define RING_SLOTS 64						/* packets moved per burst */
+#define RING_SLOT_SIZE FRAME_BATCH_SIZE				/* a super-packet (offload.h) or a jumbo packet's DTLS record */
+#define RING_HEADROOM FRAME_HEADER_SIZE				/* room to frame a packet in place */
+#define RING_PAYLOAD_SIZE (RING_SLOT_SIZE - RING_HEADROOM)
+#define RING_LINK_MTU 1500
+#define RING_MTU_OVERHEAD 28					/* IPv4 and UDP headers */
+
+struct iovec;
+struct mmsghdr;
+
+/*
+ * a preallocated set of packet buffers, reused for every burst instead of
+ * a buffer per packet; slot i's payload starts RING_HEADROOM bytes into it
+ */
+typedef struct packet_ring
+{
+	int fd;				/* the socket queued datagrams are sent from */
+	unsigned char *slots;
+	size_t lengths[RING_SLOTS];
+	size_t count;			/* slots holding a packet */
+	struct sockaddr_in *peers;	/* per slot destination of a queued datagram */
+	struct iovec *vectors;
+	struct mmsghdr *messages;
+} packet_ring_t;
+
+
+/* allocates a ring, fd is the socket PacketRingSend() sends from (-1 if unused) */
+int PacketRingInit(packet_ring_t *ring, int fd);
+
+/* releases a ring's buffers */
+void PacketRingDestroy(packet_ring_t *ring);
+
+/* returns the payload of a slot, preceded by RING_HEADROOM writable bytes */
+unsigned char *PacketRingSlot(packet_ring_t *ring, size_t index);
+
+/* reads a burst of packets from a TUN queue, one packet per slot */
+int PacketRingRead(packet_ring_t *ring, int fd);
+
+/* receives a burst of datagrams with a single recvmmsg() */
+int PacketRingReceive(packet_ring_t *ring, int fd);
+
+/* queues a datagram, sending the ring first when it is full */
+int PacketRingQueue(packet_ring_t *ring, const struct sockaddr_in *peer, const void *data, size_t length);
+
+/* sends every queued datagram with sendmmsg() and empties the ring */
+int PacketRingSend(packet_ring_t *ring);
+
+/* creates a datagram BIO whose records are queued on a ring rather than sent one by one */
+BIO *PacketRingBioNew(packet_ring_t *ring, const struct sockaddr_in *peer);
+
+/* hands a received datagram to a BIO created by PacketRingBioNew() */
+void PacketRingBioFeed(BIO *bio, const unsigned char *datagram, size_t length);
+
+#endif  /* RING_H */
@@ -1,6 +1,7 @@
 /* ===================== */
 /*      HEADER FILES     */
 /* ===================== */
+#define _GNU_SOURCE		/* recvmmsg, sendmmsg 	*/
 #include <stdlib.h>
 #include <fcntl.h>		/* O_RDWR		*/
 #include <linux/if.h>		/* ifr			*/
@@ -9,46 +10,64 @@
 #include <arpa/inet.h>         /* inet_addr		*/
 #include <openssl/ssl.h> 	/* ssl			*/
 #include <unistd.h>            /* close, read, access */
-#include <sys/select.h>	/* select 		*/
+#include <sys/epoll.h>		/* epoll_wait 		*/
+#include <netinet/ip.h>		/* iphdr 		*/
 #include <string.h>		/* strstr 		*/
 #include <signal.h>		/* SIGINT 		*/
 #include <stdio.h>		/* printf 		*/  
 #include <ctype.h>		/* isalnum 		*/
+#include <errno.h>		/* EINTR 		*/
+#include <stdint.h>		/* uint64_t 		*/
+#include <stddef.h>		/* offsetof 		*/
+#include <pthread.h>		/* pthread_create 	*/
+#include <sys/eventfd.h>	/* eventfd 		*/
+#include <sys/timerfd.h>	/* timerfd_create 	*/
+#include <time.h>		/* clock_gettime 	*/
+#include <openssl/rand.h>	/* RAND_bytes 		*/
+#include <openssl/hmac.h>	/* HMAC 		*/
+#include "server.h"		/* server_t 		*/
+#include "netconf.h"		/* NetconfLinkUp 	*/
+#include "pmtu.h"		/* PMTU_DEFAULT 	*/
+#include "offload.h"		/* OffloadSegment 	*/
+#include "upgrade.h"		/* UpgradeSend 		*/
+#include "acceptor.h"		/* SetUpAcceptor 	*/
 
 /* ===================== */
 /*      DEFINITIONS      */
 /* ===================== */
-#define VNIC_NAME "tun0"
-#define PORT 1688
-#define MTU 1400
-#define BUFFER_SIZE 1500
-#define MAX_LINE_LENGTH 4096
-#define MIN_PORT 1024
-#define MAX_PORT 65535
-#define CMD_LINE_LENGTH 1024
-
-/*** COMPILE WITH -lssl -lcrypto IN THE END ***/
+/*** COMPILE WITH -lssl -lcrypto -pthread IN THE END ***/
 /********* RUN USING ROOT *********/
 
-static volatile int keep_running = 1;
+volatile int keep_running = 1;
+static volatile int reload_requested = 0;	/* SIGHUP came, the first acceptor reloads the TLS settings */
 int port = 0;
 char interface[16] = {'\0'};
 char server_crt[MAX_LINE_LENGTH] = {'\0'};
 char server_key[MAX_LINE_LENGTH] = {'\0'};
-
-
-/* ===================== */
-/*    UTILITY FUNCTIONS  */
-/* ===================== */
-/*		
- * Function:  max 
- * --------------------
- *  returns the maximum value between two integers (x, y)
- */
-int max(int x, int y)
-{
-   	return x > y ? x : y;
-}
+in_addr_t tunnel_network = 0;		/* host order */
+int tunnel_prefix_length = 0;
+int tunnel_mtu = PMTU_DEFAULT;		/* tun0's MTU, the most a client's tunnel MTU may be */
+int worker_count = 1;
+int acceptor_count = 1;			/* threads accepting clients, each on a listening socket of its own */
+int accept_steering = 0;		/* ACCEPT_STEERING=cpu: a connection goes to the acceptor of the CPU it came in on */
+int handshake_workers = 0;		/* threads running the handshakes' crypto for the acceptors, 0 when they run it themselves */
+int handshake_backlog = DEFAULT_HANDSHAKE_BACKLOG;
+int kernel_tls = 0;			/* install the TLS keys in the kernel (SSL_OP_ENABLE_KTLS of the context), read by the first acceptor only */
+int offload = 0;			/* tun0 takes and hands out super-packets behind a virtio_net_hdr (offload.h) */
+int keepalive_interval = DEFAULT_KEEPALIVE_INTERVAL;	/* seconds, 0 when keepalives are off */
+int keepalive_timeout = DEFAULT_KEEPALIVE_TIMEOUT;	/* seconds */
+cipher_config_t cipher_config;		/* CIPHERS, TLS_MIN_VERSION and GROUPS */
+char stats_path[STATS_PATH_LENGTH] = {'\0'};	/* the statistics socket, if set */
+char upgrade_path[STATS_PATH_LENGTH] = {'\0'};	/* the socket a new server takes over on, if set */
+unsigned char cookie_secret[COOKIE_SECRET_LENGTH];
+transport_t transport = TRANSPORT_TCP;
+io_backend_t io_backend = IO_BACKEND_EPOLL;
+queue_policy_t queue_policy = QUEUE_TAIL_DROP;
+size_t queue_length = DEFAULT_QUEUE_LENGTH;
+compress_mode_t compress_mode = COMPRESS_OFF;
+uint64_t default_rate = 0;		/* RATE_LIMIT, bytes per second per client, 0 for no cap */
+rate_rule_t rate_rules[MAX_RATE_RULES];
+int rate_rule_count = 0;
 
 
 /* ============================ */
@@ -156,459 +175,4284 @@ int ValidateAndAssignServerKey(char* value)
 
 
 /*		
- * Function:  ParseConfigFile 
+ * Function:  ValidateAndAssignTunnelNetwork 
  * --------------------
- *  parses the client configuration file to extract key-value pairs
- *  representing server host and port information
+ *  validates and assigns the tunnel network (CIDR notation, e.g. 10.8.0.0/24)
+ *  client addresses are leased from
  *
- *  config_file:    	pointer to the opened client configuration file
+ *  value:            	tunnel network value to validate and assign
  *
- *  returns:	       0 if successful, -1 if an error occurred
+ *  returns:		0 if successful, -1 if an error occurred
  */
-int ParseConfigFile(FILE *config_file)
+int ValidateAndAssignTunnelNetwork(char* value)
 {
-	char line[MAX_LINE_LENGTH];
-	char *key;
-	char *value;
-	
-	while(fgets(line, sizeof(line), config_file))
+	char address[INET_ADDRSTRLEN] = {'\0'};
+	char *slash = strchr(value, '/');
+	struct in_addr addr;
+	int prefix_length = 0;
+
+	if(NULL == slash || (size_t)(slash - value) >= sizeof(address))
 	{
-		key = strtok(line, "=");
-		value = strtok(NULL, "\n");
+		printf("Error: Invalid TUNNEL_NETWORK. Expected CIDR notation, e.g. 10.8.0.0/24.\n");
+		return -1;
+	}
 
-		if(0 == strcmp(key, "PORT"))
-		{
-			if(-1 == ValidateAndAssignPort(atoi(value)))
-			{
-				return -1;
-			}
-		}
-		else if(0 == strcmp(key, "INTERFACE"))
-		{
-			if(-1 == ValidateAndAssignInterface(value))
-			{
-				return -1;
-			}
-		}
-		else if(0 == strcmp(key, "SERVER_CRT"))
-		{
-			if(-1 == ValidateAndAssignServerCrt(value))
-			{
-				return -1;
-			}
-		}
-		else if(0 == strcmp(key, "SERVER_KEY"))
-		{
-			if(-1 == ValidateAndAssignServerKey(value))
-			{
-				return -1;
-			}
-		}
-		else
-		{
-			printf("Error: Invalid configuration in 'client_config_file.txt'.\n");
-			return -1;
-		}
+	memcpy(address, value, slash - value);
+	prefix_length = atoi(slash + 1);
+	if(1 != inet_pton(AF_INET, address, &addr) || 
+	   prefix_length < MIN_TUNNEL_PREFIX || prefix_length > MAX_TUNNEL_PREFIX)
+	{
+		printf("Error: Invalid TUNNEL_NETWORK. Expected an IPv4 network with a prefix length between %d and %d.\n", 
+		       MIN_TUNNEL_PREFIX, MAX_TUNNEL_PREFIX);
+		return -1;
 	}
-	
+
+	if(0 != (ntohl(addr.s_addr) & ~(0xFFFFFFFFu << (32 - prefix_length))))
+	{
+		printf("Error: Invalid TUNNEL_NETWORK. Host bits of the network address must be zero.\n");
+		return -1;
+	}
+
+	tunnel_network = ntohl(addr.s_addr);
+	tunnel_prefix_length = prefix_length;
 	return 0;
 }
 
 
 /*		
- * Function:  GetConfiguration 
+ * Function:  ValidateAndAssignMtu 
  * --------------------
- *  reads and parses a client configuration file to retrieve port and interface information 
+ *  validates and assigns the MTU of tun0, the largest packet a client may
+ *  send; the packets sent to a DTLS client are held to the tunnel MTU its
+ *  path MTU discovery settles on, which this caps
  *
- *  returns:	 0 if successful, -1 if an error occurred or the configuration is invalid
+ *  value:            	MTU value to validate and assign
+ *
+ *  returns:		0 if successful, -1 if an error occurred
  */
-int GetConfiguration()
+int ValidateAndAssignMtu(int value)
 {
-	FILE *config_file = NULL;
-	
-	config_file = fopen("server_config_file.txt", "r");
-	if(NULL == config_file)
-	{
-		printf("Error: Unable to open 'server_config_file.txt'. Ensure the file exists and has the appropriate permissions.\n");
-		return -1;
-	}
-	
-	if(-1 == ParseConfigFile(config_file))
+	if(value < PMTU_MIN || value > PMTU_MAX)
 	{
-		fclose(config_file);
+		printf("Error: Invalid MTU. MTU should be in the range %d-%d.\n", PMTU_MIN, PMTU_MAX);
 		return -1;
 	}
-	
-	fclose(config_file);
+
+	tunnel_mtu = value;
 	return 0;
 }
 
 
-/* ========================== */
-/*    NETWORK SETUP FUNCTIONS */
-/* ========================== */
 /*		
- * Function:  SetUpVictualNIC 
+ * Function:  ValidateAndAssignWorkers 
  * --------------------
- *  initializes a virtual network interface (TUN device) with the specified name
+ *  validates and assigns the number of forwarding threads, each owning its own
+ *  queue of a multi-queue TUN device
  *
- *  vnic_name:	the name of the virtual network interface to be created
+ *  value:            	workers value to validate and assign
  *
- *  returns: 	the file descriptor associated with the TUN device if successful,
- *              or -1 if an error occurred during setup
+ *  returns:		0 if successful, -1 if an error occurred
  */
-int SetUpVictualNIC(char *vnic_name)
+int ValidateAndAssignWorkers(int value)
 {
-	struct ifreq ifr;
-	int fd = 0;
-	char cmd[CMD_LINE_LENGTH];
-
-	system("ip tuntap add mode tun tun0");
-
-	fd = open("/dev/net/tun", O_RDWR);
-	if (-1 == fd)
+	if(value < 1 || value > MAX_WORKERS)
 	{
+		printf("Error: Invalid WORKERS. Workers should be in the range 1-%d.\n", MAX_WORKERS);
 		return -1;
 	}
 
-	memset(&ifr, 0, sizeof(ifr));
-	ifr.ifr_flags = IFF_TUN | IFF_NO_PI; 
-	strncpy(ifr.ifr_name, vnic_name, IFNAMSIZ);
+	worker_count = value;
+	return 0;
+}
 
-	if (-1 == ioctl(fd, TUNSETIFF, (void *)&ifr))
+
+/*		
+ * Function:  ValidateAndAssignAcceptors 
+ * --------------------
+ *  validates and assigns the number of threads accepting clients and running
+ *  their handshakes, each on a listening socket of its own (SO_REUSEPORT)
+ *
+ *  value:            	acceptors value to validate and assign
+ *
+ *  returns:		0 if successful, -1 if an error occurred
+ */
+int ValidateAndAssignAcceptors(int value)
+{
+	if(value < 1 || value > MAX_ACCEPTORS)
 	{
-		close(fd);
+		printf("Error: Invalid ACCEPTORS. Acceptors should be in the range 1-%d.\n", MAX_ACCEPTORS);
 		return -1;
-    	}
-    
-	system("ip link set dev tun0 up");
-	snprintf(cmd, sizeof(cmd), "ifconfig tun0 10.8.0.1/24 mtu %d up", MTU);
-	system(cmd);
-	
-	return fd;
+	}
+
+	acceptor_count = value;
+	return 0;
 }
 
 
 /*		
- * Function:  SetUpTCPSocketWithTLS 
+ * Function:  ValidateAndAssignAcceptSteering 
  * --------------------
- *  sets up a TCP socket and initializes an SSL/TLS context for secure communication
- *  
- *  this function creates a socket, binds it to an IP address and port, and sets up
- *  an SSL/TLS context with the server's certificate and private key
+ *  validates and assigns how connections are spread across the acceptors,
+ *  'hash' (the kernel hashes the connection's addresses and ports) or 'cpu'
+ *  (the acceptor of the CPU the connection came in on, see AttachSteering())
  *
- *  ctx:	a pointer to a pointer for storing the SSL/TLS context
- *  ssl:	a pointer to a pointer for storing the SSL/TLS session
+ *  value:            	steering value to validate and assign
  *
- *  returns:	the socket file descriptor if successful, or -1 if an error occurred
+ *  returns:		0 if successful, -1 if an error occurred
  */
-int SetUpTCPSocketWithTLS(SSL_CTX **ctx, SSL **ssl)
+int ValidateAndAssignAcceptSteering(char *value)
 {
-	int sockfd = 0;
-	struct sockaddr_in server_addr;
-
-	*ctx = SSL_CTX_new(TLS_server_method());
-	if(SSL_CTX_use_certificate_file(*ctx, server_crt, SSL_FILETYPE_PEM) != 1)
+	if(0 == strcmp(value, "cpu"))
 	{
-		printf("Error: Failed to use the provided certificate file.\n");
-		return -1;
+		accept_steering = 1;
 	}
-	if(SSL_CTX_use_PrivateKey_file(*ctx, server_key, SSL_FILETYPE_PEM) != 1)
+	else if(0 == strcmp(value, "hash"))
 	{
-		printf("Error: Failed to use the provided key file.\n");
-		return -1;
-	} 
-
-	if((sockfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0)) < 0)
+		accept_steering = 0;
+	}
+	else
 	{
+		printf("Error: Invalid ACCEPT_STEERING. ACCEPT_STEERING should be either 'hash' or 'cpu'.\n");
 		return -1;
 	}
 
-	server_addr.sin_family = AF_INET;
-	server_addr.sin_addr.s_addr = INADDR_ANY;
-	server_addr.sin_port = htons(port);
+	return 0;
+}
 
-	if(bind(sockfd, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0)
-	{
-		return -1;
-	}
 
-	if(listen(sockfd, 1) < 0)
+/*		
+ * Function:  ValidateAndAssignHandshakeWorkers 
+ * --------------------
+ *  validates and assigns the number of threads running the handshakes'
+ *  crypto for the acceptors, 0 to run it on the acceptors
+ *
+ *  value:            	handshake workers value to validate and assign
+ *
+ *  returns:		0 if successful, -1 if an error occurred
+ */
+int ValidateAndAssignHandshakeWorkers(int value)
+{
+	if(value < 0 || value > HANDSHAKE_MAX_WORKERS)
 	{
+		printf("Error: Invalid HANDSHAKE_WORKERS. Handshake workers should be in the range 0-%d.\n", HANDSHAKE_MAX_WORKERS);
 		return -1;
 	}
 
-	return sockfd;
+	handshake_workers = value;
+	return 0;
 }
 
 
 /*		
- * Function:  CreateConnection 
+ * Function:  ValidateAndAssignHandshakeBacklog 
  * --------------------
- *  accepts an incoming client connection, sets up an SSL/TLS session, 
- *  and performs SSL/TLS handshake with the client
+ *  validates and assigns how many full handshakes may wait for a handshake
+ *  worker before new clients are turned away
  *
- *  socket_fd:  a pointer to the socket file descriptor for the listening socket
- *  ctx:        a pointer to the SSL/TLS context
- *  ssl:        a pointer to a pointer for storing the SSL/TLS session
+ *  value:            	backlog value to validate and assign
  *
- *  returns:    the socket file descriptor for the established client connection
- *              if successful, or -1 if an error occurred during connection
+ *  returns:		0 if successful, -1 if an error occurred
  */
-int CreateConnection(int *socket_fd, SSL_CTX **ctx, SSL **ssl)
+int ValidateAndAssignHandshakeBacklog(int value)
 {
-	int conn_fd = 0;
-	int result = 0;
-	socklen_t len;
-	struct sockaddr_in client_addr;
-
-	len = sizeof(client_addr);
-
-	conn_fd = accept(*socket_fd, (struct sockaddr *)&client_addr, &len);
-	if(-1 == conn_fd)
+	if(value < 1 || value > MAX_HANDSHAKE_BACKLOG)
 	{
+		printf("Error: Invalid HANDSHAKE_BACKLOG. The backlog should be in the range 1-%d.\n", MAX_HANDSHAKE_BACKLOG);
 		return -1;
 	}
 
-	*ssl = SSL_new(*ctx);
-	SSL_set_fd(*ssl, conn_fd);
+	handshake_backlog = value;
+	return 0;
+}
+
 
-	if(SSL_accept(*ssl) != 1)
+/*		
+ * Function:  ValidateAndAssignTransport 
+ * --------------------
+ *  validates and assigns the tunnel transport, 'tcp' (TLS) or 'udp' (DTLS)
+ *
+ *  value:            	transport value to validate and assign
+ *
+ *  returns:		0 if successful, -1 if an error occurred
+ */
+int ValidateAndAssignTransport(char* value)
+{
+	if(0 == strcmp(value, "tcp"))
+	{
+		transport = TRANSPORT_TCP;
+	}
+	else if(0 == strcmp(value, "udp"))
+	{
+		transport = TRANSPORT_UDP;
+	}
+	else
 	{
-		printf("Error: SSL handshake failed with the client.\n");
+		printf("Error: Invalid TRANSPORT. Transport should be either 'tcp' or 'udp'.\n");
 		return -1;
 	}
 
-	printf("Client successfully connected.\n");
-	return conn_fd;
+	return 0;
 }
 
 
 /*		
- * Function:  RouteTraffic 
+ * Function:  ValidateAndAssignIoBackend 
  * --------------------
- *  configures network routing to enable IP forwarding
- *  and sets up NAT rules to masquerade outgoing traffic
+ *  validates and assigns how the workers wait for traffic, 'epoll' or 'io_uring'
  *
- *  returns:    no return value
+ *  value:            	backend value to validate and assign
+ *
+ *  returns:		0 if successful, -1 if an error occurred
  */
-void RouteTraffic()
+int ValidateAndAssignIoBackend(char* value)
 {
-	char cmd[CMD_LINE_LENGTH];
-		
-	system("sysctl -w net.ipv4.ip_forward=1");				/* enable IP forwarding */
-	snprintf(cmd, sizeof(cmd), "iptables -t nat -A POSTROUTING -o %s -j MASQUERADE", interface);
-	system(cmd);								/* masquerade outgoing traffic */
+	if(0 == strcmp(value, "epoll"))
+	{
+		io_backend = IO_BACKEND_EPOLL;
+	}
+	else if(0 == strcmp(value, "io_uring"))
+	{
+		io_backend = IO_BACKEND_IO_URING;
+	}
+	else
+	{
+		printf("Error: Invalid IO_BACKEND. Backend should be either 'epoll' or 'io_uring'.\n");
+		return -1;
+	}
+
+	return 0;
 }
 
 
 /*		
- * Function:  HandleTrafficFromClient 
+ * Function:  ValidateAndAssignKernelTls 
  * --------------------
- *  reads data from an SSL connection and writes it to a virtual NIC
+ *  validates and assigns whether TLS records are encrypted by the kernel (kTLS),
+ *  'on' or 'off'; only applies to TRANSPORT=tcp, and falls back to user-space TLS
+ *  when the kernel lacks the 'tls' module or the negotiated cipher
  *
- *  virtual_nic_fd:   file descriptor of the virtual NIC
- *  ssl:              pointer to the SSL connection
+ *  value:            	kTLS value to validate and assign
  *
- *  returns:          0 on success, -1 on error
+ *  returns:		0 if successful, -1 if an error occurred
  */
-int HandleTrafficFromClient(int virtual_nic_fd, SSL* ssl)
+int ValidateAndAssignKernelTls(char *value)
 {
-	int read_result = 0;
-	char buffer[BUFFER_SIZE];
-
-	read_result = SSL_read(ssl, buffer, sizeof(buffer));
-	if(0 >= read_result)
+	if(0 == strcmp(value, "on"))
 	{
-		return -1;
+		kernel_tls = 1;
 	}
-    
-	if(-1 == write(virtual_nic_fd, (const void *)buffer, read_result))
+	else if(0 == strcmp(value, "off"))
+	{
+		kernel_tls = 0;
+	}
+	else
 	{
+		printf("Error: Invalid KTLS. KTLS should be either 'on' or 'off'.\n");
 		return -1;
 	}
 
-	memset(buffer, 0, sizeof(buffer));
 	return 0;
 }
 
 
 /*		
- * Function:  HandleTrafficToClient 
+ * Function:  ValidateAndAssignOffload 
  * --------------------
- *  reads data from a virtual NIC and writes it to an SSL connection
+ *  validates and assigns whether tun0 uses segmentation and checksum offloads,
+ *  'on' or 'off'; TCP super-packets then cross the tunnel whole to clients that
+ *  take them over TRANSPORT=tcp, and are cut into plain packets for the others
  *
- *  virtual_nic_fd:   file descriptor of the virtual NIC
- *  ssl:              pointer to the SSL connection
+ *  value:            	offload value to validate and assign
  *
- *  returns:          0 on success, -1 on error
+ *  returns:		0 if successful, -1 if an error occurred
  */
-int HandleTrafficToClient(int virtual_nic_fd, SSL *ssl)
+int ValidateAndAssignOffload(char *value)
 {
-	int read_result = 0;
-	char buffer[BUFFER_SIZE];
-
-	read_result = read(virtual_nic_fd, buffer, sizeof(buffer));
-	if(-1 == read_result)
+	if(0 == strcmp(value, "on"))
 	{
-		return -1;
+		offload = 1;
 	}
-    
-	if(0 >= SSL_write(ssl, buffer, read_result))
+	else if(0 == strcmp(value, "off"))
+	{
+		offload = 0;
+	}
+	else
 	{
+		printf("Error: Invalid OFFLOAD. OFFLOAD should be either 'on' or 'off'.\n");
 		return -1;
 	}
 
-	memset(buffer, 0, sizeof(buffer));
 	return 0;
 }
 
 
 /*		
- * Function:  ClearRoutingTable 
+ * Function:  ValidateAndAssignKeepalive 
  * --------------------
- *  clears the routing table by removing the NAT rule that masquerades outgoing traffic
+ *  validates and assigns how often a keepalive is sent to a client the server
+ *  had nothing else to send for a while, and how long a client may go without
+ *  sending anything before its session is closed; 'off' sends none and keeps
+ *  silent clients
  *
- *  returns:  no return value
+ *  value:            	'<interval>,<timeout>' in seconds to validate and assign, e.g. '10,60', or 'off'
+ *
+ *  returns:		0 if successful, -1 if an error occurred
  */
-void ClearRoutingTable()
+int ValidateAndAssignKeepalive(char *value)
 {
-	system("iptables -t nat -D POSTROUTING -o ens33 -j MASQUERADE"); 
+	int interval = 0;
+	int timeout = 0;
+	char end = '\0';
+
+	if(0 == strcmp(value, "off"))
+	{
+		keepalive_interval = 0;
+		return 0;
+	}
+
+	if(2 != sscanf(value, "%d,%d%c", &interval, &timeout, &end) || 1 > interval || interval >= timeout || MAX_KEEPALIVE < timeout)
+	{
+		printf("Error: Invalid KEEPALIVE. It should be 'off' or '<interval>,<timeout>' in seconds, the timeout longer than the interval and at most %d, e.g. '10,60'.\n", MAX_KEEPALIVE);
+		return -1;
+	}
+
+	keepalive_interval = interval;
+	keepalive_timeout = timeout;
+	return 0;
 }
 
 
 /*		
- * Function:  RemoveVirtualNic 
+ * Function:  ValidateAndAssignCiphers 
  * --------------------
- *  removes the virtual network interface (TUN device) from the system
+ *  validates and assigns the cipher preference, 'auto' to benchmark AES-GCM
+ *  against ChaCha20-Poly1305 at startup and prefer the faster one on this CPU,
+ *  or a colon separated list of TLS 1.3 suites and TLS 1.2/DTLS ciphers;
+ *  the list itself is checked when the context is created
  *
- *  returns:  no return value
+ *  value:            	ciphers value to validate and assign
+ *
+ *  returns:		0 if successful, -1 if an error occurred
  */
-void RemoveVirtualNic()
+int ValidateAndAssignCiphers(char *value)
 {
-	system("ip link delete tun0");
+	if(strlen(value) >= sizeof(cipher_config.ciphers))
+	{
+		printf("Error: Invalid CIPHERS. The list is too long.\n");
+		return -1;
+	}
+
+	strcpy(cipher_config.ciphers, value);
+	return 0;
 }
 
 
 /*		
- * Function:  CleanUp 
+ * Function:  ValidateAndAssignTlsMinVersion 
  * --------------------
- *  closes the network connections, SSL context, and releases resources
+ *  validates and assigns the lowest protocol version clients may use
  *
- *  virtual_nic_fd:  file descriptor of the virtual network interface (TUN device)
- *  socket_fd:       file descriptor of the TCP socket
- *  conn_fd:         file descriptor of the client connection
- *  ctx:             SSL context
- *  ssl:             SSL session
+ *  value:            	version value to validate and assign, '1.2' or '1.3'
  *
- *  returns:	      no return value
+ *  returns:		0 if successful, -1 if an error occurred
  */
-void CleanUp(int virtual_nic_fd, int socket_fd, int conn_fd, SSL_CTX *ctx, SSL *ssl)
+int ValidateAndAssignTlsMinVersion(char *value)
 {
-	close(virtual_nic_fd);
-	close(socket_fd);
-	close(conn_fd);
-	SSL_free(ssl);
-	SSL_CTX_free(ctx); 
-	RemoveVirtualNic();
-	ClearRoutingTable();
+	return CipherParseMinVersion(value, &cipher_config.min_version);
 }
 
 
 /*		
- * Function:  HandleCtrlC 
+ * Function:  ValidateAndAssignGroups 
  * --------------------
- *  handles the Ctrl+C signal by updating the keep_running flag to terminate the program
+ *  validates and assigns the key exchange groups, in preference order
+ *  (for example 'X25519:P-256'); checked when the context is created
  *
- *  dummy:	unused parameter (required by signal handler)
+ *  value:            	groups value to validate and assign
  *
- *  Returns:	no return value
+ *  returns:		0 if successful, -1 if an error occurred
  */
-void HandleCtrlC(int dummy)
+int ValidateAndAssignGroups(char *value)
 {
-	keep_running = 0;
+	if(strlen(value) >= sizeof(cipher_config.groups))
+	{
+		printf("Error: Invalid GROUPS. The list is too long.\n");
+		return -1;
+	}
+
+	strcpy(cipher_config.groups, value);
+	return 0;
 }
 
 
-/*		 
- * Function:  main 
+/*		
+ * Function:  ValidateAndAssignQueueLength 
  * --------------------
- *  the entry point of the VPN server application. sets up the virtual NIC, TCP socket,
- *  and SSL context, and then enters a loop to handle incoming and outgoing traffic
+ *  validates and assigns how many records may wait for a slow client's
+ *  connection before QUEUE_POLICY drops some
+ *
+ *  value:            	queue length value to validate and assign
+ *
+ *  returns:		0 if successful, -1 if an error occurred
  */
-int main()
+int ValidateAndAssignQueueLength(int value)
 {
-	int virtual_nic_fd = -1;
-	int socket_fd = -1;
-	int conn_fd = -1;
-	int maxfdp = 0;
-	fd_set read_fds;
-	SSL_CTX *ctx;
-	SSL *ssl;
-	
-	if(-1 == GetConfiguration())
+	if(value < 1 || value > MAX_QUEUE_LENGTH)
 	{
+		printf("Error: Invalid QUEUE_LENGTH. Queue length should be in the range 1-%d.\n", MAX_QUEUE_LENGTH);
 		return -1;
 	}
-	
-	/* set up the virtual network interface (TUN device) */
-	virtual_nic_fd = SetUpVictualNIC(VNIC_NAME);
-	if (-1 == virtual_nic_fd)
-	{
+
+	queue_length = value;
+	return 0;
+}
+
+
+/*		
+ * Function:  ValidateAndAssignQueuePolicy 
+ * --------------------
+ *  validates and assigns what a client's full send queue drops,
+ *  'tail-drop' (the new record) or 'head-drop' (the oldest one)
+ *
+ *  value:            	policy value to validate and assign
+ *
+ *  returns:		0 if successful, -1 if an error occurred
+ */
+int ValidateAndAssignQueuePolicy(char *value)
+{
+	if(0 == strcmp(value, "tail-drop"))
+	{
+		queue_policy = QUEUE_TAIL_DROP;
+	}
+	else if(0 == strcmp(value, "head-drop"))
+	{
+		queue_policy = QUEUE_HEAD_DROP;
+	}
+	else
+	{
+		printf("Error: Invalid QUEUE_POLICY. Policy should be either 'tail-drop' or 'head-drop'.\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/*		
+ * Function:  ValidateAndAssignCompression 
+ * --------------------
+ *  validates and assigns whether the packets sent to clients that restore
+ *  them are compressed: 'off', 'on' or 'adaptive' (skips flows that don't compress)
+ *
+ *  value:            	compression value to validate and assign
+ *
+ *  returns:		0 if successful, -1 if an error occurred
+ */
+int ValidateAndAssignCompression(char *value)
+{
+	return CompressParseMode(value, &compress_mode);
+}
+
+
+/*		
+ * Function:  ValidateAndAssignRateLimit 
+ * --------------------
+ *  validates and assigns the rate every client is capped at, unless a
+ *  CLIENT_RATE_LIMIT names it, in bits per second ('0' for no cap)
+ *
+ *  value:            	rate value to validate and assign, e.g. '20M'
+ *
+ *  returns:		0 if successful, -1 if an error occurred
+ */
+int ValidateAndAssignRateLimit(char *value)
+{
+	if(-1 == ShaperParseRate(value, &default_rate))
+	{
+		printf("Error: Invalid RATE_LIMIT. Rate should be in bits per second, e.g. '500k', '20M' or '1G'.\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/*		
+ * Function:  ValidateAndAssignClientRateLimit 
+ * --------------------
+ *  validates and adds the rate one client is capped at, by its public address,
+ *  in place of RATE_LIMIT; the key may be given once per client
+ *
+ *  value:            	'<address>,<rate>' value to validate and add, e.g. '203.0.113.7,5M'
+ *
+ *  returns:		0 if successful, -1 if an error occurred
+ */
+int ValidateAndAssignClientRateLimit(char *value)
+{
+	char *separator = strchr(value, ',');
+	rate_rule_t *rule = &rate_rules[rate_rule_count];
+
+	if(MAX_RATE_RULES == rate_rule_count)
+	{
+		printf("Error: Too many CLIENT_RATE_LIMIT entries, at most %d are supported.\n", MAX_RATE_RULES);
+		return -1;
+	}
+
+	if(NULL == separator)
+	{
+		printf("Error: Invalid CLIENT_RATE_LIMIT. It should be '<address>,<rate>', e.g. '203.0.113.7,5M'.\n");
+		return -1;
+	}
+	*separator = '\0';
+
+	if(1 != inet_pton(AF_INET, value, &rule->addr) || -1 == ShaperParseRate(separator + 1, &rule->rate))
+	{
+		printf("Error: Invalid CLIENT_RATE_LIMIT. It should be '<address>,<rate>', e.g. '203.0.113.7,5M'.\n");
+		return -1;
+	}
+
+	++rate_rule_count;
+	return 0;
+}
+
+
+/*		
+ * Function:  ValidateAndAssignStatsSocket 
+ * --------------------
+ *  validates and assigns the path of the Unix domain socket the statistics are
+ *  served on, in the Prometheus text format
+ *
+ *  value:            	path value to validate and assign
+ *
+ *  returns:		0 if successful, -1 if an error occurred
+ */
+int ValidateAndAssignStatsSocket(char *value)
+{
+	if(strlen(value) >= sizeof(stats_path))
+	{
+		printf("Error: Invalid STATS_SOCKET. The path should be shorter than %zu characters.\n", sizeof(stats_path));
+		return -1;
+	}
+
+	strcpy(stats_path, value);
+	return 0;
+}
+
+
+/*		
+ * Function:  ValidateAndAssignUpgradeSocket 
+ * --------------------
+ *  validates and assigns the path of the Unix domain socket a new server
+ *  connects to in order to take over from this one (see HandleUpgrade())
+ *
+ *  value:            	path value to validate and assign
+ *
+ *  returns:		0 if successful, -1 if an error occurred
+ */
+int ValidateAndAssignUpgradeSocket(char *value)
+{
+	if(strlen(value) >= sizeof(upgrade_path))
+	{
+		printf("Error: Invalid UPGRADE_SOCKET. The path should be shorter than %zu characters.\n", sizeof(upgrade_path));
+		return -1;
+	}
+
+	strcpy(upgrade_path, value);
+	return 0;
+}
+
+
+/*		
+ * Function:  IsReloadableKey 
+ * --------------------
+ *  tells whether a configuration key only shapes the TLS context, so a
+ *  reload may change it for the handshakes that follow; the other keys
+ *  size or wire up the tunnel and take a restart
+ *
+ *  key:    		the configuration key
+ *
+ *  returns:	       1 if the key is reloaded, 0 if not
+ */
+int IsReloadableKey(const char *key)
+{
+	static const char *reloadable[] = {"SERVER_CRT", "SERVER_KEY", "CIPHERS", "TLS_MIN_VERSION", "GROUPS", "KTLS"};
+	size_t i = 0;
+
+	for(i = 0; i < sizeof(reloadable) / sizeof(reloadable[0]); ++i)
+	{
+		if(0 == strcmp(key, reloadable[i]))
+		{
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+
+/*		
+ * Function:  ParseConfigFile 
+ * --------------------
+ *  parses the client configuration file to extract key-value pairs
+ *  representing server host and port information
+ *
+ *  config_file:    	pointer to the opened client configuration file
+ *  reload:		only take the keys IsReloadableKey() allows, skipping the rest
+ *
+ *  returns:	       0 if successful, -1 if an error occurred
+ */
+int ParseConfigFile(FILE *config_file, int reload)
+{
+	char line[MAX_LINE_LENGTH];
+	char *key;
+	char *value;
+	
+	while(fgets(line, sizeof(line), config_file))
+	{
+		key = strtok(line, "=");
+		value = strtok(NULL, "\n");
+
+		if(reload && !IsReloadableKey(key))
+		{
+			continue;
+		}
+
+		if(0 == strcmp(key, "PORT"))
+		{
+			if(-1 == ValidateAndAssignPort(atoi(value)))
+			{
+				return -1;
+			}
+		}
+		else if(0 == strcmp(key, "INTERFACE"))
+		{
+			if(-1 == ValidateAndAssignInterface(value))
+			{
+				return -1;
+			}
+		}
+		else if(0 == strcmp(key, "SERVER_CRT"))
+		{
+			if(-1 == ValidateAndAssignServerCrt(value))
+			{
+				return -1;
+			}
+		}
+		else if(0 == strcmp(key, "SERVER_KEY"))
+		{
+			if(-1 == ValidateAndAssignServerKey(value))
+			{
+				return -1;
+			}
+		}
+		else if(0 == strcmp(key, "TUNNEL_NETWORK"))
+		{
+			if(-1 == ValidateAndAssignTunnelNetwork(value))
+			{
+				return -1;
+			}
+		}
+		else if(0 == strcmp(key, "MTU"))
+		{
+			if(-1 == ValidateAndAssignMtu(atoi(value)))
+			{
+				return -1;
+			}
+		}
+		else if(0 == strcmp(key, "WORKERS"))
+		{
+			if(-1 == ValidateAndAssignWorkers(atoi(value)))
+			{
+				return -1;
+			}
+		}
+		else if(0 == strcmp(key, "ACCEPTORS"))
+		{
+			if(-1 == ValidateAndAssignAcceptors(atoi(value)))
+			{
+				return -1;
+			}
+		}
+		else if(0 == strcmp(key, "ACCEPT_STEERING"))
+		{
+			if(-1 == ValidateAndAssignAcceptSteering(value))
+			{
+				return -1;
+			}
+		}
+		else if(0 == strcmp(key, "HANDSHAKE_WORKERS"))
+		{
+			if(-1 == ValidateAndAssignHandshakeWorkers(atoi(value)))
+			{
+				return -1;
+			}
+		}
+		else if(0 == strcmp(key, "HANDSHAKE_BACKLOG"))
+		{
+			if(-1 == ValidateAndAssignHandshakeBacklog(atoi(value)))
+			{
+				return -1;
+			}
+		}
+		else if(0 == strcmp(key, "TRANSPORT"))
+		{
+			if(-1 == ValidateAndAssignTransport(value))
+			{
+				return -1;
+			}
+		}
+		else if(0 == strcmp(key, "IO_BACKEND"))
+		{
+			if(-1 == ValidateAndAssignIoBackend(value))
+			{
+				return -1;
+			}
+		}
+		else if(0 == strcmp(key, "KTLS"))
+		{
+			if(-1 == ValidateAndAssignKernelTls(value))
+			{
+				return -1;
+			}
+		}
+		else if(0 == strcmp(key, "OFFLOAD"))
+		{
+			if(-1 == ValidateAndAssignOffload(value))
+			{
+				return -1;
+			}
+		}
+		else if(0 == strcmp(key, "CIPHERS"))
+		{
+			if(-1 == ValidateAndAssignCiphers(value))
+			{
+				return -1;
+			}
+		}
+		else if(0 == strcmp(key, "TLS_MIN_VERSION"))
+		{
+			if(-1 == ValidateAndAssignTlsMinVersion(value))
+			{
+				return -1;
+			}
+		}
+		else if(0 == strcmp(key, "GROUPS"))
+		{
+			if(-1 == ValidateAndAssignGroups(value))
+			{
+				return -1;
+			}
+		}
+		else if(0 == strcmp(key, "QUEUE_LENGTH"))
+		{
+			if(-1 == ValidateAndAssignQueueLength(atoi(value)))
+			{
+				return -1;
+			}
+		}
+		else if(0 == strcmp(key, "QUEUE_POLICY"))
+		{
+			if(-1 == ValidateAndAssignQueuePolicy(value))
+			{
+				return -1;
+			}
+		}
+		else if(0 == strcmp(key, "COMPRESSION"))
+		{
+			if(-1 == ValidateAndAssignCompression(value))
+			{
+				return -1;
+			}
+		}
+		else if(0 == strcmp(key, "RATE_LIMIT"))
+		{
+			if(-1 == ValidateAndAssignRateLimit(value))
+			{
+				return -1;
+			}
+		}
+		else if(0 == strcmp(key, "KEEPALIVE"))
+		{
+			if(-1 == ValidateAndAssignKeepalive(value))
+			{
+				return -1;
+			}
+		}
+		else if(0 == strcmp(key, "CLIENT_RATE_LIMIT"))
+		{
+			if(-1 == ValidateAndAssignClientRateLimit(value))
+			{
+				return -1;
+			}
+		}
+		else if(0 == strcmp(key, "STATS_SOCKET"))
+		{
+			if(-1 == ValidateAndAssignStatsSocket(value))
+			{
+				return -1;
+			}
+		}
+		else if(0 == strcmp(key, "UPGRADE_SOCKET"))
+		{
+			if(-1 == ValidateAndAssignUpgradeSocket(value))
+			{
+				return -1;
+			}
+		}
+		else
+		{
+			printf("Error: Invalid configuration in 'client_config_file.txt'.\n");
+			return -1;
+		}
+	}
+	
+	return 0;
+}
+
+
+/*		
+ * Function:  GetConfiguration 
+ * --------------------
+ *  reads and parses a client configuration file to retrieve port and interface information 
+ *
+ *  returns:	 0 if successful, -1 if an error occurred or the configuration is invalid
+ */
+int GetConfiguration()
+{
+	FILE *config_file = NULL;
+	char default_network[] = DEFAULT_TUNNEL_NETWORK;
+	
+	/* optional keys */
+	ValidateAndAssignTunnelNetwork(default_network);
+
+	config_file = fopen("server_config_file.txt", "r");
+	if(NULL == config_file)
+	{
+		printf("Error: Unable to open 'server_config_file.txt'. Ensure the file exists and has the appropriate permissions.\n");
+		return -1;
+	}
+	
+	if(-1 == ParseConfigFile(config_file, 0))
+	{
+		fclose(config_file);
+		return -1;
+	}
+	
+	fclose(config_file);
+
+	/* DTLS clients move to sockets of their own bound to the listener's port, only TCP listeners are sharded */
+	if(1 < acceptor_count && TRANSPORT_UDP == transport)
+	{
+		printf("Error: Invalid ACCEPTORS. More than one acceptor takes TRANSPORT=tcp.\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/* ========================== */
+/*    LEASE POOL FUNCTIONS    */
+/* ========================== */
+/*		
+ * Function:  LeasePoolInit 
+ * --------------------
+ *  initializes an address pool over a tunnel network, reserving the network
+ *  address, the server's address (the first host) and the broadcast address
+ *
+ *  pool:		the pool to initialize
+ *  network:		the tunnel network address (host order)
+ *  prefix_length:	the tunnel network prefix length
+ *
+ *  returns:		0 if successful, -1 if memory allocation failed
+ */
+int LeasePoolInit(lease_pool_t *pool, in_addr_t network, int prefix_length)
+{
+	pool->network = network;
+	pool->size = 1u << (32 - prefix_length);
+	pool->hint = 0;
+	pool->bitmap = calloc((pool->size + 63) / 64, sizeof(uint64_t));
+	if(NULL == pool->bitmap)
+	{
+		return -1;
+	}
+
+	pool->bitmap[0] |= 0x3;						/* network and server */
+	pool->bitmap[(pool->size - 1) / 64] |= 1ull << ((pool->size - 1) % 64);	/* broadcast */
+	return 0;
+}
+
+
+/*		
+ * Function:  LeasePoolDestroy 
+ * --------------------
+ *  releases the memory of an address pool
+ *
+ *  pool:	the pool to destroy
+ *
+ *  returns:	no return value
+ */
+void LeasePoolDestroy(lease_pool_t *pool)
+{
+	free(pool->bitmap);
+	pool->bitmap = NULL;
+}
+
+
+/*		
+ * Function:  LeasePoolAcquire 
+ * --------------------
+ *  leases a free address, scanning the bitmap a word at a time starting 
+ *  from where the last lease was found
+ *
+ *  pool:	the pool to lease from
+ *  addr:	set to the leased address (network order)
+ *
+ *  returns:	0 if successful, -1 if the pool is exhausted
+ */
+int LeasePoolAcquire(lease_pool_t *pool, in_addr_t *addr)
+{
+	uint32_t words = (pool->size + 63) / 64;
+	uint32_t word = 0;
+	uint32_t i = 0;
+	int bit = 0;
+
+	for(i = 0; i < words; ++i)
+	{
+		word = (pool->hint + i) % words;
+		if(~0ull != pool->bitmap[word])
+		{
+			bit = __builtin_ctzll(~pool->bitmap[word]);
+			pool->bitmap[word] |= 1ull << bit;
+			pool->hint = word;
+			*addr = htonl(pool->network + word * 64 + bit);
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+
+/*		
+ * Function:  LeasePoolRelease 
+ * --------------------
+ *  returns a leased address to the pool
+ *
+ *  pool:	the pool the address was leased from
+ *  addr:	the leased address (network order)
+ *
+ *  returns:	no return value
+ */
+void LeasePoolRelease(lease_pool_t *pool, in_addr_t addr)
+{
+	uint32_t offset = ntohl(addr) - pool->network;
+
+	pool->bitmap[offset / 64] &= ~(1ull << (offset % 64));
+}
+
+
+/*		
+ * Function:  LeasePoolReserve 
+ * --------------------
+ *  leases a given address, the one a client carried over from the previous
+ *  server already has
+ *
+ *  pool:	the pool to lease from
+ *  addr:	the address (network order)
+ *
+ *  returns:	0 if successful, -1 if the address is outside the pool or leased already
+ */
+int LeasePoolReserve(lease_pool_t *pool, in_addr_t addr)
+{
+	uint32_t offset = ntohl(addr) - pool->network;
+
+	if(offset >= pool->size || (pool->bitmap[offset / 64] & (1ull << (offset % 64))))
+	{
+		return -1;
+	}
+
+	pool->bitmap[offset / 64] |= 1ull << (offset % 64);
+	return 0;
+}
+
+
+/* ========================== */
+/*    NETWORK SETUP FUNCTIONS */
+/* ========================== */
+/*		
+ * Function:  SetUpVictualNIC 
+ * --------------------
+ *  initializes a virtual network interface (TUN device) with the specified name
+ *
+ *  with more than one queue the device is created with IFF_MULTI_QUEUE and the
+ *  kernel spreads the packets it routes to the device across the queues by flow;
+ *  the device isn't persistent, it goes away with its last queue
+ *
+ *  with OFFLOAD=on it is created with IFF_VNET_HDR and its offloads enabled,
+ *  its super-packets capped to what fits a frame
+ *
+ *  vnic_name:		the name of the virtual network interface to be created
+ *  queue_fds:		filled with one file descriptor per queue
+ *  queue_count:	the number of queues to open
+ *
+ *  returns: 	0 if successful, or -1 if an error occurred during setup
+ */
+int SetUpVictualNIC(char *vnic_name, int *queue_fds, int queue_count)
+{
+	struct ifreq ifr;
+	int i = 0;
+	struct in_addr server_addr;
+
+	memset(&ifr, 0, sizeof(ifr));
+	ifr.ifr_flags = IFF_TUN | IFF_NO_PI | (1 == queue_count ? 0 : IFF_MULTI_QUEUE) | (offload ? IFF_VNET_HDR : 0);
+	strncpy(ifr.ifr_name, vnic_name, IFNAMSIZ);
+
+	for(i = 0; i < queue_count; ++i)
+	{
+		queue_fds[i] = open("/dev/net/tun", O_RDWR | O_NONBLOCK);	/* lets the event loop drain every queued packet */
+		if (-1 == queue_fds[i] || -1 == ioctl(queue_fds[i], TUNSETIFF, (void *)&ifr))
+		{
+			if(-1 != queue_fds[i])
+			{
+				close(queue_fds[i]);
+			}
+			while(i-- > 0)
+			{
+				close(queue_fds[i]);
+			}
+			return -1;
+		}
+	}
+    
+	server_addr.s_addr = htonl(tunnel_network + 1);		/* the first host address is the server's */
+	if(-1 == NetconfSetAddress(vnic_name, server_addr, tunnel_prefix_length) || -1 == NetconfLinkUp(vnic_name, tunnel_mtu) ||
+	   (offload && (-1 == NetconfLinkLimitGso(vnic_name, OFFLOAD_MAX_LENGTH) || -1 == OffloadEnable(queue_fds[0]))))
+	{
+		printf("Error: Failed to configure %s: %s.\n", vnic_name, strerror(errno));
+		for(i = 0; i < queue_count; ++i)
+		{
+			close(queue_fds[i]);
+		}
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/*		
+ * Function:  EnableSessionResumption 
+ * --------------------
+ *  lets reconnecting clients resume their session with an abbreviated handshake,
+ *  skipping the key exchange and the certificate: TLS 1.3 and DTLS 1.2 clients
+ *  get a session ticket encrypted with a key that lives in the context (shared by
+ *  every worker), and the session cache covers clients resuming by session id
+ *
+ *  ctx:	the SSL/TLS (or SSL/DTLS) context
+ *
+ *  returns:	no return value
+ */
+void EnableSessionResumption(SSL_CTX *ctx)
+{
+	SSL_CTX_set_session_id_context(ctx, (const unsigned char *)SESSION_ID_CONTEXT, strlen(SESSION_ID_CONTEXT));
+	SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+	SSL_CTX_set_timeout(ctx, SESSION_LIFETIME);
+	SSL_CTX_clear_options(ctx, SSL_OP_NO_TICKET);
+}
+
+
+/*		
+ * Function:  ComputeCookie 
+ * --------------------
+ *  computes the DTLS cookie of the peer a ClientHello came from, an HMAC of its
+ *  address and port keyed with a secret drawn at startup, so the server keeps no
+ *  state for clients that didn't prove they own their address
+ *
+ *  ssl:		the SSL/DTLS session listening for the ClientHello
+ *  cookie:		filled with the cookie (at least EVP_MAX_MD_SIZE bytes)
+ *  cookie_len:		set to the cookie length
+ *
+ *  returns:		1 if successful, or 0 if an error occurred
+ */
+int ComputeCookie(SSL *ssl, unsigned char *cookie, unsigned int *cookie_len)
+{
+	unsigned char peer_id[sizeof(struct in6_addr) + sizeof(unsigned short)];
+	size_t addr_len = 0;
+	unsigned short peer_port = 0;
+	BIO_ADDR *peer = BIO_ADDR_new();
+
+	if(NULL == peer || 0 >= BIO_dgram_get_peer(SSL_get_rbio(ssl), peer) ||
+	   !BIO_ADDR_rawaddress(peer, NULL, &addr_len) || addr_len > sizeof(struct in6_addr))
+	{
+		BIO_ADDR_free(peer);
+		return 0;
+	}
+
+	BIO_ADDR_rawaddress(peer, peer_id, &addr_len);
+	peer_port = BIO_ADDR_rawport(peer);
+	memcpy(peer_id + addr_len, &peer_port, sizeof(peer_port));
+	BIO_ADDR_free(peer);
+
+	if(NULL == HMAC(EVP_sha256(), cookie_secret, COOKIE_SECRET_LENGTH, 
+	                peer_id, addr_len + sizeof(peer_port), cookie, cookie_len))
+	{
+		return 0;
+	}
+
+	return 1;
+}
+
+
+/*		
+ * Function:  GenerateCookie 
+ * --------------------
+ *  DTLS cookie generation callback, see ComputeCookie()
+ *
+ *  returns:		1 if successful, or 0 if an error occurred
+ */
+int GenerateCookie(SSL *ssl, unsigned char *cookie, unsigned int *cookie_len)
+{
+	return ComputeCookie(ssl, cookie, cookie_len);
+}
+
+
+/*		
+ * Function:  VerifyCookie 
+ * --------------------
+ *  DTLS cookie verification callback, accepts the cookie the peer's address should have
+ *
+ *  returns:		1 if the cookie is valid, or 0 otherwise
+ */
+int VerifyCookie(SSL *ssl, const unsigned char *cookie, unsigned int cookie_len)
+{
+	unsigned char expected[EVP_MAX_MD_SIZE];
+	unsigned int expected_len = 0;
+
+	if(!ComputeCookie(ssl, expected, &expected_len) || expected_len != cookie_len || 
+	   0 != CRYPTO_memcmp(expected, cookie, cookie_len))
+	{
+		return 0;
+	}
+
+	return 1;
+}
+
+
+/*		
+ * Function:  HoldClientHello 
+ * --------------------
+ *  client hello callback with HANDSHAKE_WORKERS set: on the acceptor, notes
+ *  whether the client resumes and suspends the handshake before anything
+ *  expensive is computed, for a handshake worker to go on with it
+ *  (AdmitHandshake()); on the handshake worker, lets it go on
+ *
+ *  ssl:	the client's session, its app data the session_t
+ *  alert:	unused, nothing is refused here
+ *  arg:	unused
+ *
+ *  returns:	SSL_CLIENT_HELLO_RETRY to suspend, or SSL_CLIENT_HELLO_SUCCESS
+ */
+int HoldClientHello(SSL *ssl, int *alert, void *arg)
+{
+	session_t *session = SSL_get_app_data(ssl);
+
+	(void)alert;
+	(void)arg;
+	if(NULL == session || session->offloaded)
+	{
+		return SSL_CLIENT_HELLO_SUCCESS;
+	}
+
+	session->resuming = HandshakeIsResumption(ssl);
+	return SSL_CLIENT_HELLO_RETRY;
+}
+
+
+/*		
+ * Function:  CreateContext 
+ * --------------------
+ *  builds the SSL/TLS (or SSL/DTLS) context new clients are accepted with
+ *  from the current configuration: the server's certificate and private
+ *  key, session resumption, the cipher settings and kTLS (or the DTLS
+ *  cookie exchange)
+ *
+ *  datagram:	build a DTLS context
+ *
+ *  returns:	the context if successful, or NULL if an error occurred
+ */
+SSL_CTX *CreateContext(int datagram)
+{
+	SSL_CTX *ctx = SSL_CTX_new(datagram ? DTLS_server_method() : TLS_server_method());
+
+	if(NULL == ctx)
+	{
+		return NULL;
+	}
+
+	if(SSL_CTX_use_certificate_file(ctx, server_crt, SSL_FILETYPE_PEM) != 1)
+	{
+		printf("Error: Failed to use the provided certificate file.\n");
+		SSL_CTX_free(ctx);
+		return NULL;
+	}
+	if(SSL_CTX_use_PrivateKey_file(ctx, server_key, SSL_FILETYPE_PEM) != 1 || SSL_CTX_check_private_key(ctx) != 1)
+	{
+		printf("Error: Failed to use the provided key file.\n");
+		SSL_CTX_free(ctx);
+		return NULL;
+	} 
+
+	EnableSessionResumption(ctx);
+	if(-1 == CipherConfigure(ctx, &cipher_config, datagram, 1))
+	{
+		SSL_CTX_free(ctx);
+		return NULL;
+	}
+
+	if(datagram)
+	{
+		if(kernel_tls)
+		{
+			printf("Notice: KTLS only applies to TRANSPORT=tcp, DTLS records are encrypted in user space.\n");
+		}
+		SSL_CTX_set_cookie_generate_cb(ctx, GenerateCookie);
+		SSL_CTX_set_cookie_verify_cb(ctx, VerifyCookie);
+	}
+	else if(kernel_tls)
+	{
+		SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+	}
+
+	/* the acceptors hand the steps after a ClientHello, the key exchange and signature, to the handshake workers */
+	if(0 != handshake_workers)
+	{
+		SSL_CTX_set_client_hello_cb(ctx, HoldClientHello, NULL);
+	}
+
+	/* a new server carries the clients' TLS 1.3 sessions on with the secrets they were keyed with */
+	if(!datagram && '\0' != upgrade_path[0])
+	{
+		SSL_CTX_set_keylog_callback(ctx, RecordKeylog);
+	}
+
+	return ctx;
+}
+
+
+/*		
+ * Function:  SetUpTCPListener 
+ * --------------------
+ *  creates a listening TCP socket bound to the port; with more than one
+ *  acceptor every acceptor creates one and they share the port through
+ *  SO_REUSEPORT, the kernel picking the socket each connection lands on
+ *
+ *  returns:	the socket file descriptor if successful, or -1 if an error occurred
+ */
+int SetUpTCPListener()
+{
+	int sockfd = 0;
+	int enable = 1;
+	struct sockaddr_in server_addr;
+
+	if((sockfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0)) < 0)
+	{
+		return -1;
+	}
+
+	/* clients reconnect as soon as a restarted server listens again */
+	setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+	if(1 < acceptor_count && -1 == setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)))
+	{
+		close(sockfd);
+		return -1;
+	}
+
+	server_addr.sin_family = AF_INET;
+	server_addr.sin_addr.s_addr = INADDR_ANY;
+	server_addr.sin_port = htons(port);
+
+	if(bind(sockfd, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0 || listen(sockfd, SOMAXCONN) < 0)
+	{
+		close(sockfd);
+		return -1;
+	}
+
+	return sockfd;
+}
+
+
+/*		
+ * Function:  SetUpTCPSocketWithTLS 
+ * --------------------
+ *  sets up a TCP socket and initializes an SSL/TLS context for secure communication
+ *  
+ *  this function creates a socket, binds it to an IP address and port, and sets up
+ *  an SSL/TLS context with the server's certificate and private key
+ *
+ *  ctx:	a pointer to a pointer for storing the SSL/TLS context
+ *
+ *  returns:	the socket file descriptor if successful, or -1 if an error occurred
+ */
+int SetUpTCPSocketWithTLS(SSL_CTX **ctx)
+{
+	*ctx = CreateContext(0);
+	if(NULL == *ctx)
+	{
+		return -1;
+	}
+
+	return SetUpTCPListener();
+}
+
+
+/*		
+ * Function:  SetUpUDPSocketWithDTLS 
+ * --------------------
+ *  sets up a UDP socket and initializes an SSL/DTLS context for secure communication
+ *  
+ *  the listening socket only receives ClientHellos; every client that completes the
+ *  cookie exchange gets its own UDP socket bound to the same port and connected to it
+ *
+ *  ctx:	a pointer to a pointer for storing the SSL/DTLS context
+ *
+ *  returns:	the socket file descriptor if successful, or -1 if an error occurred
+ */
+int SetUpUDPSocketWithDTLS(SSL_CTX **ctx)
+{
+	int sockfd = 0;
+	int enable = 1;
+	int discover = IP_PMTUDISC_PROBE;
+	struct sockaddr_in server_addr;
+
+	if(1 != RAND_bytes(cookie_secret, COOKIE_SECRET_LENGTH))
+	{
+		return -1;
+	}
+
+	*ctx = CreateContext(1);
+	if(NULL == *ctx)
+	{
+		return -1;
+	}
+
+	if((sockfd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0)) < 0)
+	{
+		return -1;
+	}
+
+	setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+
+	/* datagrams are never fragmented, whatever the kernel learnt about a path, so a client's probes and their echoes measure it */
+	setsockopt(sockfd, IPPROTO_IP, IP_MTU_DISCOVER, &discover, sizeof(discover));
+
+	server_addr.sin_family = AF_INET;
+	server_addr.sin_addr.s_addr = INADDR_ANY;
+	server_addr.sin_port = htons(port);
+
+	if(bind(sockfd, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0)
+	{
+		return -1;
+	}
+
+	return sockfd;
+}
+
+
+/*		
+ * Function:  ReloadConfiguration 
+ * --------------------
+ *  reads the TLS settings (IsReloadableKey()) from the configuration file
+ *  again and swaps a context built from them in for the handshakes that
+ *  follow; sessions hold a reference to the context they were accepted
+ *  with, so the old one lives on until the last of them is closed and no
+ *  tunnel is dropped. The session ticket keys move over, clients keep
+ *  resuming their sessions. The acceptors read server->ctx under ctx_lock
+ *
+ *  server:	the server state
+ *
+ *  returns:	0 if successful, or -1 if the new settings are invalid and the
+ *		current ones were kept
+ */
+int ReloadConfiguration(server_t *server)
+{
+	FILE *config_file = NULL;
+	SSL_CTX *ctx = NULL;
+	SSL_CTX *swap = NULL;
+	char saved_crt[MAX_LINE_LENGTH];
+	char saved_key[MAX_LINE_LENGTH];
+	cipher_config_t saved_ciphers = cipher_config;
+	int saved_kernel_tls = kernel_tls;
+	unsigned char ticket_keys[TICKET_KEYS_LENGTH];
+	int result = -1;
+
+	strcpy(saved_crt, server_crt);
+	strcpy(saved_key, server_key);
+
+	/* keys left out of the file go back to their defaults */
+	memset(&cipher_config, 0, sizeof(cipher_config));
+	kernel_tls = 0;
+
+	config_file = fopen("server_config_file.txt", "r");
+	if(NULL == config_file)
+	{
+		printf("Error: Unable to open 'server_config_file.txt'. Ensure the file exists and has the appropriate permissions.\n");
+	}
+	else
+	{
+		result = ParseConfigFile(config_file, 1);
+		fclose(config_file);
+	}
+
+	if(0 == result)
+	{
+		ctx = CreateContext(TRANSPORT_UDP == transport);
+	}
+
+	if(NULL == ctx)
+	{
+		strcpy(server_crt, saved_crt);
+		strcpy(server_key, saved_key);
+		cipher_config = saved_ciphers;
+		kernel_tls = saved_kernel_tls;
+		STATS_ADD(server->acceptors[0].handshake_stats.failed_reloads, 1);
+		printf("Error: Failed to reload the configuration, new clients are still accepted with the current certificate and TLS settings.\n");
+		return -1;
+	}
+
+	if(1 == SSL_CTX_get_tlsext_ticket_keys(server->ctx, ticket_keys, sizeof(ticket_keys)))
+	{
+		SSL_CTX_set_tlsext_ticket_keys(ctx, ticket_keys, sizeof(ticket_keys));
+		OPENSSL_cleanse(ticket_keys, sizeof(ticket_keys));
+	}
+
+	pthread_mutex_lock(&server->ctx_lock);
+	swap = server->ctx;
+	server->ctx = ctx;
+	pthread_mutex_unlock(&server->ctx_lock);
+
+	SSL_CTX_free(swap);
+	STATS_ADD(server->acceptors[0].handshake_stats.reloads, 1);
+	printf("Notice: Reloaded the certificate and TLS settings, connected clients keep their sessions.\n");
+	return 0;
+}
+
+
+/*		
+ * Function:  SetUpWorker 
+ * --------------------
+ *  creates a worker's epoll instance, registers its TUN queue and its
+ *  wakeup eventfd with it and allocates its packet rings
+ *
+ *  with the io_uring backend the TUN queue is read through the worker's io_uring
+ *  instead of epoll; if io_uring is unavailable the worker falls back to epoll
+ *
+ *  server:		the server state
+ *  worker:		the worker to set up
+ *  index:		the worker's position in the server's worker array
+ *  vnic_fd:		the TUN queue owned by the worker
+ *
+ *  returns:		0 if successful, or -1 if an error occurred
+ */
+int SetUpWorker(server_t *server, worker_t *worker, int index, int vnic_fd)
+{
+	struct epoll_event event;
+	struct itimerspec spec;
+
+	worker->index = index;
+	worker->server = server;
+	worker->vnic.type = EVENT_VNIC;
+	worker->vnic.fd = vnic_fd;
+	worker->wakeup.type = EVENT_WAKEUP;
+	worker->timer.type = EVENT_TIMER;
+	worker->tick.type = EVENT_TICK;
+	worker->uring.fd = -1;
+	pthread_mutex_init(&worker->handoff_lock, NULL);
+	WheelInit(&worker->wheel);
+
+	worker->wakeup.fd = eventfd(0, EFD_NONBLOCK);
+	worker->timer.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+	worker->tick.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+	worker->epoll_fd = epoll_create1(0);
+	if(-1 == worker->wakeup.fd || -1 == worker->timer.fd || -1 == worker->tick.fd || -1 == worker->epoll_fd)
+	{
+		return -1;
+	}
+
+	/* DTLS clients are answered from the listening socket, every client's datagrams in one sendmmsg() */
+	if(-1 == PacketRingInit(&worker->packets, -1) || 
+	   -1 == PacketRingInit(&worker->inbound, -1) || 
+	   -1 == PacketRingInit(&worker->outbound, server->acceptors[0].listener.fd))
+	{
+		return -1;
+	}
+
+	if(IO_BACKEND_IO_URING == io_backend)
+	{
+		if(-1 == UringInit(&worker->uring, URING_ENTRIES))
+		{
+			printf("Notice: io_uring is unavailable, worker %d falls back to epoll.\n", index);
+		}
+		else
+		{
+			/* io_uring only waits for data on blocking files */
+			fcntl(vnic_fd, F_SETFL, fcntl(vnic_fd, F_GETFL) & ~O_NONBLOCK);
+			UringRegisterBuffer(&worker->uring, worker->packets.slots, RING_SLOTS * RING_SLOT_SIZE);
+		}
+	}
+
+	event.events = EPOLLIN;
+	event.data.ptr = &worker->vnic;
+	if(-1 == worker->uring.fd && -1 == epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, worker->vnic.fd, &event))
+	{
+		return -1;
+	}
+
+	event.events = EPOLLIN;
+	event.data.ptr = &worker->wakeup;
+	if(-1 == epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, worker->wakeup.fd, &event))
+	{
+		return -1;
+	}
+
+	event.events = EPOLLIN;
+	event.data.ptr = &worker->timer;
+	if(-1 == epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, worker->timer.fd, &event))
+	{
+		return -1;
+	}
+
+	/* the wheel only turns with keepalives on */
+	memset(&spec, 0, sizeof(spec));
+	spec.it_value.tv_sec = 1;
+	spec.it_interval.tv_sec = 1;
+	event.events = EPOLLIN;
+	event.data.ptr = &worker->tick;
+	if(0 != keepalive_interval &&
+	   (-1 == timerfd_settime(worker->tick.fd, 0, &spec, NULL) || -1 == epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, worker->tick.fd, &event)))
+	{
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/*		
+ * Function:  AppendLease 
+ * --------------------
+ *  appends the frames telling a client which tunnel address it was leased to
+ *  a batch; the lease carries the leased address (network order) followed by
+ *  one byte holding the tunnel network prefix length, and FRAME_FLAG_COMPRESSED
+ *  when the server compresses for clients that ask for it, FRAME_FLAG_OFFLOAD
+ *  when tun0 takes super-packets from a TLS client, FRAME_FLAG_KEEPALIVE when
+ *  keepalives are on, and is preceded by a FRAME_MTU with the largest tunnel
+ *  MTU the server takes
+ *
+ *  batch:		the batch
+ *  session:		the client session
+ *  prefix_length:	the tunnel network prefix length
+ *
+ *  returns:		0 if successful, or -1 if the batch has no room left
+ */
+int AppendLease(frame_batch_t *batch, session_t *session, int prefix_length)
+{
+	unsigned char payload[LEASE_PAYLOAD_SIZE];
+	unsigned char flags = 0;
+	uint16_t mtu = htons((uint16_t)tunnel_mtu);
+
+	if(-1 == FrameBatchAppend(batch, FRAME_MTU, 0, &mtu, MTU_PAYLOAD_SIZE))
+	{
+		return -1;
+	}
+
+	memcpy(payload, &session->inner_addr, sizeof(session->inner_addr));
+	payload[4] = (unsigned char)prefix_length;
+
+	flags |= COMPRESS_OFF == compress_mode ? 0 : FRAME_FLAG_COMPRESSED;
+	flags |= offload && !session->datagram ? FRAME_FLAG_OFFLOAD : 0;
+	flags |= 0 != keepalive_interval ? FRAME_FLAG_KEEPALIVE : 0;
+	return FrameBatchAppend(batch, FRAME_LEASE, flags, payload, LEASE_PAYLOAD_SIZE);
+}
+
+
+/*		
+ * Function:  SendLease 
+ * --------------------
+ *  tells a client which tunnel address it was leased, right after the handshake
+ *  while the connection's send buffer is still empty, and again whenever a
+ *  DTLS client asks (a lost datagram may carry the first one)
+ *
+ *  session:		the client session
+ *  prefix_length:	the tunnel network prefix length
+ *
+ *  returns:		0 if successful, or -1 if an error occurred
+ */
+int SendLease(session_t *session, int prefix_length)
+{
+	frame_batch_t lease;
+
+	FrameBatchReset(&lease);
+	AppendLease(&lease, session, prefix_length);
+
+	if(0 >= SSL_write(session->ssl, lease.data, lease.length))
+	{
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/*		
+ * Function:  WakeWorker 
+ * --------------------
+ *  signals a worker's eventfd so it picks up what was handed off to it
+ *
+ *  worker:     the worker to wake
+ *
+ *  returns:    no return value
+ */
+void WakeWorker(worker_t *worker)
+{
+	uint64_t one = 1;
+
+	if(-1 == write(worker->wakeup.fd, &one, sizeof(one)))
+	{
+		return;		/* the counter is already pending */
+	}
+}
+
+
+/*		
+ * Function:  GetMonotonicTime 
+ * --------------------
+ *  reads the monotonic clock handshake deadlines are kept in
+ *
+ *  returns:    the time in milliseconds
+ */
+uint64_t GetMonotonicTime()
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+
+/*		
+ * Function:  SwitchToPacketRing 
+ * --------------------
+ *  moves an established SSL/DTLS session from its datagram socket BIO to a
+ *  BIO on the worker's rings: its datagrams are received in bursts by the
+ *  worker and its records sent from the listening socket with those of the
+ *  worker's other clients; the connected socket is only read from
+ *
+ *  session:    the session, after the handshake
+ *  worker:     the worker the session is handed to
+ *
+ *  returns:    0 if successful, or -1 if an error occurred
+ */
+int SwitchToPacketRing(session_t *session, worker_t *worker)
+{
+	BIO *bio = PacketRingBioNew(&worker->outbound, &session->peer_addr);
+
+	if(NULL == bio)
+	{
+		return -1;
+	}
+
+	SSL_set_bio(session->ssl, bio, bio);
+	return 0;
+}
+
+
+/*		
+ * Function:  WriteRecord 
+ * --------------------
+ *  hands a record to a client's non-blocking connection, through SSL_write(),
+ *  as it is when the kernel encrypts for the connection (kTLS), or sealed
+ *  here when the session was carried over from the previous server
+ *
+ *  session:          the client session
+ *  record:           the frames of the record
+ *  sent:             over kTLS, how much of the record was already written, advanced
+ *
+ *  returns:          1 if the record was sent, 0 if the connection can't take (all of) it
+ *                    now and it must be retried, or -1 if an error occurred
+ */
+int WriteRecord(session_t *session, const frame_batch_t *record, size_t *sent)
+{
+	ssize_t result = 0;
+	int error = 0;
+
+	if(session->kernel_send)
+	{
+		while(*sent < record->length)
+		{
+			result = write(session->source.fd, record->data + *sent, record->length - *sent);
+			if(-1 == result && EINTR == errno)
+			{
+				continue;
+			}
+			if(-1 == result && (EAGAIN == errno || EWOULDBLOCK == errno))
+			{
+				COUNT_TRAFFIC(session, short_writes, 1);
+				return 0;
+			}
+			if(-1 == result)
+			{
+				return -1;
+			}
+			*sent += result;
+		}
+		return 1;
+	}
+
+	if(NULL != session->records)
+	{
+		result = RecordStreamWrite(session->records, session->source.fd, record->data, record->length);
+		if(0 == result)
+		{
+			COUNT_TRAFFIC(session, short_writes, 1);
+		}
+		return result;
+	}
+
+	result = SSL_write(session->ssl, record->data, record->length);
+	if(0 < result)
+	{
+		return 1;
+	}
+
+	error = SSL_get_error(session->ssl, result);
+	if(SSL_ERROR_WANT_WRITE == error || SSL_ERROR_WANT_READ == error)
+	{
+		COUNT_TRAFFIC(session, short_writes, 1);
+		return 0;
+	}
+
+	return -1;
+}
+
+
+/*		
+ * Function:  CountQueuedBytes 
+ * --------------------
+ *  keeps the statistics of a session's queued bytes, and of its worker's, current
+ *
+ *  session:          the client session
+ *  delta:            bytes queued (or, negative, dequeued)
+ *
+ *  returns:          no return value
+ */
+void CountQueuedBytes(session_t *session, ssize_t delta)
+{
+	session->queue.bytes += delta;
+	STATS_SET(session->stats->traffic.queue_bytes, session->queue.bytes);
+	STATS_ADD(session->worker->traffic.queue_bytes, delta);
+}
+
+
+/*		
+ * Function:  CountDroppedRecord 
+ * --------------------
+ *  counts the packets of a record a full send queue dropped
+ *
+ *  session:          the client session
+ *  record:           the record
+ *
+ *  returns:          no return value
+ */
+void CountDroppedRecord(session_t *session, const frame_batch_t *record)
+{
+	size_t position = 0;
+	frame_t frame;
+
+	while(FrameBatchNext(record, &position, &frame))
+	{
+		COUNT_TRAFFIC(session, drops, 1);
+	}
+}
+
+
+/*		
+ * Function:  PauseVirtualNic 
+ * --------------------
+ *  pauses or resumes reading a worker's TUN queue as server->vnic_paused
+ *  says. The kernel spreads packets over the queues by flow, not by client,
+ *  so every queue carries packets for every worker's clients and is only
+ *  paused while all of them are backlogged; until then a packet for a client
+ *  with a full send queue is read and dropped by its queue's policy
+ *
+ *  worker:           the worker
+ *
+ *  returns:          no return value
+ */
+void PauseVirtualNic(worker_t *worker)
+{
+	int paused = __atomic_load_n(&worker->server->vnic_paused, __ATOMIC_ACQUIRE);
+	struct epoll_event event;
+
+	if(paused == worker->vnic_paused)
+	{
+		return;
+	}
+	worker->vnic_paused = paused;
+
+	/* with io_uring the reads are parked as they complete, and posted again by the loop */
+	if(-1 == worker->uring.fd)
+	{
+		event.events = paused ? 0 : EPOLLIN;
+		event.data.ptr = &worker->vnic;
+		epoll_ctl(worker->epoll_fd, EPOLL_CTL_MOD, worker->vnic.fd, &event);
+	}
+}
+
+
+/*		
+ * Function:  CountBacklog 
+ * --------------------
+ *  counts clients attached to or detached from a worker and send queues
+ *  that filled up or got room again; when every client of the server turns
+ *  backlogged, or one no longer is, the other workers are woken to pause
+ *  or resume reading their TUN queues as well
+ *
+ *  worker:           the worker owning the clients
+ *  attached:         change in the number of attached clients
+ *  full:             change in the number of full send queues
+ *
+ *  returns:          no return value
+ */
+void CountBacklog(worker_t *worker, int attached, int full)
+{
+	server_t *server = worker->server;
+	int paused = 0;
+	int changed = 0;
+	int i = 0;
+
+	pthread_mutex_lock(&server->backlog_lock);
+	server->attached_sessions += attached;
+	server->full_sessions += full;
+	paused = 0 < server->full_sessions && server->full_sessions >= server->attached_sessions;
+	changed = paused != server->vnic_paused;
+	__atomic_store_n(&server->vnic_paused, paused, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&server->backlog_lock);
+
+	for(i = 0; changed && i < server->worker_count; ++i)
+	{
+		if(worker != &server->workers[i])
+		{
+			WakeWorker(&server->workers[i]);
+		}
+	}
+
+	PauseVirtualNic(worker);
+}
+
+
+/*		
+ * Function:  WatchWritable 
+ * --------------------
+ *  asks a worker's event loop to report a client's connection writable too,
+ *  while its send queue holds records, or only readable again
+ *
+ *  worker:           the worker owning the session
+ *  session:          the client session
+ *  writable:         whether to report the connection writable
+ *
+ *  returns:          no return value
+ */
+void WatchWritable(worker_t *worker, session_t *session, int writable)
+{
+	struct epoll_event event;
+
+	event.events = writable ? EPOLLIN | EPOLLOUT : EPOLLIN;
+	event.data.ptr = &session->source;
+	epoll_ctl(worker->epoll_fd, EPOLL_CTL_MOD, session->source.fd, &event);
+}
+
+
+/*		
+ * Function:  QueueRecord 
+ * --------------------
+ *  moves a client's outgoing record to the tail of its send queue; a full
+ *  queue drops the new record (tail-drop) or the oldest one the connection
+ *  wasn't handed yet (head-drop)
+ *
+ *  worker:           the worker owning the session
+ *  session:          the client session
+ *
+ *  returns:          0 if successful, or -1 if no memory was available
+ */
+int QueueRecord(worker_t *worker, session_t *session)
+{
+	send_queue_t *queue = &session->queue;
+	frame_batch_t *record = NULL;
+	int was_full = queue_length == queue->count;
+	size_t tail = 0;
+	size_t victim = 0;
+
+	if(NULL == queue->records)
+	{
+		queue->records = calloc(queue_length, sizeof(frame_batch_t *));
+		if(NULL == queue->records)
+		{
+			return -1;
+		}
+	}
+
+	if(queue->count == queue_length)
+	{
+		/* the oldest record stays while the connection holds part of it */
+		if(QUEUE_TAIL_DROP == queue_policy || (queue->started && 1 == queue->count))
+		{
+			CountDroppedRecord(session, &session->outgoing);
+			FrameBatchReset(&session->outgoing);
+			return 0;
+		}
+
+		victim = queue->started ? (queue->head + 1) % queue_length : queue->head;
+		record = queue->records[victim];
+		CountDroppedRecord(session, record);
+		CountQueuedBytes(session, -(ssize_t)record->length);
+		if(queue->started)
+		{
+			queue->records[victim] = queue->records[queue->head];
+		}
+		queue->head = (queue->head + 1) % queue_length;
+		--queue->count;
+	}
+	else
+	{
+		record = malloc(sizeof(frame_batch_t));
+		if(NULL == record)
+		{
+			return -1;
+		}
+	}
+
+	memcpy(record, &session->outgoing, sizeof(frame_batch_t));
+	FrameBatchReset(&session->outgoing);
+	tail = (queue->head + queue->count) % queue_length;
+	queue->records[tail] = record;
+	++queue->count;
+	CountQueuedBytes(session, record->length);
+
+	if(!was_full && queue_length == queue->count)
+	{
+		CountBacklog(worker, 0, 1);
+	}
+
+	return 0;
+}
+
+
+/*		
+ * Function:  DequeueRecord 
+ * --------------------
+ *  frees a client's oldest record once its connection took all of it
+ *
+ *  worker:           the worker owning the session
+ *  session:          the client session
+ *
+ *  returns:          no return value
+ */
+void DequeueRecord(worker_t *worker, session_t *session)
+{
+	send_queue_t *queue = &session->queue;
+	frame_batch_t *record = queue->records[queue->head];
+
+	if(queue_length == queue->count)
+	{
+		CountBacklog(worker, 0, -1);
+	}
+
+	CountQueuedBytes(session, -(ssize_t)record->length);
+	free(record);
+	queue->records[queue->head] = NULL;
+	queue->head = (queue->head + 1) % queue_length;
+	--queue->count;
+	queue->started = 0;
+	queue->sent = 0;
+}
+
+
+/*		
+ * Function:  JoinRound 
+ * --------------------
+ *  puts a client in its worker's round of clients with records to send
+ *
+ *  worker:           the worker owning the session
+ *  session:          the client session
+ *  front:            whether the client goes first, to go on with a turn a pass
+ *                    ended in the middle of, or last, to wait for its turn
+ *
+ *  returns:          no return value
+ */
+void JoinRound(worker_t *worker, session_t *session, int front)
+{
+	session->egress_state = EGRESS_ACTIVE;
+
+	if(front)
+	{
+		session->egress_next = worker->round_head;
+		worker->round_head = session;
+		if(NULL == worker->round_tail)
+		{
+			worker->round_tail = session;
+		}
+		return;
+	}
+
+	session->egress_next = NULL;
+	if(NULL == worker->round_tail)
+	{
+		worker->round_head = session;
+	}
+	else
+	{
+		worker->round_tail->egress_next = session;
+	}
+	worker->round_tail = session;
+}
+
+
+/*		
+ * Function:  ActivateSession 
+ * --------------------
+ *  adds a client that just queued a record to the round, unless it is already
+ *  in it, or waits for its connection or its rate cap
+ *
+ *  worker:           the worker owning the session
+ *  session:          the client session
+ *
+ *  returns:          no return value
+ */
+void ActivateSession(worker_t *worker, session_t *session)
+{
+	if(EGRESS_IDLE == session->egress_state && 0 < session->queue.count)
+	{
+		JoinRound(worker, session, 0);
+	}
+}
+
+
+/*		
+ * Function:  LeaveScheduler 
+ * --------------------
+ *  takes a closing client out of the round, or out of the throttled clients
+ *
+ *  worker:           the worker owning the session
+ *  session:          the client session
+ *
+ *  returns:          no return value
+ */
+void LeaveScheduler(worker_t *worker, session_t *session)
+{
+	session_t **link = NULL;
+	session_t *previous = NULL;
+
+	if(EGRESS_ACTIVE == session->egress_state)
+	{
+		link = &worker->round_head;
+	}
+	else if(EGRESS_THROTTLED == session->egress_state)
+	{
+		link = &worker->throttled;
+	}
+	session->egress_state = EGRESS_IDLE;
+
+	while(NULL != link && NULL != *link)
+	{
+		if(*link == session)
+		{
+			*link = session->egress_next;
+			if(worker->round_tail == session)
+			{
+				worker->round_tail = previous;
+			}
+			return;
+		}
+		previous = *link;
+		link = &(*link)->egress_next;
+	}
+}
+
+
+/*		
+ * Function:  ArmEgressTimer 
+ * --------------------
+ *  makes sure the worker's timer fires by a deadline, for the next pass of a
+ *  round the budget cut short or for a rate cap to allow more
+ *
+ *  worker:           the worker
+ *  deadline:         when the timer has to fire by (monotonic nanoseconds)
+ *
+ *  returns:          no return value
+ */
+void ArmEgressTimer(worker_t *worker, uint64_t deadline)
+{
+	struct itimerspec spec;
+
+	if(0 != worker->timer_deadline && worker->timer_deadline <= deadline)
+	{
+		return;
+	}
+
+	memset(&spec, 0, sizeof(spec));
+	spec.it_value.tv_sec = deadline / SHAPER_NSEC;
+	spec.it_value.tv_nsec = deadline % SHAPER_NSEC;
+	if(0 == timerfd_settime(worker->timer.fd, TFD_TIMER_ABSTIME, &spec, NULL))
+	{
+		worker->timer_deadline = deadline;
+	}
+}
+
+
+/*		
+ * Function:  ServeTurn 
+ * --------------------
+ *  hands a client's connection its queued records, oldest first, while its
+ *  deficit covers them, the pass' budget lasts, its rate cap allows and the
+ *  connection takes them; egress_state tells which of them stopped it
+ *
+ *  worker:           the worker owning the session
+ *  session:          the client session
+ *  budget:           bytes the pass may still send, decreased
+ *  now:              the current time (monotonic nanoseconds)
+ *
+ *  returns:          0 on success, -1 on error
+ */
+int ServeTurn(worker_t *worker, session_t *session, size_t *budget, uint64_t now)
+{
+	send_queue_t *queue = &session->queue;
+	frame_batch_t *record = NULL;
+	int result = 0;
+
+	while(0 < queue->count)
+	{
+		record = queue->records[queue->head];
+		if(record->length > session->deficit || 0 == *budget)
+		{
+			session->egress_state = EGRESS_ACTIVE;
+			return 0;
+		}
+		if(!TokenBucketAllows(&session->bucket, now))
+		{
+			session->egress_state = EGRESS_THROTTLED;
+			return 0;
+		}
+
+		result = WriteRecord(session, record, &queue->sent);
+		if(-1 == result)
+		{
+			COUNT_TRAFFIC(session, errors, 1);
+			return -1;
+		}
+		if(0 == result)
+		{
+			queue->started = 1;
+			session->egress_state = EGRESS_BLOCKED;
+			WatchWritable(worker, session, 1);
+			return 0;
+		}
+
+		COUNT_TRAFFIC(session, tx_records, 1);
+		TokenBucketTake(&session->bucket, record->length);
+		session->deficit -= record->length;
+		*budget = *budget > record->length ? *budget - record->length : 0;
+		DequeueRecord(worker, session);
+	}
+
+	/* a client that ran out of records doesn't keep its deficit */
+	session->egress_state = EGRESS_IDLE;
+	session->deficit = 0;
+	return 0;
+}
+
+
+/*		
+ * Function:  ResumeWritable 
+ * --------------------
+ *  puts a client whose connection became writable back in the round
+ *
+ *  worker:           the worker owning the session
+ *  session:          the client session
+ *
+ *  returns:          no return value
+ */
+void ResumeWritable(worker_t *worker, session_t *session)
+{
+	if(EGRESS_BLOCKED != session->egress_state)
+	{
+		return;
+	}
+
+	WatchWritable(worker, session, 0);
+	session->egress_state = EGRESS_IDLE;
+	ActivateSession(worker, session);
+}
+
+
+/*		
+ * Function:  ReleaseQueue 
+ * --------------------
+ *  frees a closed client's send queue
+ *
+ *  worker:           the worker owning the session
+ *  session:          the client session
+ *
+ *  returns:          no return value
+ */
+void ReleaseQueue(worker_t *worker, session_t *session)
+{
+	send_queue_t *queue = &session->queue;
+
+	if(NULL == queue->records)
+	{
+		return;
+	}
+
+	while(0 < queue->count)
+	{
+		free(queue->records[queue->head]);
+		queue->head = (queue->head + 1) % queue_length;
+		--queue->count;
+	}
+	STATS_ADD(worker->traffic.queue_bytes, -(ssize_t)queue->bytes);
+
+	free(queue->records);
+	memset(queue, 0, sizeof(send_queue_t));
+}
+
+
+/*		
+ * Function:  FlushToClient 
+ * --------------------
+ *  queues the frames batched for a client as a single TLS record, to be
+ *  sent on the client's turn (see ServeClients())
+ *
+ *  worker:           the worker owning the session
+ *  session:          the client session
+ *
+ *  returns:          0 on success, -1 on error
+ */
+int FlushToClient(worker_t *worker, session_t *session)
+{
+	if(0 == session->outgoing.length)
+	{
+		return 0;
+	}
+
+	if(-1 == QueueRecord(worker, session))
+	{
+		return -1;
+	}
+
+	ActivateSession(worker, session);
+	return 0;
+}
+
+
+/*		
+ * Function:  CloseConnection 
+ * --------------------
+ *  shuts down a client's SSL/TLS session, unregisters it from its worker's
+ *  event loop and returns its tunnel address to the pool
+ *
+ *  the session itself stays allocated until ReapConnections(), since later
+ *  events of the same epoll batch may still point at it
+ *
+ *  worker:     the worker owning the session
+ *  session:    the session to close
+ *
+ *  returns:    no return value
+ */
+void CloseConnection(worker_t *worker, session_t *session)
+{
+	server_t *server = worker->server;
+	uint32_t offset = ntohl(session->inner_addr) - server->leases.network;
+
+	if(session->closing)
+	{
+		return;
+	}
+
+	epoll_ctl(worker->epoll_fd, EPOLL_CTL_DEL, session->source.fd, NULL);
+	if(NULL != session->records)
+	{
+		RecordStreamClose(session->records, session->source.fd);
+		RecordStreamFree(session->records);
+		session->records = NULL;
+	}
+	else
+	{
+		SSL_shutdown(session->ssl);
+		SSL_free(session->ssl);
+	}
+	close(session->source.fd);
+	session->closing = 1;
+
+	__atomic_store_n(&server->route_owners[offset], -1, __ATOMIC_RELEASE);
+	server->routes[offset] = NULL;
+	pthread_mutex_lock(&server->lease_lock);
+	LeasePoolRelease(&server->leases, session->inner_addr);
+	pthread_mutex_unlock(&server->lease_lock);
+
+	if(NULL != session->prev)
+	{
+		session->prev->next = session->next;
+	}
+	else
+	{
+		worker->sessions = session->next;
+	}
+	if(NULL != session->next)
+	{
+		session->next->prev = session->prev;
+	}
+	__atomic_sub_fetch(&worker->session_count, 1, __ATOMIC_RELAXED);
+	WheelCancel(&worker->wheel, &session->keepalive_timer);
+	LeaveScheduler(worker, session);
+	CountBacklog(worker, -1, queue_length == session->queue.count ? -1 : 0);
+	ReleaseQueue(worker, session);
+
+	printf("Client %s disconnected from worker %d.\n", inet_ntoa(session->peer_addr.sin_addr), worker->index);
+
+	session->prev = NULL;
+	session->next = worker->closed;
+	worker->closed = session;
+}
+
+
+/*		
+ * Function:  FindClientRate 
+ * --------------------
+ *  finds the rate a client is capped at, its CLIENT_RATE_LIMIT or else RATE_LIMIT
+ *
+ *  addr:       the client's public address (network order)
+ *
+ *  returns:    the rate in bytes per second, 0 for no cap
+ */
+uint64_t FindClientRate(in_addr_t addr)
+{
+	int i = 0;
+
+	for(i = 0; i < rate_rule_count; ++i)
+	{
+		if(rate_rules[i].addr == addr)
+		{
+			return rate_rules[i].rate;
+		}
+	}
+
+	return default_rate;
+}
+
+
+/*		
+ * Function:  AttachSession 
+ * --------------------
+ *  registers a session handed off by the acceptor with its worker's event loop
+ *  and publishes its tunnel address in the route table
+ *
+ *  worker:     the worker the session was handed to
+ *  session:    the session
+ *
+ *  returns:    0 if successful, or -1 if an error occurred (the session is closed)
+ */
+int AttachSession(worker_t *worker, session_t *session)
+{
+	server_t *server = worker->server;
+	uint32_t offset = ntohl(session->inner_addr) - server->leases.network;
+	struct epoll_event event;
+	uint64_t rate = 0;
+
+	session->prev = NULL;
+	session->next = worker->sessions;
+	if(NULL != worker->sessions)
+	{
+		worker->sessions->prev = session;
+	}
+	worker->sessions = session;
+	__atomic_add_fetch(&worker->session_count, 1, __ATOMIC_RELAXED);
+
+	/* a client with room in its queue is worth reading the TUN queues for */
+	CountBacklog(worker, 1, queue_length == session->queue.count ? 1 : 0);
+
+	/* the address' statistics start over, published along with the route */
+	session->stats = &server->session_stats[offset];
+	StatsReset(&session->stats->traffic);
+	session->stats->peer_addr = session->peer_addr;
+
+	rate = FindClientRate(session->peer_addr.sin_addr.s_addr);
+	TokenBucketInit(&session->bucket, rate, rate / RATE_BURST_DIVISOR > EGRESS_QUANTUM ? rate / RATE_BURST_DIVISOR : EGRESS_QUANTUM, ShaperNow());
+
+	server->routes[offset] = session;
+	__atomic_store_n(&server->route_owners[offset], worker->index, __ATOMIC_RELEASE);
+
+	event.events = EPOLLIN;
+	event.data.ptr = &session->source;
+	if(-1 == epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, session->source.fd, &event))
+	{
+		CloseConnection(worker, session);
+		return -1;
+	}
+
+	/* every client is timed from its lease on, one that vanishes before its first keepalive is closed too */
+	if(0 != keepalive_interval)
+	{
+		session->last_received = worker->wheel.tick;
+		session->last_sent = worker->wheel.tick;
+		WheelSchedule(&worker->wheel, &session->keepalive_timer, session->last_sent + keepalive_interval);
+	}
+	/* a session carried over from the previous server goes on with the records it had queued */
+	if(0 < session->queue.count)
+	{
+		STATS_SET(session->stats->traffic.queue_bytes, session->queue.bytes);
+		STATS_ADD(worker->traffic.queue_bytes, session->queue.bytes);
+		ActivateSession(worker, session);
+	}
+
+	return 0;
+}
+
+
+/*		
+ * Function:  ReapConnections 
+ * --------------------
+ *  frees every session closed during the last batch of events
+ *
+ *  worker:     the worker the sessions belonged to
+ *
+ *  returns:    no return value
+ */
+void ReapConnections(worker_t *worker)
+{
+	session_t *next = NULL;
+
+	while(NULL != worker->closed)
+	{
+		next = worker->closed->next;
+		free(worker->closed);
+		worker->closed = next;
+	}
+}
+
+
+/*		
+ * Function:  FindRouteOwner 
+ * --------------------
+ *  looks up which worker owns the session of an inner packet's destination 
+ *  in constant time, by indexing the route table with the address' offset
+ *  in the tunnel network
+ *
+ *  server:     the server state
+ *  addr:       the inner IPv4 destination address (network order)
+ *  offset:     set to the address' offset in the tunnel network
+ *
+ *  returns:    the owning worker's index, or -1 if no client owns the address
+ */
+int FindRouteOwner(server_t *server, in_addr_t addr, uint32_t *offset)
+{
+	*offset = ntohl(addr) - server->leases.network;
+
+	if(*offset >= server->leases.size)
+	{
+		return -1;
+	}
+
+	return __atomic_load_n(&server->route_owners[*offset], __ATOMIC_ACQUIRE);
+}
+
+
+/*		
+ * Function:  RouteTraffic 
+ * --------------------
+ *  configures network routing to enable IP forwarding
+ *  and sets up an nftables rule to masquerade outgoing traffic
+ *
+ *  returns:    no return value
+ */
+void RouteTraffic()
+{
+	if(-1 == NetconfEnableForwarding())					/* enable IP forwarding */
+	{
+		printf("Error: Failed to enable IP forwarding: %s.\n", strerror(errno));
+	}
+	if(-1 == NetconfMasquerade(interface))					/* masquerade outgoing traffic */
+	{
+		printf("Error: Failed to masquerade the traffic leaving %s: %s.\n", interface, strerror(errno));
+	}
+}
+
+
+/*		
+ * Function:  ResendLease 
+ * --------------------
+ *  answers a client asking for its lease again: over DTLS in a datagram of
+ *  its own, over TLS through the send queue like any other record
+ *
+ *  session:          the client session
+ *
+ *  returns:          0 on success, -1 on error
+ */
+int ResendLease(session_t *session)
+{
+	if(session->datagram)
+	{
+		return SendLease(session, tunnel_prefix_length);
+	}
+
+	if(-1 == AppendLease(&session->outgoing, session, tunnel_prefix_length))
+	{
+		if(-1 == FlushToClient(session->worker, session))
+		{
+			return -1;
+		}
+		AppendLease(&session->outgoing, session, tunnel_prefix_length);
+	}
+
+	return FlushToClient(session->worker, session);
+}
+
+
+/*		
+ * Function:  HandleTrafficFromClient 
+ * --------------------
+ *  reads data from a client's SSL connection, reassembles the frames it
+ *  carries and writes every packet to a virtual NIC (restoring compressed
+ *  ones), answering lease requests, turning compression and super-packets
+ *  on when asked, taking the client's tunnel MTU and echoing its path MTU
+ *  probes; the first keepalive puts the client on the worker's keepalive
+ *  wheel, and anything received counts as a sign of life; with OFFLOAD=on a super-packet is written with its virtio_net_hdr
+ *  and a plain packet behind an empty one
+ *
+ *  packets whose source isn't the client's leased address are dropped,
+ *  so a client can't spoof another client's tunnel address, and so are
+ *  packets the TUN queue has no room for
+ *
+ *  virtual_nic_fd:   file descriptor of the virtual NIC
+ *  session:          the client session the data arrived on
+ *
+ *  returns:          0 on success, -1 on error
+ */
+int HandleTrafficFromClient(int virtual_nic_fd, session_t *session)
+{
+	int read_result = 0;
+	int next_result = 0;
+	int inflated_length = 0;
+	int mtu = 0;
+	ssize_t written = 0;
+	size_t room = 0;
+	size_t skip = 0;
+	unsigned char *space = NULL;
+	unsigned char inflated[FRAME_MAX_PAYLOAD];
+	frame_t frame;
+	struct iphdr *header = NULL;
+
+	/* SSL may hold more than one decrypted record, which epoll won't report */
+	do
+	{
+		space = DeframerSpace(&session->incoming, &room);
+		if(NULL != session->records)
+		{
+			/* nothing more for now (0), the client closed the session (-1) or an error (-2) */
+			read_result = RecordStreamRead(session->records, session->source.fd, space, room);
+			if(-2 == read_result)
+			{
+				COUNT_TRAFFIC(session, errors, 1);
+			}
+			if(0 >= read_result)
+			{
+				return 0 == read_result ? 0 : -1;
+			}
+		}
+		else
+		{
+			read_result = SSL_read(session->ssl, space, room);
+		}
+		if(0 >= read_result)
+		{
+			/* the record carried no application data */
+			switch(SSL_get_error(session->ssl, read_result))
+			{
+				case SSL_ERROR_WANT_READ:
+				case SSL_ERROR_WANT_WRITE:	/* e.g. a key update to answer, retried with the next read */
+					return 0;
+				case SSL_ERROR_ZERO_RETURN:
+					return -1;
+				default:
+					COUNT_TRAFFIC(session, errors, 1);
+					return -1;
+			}
+		}
+		DeframerCommit(&session->incoming, read_result);
+		COUNT_TRAFFIC(session, rx_records, 1);
+		session->last_received = session->worker->wheel.tick;
+
+		while(1 == (next_result = DeframerNext(&session->incoming, &frame)))
+		{
+			if(FRAME_LEASE == frame.type)
+			{
+				if(-1 == ResendLease(session))
+				{
+					return -1;
+				}
+				continue;
+			}
+
+			if(FRAME_COMPRESSION == frame.type)
+			{
+				if(COMPRESS_OFF != compress_mode && COMPRESS_OFF == session->compressor.mode)
+				{
+					CompressorInit(&session->compressor, compress_mode);
+				}
+				continue;
+			}
+
+			if(FRAME_OFFLOAD == frame.type)
+			{
+				session->offload = offload && !session->datagram;
+				continue;
+			}
+
+			/* a keepalive only counts as traffic */
+			if(FRAME_KEEPALIVE == frame.type)
+			{
+				continue;
+			}
+
+			if(FRAME_MTU == frame.type && MTU_PAYLOAD_SIZE == frame.length)
+			{
+				mtu = (frame.payload[0] << 8) | frame.payload[1];
+				session->mtu = mtu < PMTU_MIN ? PMTU_MIN : (mtu > tunnel_mtu ? tunnel_mtu : mtu);
+				continue;
+			}
+
+			/* a probe is echoed in place, at its size, as long as tun0 would take a packet that long */
+			if(FRAME_PROBE == frame.type && session->datagram)
+			{
+				if(frame.length <= (size_t)tunnel_mtu)
+				{
+					FrameWriteHeader(frame.payload - FRAME_HEADER_SIZE, FRAME_PROBE_ACK, 0, frame.length);
+					if(0 >= SSL_write(session->ssl, frame.payload - FRAME_HEADER_SIZE, frame.length + FRAME_HEADER_SIZE))
+					{
+						COUNT_TRAFFIC(session, errors, 1);
+						return -1;
+					}
+				}
+				continue;
+			}
+
+			/* the source is checked on the restored packet */
+			if(FRAME_PACKET == frame.type && (FRAME_FLAG_COMPRESSED & frame.flags))
+			{
+				inflated_length = DecompressPacket(frame.payload, frame.length, inflated, sizeof(inflated));
+				if(-1 == inflated_length)
+				{
+					COUNT_TRAFFIC(session, errors, 1);
+					continue;
+				}
+				frame.payload = inflated;
+				frame.length = inflated_length;
+			}
+
+			/* a super-packet only comes from a client told tun0 takes them */
+			skip = FRAME_FLAG_OFFLOAD & frame.flags ? OFFLOAD_HEADER_SIZE : 0;
+			header = (struct iphdr *)(frame.payload + skip);
+			if(FRAME_PACKET != frame.type || (0 != skip && !offload) || frame.length < skip + sizeof(struct iphdr) ||
+			   4 != header->version || header->saddr != session->inner_addr)
+			{
+				COUNT_TRAFFIC(session, drops, 1);
+				continue;
+			}
+
+			/* a full TUN queue drops the packet, as the kernel would, rather than the client */
+			if(offload && 0 == skip)
+			{
+				written = OffloadWrite(virtual_nic_fd, frame.payload, frame.length);
+				written -= -1 == written ? 0 : OFFLOAD_HEADER_SIZE;
+			}
+			else
+			{
+				written = write(virtual_nic_fd, frame.payload, frame.length);
+			}
+			if(written == (ssize_t)frame.length)
+			{
+				COUNT_TRAFFIC(session, rx_packets, 1);
+				COUNT_TRAFFIC(session, rx_bytes, frame.length);
+			}
+			else if(-1 != written || EAGAIN == errno || EWOULDBLOCK == errno || ENOBUFS == errno || EINTR == errno)
+			{
+				COUNT_TRAFFIC(session, drops, 1);
+			}
+			else
+			{
+				COUNT_TRAFFIC(session, errors, 1);
+				return -1;
+			}
+		}
+
+		if(-1 == next_result)
+		{
+			printf("Error: Malformed frame from the client %s.\n", inet_ntoa(session->peer_addr.sin_addr));
+			COUNT_TRAFFIC(session, errors, 1);
+			return -1;
+		}
+
+		/* every datagram holds whole frames, never keep a truncated one for the next */
+		if(session->datagram)
+		{
+			DeframerInit(&session->incoming);
+		}
+	} while(session->datagram || (NULL == session->records ? 0 < SSL_pending(session->ssl) : RecordStreamPending(session->records)));	/* a datagram may hold more than one record */
+
+	return 0;
+}
+
+
+/*		
+ * Function:  HandleDatagramsFromClient 
+ * --------------------
+ *  receives every datagram waiting from a DTLS client with a single recvmmsg()
+ *  into the worker's inbound ring and decrypts them one by one straight from
+ *  their slots, writing their packets to the virtual NIC
+ *
+ *  worker:           the worker owning the session
+ *  session:          the client session the datagrams arrived on
+ *
+ *  returns:          0 on success, -1 on error
+ */
+int HandleDatagramsFromClient(worker_t *worker, session_t *session)
+{
+	int count = 0;
+	int i = 0;
+
+	count = PacketRingReceive(&worker->inbound, session->source.fd);
+	if(-1 == count)
+	{
+		return -1;
+	}
+
+	for(i = 0; i < count; ++i)
+	{
+		PacketRingBioFeed(SSL_get_rbio(session->ssl), PacketRingSlot(&worker->inbound, i), worker->inbound.lengths[i]);
+		if(-1 == HandleTrafficFromClient(worker->vnic.fd, session))
+		{
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+
+/*		
+ * Function:  ServeClients 
+ * --------------------
+ *  sends the worker's queued records by deficit round-robin: each client in
+ *  the round is granted EGRESS_QUANTUM bytes per turn and sends records while
+ *  they fit, so a bulk download gets its share and an interactive client's
+ *  record is never further than one round away; a pass sends EGRESS_BUDGET
+ *  bytes at most before the worker reads again, and the timer brings it back
+ *
+ *  worker:           the worker
+ *
+ *  returns:          no return value, a client whose connection fails is closed
+ */
+void ServeClients(worker_t *worker)
+{
+	size_t budget = EGRESS_BUDGET;
+	uint64_t now = ShaperNow();
+	session_t *session = NULL;
+
+	while(NULL != worker->round_head && 0 < budget)
+	{
+		session = worker->round_head;
+		worker->round_head = session->egress_next;
+		if(NULL == worker->round_head)
+		{
+			worker->round_tail = NULL;
+		}
+
+		if(!session->turn)
+		{
+			session->deficit = DeficitGrant(session->deficit, EGRESS_QUANTUM);
+			session->turn = 1;
+		}
+
+		if(-1 == ServeTurn(worker, session, &budget, now))
+		{
+			session->egress_state = EGRESS_IDLE;
+			CloseConnection(worker, session);
+			continue;
+		}
+
+		if(EGRESS_ACTIVE == session->egress_state && 0 == budget)
+		{
+			JoinRound(worker, session, 1);
+			continue;
+		}
+
+		session->turn = 0;
+		if(EGRESS_ACTIVE == session->egress_state)
+		{
+			JoinRound(worker, session, 0);
+		}
+		else if(EGRESS_THROTTLED == session->egress_state)
+		{
+			session->egress_next = worker->throttled;
+			worker->throttled = session;
+		}
+	}
+
+	if(NULL != worker->round_head)
+	{
+		ArmEgressTimer(worker, now);
+	}
+	for(session = worker->throttled; NULL != session; session = session->egress_next)
+	{
+		ArmEgressTimer(worker, now + TokenBucketWait(&session->bucket));
+	}
+}
+
+
+/*		
+ * Function:  HandleEgressTimer 
+ * --------------------
+ *  puts the throttled clients whose rate cap allows more back in the round,
+ *  the pass itself follows at the end of the batch of events
+ *
+ *  worker:           the worker
+ *
+ *  returns:          no return value
+ */
+void HandleEgressTimer(worker_t *worker)
+{
+	uint64_t expirations = 0;
+	uint64_t now = ShaperNow();
+	session_t *throttled = worker->throttled;
+	session_t *session = NULL;
+
+	if(-1 == read(worker->timer.fd, &expirations, sizeof(expirations)) && EAGAIN != errno)
+	{
+		return;
+	}
+	worker->timer_deadline = 0;
+
+	worker->throttled = NULL;
+	while(NULL != throttled)
+	{
+		session = throttled;
+		throttled = session->egress_next;
+
+		if(TokenBucketAllows(&session->bucket, now))
+		{
+			JoinRound(worker, session, 0);
+		}
+		else
+		{
+			session->egress_next = worker->throttled;
+			worker->throttled = session;
+		}
+	}
+}
+
+
+/*		
+ * Function:  QueueToClient 
+ * --------------------
+ *  batches a packet into a client's outgoing record, sending the record first
+ *  if it has no room left, and remembers the client for the final flush;
+ *  over DTLS the packet is framed in place and encrypted into its own datagram
+ *  right away, the datagram waits in the worker's outbound ring; either way
+ *  it is compressed in place first if the client asked for that; a packet
+ *  longer than the client's tunnel MTU that may not be fragmented is answered
+ *  with an ICMP 'fragmentation needed' written to the TUN queue instead;
+ *  a super-packet goes as it is
+ *
+ *  worker:           the worker owning the session
+ *  session:          the destination session
+ *  packet:           the packet, preceded by FRAME_HEADER_SIZE bytes of headroom, may be overwritten
+ *  length:           packet length
+ *  flags:            FRAME_FLAG_OFFLOAD for a virtio_net_hdr and its super-packet, or 0
+ *  flush_list:       the list of sessions with pending outgoing frames
+ *
+ *  returns:          no return value, a client whose connection fails is closed
+ */
+void QueueToClient(worker_t *worker, session_t *session, unsigned char *packet, size_t length, unsigned char flags, session_t **flush_list)
+{
+	unsigned char reply[PMTU_ICMP_SIZE];
+	int compressed = 0;
+	size_t size = 0;
+
+	/* a closed session's address may already be another session's */
+	if(session->closing)
+	{
+		STATS_ADD(worker->traffic.drops, 1);
+		return;
+	}
+
+	/* the sender learns the client's tunnel MTU as it would from any router, a packet that may be fragmented is sent anyway */
+	if(!(FRAME_FLAG_OFFLOAD & flags) && length > session->mtu)
+	{
+		size = PmtuFragmentationNeeded(packet, length, session->mtu, reply);
+		if(0 != size)
+		{
+			COUNT_TRAFFIC(session, drops, 1);
+			if(-1 == (offload ? OffloadWrite(worker->vnic.fd, reply, size) : write(worker->vnic.fd, reply, size)) &&
+			   EAGAIN != errno && EWOULDBLOCK != errno)
+			{
+				COUNT_TRAFFIC(session, errors, 1);
+			}
+			return;
+		}
+	}
+
+	/* datagrams aren't queued, a DTLS client over its rate cap loses them as with a policer */
+	if(session->datagram && 0 != session->bucket.rate && !TokenBucketAllows(&session->bucket, ShaperNow()))
+	{
+		COUNT_TRAFFIC(session, drops, 1);
+		return;
+	}
+
+	COUNT_TRAFFIC(session, tx_packets, 1);
+	COUNT_TRAFFIC(session, tx_bytes, length);
+	session->last_sent = worker->wheel.tick;
+
+	size = FRAME_FLAG_OFFLOAD & flags ? length : CompressPacket(&session->compressor, packet, length, &compressed);
+	if(compressed)
+	{
+		COUNT_TRAFFIC(session, compression_saved, length - size);
+		flags = FRAME_FLAG_COMPRESSED;
+		length = size;
+	}
+
+	/* one IP packet per datagram */
+	if(session->datagram)
+	{
+		TokenBucketTake(&session->bucket, length + FRAME_HEADER_SIZE);
+		FrameWriteHeader(packet - FRAME_HEADER_SIZE, FRAME_PACKET, flags, length);
+		if(0 >= SSL_write(session->ssl, packet - FRAME_HEADER_SIZE, length + FRAME_HEADER_SIZE))
+		{
+			COUNT_TRAFFIC(session, errors, 1);
+			CloseConnection(worker, session);
+			return;
+		}
+		COUNT_TRAFFIC(session, tx_records, 1);
+		return;
+	}
+
+	if(-1 == FrameBatchAppend(&session->outgoing, FRAME_PACKET, flags, packet, length))
+	{
+		if(-1 == FlushToClient(worker, session))
+		{
+			CloseConnection(worker, session);
+			return;
+		}
+		FrameBatchAppend(&session->outgoing, FRAME_PACKET, flags, packet, length);
+	}
+
+	if(!session->flush_pending)
+	{
+		session->flush_pending = 1;
+		session->flush_next = *flush_list;
+		*flush_list = session;
+	}
+}
+
+
+/*		
+ * Function:  QueueFromVirtualNic 
+ * --------------------
+ *  queues what a read from a TUN queue returned for a client: a plain packet
+ *  as it is, and with OFFLOAD=on a virtio_net_hdr and its packet, which crosses
+ *  whole to a client that takes it, gets its checksum completed in place when
+ *  it is a single packet, and is cut into plain packets otherwise
+ *
+ *  worker:           the worker owning the session
+ *  session:          the destination session
+ *  data:             what was read, preceded by FRAME_HEADER_SIZE bytes of headroom, may be overwritten
+ *  length:           its length
+ *  flush_list:       the list of sessions with pending outgoing frames
+ *
+ *  returns:          no return value
+ */
+void QueueFromVirtualNic(worker_t *worker, session_t *session, unsigned char *data, size_t length, session_t **flush_list)
+{
+	struct virtio_net_hdr header;
+	unsigned char segment[FRAME_HEADER_SIZE + PMTU_MAX];
+	unsigned char *packet = data + OFFLOAD_HEADER_SIZE;
+	size_t size = 0;
+	size_t i = 0;
+
+	if(!offload)
+	{
+		QueueToClient(worker, session, data, length, 0, flush_list);
+		return;
+	}
+
+	if(session->offload)
+	{
+		QueueToClient(worker, session, data, length, FRAME_FLAG_OFFLOAD, flush_list);
+		return;
+	}
+
+	/* the header is headroom enough for the frame's */
+	memcpy(&header, data, OFFLOAD_HEADER_SIZE);
+	length -= OFFLOAD_HEADER_SIZE;
+	if(VIRTIO_NET_HDR_GSO_NONE == header.gso_type)
+	{
+		if(-1 == OffloadCompleteChecksum(&header, packet, length))
+		{
+			STATS_ADD(worker->traffic.drops, 1);
+			return;
+		}
+		QueueToClient(worker, session, packet, length, 0, flush_list);
+		return;
+	}
+
+	for(i = 0; 0 != (size = OffloadSegment(&header, packet, length, i, segment + FRAME_HEADER_SIZE, PMTU_MAX)); ++i)
+	{
+		QueueToClient(worker, session, segment + FRAME_HEADER_SIZE, size, 0, flush_list);
+	}
+
+	/* a super-packet of no segments was malformed */
+	if(0 == i)
+	{
+		STATS_ADD(worker->traffic.drops, 1);
+	}
+}
+
+
+/*		
+ * Function:  FlushPendingClients 
+ * --------------------
+ *  sends every client in the flush list its batch as one TLS record
+ *
+ *  worker:           the worker owning the sessions
+ *  flush_list:       the list of sessions with pending outgoing frames
+ *
+ *  returns:          no return value, a client whose connection fails is closed
+ */
+void FlushPendingClients(worker_t *worker, session_t *flush_list)
+{
+	session_t *session = NULL;
+
+	while(NULL != flush_list)
+	{
+		session = flush_list;
+		flush_list = session->flush_next;
+		session->flush_pending = 0;
+
+		if(!session->closing && -1 == FlushToClient(worker, session))
+		{
+			CloseConnection(worker, session);
+		}
+	}
+}
+
+
+/*		
+ * Function:  PostHandoff 
+ * --------------------
+ *  queues a chunk of packets on the worker owning their sessions and wakes it
+ *
+ *  owner:            the worker owning the sessions
+ *  chunk:            the chunk
+ *
+ *  returns:          no return value
+ */
+void PostHandoff(worker_t *owner, handoff_chunk_t *chunk)
+{
+	chunk->next = NULL;
+
+	pthread_mutex_lock(&owner->handoff_lock);
+	if(NULL == owner->handoff_tail)
+	{
+		owner->handoff_head = chunk;
+	}
+	else
+	{
+		owner->handoff_tail->next = chunk;
+	}
+	owner->handoff_tail = chunk;
+	pthread_mutex_unlock(&owner->handoff_lock);
+
+	WakeWorker(owner);
+}
+
+
+/*		
+ * Function:  HandOffPacket 
+ * --------------------
+ *  batches a packet read from this worker's TUN queue for a session owned by 
+ *  another worker into the chunk destined to that worker
+ *
+ *  worker:           the worker that read the packet
+ *  owner:            the index of the worker owning the destination session
+ *  packet:           the packet
+ *  length:           packet length
+ *
+ *  returns:          no return value, the packet is dropped if no memory is available
+ */
+void HandOffPacket(worker_t *worker, int owner, const void *packet, size_t length)
+{
+	handoff_chunk_t *chunk = worker->outbox[owner];
+
+	if(NULL != chunk && -1 == FrameBatchAppend(&chunk->frames, FRAME_PACKET, 0, packet, length))
+	{
+		PostHandoff(&worker->server->workers[owner], chunk);
+		chunk = NULL;
+	}
+
+	if(NULL == chunk)
+	{
+		chunk = malloc(sizeof(handoff_chunk_t));
+		if(NULL == chunk)
+		{
+			STATS_ADD(worker->traffic.drops, 1);
+			worker->outbox[owner] = NULL;
+			return;
+		}
+		FrameBatchReset(&chunk->frames);
+		FrameBatchAppend(&chunk->frames, FRAME_PACKET, 0, packet, length);
+	}
+
+	worker->outbox[owner] = chunk;
+}
+
+
+/*		
+ * Function:  RouteFromVirtualNic 
+ * --------------------
+ *  batches a packet read from a worker's TUN queue into the outgoing record of
+ *  the client that owns the packet's destination address
+ *
+ *  the kernel spreads packets across the TUN queues by flow, not by client, so
+ *  packets for sessions owned by other workers are handed off to them in chunks
+ *
+ *  packets addressed to no connected client are dropped
+ *
+ *  worker:           the worker owning the TUN queue
+ *  packet:           the packet (behind its virtio_net_hdr with OFFLOAD=on), in a slot of the worker's packet ring
+ *  length:           packet length
+ *  flush_list:       the list of sessions with pending outgoing frames
+ *
+ *  returns:          no return value
+ */
+void RouteFromVirtualNic(worker_t *worker, unsigned char *packet, size_t length, session_t **flush_list)
+{
+	server_t *server = worker->server;
+	size_t skip = offload ? OFFLOAD_HEADER_SIZE : 0;
+	struct iphdr *header = (struct iphdr *)(packet + skip);
+	uint32_t offset = 0;
+	int owner = 0;
+
+	if(length < skip + sizeof(struct iphdr) || 4 != header->version)
+	{
+		STATS_ADD(worker->traffic.drops, 1);
+		return;
+	}
+
+	owner = FindRouteOwner(server, header->daddr, &offset);
+	if(worker->index == owner)
+	{
+		QueueFromVirtualNic(worker, server->routes[offset], packet, length, flush_list);
+	}
+	else if(-1 != owner)
+	{
+		HandOffPacket(worker, owner, packet, length);
+	}
+	else
+	{
+		STATS_ADD(worker->traffic.drops, 1);
+	}
+}
+
+
+/*		
+ * Function:  FinishVirtualNicBurst 
+ * --------------------
+ *  sends every client its batch as one TLS record and the other workers
+ *  the chunks filled for them, once a burst of TUN packets was routed
+ *
+ *  worker:           the worker owning the TUN queue
+ *  flush_list:       the list of sessions with pending outgoing frames
+ *
+ *  returns:          no return value
+ */
+void FinishVirtualNicBurst(worker_t *worker, session_t *flush_list)
+{
+	server_t *server = worker->server;
+	int owner = 0;
+
+	FlushPendingClients(worker, flush_list);
+
+	for(owner = 0; owner < server->worker_count; ++owner)
+	{
+		if(NULL != worker->outbox[owner])
+		{
+			PostHandoff(&server->workers[owner], worker->outbox[owner]);
+			worker->outbox[owner] = NULL;
+		}
+	}
+}
+
+
+/*		
+ * Function:  HandleTrafficToClient 
+ * --------------------
+ *  drains a burst of packets from a worker's TUN queue into its packet ring and
+ *  routes each to its client, then sends every client its batch as one TLS record
+ *  (DTLS clients' packets are encrypted straight from their slots)
+ *
+ *  worker:           the worker owning the TUN queue
+ *
+ *  returns:          0 on success, -1 if reading the TUN queue failed
+ */
+int HandleTrafficToClient(worker_t *worker)
+{
+	int count = 0;
+	int i = 0;
+	session_t *flush_list = NULL;
+
+	count = PacketRingRead(&worker->packets, worker->vnic.fd);
+	if(-1 == count)
+	{
+		return -1;
+	}
+
+	for(i = 0; i < count; ++i)
+	{
+		RouteFromVirtualNic(worker, PacketRingSlot(&worker->packets, i), worker->packets.lengths[i], &flush_list);
+	}
+
+	FinishVirtualNicBurst(worker, flush_list);
+	return 0;
+}
+
+
+/*		
+ * Function:  HandleHandoff 
+ * --------------------
+ *  attaches the sessions the acceptor handed to a worker, forwards the 
+ *  packets other workers read for the worker's sessions and pauses or
+ *  resumes reading its TUN queue after the server's backlog changed
+ *
+ *  worker:           the woken worker
+ *
+ *  returns:          no return value
+ */
+void HandleHandoff(worker_t *worker)
+{
+	server_t *server = worker->server;
+	uint64_t counter = 0;
+	session_t *sessions = NULL;
+	session_t *session = NULL;
+	session_t *flush_list = NULL;
+	handoff_chunk_t *chunks = NULL;
+	handoff_chunk_t *chunk = NULL;
+	struct iphdr *header = NULL;
+	uint32_t offset = 0;
+	size_t position = 0;
+	frame_t frame;
+
+	if(-1 == read(worker->wakeup.fd, &counter, sizeof(counter)))
+	{
+		return;
+	}
+
+	pthread_mutex_lock(&worker->handoff_lock);
+	sessions = worker->handoff_sessions;
+	chunks = worker->handoff_head;
+	worker->handoff_sessions = NULL;
+	worker->handoff_head = NULL;
+	worker->handoff_tail = NULL;
+	pthread_mutex_unlock(&worker->handoff_lock);
+
+	while(NULL != sessions)
+	{
+		session = sessions;
+		sessions = session->next;
+		AttachSession(worker, session);
+	}
+
+	while(NULL != chunks)
+	{
+		chunk = chunks;
+		chunks = chunk->next;
+
+		/* the session may have closed since, or its address been leased to another worker's client */
+		position = 0;
+		while(FrameBatchNext(&chunk->frames, &position, &frame))
+		{
+			header = (struct iphdr *)(frame.payload + (offload ? OFFLOAD_HEADER_SIZE : 0));
+			if(worker->index == FindRouteOwner(server, header->daddr, &offset))
+			{
+				QueueFromVirtualNic(worker, server->routes[offset], frame.payload, frame.length, &flush_list);
+			}
+			else
+			{
+				STATS_ADD(worker->traffic.drops, 1);
+			}
+		}
+
+		free(chunk);
+	}
+
+	FlushPendingClients(worker, flush_list);
+	PauseVirtualNic(worker);
+}
+
+
+/*		
+ * Function:  SendKeepalive 
+ * --------------------
+ *  sends a client an empty FRAME_KEEPALIVE, batched (and flushed with the
+ *  flush list) over TLS, or in a datagram of its own over DTLS
+ *
+ *  worker:           the worker owning the session
+ *  session:          the client session
+ *  flush_list:       the list of sessions with pending outgoing frames
+ *
+ *  returns:          0 on success, -1 on error
+ */
+int SendKeepalive(worker_t *worker, session_t *session, session_t **flush_list)
+{
+	unsigned char frame[FRAME_HEADER_SIZE] = {0, 0, FRAME_KEEPALIVE, 0};
+
+	session->last_sent = worker->wheel.tick;
+	if(session->datagram)
+	{
+		if(0 >= SSL_write(session->ssl, frame, sizeof(frame)))
+		{
+			COUNT_TRAFFIC(session, errors, 1);
+			return -1;
+		}
+		COUNT_TRAFFIC(session, tx_records, 1);
+		return 0;
+	}
+
+	if(-1 == FrameBatchAppend(&session->outgoing, FRAME_KEEPALIVE, 0, frame, 0))
+	{
+		if(-1 == FlushToClient(worker, session))
+		{
+			return -1;
+		}
+		FrameBatchAppend(&session->outgoing, FRAME_KEEPALIVE, 0, frame, 0);
+	}
+
+	if(!session->flush_pending)
+	{
+		session->flush_pending = 1;
+		session->flush_next = *flush_list;
+		*flush_list = session;
+	}
+	return 0;
+}
+
+
+/*		
+ * Function:  CheckKeepalive 
+ * --------------------
+ *  acts on a client's expired keepalive timer: a client that sent nothing
+ *  for keepalive_timeout seconds is gone and its session is closed, which
+ *  returns its tunnel address to the pool and frees its queue; one that was
+ *  sent nothing for keepalive_interval seconds is sent a keepalive; the
+ *  timer is then due again on whichever comes first
+ *
+ *  worker:           the worker owning the session
+ *  session:          the client session
+ *  flush_list:       the list of sessions with pending outgoing frames
+ *
+ *  returns:          no return value
+ */
+void CheckKeepalive(worker_t *worker, session_t *session, session_t **flush_list)
+{
+	uint64_t now = worker->wheel.tick;
+	uint64_t due = 0;
+
+	if(now - session->last_received >= (uint64_t)keepalive_timeout)
+	{
+		printf("Notice: Client %s sent nothing for %d seconds, closing its session.\n", inet_ntoa(session->peer_addr.sin_addr), keepalive_timeout);
+		CloseConnection(worker, session);
+		return;
+	}
+
+	if(now - session->last_sent >= (uint64_t)keepalive_interval && -1 == SendKeepalive(worker, session, flush_list))
+	{
+		CloseConnection(worker, session);
+		return;
+	}
+
+	due = session->last_sent + keepalive_interval;
+	due = due < session->last_received + keepalive_timeout ? due : session->last_received + keepalive_timeout;
+	WheelSchedule(&worker->wheel, &session->keepalive_timer, due);
+}
+
+
+/*		
+ * Function:  HandleKeepaliveTick 
+ * --------------------
+ *  moves a worker's keepalive wheel on by every second that passed and
+ *  checks the clients whose timers expired, only those, however many
+ *  clients the worker has
+ *
+ *  worker:           the worker
+ *
+ *  returns:          no return value
+ */
+void HandleKeepaliveTick(worker_t *worker)
+{
+	uint64_t expirations = 0;
+	wheel_timer_t *expired = NULL;
+	session_t *session = NULL;
+	session_t *flush_list = NULL;
+
+	if(-1 == read(worker->tick.fd, &expirations, sizeof(expirations)))
+	{
+		return;
+	}
+
+	while(0 < expirations--)
+	{
+		expired = WheelAdvance(&worker->wheel);
+		while(NULL != expired)
+		{
+			session = (session_t *)((char *)expired - offsetof(session_t, keepalive_timer));
+			expired = expired->next;
+			CheckKeepalive(worker, session, &flush_list);
+		}
+	}
+
+	FlushPendingClients(worker, flush_list);
+}
+
+
+/*		
+ * Function:  HandleEvents 
+ * --------------------
+ *  dispatches a batch of epoll events of a worker, then sends the records
+ *  and datagrams queued for the clients and frees the sessions closed during
+ *  the batch
+ *
+ *  worker:	the worker
+ *  events:	the events
+ *  ready:	number of events
+ *
+ *  returns:	no return value
+ */
+void HandleEvents(worker_t *worker, struct epoll_event *events, int ready)
+{
+	event_source_t *source = NULL;
+	int i = 0;
+
+	for(i = 0; i < ready; ++i)
+	{
+		source = events[i].data.ptr;
+
+		if(EVENT_VNIC == source->type)			/* outgoing */
+		{
+			HandleTrafficToClient(worker);
+		}
+		else if(EVENT_WAKEUP == source->type)		/* new clients, other workers' packets */
+		{
+			HandleHandoff(worker);
+		}
+		else if(EVENT_TIMER == source->type)		/* rate caps to refill, or a pass to go on with */
+		{
+			HandleEgressTimer(worker);
+		}
+		else if(EVENT_TICK == source->type)		/* keepalives to send, silent clients to close */
+		{
+			HandleKeepaliveTick(worker);
+		}
+		else if(EVENT_SESSION == source->type && ((session_t *)source)->datagram)	/* incoming datagrams */
+		{
+			if(!((session_t *)source)->closing && -1 == HandleDatagramsFromClient(worker, (session_t *)source))
+			{
+				CloseConnection(worker, (session_t *)source);
+			}
+		}
+		else if(EVENT_SESSION == source->type && !((session_t *)source)->closing)	/* incoming, or room for the queue */
+		{
+			if(events[i].events & EPOLLOUT)
+			{
+				ResumeWritable(worker, (session_t *)source);
+			}
+			if((events[i].events & ~EPOLLOUT) && -1 == HandleTrafficFromClient(worker->vnic.fd, (session_t *)source))
+			{
+				CloseConnection(worker, (session_t *)source);
+			}
+		}
+	}
+
+	/* the records queued for TLS clients during the batch, in turn */
+	ServeClients(worker);
+
+	/* every datagram queued for DTLS clients during the batch, in one go */
+	PacketRingSend(&worker->outbound);
+	ReapConnections(worker);
+}
+
+
+/*		
+ * Function:  WaitForUpgrade 
+ * --------------------
+ *  stops a worker while a new server takes over, once the acceptor asked
+ *  for it (HandleUpgrade()): the worker tells the acceptor it let go of its
+ *  clients and waits for it to hand them over or to give up on it
+ *
+ *  worker:	the worker
+ *
+ *  returns:	no return value, keep_running is cleared once the clients were handed over
+ */
+void WaitForUpgrade(worker_t *worker)
+{
+	server_t *server = worker->server;
+
+	if(UPGRADE_PAUSED != __atomic_load_n(&server->upgrade_state, __ATOMIC_ACQUIRE))
+	{
+		return;
+	}
+
+	pthread_barrier_wait(&server->upgrade_barrier);		/* the acceptor may touch the clients */
+	pthread_barrier_wait(&server->upgrade_barrier);		/* it is done with them */
+}
+
+
+/*		
+ * Function:  RunUringLoop 
+ * --------------------
+ *  forwards a worker's traffic with io_uring: URING_POSTED_READS reads stay posted
+ *  on the TUN queue, each into its slot of the registered packet ring, and the worker's
+ *  epoll instance is polled through the same io_uring for its sessions and wakeups,
+ *  so a whole burst of packets completes per io_uring_enter()
+ *
+ *  worker:	the worker
+ *
+ *  returns:	no return value, returns once the server shuts down
+ */
+void RunUringLoop(worker_t *worker)
+{
+	struct epoll_event events[MAX_EVENTS];
+	session_t *flush_list = NULL;
+	uint64_t tag = 0;
+	int result = 0;
+	int events_pending = 0;
+	int ready = 0;
+
+	for(tag = 0; tag < URING_POSTED_READS; ++tag)
+	{
+		UringPrepareRead(&worker->uring, worker->vnic.fd, PacketRingSlot(&worker->packets, tag), RING_PAYLOAD_SIZE, tag);
+	}
+	UringPreparePoll(&worker->uring, worker->epoll_fd, URING_TAG_EVENTS);
+
+	while(keep_running)
+	{
+		if(-1 == UringWait(&worker->uring))
+		{
+			break;
+		}
+
+		/* the slot a completed read filled is posted again as soon as its packet was routed */
+		flush_list = NULL;
+		events_pending = 0;
+		while(UringNextCompletion(&worker->uring, &tag, &result))
+		{
+			if(URING_TAG_EVENTS == tag)
+			{
+				events_pending = 1;
+				continue;
+			}
+
+			if(0 < result)
+			{
+				RouteFromVirtualNic(worker, PacketRingSlot(&worker->packets, tag), result, &flush_list);
+			}
+			else if(-EINTR != result && -EAGAIN != result)
+			{
+				continue;		/* the TUN queue failed, retire the slot */
+			}
+
+			/* while every client is backlogged the slot waits to be posted again */
+			if(worker->vnic_paused)
+			{
+				worker->parked[worker->parked_count++] = tag;
+				continue;
+			}
+			UringPrepareRead(&worker->uring, worker->vnic.fd, PacketRingSlot(&worker->packets, tag), RING_PAYLOAD_SIZE, tag);
+		}
+		FinishVirtualNicBurst(worker, flush_list);
+		ServeClients(worker);
+
+		if(events_pending)
+		{
+			ready = epoll_wait(worker->epoll_fd, events, MAX_EVENTS, 0);
+			if(-1 == ready)
+			{
+				ready = 0;
+			}
+			HandleEvents(worker, events, ready);
+			UringPreparePoll(&worker->uring, worker->epoll_fd, URING_TAG_EVENTS);
+		}
+		else
+		{
+			PacketRingSend(&worker->outbound);
+			ReapConnections(worker);
+		}
+
+		/* a queue drained (or a client left or arrived), reading the TUN queue resumes */
+		if(!worker->vnic_paused)
+		{
+			while(0 < worker->parked_count)
+			{
+				tag = worker->parked[--worker->parked_count];
+				UringPrepareRead(&worker->uring, worker->vnic.fd, PacketRingSlot(&worker->packets, tag), RING_PAYLOAD_SIZE, tag);
+			}
+		}
+
+		WaitForUpgrade(worker);
+	}
+}
+
+
+/*		
+ * Function:  WorkerLoop 
+ * --------------------
+ *  the body of a worker thread: forwards traffic between the worker's TUN queue
+ *  and the worker's clients until the server shuts down
+ *
+ *  arg:	the worker
+ *
+ *  returns:	NULL
+ */
+void *WorkerLoop(void *arg)
+{
+	worker_t *worker = arg;
+	struct epoll_event events[MAX_EVENTS];
+	int ready = 0;
+
+	if(-1 != worker->uring.fd)
+	{
+		RunUringLoop(worker);
+	}
+
+	while(keep_running && -1 == worker->uring.fd)
+	{
+		ready = epoll_wait(worker->epoll_fd, events, MAX_EVENTS, -1);
+		if(-1 == ready)
+		{
+			if(EINTR == errno)
+			{
+				continue;
+			}
+			break;
+		}
+
+		HandleEvents(worker, events, ready);
+		WaitForUpgrade(worker);
+	}
+
+	/* the clients a new server took over were taken off the list already */
+	while(NULL != worker->sessions)
+	{
+		CloseConnection(worker, worker->sessions);
+	}
+	PacketRingSend(&worker->outbound);
+	ReapConnections(worker);
+
+	return NULL;
+}
+
+
+/* ========================== */
+/*    STATISTICS FUNCTIONS    */
+/* ========================== */
+/*		
+ * Function:  RenderSessionStats 
+ * --------------------
+ *  appends the traffic metrics of every attached session, labelled with its
+ *  tunnel address, public address and worker
+ *
+ *  buffer:     the buffer
+ *  server:     the server state
+ *
+ *  returns:    no return value
+ */
+void RenderSessionStats(stats_buffer_t *buffer, server_t *server)
+{
+	traffic_sample_t *samples = NULL;
+	traffic_sample_t *grown = NULL;
+	session_stats_t *stats = NULL;
+	size_t capacity = 0;
+	size_t count = 0;
+	uint32_t offset = 0;
+	int owner = 0;
+	struct in_addr inner_addr;
+	char peer[INET_ADDRSTRLEN];
+
+	for(offset = 0; offset < server->leases.size; ++offset)
+	{
+		/* the owner is published after the session's statistics were reset */
+		owner = __atomic_load_n(&server->route_owners[offset], __ATOMIC_ACQUIRE);
+		if(-1 == owner)
+		{
+			continue;
+		}
+
+		if(count == capacity)
+		{
+			capacity = 0 == capacity ? MAX_EVENTS : capacity * 2;
+			grown = realloc(samples, capacity * sizeof(traffic_sample_t));
+			if(NULL == grown)
+			{
+				break;
+			}
+			samples = grown;
+		}
+
+		stats = &server->session_stats[offset];
+		inner_addr.s_addr = htonl(server->leases.network + offset);
+		inet_ntop(AF_INET, &stats->peer_addr.sin_addr, peer, sizeof(peer));
+		snprintf(samples[count].labels, STATS_LABELS_LENGTH, "client=\"%s\",peer=\"%s:%d\",worker=\"%d\"", 
+		         inet_ntoa(inner_addr), peer, ntohs(stats->peer_addr.sin_port), owner);
+		memset(samples[count].values, 0, sizeof(samples[count].values));
+		StatsAccumulate(&samples[count], &stats->traffic);
+		++count;
+	}
+
+	StatsWriteTraffic(buffer, "vpn_session", samples, count);
+	free(samples);
+}
+
+
+/*		
+ * Function:  RenderStats 
+ * --------------------
+ *  renders the server's statistics in the Prometheus text format, called on
+ *  the statistics socket's thread: the totals are the workers' counters added
+ *  up, each worker only ever writes its own
+ *
+ *  buffer:     the buffer
+ *  arg:        the server state
+ *
+ *  returns:    no return value
+ */
+void RenderStats(stats_buffer_t *buffer, void *arg)
+{
+	server_t *server = arg;
+	handshake_counters_t sum;
+	handshake_counters_t *handshakes = &sum;
+	traffic_sample_t workers[MAX_WORKERS];
+	traffic_sample_t total;
+	uint64_t completed = 0;
+	int i = 0;
+
+	/* each acceptor counts its own handshakes, the reloads on the first */
+	memset(&sum, 0, sizeof(sum));
+	for(i = 0; i < server->acceptor_count; ++i)
+	{
+		handshakes = &server->acceptors[i].handshake_stats;
+		sum.in_progress += STATS_GET(handshakes->in_progress);
+		sum.completed += STATS_GET(handshakes->completed);
+		sum.failed += STATS_GET(handshakes->failed);
+		sum.timed_out += STATS_GET(handshakes->timed_out);
+		sum.resumed += STATS_GET(handshakes->resumed);
+		sum.duration_ms += STATS_GET(handshakes->duration_ms);
+		sum.reloads += STATS_GET(handshakes->reloads);
+		sum.failed_reloads += STATS_GET(handshakes->failed_reloads);
+		sum.shed += STATS_GET(handshakes->shed);
+	}
+	handshakes = &sum;
+	completed = sum.completed;
+
+	memset(&total, 0, sizeof(total));
+	memset(workers, 0, sizeof(workers));
+	for(i = 0; i < server->worker_count; ++i)
+	{
+		snprintf(workers[i].labels, STATS_LABELS_LENGTH, "worker=\"%d\"", i);
+		StatsAccumulate(&workers[i], &server->workers[i].traffic);
+		StatsAccumulate(&total, &server->workers[i].traffic);
+	}
+
+	StatsMetric(buffer, "vpn_sessions", "gauge", "Clients attached to a worker.");
+	for(i = 0; i < server->worker_count; ++i)
+	{
+		StatsPrintf(buffer, "vpn_sessions{worker=\"%d\"} %zu\n", i, 
+		            __atomic_load_n(&server->workers[i].session_count, __ATOMIC_RELAXED));
+	}
+
+	StatsMetric(buffer, "vpn_handshakes_in_progress", "gauge", "Handshakes the acceptors are running.");
+	StatsPrintf(buffer, "vpn_handshakes_in_progress %llu\n", (unsigned long long)STATS_GET(handshakes->in_progress));
+	StatsMetric(buffer, "vpn_handshakes_total", "counter", "Handshakes that ended, by result.");
+	StatsPrintf(buffer, "vpn_handshakes_total{result=\"completed\"} %llu\n", (unsigned long long)completed);
+	StatsPrintf(buffer, "vpn_handshakes_total{result=\"failed\"} %llu\n", (unsigned long long)STATS_GET(handshakes->failed));
+	StatsPrintf(buffer, "vpn_handshakes_total{result=\"timed_out\"} %llu\n", (unsigned long long)STATS_GET(handshakes->timed_out));
+	StatsPrintf(buffer, "vpn_handshakes_total{result=\"shed\"} %llu\n", (unsigned long long)STATS_GET(handshakes->shed));
+	StatsMetric(buffer, "vpn_handshakes_waiting", "gauge", "Handshakes waiting for a handshake worker, by kind.");
+	StatsPrintf(buffer, "vpn_handshakes_waiting{kind=\"resumption\"} %zu\n", HandshakePoolWaiting(&server->handshake_pool, HANDSHAKE_RESUMPTION));
+	StatsPrintf(buffer, "vpn_handshakes_waiting{kind=\"full\"} %zu\n", HandshakePoolWaiting(&server->handshake_pool, HANDSHAKE_FULL));
+	StatsMetric(buffer, "vpn_acceptor_handshakes_total", "counter", "Completed handshakes, by acceptor.");
+	for(i = 0; i < server->acceptor_count; ++i)
+	{
+		StatsPrintf(buffer, "vpn_acceptor_handshakes_total{acceptor=\"%d\"} %llu\n", i, 
+		            (unsigned long long)STATS_GET(server->acceptors[i].handshake_stats.completed));
+	}
+	StatsMetric(buffer, "vpn_handshakes_resumed_total", "counter", "Completed handshakes that resumed a session.");
+	StatsPrintf(buffer, "vpn_handshakes_resumed_total %llu\n", (unsigned long long)STATS_GET(handshakes->resumed));
+	StatsMetric(buffer, "vpn_handshake_duration_seconds", "summary", "Time from accepting a client to handing it to a worker.");
+	StatsPrintf(buffer, "vpn_handshake_duration_seconds_sum %.3f\n", STATS_GET(handshakes->duration_ms) / 1000.0);
+	StatsPrintf(buffer, "vpn_handshake_duration_seconds_count %llu\n", (unsigned long long)completed);
+	StatsMetric(buffer, "vpn_reloads_total", "counter", "Reloads of the certificate and TLS settings (SIGHUP), by result.");
+	StatsPrintf(buffer, "vpn_reloads_total{result=\"applied\"} %llu\n", (unsigned long long)STATS_GET(handshakes->reloads));
+	StatsPrintf(buffer, "vpn_reloads_total{result=\"failed\"} %llu\n", (unsigned long long)STATS_GET(handshakes->failed_reloads));
+
+	StatsWriteTraffic(buffer, "vpn", &total, 1);
+	StatsWriteTraffic(buffer, "vpn_worker", workers, server->worker_count);
+	RenderSessionStats(buffer, server);
+}
+
+
+/*		
+ * Function:  ClearRoutingTable 
+ * --------------------
+ *  clears the routing table by removing the NAT rule that masquerades outgoing traffic
+ *  (with the rest of the server's nftables table)
+ *
+ *  returns:  no return value
+ */
+void ClearRoutingTable()
+{
+	NetconfRemoveRules();
+}
+
+
+/*		
+ * Function:  RemoveVirtualNic 
+ * --------------------
+ *  removes the virtual network interface (TUN device) from the system
+ *
+ *  returns:  no return value
+ */
+void RemoveVirtualNic()
+{
+	NetconfLinkDelete(VNIC_NAME);
+}
+
+
+/*		
+ * Function:  CleanUp 
+ * --------------------
+ *  closes what the stopped workers left behind, the network sockets and the 
+ *  SSL context, and releases resources
+ *
+ *  server:	     the server state
+ *
+ *  returns:	      no return value
+ */
+void CleanUp(server_t *server)
+{
+	worker_t *worker = NULL;
+	session_t *session = NULL;
+	handoff_chunk_t *chunk = NULL;
+	acceptor_t *acceptor = NULL;
+	int i = 0;
+
+	for(i = 0; i < server->acceptor_count; ++i)
+	{
+		acceptor = &server->acceptors[i];
+		ReclaimHandshakes(acceptor, 0);		/* the handshake workers stopped, the steps still queued never ran */
+		while(NULL != acceptor->handshakes)
+		{
+			AbortHandshake(acceptor, acceptor->handshakes);
+		}
+		close(acceptor->epoll_fd);
+		close(acceptor->wakeup.fd);
+		close(acceptor->listener.fd);
+		pthread_mutex_destroy(&acceptor->returned_lock);
+	}
+
+	for(i = 0; i < server->worker_count; ++i)
+	{
+		worker = &server->workers[i];
+
+		while(NULL != (session = worker->handoff_sessions))
+		{
+			worker->handoff_sessions = session->next;
+			SSL_free(session->ssl);
+			RecordStreamFree(session->records);
+			ReleaseQueue(worker, session);
+			close(session->source.fd);
+			free(session);
+		}
+		while(NULL != (chunk = worker->handoff_head))
+		{
+			worker->handoff_head = chunk->next;
+			free(chunk);
+		}
+
+		UringDestroy(&worker->uring);
+		close(worker->epoll_fd);
+		close(worker->wakeup.fd);
+		close(worker->timer.fd);
+		close(worker->tick.fd);
+		close(worker->vnic.fd);
+		pthread_mutex_destroy(&worker->handoff_lock);
+		PacketRingDestroy(&worker->packets);
+		PacketRingDestroy(&worker->inbound);
+		PacketRingDestroy(&worker->outbound);
+	}
+
+	if(-1 != server->upgrade.fd)
+	{
+		close(server->upgrade.fd);
+		if(UPGRADE_NONE == server->upgrade_state)
+		{
+			unlink(upgrade_path);
+		}
+	}
+
+	SSL_CTX_free(server->ctx); 
+	pthread_mutex_destroy(&server->ctx_lock);
+	pthread_mutex_destroy(&server->backlog_lock);
+	pthread_barrier_destroy(&server->upgrade_barrier);
+	LeasePoolDestroy(&server->leases);
+	pthread_mutex_destroy(&server->lease_lock);
+	free(server->routes);
+	free(server->route_owners);
+	free(server->session_stats);
+	free(server->workers);
+	free(server->acceptors);
+
+	/* tun0 and the NAT rules stay with the server that serves on */
+	if(UPGRADE_NONE == server->upgrade_state)
+	{
+		RemoveVirtualNic();
+		ClearRoutingTable();
+	}
+}
+
+
+/*		
+ * Function:  HandleCtrlC 
+ * --------------------
+ *  handles the Ctrl+C signal by updating the keep_running flag to terminate the program
+ *
+ *  dummy:	unused parameter (required by signal handler)
+ *
+ *  Returns:	no return value
+ */
+void HandleCtrlC(int dummy)
+{
+	(void)dummy;
+	keep_running = 0;
+}
+
+
+/*		
+ * Function:  HandleHangUp 
+ * --------------------
+ *  handles SIGHUP by asking the acceptor to reload the certificate and TLS settings
+ *
+ *  dummy:	unused parameter (required by signal handler)
+ *
+ *  Returns:	no return value
+ */
+void HandleHangUp(int dummy)
+{
+	(void)dummy;
+	reload_requested = 1;
+}
+
+/*		 
+ * Function:  main 
+ * --------------------
+ *  the entry point of the VPN server application. sets up the virtual NIC, TCP socket,
+ *  and SSL context, starts one forwarding worker per TUN queue and then enters an
+ *  event loop that accepts clients and hands them to the workers
+ */
+int main()
+{
+	server_t server;
+	acceptor_t *first = NULL;
+	session_t *session = NULL;
+	session_t *imported = NULL;
+	struct epoll_event events[MAX_EVENTS];
+	int queue_fds[MAX_WORKERS];
+	upgrade_message_type_t closed = UPGRADE_TAKEN;
+	int upgrade_fd = -1;
+	int upgrade_count = 0;
+	int received = 0;
+	sigset_t signals;
+	sigset_t waiting;
+	int ready = 0;
+	int i = 0;
+	
+	memset(&server, 0, sizeof(server));
+	server.stats.fd = -1;
+	server.upgrade.fd = -1;
+	pthread_mutex_init(&server.lease_lock, NULL);
+	pthread_mutex_init(&server.ctx_lock, NULL);
+	pthread_mutex_init(&server.backlog_lock, NULL);
+
+	if(-1 == GetConfiguration())
+	{
+		return -1;
+	}
+
+	/* set up the tunnel address pool and the route table indexed by it */
+	if(-1 == LeasePoolInit(&server.leases, tunnel_network, tunnel_prefix_length) || 
+	   NULL == (server.routes = calloc(server.leases.size, sizeof(session_t *))) ||
+	   NULL == (server.route_owners = malloc(server.leases.size * sizeof(int))) ||
+	   NULL == (server.session_stats = aligned_alloc(STATS_CACHE_LINE, server.leases.size * sizeof(session_stats_t))) ||
+	   NULL == (server.workers = aligned_alloc(STATS_CACHE_LINE, worker_count * sizeof(worker_t))) ||
+	   NULL == (server.acceptors = aligned_alloc(STATS_CACHE_LINE, acceptor_count * sizeof(acceptor_t))))
+	{
+		printf("Error: Failed to allocate the tunnel address pool.\n");
+		return -1;
+	}
+	memset(server.route_owners, 0xFF, server.leases.size * sizeof(int));	/* -1, no owner */
+	memset(server.workers, 0, worker_count * sizeof(worker_t));
+	memset(server.acceptors, 0, acceptor_count * sizeof(acceptor_t));
+	for(i = 0; i < acceptor_count; ++i)
+	{
+		server.acceptors[i].epoll_fd = -1;
+		server.acceptors[i].listener.fd = -1;
+		server.acceptors[i].wakeup.fd = -1;
+	}
+	server.worker_count = worker_count;
+	server.acceptor_count = acceptor_count;
+	first = &server.acceptors[0];
+	pthread_barrier_init(&server.upgrade_barrier, NULL, worker_count + acceptor_count);
+
+	/* a server running on the upgrade socket hands its TUN queues, listening sockets and clients over */
+	if('\0' != upgrade_path[0])
+	{
+		upgrade_fd = UpgradeConnect(upgrade_path);
+		if(-1 == upgrade_fd && ENOENT != errno && ECONNREFUSED != errno)
+		{
+			printf("Error: Failed to connect to the running server on '%s'.\n", upgrade_path);
+			return -1;
+		}
+	}
+
+	if(-1 != upgrade_fd)
+	{
+		server.upgrade_state = UPGRADE_TAKING_OVER;
+		upgrade_count = TakeOver(&server, upgrade_fd, queue_fds);
+		if(-1 == upgrade_count)
+		{
+			printf("Error: Failed to take over from the running server.\n");
+			close(upgrade_fd);
+			return -1;
+		}
+	}
+	/* set up the virtual network interface (TUN device), one queue per worker */
+	else if (-1 == SetUpVictualNIC(VNIC_NAME, queue_fds, worker_count))
+	{
+		printf("Error: Failed to set up the virtual network interface.\n");
 		return -1;
 	}
 
-	/* set up the Ctrl+C signal handler */ 
+	/* set up the Ctrl+C signal handler, a vanished client must not kill the server, SIGHUP reloads the certificate */ 
 	signal(SIGINT, HandleCtrlC);
+	signal(SIGHUP, HandleHangUp);
+	signal(SIGPIPE, SIG_IGN);
 	
-	/* route traffic using IP tables */
-	RouteTraffic();
+	/* route traffic using nftables, unless the running server did */
+	if(-1 == upgrade_fd)
+	{
+		RouteTraffic();
+	}
     
-    	/* set up the TCP socket with TLS/SSL */
-	socket_fd = SetUpTCPSocketWithTLS(&ctx, &ssl);
-	if (-1 == socket_fd)
+    	/* set up the TCP socket with TLS/SSL (or the UDP socket with DTLS), unless the running server's was taken over */
+	if(-1 == upgrade_fd && TRANSPORT_UDP == transport)
 	{
-		close(virtual_nic_fd);
-		ClearRoutingTable();
-		RemoveVirtualNic();
+		first->listener.fd = SetUpUDPSocketWithDTLS(&server.ctx);
+	}
+	else if(-1 == upgrade_fd)
+	{
+		first->listener.fd = SetUpTCPSocketWithTLS(&server.ctx);
+	}
+
+	/* every other acceptor listens on a socket of its own in the first one's SO_REUSEPORT group, in order */
+	for(i = 1; -1 == upgrade_fd && -1 != first->listener.fd && i < acceptor_count; ++i)
+	{
+		server.acceptors[i].listener.fd = SetUpTCPListener();
+	}
+
+	for(i = 0; i < acceptor_count; ++i)
+	{
+		if(-1 == server.acceptors[i].listener.fd || -1 == SetUpAcceptor(&server, &server.acceptors[i], i))
+		{
+			break;
+		}
+	}
+
+	if (acceptor_count != i)
+	{
+		for(i = 0; i < worker_count; ++i)
+		{
+			close(queue_fds[i]);
+		}
+		if(-1 == upgrade_fd)
+		{
+			ClearRoutingTable();
+			RemoveVirtualNic();
+		}
 		printf("Error: Failed to set up the TCP socket with TLS/SSL.\n");
 		return -1;
 	}
-    
 
+	/* the group keeps the program across a takeover, attaching it again replaces it */
+	if(accept_steering && -1 == AttachSteering(first->listener.fd, acceptor_count))
+	{
+		printf("Notice: Failed to steer connections by CPU, the kernel spreads them across the acceptors by hash.\n");
+	}
+
+	/* once the running server's clients came over it stops, tun0 is this server's from then on */
+	if(-1 != upgrade_fd)
+	{
+		if(-1 == ImportSessions(&server, upgrade_fd, upgrade_count, &imported))
+		{
+			printf("Error: Failed to take over the running server's clients, it serves on.\n");
+			close(upgrade_fd);
+			server.worker_count = 0;
+			CleanUp(&server);
+			return -1;
+		}
+
+		/* a queue the running server read through io_uring blocks, the workers set it up for themselves */
+		server.upgrade_state = UPGRADE_NONE;
+		for(i = 0; i < worker_count; ++i)
+		{
+			fcntl(queue_fds[i], F_SETFL, fcntl(queue_fds[i], F_GETFL) | O_NONBLOCK);
+		}
+	}
+
+	/* start the workers, the handshake workers, the other acceptors (and the statistics thread) with Ctrl+C and SIGHUP blocked, so they always interrupt the first acceptor */
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGHUP);
+	pthread_sigmask(SIG_BLOCK, &signals, &waiting);
+	for(i = 0; i < worker_count; ++i)
+	{
+		if(-1 == SetUpWorker(&server, &server.workers[i], i, queue_fds[i]) || 
+		   0 != pthread_create(&server.workers[i].thread, NULL, WorkerLoop, &server.workers[i]))
+		{
+			printf("Error: Failed to start worker %d.\n", i);
+			keep_running = 0;
+			server.worker_count = i + 1;
+			break;
+		}
+	}
+
+	if(keep_running && 0 != handshake_workers && 
+	   -1 == HandshakePoolStart(&server.handshake_pool, handshake_workers, handshake_backlog, ReturnHandshake))
+	{
+		printf("Error: Failed to start the handshake workers.\n");
+		keep_running = 0;
+	}
+
+	for(i = 1; keep_running && i < acceptor_count; ++i)
+	{
+		if(0 != pthread_create(&server.acceptors[i].thread, NULL, AcceptorLoop, &server.acceptors[i]))
+		{
+			printf("Error: Failed to start acceptor %d.\n", i);
+			keep_running = 0;
+		}
+	}
+
+	/* the clients taken over go back to the workers that served them */
+	while(keep_running && NULL != (session = imported))
+	{
+		imported = session->next;
+		pthread_mutex_lock(&session->worker->handoff_lock);
+		session->next = session->worker->handoff_sessions;
+		session->worker->handoff_sessions = session;
+		pthread_mutex_unlock(&session->worker->handoff_lock);
+		WakeWorker(session->worker);
+	}
+
+	/* the running server lets go of the statistics socket as it exits, its end of the connection closes then */
+	if(-1 != upgrade_fd)
+	{
+		UpgradeReceive(upgrade_fd, &closed, sizeof(closed), NULL, 0, &received);
+		close(upgrade_fd);
+		printf("Notice: Took over from the running server with %d of its clients.\n", upgrade_count);
+	}
+
+	/* serve the statistics, read while the workers update them */
+	if(keep_running && '\0' != stats_path[0] && -1 == StatsStart(&server.stats, stats_path, RenderStats, &server))
+	{
+		printf("Error: Failed to serve the statistics on '%s'.\n", stats_path);
+		keep_running = 0;
+	}
+
+	/* a newer server takes over on the upgrade socket */
+	if(keep_running && '\0' != upgrade_path[0] && -1 == ListenForUpgrade(&server))
+	{
+		printf("Error: Failed to listen for a new server on '%s'.\n", upgrade_path);
+		keep_running = 0;
+	}
+
+	/* the first acceptor is pinned after the other threads were created, so they don't inherit its CPUs */
+	if(accept_steering)
+	{
+		PinAcceptor(first);
+	}
+
+	/* SIGHUP stays blocked outside of epoll_pwait(), a reload asked for after the check below still interrupts the wait */
+	sigdelset(&signals, SIGHUP);
+	pthread_sigmask(SIG_UNBLOCK, &signals, NULL);
+    
+	/* main loop for accepting clients */
 	while(keep_running)
 	{
-	    	/* accept incoming client connection */
-		conn_fd = CreateConnection(&socket_fd, &ctx, &ssl);
-		
-		/* main loop for handling traffic */
-		while(-1 != conn_fd)
+		if(reload_requested)
 		{
-			FD_ZERO(&read_fds);
-			FD_SET(virtual_nic_fd, &read_fds);
-			FD_SET(conn_fd, &read_fds);
+			reload_requested = 0;
+			ReloadConfiguration(&server);
+		}
 
-			maxfdp = max(virtual_nic_fd, conn_fd);
-			select(maxfdp + 1, &read_fds, NULL, NULL, NULL);
-		
-			if(FD_ISSET(virtual_nic_fd, &read_fds))	/* outgoing */
-			{
-				if(-1 == HandleTrafficToClient(virtual_nic_fd, ssl))
-				{
-					break;
-				}
-			}
-			
-			if(FD_ISSET(conn_fd, &read_fds))		/* incoming */
+		ready = epoll_pwait(first->epoll_fd, events, MAX_EVENTS, NextAcceptorTimeout(first), &waiting);
+		if(-1 == ready)
+		{
+			if(EINTR == errno)
 			{
-				if(-1 == HandleTrafficFromClient(virtual_nic_fd, ssl))
-				{
-					break;
-				}
+				continue;
 			}
-		}	
+			break;
+		}
+
+		HandleAcceptorEvents(first, events, ready);
+		HandleAcceptorTimers(first);
+	}
+
+	/* stop the other acceptors, the handshake workers, then the workers, each closes its own clients */
+	keep_running = 0;
+	StatsStop(&server.stats);
+	for(i = 1; i < acceptor_count; ++i)
+	{
+		if(0 != server.acceptors[i].thread)
+		{
+			WakeAcceptor(&server.acceptors[i]);
+			pthread_join(server.acceptors[i].thread, NULL);
+		}
+	}
+	HandshakePoolStop(&server.handshake_pool);
+	for(i = 0; i < server.worker_count; ++i)
+	{
+		if(0 != server.workers[i].thread)
+		{
+			WakeWorker(&server.workers[i]);
+			pthread_join(server.workers[i].thread, NULL);
+		}
 	}
 	
-	CleanUp(virtual_nic_fd, socket_fd, conn_fd, ctx, ssl);
+	CleanUp(&server);
 	return 0;
 }
@@ -0,0 +1,572 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stddef.h>		/* size_t 		*/
+#include <stdint.h>		/* uint64_t 		*/
+#include <pthread.h>		/* pthread_t 		*/
+#include <netinet/in.h>		/* sockaddr_in 		*/
+#include <openssl/ssl.h>	/* SSL 			*/
+#include "frame.h"		/* frame_batch_t 	*/
+#include "ring.h"		/* packet_ring_t 	*/
+#include "uring.h"		/* uring_t 		*/
+#include "cipher.h"		/* cipher_config_t 	*/
+#include "stats.h"		/* traffic_counters_t 	*/
+#include "shaper.h"		/* token_bucket_t 	*/
+#include "compress.h"		/* compressor_t 	*/
+#include "wheel.h"		/* timer_wheel_t 	*/
+#include "record.h"		/* record_stream_t 	*/
+#include "handshake.h"		/* handshake_pool_t 	*/
+
+#define VNIC_NAME "tun0"
+#define PORT 1688
+#define MAX_LINE_LENGTH 4096
+#define MIN_PORT 1024
+#define MAX_PORT 65535
+#define MAX_EVENTS 64
+#define DEFAULT_TUNNEL_NETWORK "10.8.0.0/24"
+#define MIN_TUNNEL_PREFIX 16
+#define MAX_TUNNEL_PREFIX 30
+#define COOKIE_SECRET_LENGTH 32
+#define MAX_WORKERS 64
+#define MAX_ACCEPTORS 64
+#define URING_TAG_EVENTS RING_SLOTS				/* TUN reads are tagged with their slot */
+#define SESSION_LIFETIME 7200					/* seconds a client may resume its session for */
+#define SESSION_ID_CONTEXT "vpn-tunnel"
+#define HANDSHAKE_TIMEOUT 10000					/* milliseconds a client has to complete its handshake */
+#define ACCEPT_PAUSE 1000					/* milliseconds accepting stops for after accept() failed */
+#define DEFAULT_HANDSHAKE_BACKLOG 256				/* full handshakes waiting for a handshake worker */
+#define MAX_HANDSHAKE_BACKLOG 65536
+#define DEFAULT_QUEUE_LENGTH 64					/* records (of up to FRAME_BATCH_SIZE bytes) per client */
+#define MAX_QUEUE_LENGTH 4096
+#define EGRESS_QUANTUM FRAME_BATCH_SIZE				/* bytes a backlogged client is granted per round, one whole record */
+#define EGRESS_BUDGET (16 * FRAME_BATCH_SIZE)			/* bytes a worker sends per pass before it reads again */
+#define RATE_BURST_DIVISOR 10					/* a capped client may burst 1/10 s (100 ms) of its rate */
+#define DEFAULT_KEEPALIVE_INTERVAL 10				/* seconds without sending before a keepalive is sent */
+#define DEFAULT_KEEPALIVE_TIMEOUT 60				/* seconds without hearing from a client before it counts as gone */
+#define MAX_KEEPALIVE 3600
+#define MAX_RATE_RULES 256
+#define TICKET_KEYS_LENGTH 80					/* key name, HMAC and AES keys, as SSL_CTX_get_tlsext_ticket_keys() hands them out */
+
+/*
+ * Enum:  transport 
+ * --------------------
+ *  how the tunnel is carried between client and server
+ */
+typedef enum transport
+{
+	TRANSPORT_TCP,		/* TLS over TCP, frames are coalesced into records */
+	TRANSPORT_UDP		/* DTLS over UDP, one frame (one IP packet) per datagram */
+} transport_t;
+
+/*
+ * Enum:  io_backend 
+ * --------------------
+ *  how the workers wait for traffic
+ */
+typedef enum io_backend
+{
+	IO_BACKEND_EPOLL,	/* epoll, then one read per TUN packet */
+	IO_BACKEND_IO_URING	/* TUN reads kept posted on an io_uring, epoll nested for the sessions */
+} io_backend_t;
+
+/*
+ * Enum:  queue_policy 
+ * --------------------
+ *  what a client's full send queue does with one more record
+ */
+typedef enum queue_policy
+{
+	QUEUE_TAIL_DROP,	/* drop the new record, the queued ones keep their order */
+	QUEUE_HEAD_DROP		/* drop the oldest record not yet handed to the socket, favouring fresh packets */
+} queue_policy_t;
+
+/*
+ * Struct:  rate_rule 
+ * --------------------
+ *  a CLIENT_RATE_LIMIT entry, capping the traffic sent to one client
+ *
+ *  addr:	the client's public address (network order)
+ *  rate:	bytes per second, 0 for no cap
+ */
+typedef struct rate_rule
+{
+	in_addr_t addr;
+	uint64_t rate;
+} rate_rule_t;
+
+/*
+ * Enum:  egress_state 
+ * --------------------
+ *  where a TLS client stands in its worker's egress scheduler
+ */
+typedef enum egress_state
+{
+	EGRESS_IDLE,		/* nothing queued */
+	EGRESS_ACTIVE,		/* in the worker's round, waiting for its turn */
+	EGRESS_BLOCKED,		/* its connection can't take more, waiting to become writable */
+	EGRESS_THROTTLED	/* over its rate cap, waiting for the worker's timer */
+} egress_state_t;
+
+/*
+ * Enum:  upgrade_state 
+ * --------------------
+ *  where the server stands in handing over to a new server
+ */
+typedef enum upgrade_state
+{
+	UPGRADE_NONE,		/* serving */
+	UPGRADE_PAUSED,		/* a new server is taking over, the workers wait for the first acceptor */
+	UPGRADE_HANDED_OVER,	/* the new server took over, tun0 and the clients it took are its own */
+	UPGRADE_TAKING_OVER	/* this server is taking over, tun0 is still the running server's */
+} upgrade_state_t;
+
+/*
+ * Enum:  event_type 
+ * --------------------
+ *  identifies the kind of file descriptor an epoll event was reported for
+ */
+typedef enum event_type
+{
+	EVENT_LISTENER,
+	EVENT_HANDSHAKE,
+	EVENT_VNIC,
+	EVENT_SESSION,
+	EVENT_WAKEUP,
+	EVENT_TIMER,
+	EVENT_TICK,
+	EVENT_UPGRADE
+} event_type_t;
+
+/*
+ * Struct:  event_source 
+ * --------------------
+ *  the object registered as epoll user data; every registered fd embeds one
+ *  as its first member so the event loop can dispatch on the type
+ *
+ *  type:	the kind of file descriptor
+ *  fd:		the registered file descriptor
+ */
+typedef struct event_source
+{
+	event_type_t type;
+	int fd;
+} event_source_t;
+
+typedef struct server server_t;
+typedef struct worker worker_t;
+typedef struct acceptor acceptor_t;
+
+/*
+ * Struct:  session_stats 
+ * --------------------
+ *  the statistics of the session leasing a tunnel address, kept in a table
+ *  indexed like the route table so the statistics socket's thread can read
+ *  them while the session's worker updates them
+ *
+ *  traffic:	the session's counters, reset when the address is leased again
+ *  peer_addr:	the client's public address
+ */
+typedef struct session_stats
+{
+	traffic_counters_t traffic;
+	struct sockaddr_in peer_addr;
+} session_stats_t;
+
+/*
+ * Struct:  send_queue 
+ * --------------------
+ *  the records a client's non-blocking socket didn't take yet, oldest first;
+ *  bounded by queue_length, beyond which queue_policy drops records
+ *
+ *  records:	ring of queue_length records, allocated with the first record queued
+ *  head:	index of the oldest record
+ *  count:	number of queued records
+ *  bytes:	bytes queued, for the statistics
+ *  started:	the oldest record was handed to the socket: SSL_write() must be retried
+ *		with it (or, over kTLS, its first 'sent' bytes were written), so it stays
+ *  sent:	over kTLS, how much of the oldest record was written
+ */
+typedef struct send_queue
+{
+	frame_batch_t **records;
+	size_t head;
+	size_t count;
+	size_t bytes;
+	int started;
+	size_t sent;
+} send_queue_t;
+
+/*
+ * Struct:  handshake_counters 
+ * --------------------
+ *  the acceptor's handshake statistics, only written by the acceptor
+ *
+ *  in_progress:	handshakes currently running (gauge)
+ *  completed:		handshakes that completed, the client was handed to a worker
+ *  resumed:		the completed handshakes that resumed a session
+ *  failed:		handshakes that failed, or completed without a lease for the client
+ *  timed_out:		handshakes dropped after HANDSHAKE_TIMEOUT
+ *  duration_ms:	total time the completed handshakes took
+ *  reloads:		reloads of the TLS settings new handshakes got
+ *  failed_reloads:	reloads that failed, handshakes kept the settings they had
+ *  shed:		full handshakes dropped since HANDSHAKE_BACKLOG of them waited already
+ */
+typedef struct handshake_counters
+{
+	uint64_t in_progress;
+	uint64_t completed;
+	uint64_t resumed;
+	uint64_t failed;
+	uint64_t timed_out;
+	uint64_t duration_ms;
+	uint64_t reloads;
+	uint64_t failed_reloads;
+	uint64_t shed;
+} __attribute__((aligned(STATS_CACHE_LINE))) handshake_counters_t;
+
+/*
+ * Struct:  session 
+ * --------------------
+ *  per-client tunnel state
+ *
+ *  source:		epoll registration of the client connection (source.fd is the connection)
+ *  worker:		the worker thread owning the session, the only thread touching it once attached
+ *  ssl:		the client's SSL/TLS session
+ *  peer_addr:		the client's public address
+ *  inner_addr:		the tunnel address leased to the client (network order)
+ *  datagram:		whether the session runs over DTLS, where every frame is sent in its own record;
+ *			once attached, its records go through the worker's datagram rings
+ *  kernel_send:	whether the kernel encrypts what is written to the connection (kTLS),
+ *			batches are then written to it directly instead of through SSL_write()
+ *  closing:		set once the session was closed, it is freed after the current batch of events
+ *  deadline:		while the acceptor runs the handshake, when it gives up on it (monotonic milliseconds)
+ *  handshake:		the step of the handshake a handshake worker runs after a ClientHello
+ *  offloaded:		set while the handshake workers have the session, nothing else touches it then
+ *  resuming:		whether the last ClientHello offered a session to resume
+ *  stats:		once attached, the statistics of the session's tunnel address
+ *  outgoing:		packets for the client waiting to be sent as one TLS record
+ *  queue:		the records waiting for their turn, or for the connection to take them (TLS only)
+ *  bucket:		the client's rate cap
+ *  egress_state:	where the client stands in the worker's egress scheduler
+ *  deficit:		bytes the client may still send in the current round (deficit round-robin)
+ *  turn:		whether the client's turn began, and was granted its quantum, already
+ *  egress_next:	link in the worker's round, or in its list of throttled clients
+ *  compressor:		compresses the packets for the client, off until it asked for them compressed
+ *  mtu:		the client's tunnel MTU, larger packets for it get an ICMP error if they may
+ *			not be fragmented; PMTU_DEFAULT (at most MTU) until the client tells its own
+ *  offload:		whether the client takes FRAME_FLAG_OFFLOAD packets, once it asked for them
+ *  last_received:	the worker's tick anything last came from the client on
+ *  last_sent:		the worker's tick anything was last sent to the client on
+ *  keepalive_timer:	in the worker's wheel, due when a keepalive or the client's timeout is
+ *  incoming:		reassembles the frames received from the client
+ *  secrets:		with UPGRADE_SOCKET set, what carrying the TLS session over to a new server takes
+ *  records:		a session carried over from the previous server: its records are sealed and
+ *			opened here (record.h) instead of by an SSL, and ssl is NULL
+ *  flush_next:		link in the list of sessions with pending outgoing frames
+ *  flush_pending:	whether the session is in that list
+ *  prev, next:		links in the worker's session list (or in the list of closed sessions,
+ *			the worker's list of sessions handed off to it, or the acceptor's list
+ *			of handshakes in progress)
+ */
+typedef struct session
+{
+	event_source_t source;
+	worker_t *worker;
+	SSL *ssl;
+	struct sockaddr_in peer_addr;
+	in_addr_t inner_addr;
+	int datagram;
+	int kernel_send;
+	int closing;
+	uint64_t deadline;
+	handshake_job_t handshake;
+	int offloaded;
+	int resuming;
+	session_stats_t *stats;
+	frame_batch_t outgoing;
+	send_queue_t queue;
+	token_bucket_t bucket;
+	egress_state_t egress_state;
+	size_t deficit;
+	int turn;
+	struct session *egress_next;
+	compressor_t compressor;
+	size_t mtu;
+	int offload;
+	uint64_t last_received;
+	uint64_t last_sent;
+	wheel_timer_t keepalive_timer;
+	deframer_t incoming;
+	record_secrets_t secrets;
+	record_stream_t *records;
+	struct session *flush_next;
+	int flush_pending;
+	struct session *prev;
+	struct session *next;
+} session_t;
+
+/*
+ * Struct:  lease_pool 
+ * --------------------
+ *  allocator of tunnel addresses, one bit per address of the tunnel network
+ *
+ *  network:	the tunnel network address (host order)
+ *  size:	number of addresses in the tunnel network
+ *  bitmap:	bit i is set when network + i is leased or reserved
+ *  hint:	the word to start the next search from
+ */
+typedef struct lease_pool
+{
+	in_addr_t network;
+	uint32_t size;
+	uint64_t *bitmap;
+	uint32_t hint;
+} lease_pool_t;
+
+/*
+ * Struct:  handoff_chunk 
+ * --------------------
+ *  packets read by one worker for sessions owned by another, framed back to back
+ *
+ *  next:	link in the owning worker's handoff queue
+ *  frames:	the packets
+ */
+typedef struct handoff_chunk
+{
+	struct handoff_chunk *next;
+	frame_batch_t frames;
+} handoff_chunk_t;
+
+/*
+ * Struct:  worker 
+ * --------------------
+ *  a forwarding thread, owning one TUN queue and a subset of the client sessions
+ *
+ *  index:		the worker's position in the server's worker array
+ *  thread:		the worker's thread
+ *  server:		the shared server state
+ *  epoll_fd:		the worker's epoll instance
+ *  vnic:		epoll registration of the worker's TUN queue
+ *  wakeup:		epoll registration of the eventfd other threads signal after a handoff
+ *  sessions:		head of the list of the worker's clients
+ *  closed:		head of the list of closed sessions waiting to be freed
+ *  session_count:	number of the worker's clients, read by the acceptors for balancing
+ *  handoff_lock:	protects the two handoff queues below
+ *  handoff_sessions:	newly accepted sessions waiting to be attached
+ *  handoff_head/tail:	packets other workers read for this worker's sessions
+ *  outbox:		per destination worker, the chunk this worker is filling during a drain
+ *  packets:		the buffers packets are read into from the TUN queue, a burst at a time
+ *  inbound:		the buffers a DTLS client's datagrams are received into
+ *  outbound:		the datagrams sent to DTLS clients, queued until the end of the event batch
+ *  uring:		the worker's io_uring with a read posted on the TUN queue for every packet
+ *			slot, or uring.fd is -1 when the worker runs on epoll alone
+ *  traffic:		the worker's counters, its sessions' traffic and the packets it dropped
+ *			without a session to count them on
+ *  vnic_paused:	whether reading the TUN queue is paused, because every client of the
+ *			server is backlogged (server->vnic_paused as the worker last applied it)
+ *  parked:		while paused with io_uring, the slots whose reads weren't posted again
+ *  parked_count:	number of parked slots
+ *  timer:		epoll registration of the timerfd waking the egress scheduler
+ *  timer_deadline:	when the timer fires (monotonic nanoseconds), 0 when disarmed
+ *  round_head/tail:	the clients with records to send, served in turn (deficit round-robin)
+ *  throttled:		the clients waiting for their rate cap to allow more
+ *  tick:		epoll registration of the timerfd moving the wheel on every second
+ *  wheel:		the keepalive timers of the worker's clients, a slot per second
+ */
+struct worker
+{
+	int index;
+	pthread_t thread;
+	server_t *server;
+	int epoll_fd;
+	event_source_t vnic;
+	event_source_t wakeup;
+	session_t *sessions;
+	session_t *closed;
+	size_t session_count;
+	pthread_mutex_t handoff_lock;
+	session_t *handoff_sessions;
+	handoff_chunk_t *handoff_head;
+	handoff_chunk_t *handoff_tail;
+	handoff_chunk_t *outbox[MAX_WORKERS];
+	packet_ring_t packets;
+	packet_ring_t inbound;
+	packet_ring_t outbound;
+	uring_t uring;
+	traffic_counters_t traffic;
+	int vnic_paused;
+	uint64_t parked[RING_SLOTS];
+	int parked_count;
+	event_source_t timer;
+	uint64_t timer_deadline;
+	session_t *round_head;
+	session_t *round_tail;
+	session_t *throttled;
+	event_source_t tick;
+	timer_wheel_t wheel;
+};
+
+/*
+ * Struct:  acceptor 
+ * --------------------
+ *  a thread accepting clients on a listening socket of its own and running
+ *  their handshakes; with more than one, the sockets share the port through
+ *  SO_REUSEPORT and the kernel spreads the connections across them. The
+ *  first acceptor runs on the main thread, which also reloads the TLS
+ *  settings and hands over to a new server
+ *
+ *  index:		the acceptor's position in the server's acceptor array
+ *  thread:		the acceptor's thread, unset for the first acceptor
+ *  server:		the shared server state
+ *  epoll_fd:		the acceptor's epoll instance
+ *  listener:		epoll registration of the listening socket (TCP, or UDP in datagram mode)
+ *  wakeup:		epoll registration of the eventfd signalled on shutdown or upgrade and as the
+ *			handshake workers give sessions back
+ *  handshakes:		head of the list of clients the acceptor is running the handshake with
+ *  accept_resume:	while accepting is paused after accept() failed, when to resume (or 0)
+ *  returned_lock:	protects returned
+ *  returned:		the handshake steps the handshake workers ran, for the acceptor to carry on with
+ *  offloaded:		the acceptor's handshakes the handshake workers have
+ *  handshake_stats:	the acceptor's handshake statistics
+ */
+struct acceptor
+{
+	int index;
+	pthread_t thread;
+	server_t *server;
+	int epoll_fd;
+	event_source_t listener;
+	event_source_t wakeup;
+	session_t *handshakes;
+	uint64_t accept_resume;
+	pthread_mutex_t returned_lock;
+	handshake_job_t *returned;
+	size_t offloaded;
+	handshake_counters_t handshake_stats;
+};
+
+/*
+ * Struct:  server 
+ * --------------------
+ *  the state shared by the acceptors and the worker threads
+ *
+ *  acceptors:		the threads accepting clients, ACCEPTORS of them
+ *  acceptor_count:	number of acceptors (and listening sockets)
+ *  ctx:		the SSL/TLS context used for new clients
+ *  ctx_lock:		protects ctx, which the first acceptor swaps on a reload
+ *  leases:		the pool tunnel addresses are leased from
+ *  lease_lock:		protects leases, which the acceptors acquire from and workers release to
+ *  routes:		flat table from a tunnel address' offset in the tunnel network to its session,
+ *			an entry is only read or written by the worker owning the session
+ *  route_owners:	parallel to routes, the index of the worker owning the address or -1,
+ *			read by every worker to hand off packets (atomic accesses)
+ *  session_stats:	parallel to routes, the statistics of the session leasing each address
+ *  workers:		the forwarding threads
+ *  worker_count:	number of forwarding threads (and TUN queues)
+ *  backlog_lock:	protects the three below, which the workers update as their clients come,
+ *			go and fill or drain their send queues
+ *  attached_sessions:	number of clients attached to the workers
+ *  full_sessions:	number of them whose send queue is full
+ *  vnic_paused:	whether the workers pause reading their TUN queues, because every client
+ *			is backlogged (read by the workers with atomic accesses)
+ *  handshake_pool:	the threads running the handshakes' crypto, unless HANDSHAKE_WORKERS is 0
+ *  stats:		the statistics socket, stats.fd is -1 unless STATS_SOCKET is set
+ *  upgrade:		epoll registration with the first acceptor of the socket a new server takes
+ *			over on, upgrade.fd is -1 unless UPGRADE_SOCKET is set
+ *  upgrade_state:	whether a new server is taking over, read by the workers and the other
+ *			acceptors (atomic accesses)
+ *  upgrade_barrier:	where the workers and the other acceptors wait for the first acceptor
+ *			while a new server takes over
+ */
+struct server
+{
+	acceptor_t *acceptors;
+	int acceptor_count;
+	SSL_CTX *ctx;
+	pthread_mutex_t ctx_lock;
+	lease_pool_t leases;
+	pthread_mutex_t lease_lock;
+	session_t **routes;
+	int *route_owners;
+	session_stats_t *session_stats;
+	worker_t *workers;
+	int worker_count;
+	pthread_mutex_t backlog_lock;
+	size_t attached_sessions;
+	size_t full_sessions;
+	int vnic_paused;
+	handshake_pool_t handshake_pool;
+	stats_endpoint_t stats;
+	event_source_t upgrade;
+	upgrade_state_t upgrade_state;
+	pthread_barrier_t upgrade_barrier;
+};
+
+
+/* the settings and the run state server.c keeps, read by the acceptors and the upgrade too */
+extern volatile int keep_running;
+extern int port;
+extern in_addr_t tunnel_network;
+extern int tunnel_prefix_length;
+extern int tunnel_mtu;
+extern int worker_count;
+extern int acceptor_count;
+extern int accept_steering;
+extern int offload;
+extern char upgrade_path[STATS_PATH_LENGTH];
+extern unsigned char cookie_secret[COOKIE_SECRET_LENGTH];
+extern transport_t transport;
+extern size_t queue_length;
+extern compress_mode_t compress_mode;
+
+
+/* counts on a session and on its worker, both only ever written by the worker */
+#define COUNT_TRAFFIC(session, field, value) \
+	do { STATS_ADD((session)->stats->traffic.field, value); STATS_ADD((session)->worker->traffic.field, value); } while(0)
+
+
+/*
+ * the functions of server.c the acceptors (acceptor.c) and the upgrade
+ * (upgrade.c) call on
+ */
+
+/* signals a worker so it picks up what was handed off to it */
+void WakeWorker(worker_t *worker);
+
+/* moves an established DTLS session from its socket BIO to its worker's datagram rings */
+int SwitchToPacketRing(session_t *session, worker_t *worker);
+
+/* tells a client which tunnel address it was leased */
+int SendLease(session_t *session, int prefix_length);
+
+/* leases a free tunnel address */
+int LeasePoolAcquire(lease_pool_t *pool, in_addr_t *addr);
+
+/* returns a leased address to the pool */
+void LeasePoolRelease(lease_pool_t *pool, in_addr_t addr);
+
+/* leases a given address, the one a client carried over from the previous server */
+int LeasePoolReserve(lease_pool_t *pool, in_addr_t addr);
+
+/* reads the monotonic clock handshake deadlines are kept in, in milliseconds */
+uint64_t GetMonotonicTime();
+
+/* hands a record to a client's non-blocking connection */
+int WriteRecord(session_t *session, const frame_batch_t *record, size_t *sent);
+
+/* frees a client's oldest record once its connection took all of it */
+void DequeueRecord(worker_t *worker, session_t *session);
+
+/* queues the frames batched for a client as a single TLS record */
+int FlushToClient(worker_t *worker, session_t *session);
+
+/* closes a client's session and returns its tunnel address to the pool */
+void CloseConnection(worker_t *worker, session_t *session);
+
+/* reads what a client sent and writes the packets in it to tun0 */
+int HandleTrafficFromClient(int virtual_nic_fd, session_t *session);
+
+/* builds the SSL/TLS (or SSL/DTLS) context new clients are accepted with */
+SSL_CTX *CreateContext(int datagram);
+
+#endif  /* SERVER_H */
@@ -0,0 +1,206 @@
+#include "shaper.h"
+#include <stdlib.h>		/* strtoull 		*/
+#include <string.h>		/* strcmp 		*/
+#include <time.h>		/* clock_gettime 	*/
+
+
+/*
+ * Function:  ShaperNow
+ * --------------------
+ *  reads the monotonic clock the buckets are refilled by
+ *
+ *  returns:	the time in nanoseconds
+ */
+uint64_t ShaperNow()
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * SHAPER_NSEC + now.tv_nsec;
+}
+
+
+/*
+ * Function:  ShaperParseRate
+ * --------------------
+ *  parses a rate the way links are rated, in bits per second, e.g. '512k',
+ *  '20M' or '1G' (decimal multiples)
+ *
+ *  value:	the rate
+ *  rate:	set to the rate in bytes per second, 0 for '0' (no cap)
+ *
+ *  returns:	0 if successful, -1 if the value is invalid
+ */
+int ShaperParseRate(const char *value, uint64_t *rate)
+{
+	char *end = NULL;
+	unsigned long long bits = 0;
+	uint64_t multiple = 1;
+
+	if(NULL == value || '\0' == value[0] || '-' == value[0])
+	{
+		return -1;
+	}
+
+	bits = strtoull(value, &end, 10);
+	if(end == value)
+	{
+		return -1;
+	}
+
+	switch(*end)
+	{
+		case '\0':
+			break;
+		case 'k':
+		case 'K':
+			multiple = 1000ULL;
+			++end;
+			break;
+		case 'm':
+		case 'M':
+			multiple = 1000000ULL;
+			++end;
+			break;
+		case 'g':
+		case 'G':
+			multiple = 1000000000ULL;
+			++end;
+			break;
+		default:
+			return -1;
+	}
+
+	/* an optional unit, as in '20Mbit' */
+	if('\0' != *end && 0 != strcmp(end, "bit"))
+	{
+		return -1;
+	}
+
+	*rate = bits * multiple / 8;
+	return 0;
+}
+
+
+/*
+ * Function:  TokenBucketInit
+ * --------------------
+ *  starts a bucket full, so a client may send a burst right away
+ *
+ *  bucket:	the bucket
+ *  rate:	bytes per second, 0 for no cap
+ *  burst:	bytes the bucket holds at most
+ *  now:	the current time (ShaperNow())
+ *
+ *  returns:	no return value
+ */
+void TokenBucketInit(token_bucket_t *bucket, uint64_t rate, uint64_t burst, uint64_t now)
+{
+	bucket->rate = rate;
+	bucket->burst = burst;
+	bucket->tokens = burst;
+	bucket->updated = now;
+}
+
+
+/*
+ * Function:  TokenBucketAllows
+ * --------------------
+ *  adds the tokens earned since the last refill, up to the burst
+ *
+ *  bucket:	the bucket
+ *  now:	the current time (ShaperNow())
+ *
+ *  returns:	1 if the bucket holds tokens (or caps nothing), 0 if it is overdrawn
+ */
+int TokenBucketAllows(token_bucket_t *bucket, uint64_t now)
+{
+	uint64_t earned = 0;
+
+	if(0 == bucket->rate)
+	{
+		return 1;
+	}
+
+	/* long enough to fill up from empty (which also keeps the product below from overflowing) */
+	if(now - bucket->updated >= bucket->burst * SHAPER_NSEC / bucket->rate + SHAPER_NSEC)
+	{
+		bucket->tokens = bucket->burst;
+		bucket->updated = now;
+	}
+	else if(now > bucket->updated)
+	{
+		earned = (now - bucket->updated) * bucket->rate / SHAPER_NSEC;
+
+		/* only the time the earned tokens account for is spent, no fraction is lost */
+		if(0 < earned)
+		{
+			bucket->updated += earned * SHAPER_NSEC / bucket->rate;
+			bucket->tokens += earned;
+		}
+		if((int64_t)bucket->burst < bucket->tokens)
+		{
+			bucket->tokens = bucket->burst;
+			bucket->updated = now;
+		}
+	}
+
+	return 0 < bucket->tokens;
+}
+
+
+/*
+ * Function:  TokenBucketTake
+ * --------------------
+ *  takes the bytes sent from the bucket, which may overdraw it
+ *
+ *  bucket:	the bucket
+ *  bytes:	bytes sent
+ *
+ *  returns:	no return value
+ */
+void TokenBucketTake(token_bucket_t *bucket, size_t bytes)
+{
+	if(0 != bucket->rate)
+	{
+		bucket->tokens -= bytes;
+	}
+}
+
+
+/*
+ * Function:  TokenBucketWait
+ * --------------------
+ *  computes how long an overdrawn bucket takes to hold a token again
+ *
+ *  bucket:	the bucket, refilled by TokenBucketAllows() just before
+ *
+ *  returns:	the time in nanoseconds, 0 if it may send now
+ */
+uint64_t TokenBucketWait(const token_bucket_t *bucket)
+{
+	if(0 == bucket->rate || 0 < bucket->tokens)
+	{
+		return 0;
+	}
+
+	return ((uint64_t)(1 - bucket->tokens) * SHAPER_NSEC + bucket->rate - 1) / bucket->rate;
+}
+
+
+/*
+ * Function:  DeficitGrant
+ * --------------------
+ *  computes a client's deficit for a new turn of the deficit round-robin,
+ *  what a throttled or blocked client didn't use isn't saved up beyond a
+ *  quantum, so it can't send a burst of several rounds' worth once it may
+ *
+ *  deficit:	bytes the client didn't send in its last turn
+ *  quantum:	bytes a client is granted per turn
+ *
+ *  returns:	the bytes the client may send in the new turn
+ */
+size_t DeficitGrant(size_t deficit, size_t quantum)
+{
+	return (deficit < quantum ? deficit : quantum) + quantum;
+}
@@ -0,0 +1,49 @@
+#ifndef SHAPER_H
+#define SHAPER_H
+
+#include <stddef.h>		/* size_t 	*/
+#include <stdint.h>		/* uint64_t 	*/
+
+#define SHAPER_NSEC 1000000000ULL
+
+/*
+ * a token bucket capping a client's rate: a record may be sent while the
+ * bucket holds any tokens and takes its whole length, overdrawing it, so
+ * records of any size pass and the rate still averages out
+ *
+ *  rate:	bytes per second, 0 for no cap
+ *  burst:	bytes the bucket holds at most
+ *  tokens:	bytes that may be sent, negative once overdrawn
+ *  updated:	when the bucket was last refilled (monotonic nanoseconds)
+ */
+typedef struct token_bucket
+{
+	uint64_t rate;
+	uint64_t burst;
+	int64_t tokens;
+	uint64_t updated;
+} token_bucket_t;
+
+
+/* reads the monotonic clock in nanoseconds */
+uint64_t ShaperNow();
+
+/* parses a rate in bits per second, with an optional k, M or G suffix, into bytes per second */
+int ShaperParseRate(const char *value, uint64_t *rate);
+
+/* starts a full bucket, a rate of 0 never caps */
+void TokenBucketInit(token_bucket_t *bucket, uint64_t rate, uint64_t burst, uint64_t now);
+
+/* refills the bucket, returns whether anything may be sent */
+int TokenBucketAllows(token_bucket_t *bucket, uint64_t now);
+
+/* takes what was sent from the bucket */
+void TokenBucketTake(token_bucket_t *bucket, size_t bytes);
+
+/* nanoseconds until an overdrawn bucket allows sending again */
+uint64_t TokenBucketWait(const token_bucket_t *bucket);
+
+/* a client's deficit for a new turn of the round: its quantum, plus at most a quantum it didn't use */
+size_t DeficitGrant(size_t deficit, size_t quantum);
+
+#endif  /* SHAPER_H */
@@ -0,0 +1,134 @@
+#include "shaper.h"
+#include "utilities.h"
+
+#define RATE 1000000ULL		/* bytes per second, a byte per microsecond */
+#define BURST 20000ULL
+#define QUANTUM 16384
+#define ROUNDS 1000
+
+int main()
+{
+	token_bucket_t bucket;
+	uint64_t now = 5 * SHAPER_NSEC;
+	uint64_t rate = 0;
+	uint64_t wait = 0;
+	size_t deficit = 0;
+	size_t sent = 0;
+	size_t i = 0;
+	int allowed = 0;
+
+
+	/***** ShaperParseRate *****/
+	printf("\n\n----- ShaperParseRate -----\n\n");
+	TESTS(0 == ShaperParseRate("20M", &rate) && 2500000 == rate);
+	TESTS(0 == ShaperParseRate("512kbit", &rate) && 64000 == rate);
+	TESTS(0 == ShaperParseRate("1G", &rate) && 125000000 == rate);
+	TESTS(0 == ShaperParseRate("0", &rate) && 0 == rate);
+	TESTS(-1 == ShaperParseRate("-5M", &rate));
+	TESTS(-1 == ShaperParseRate("M", &rate));
+	TESTS(-1 == ShaperParseRate("5X", &rate));
+	TESTS(-1 == ShaperParseRate("5Mbyte", &rate));
+
+
+	/***** TokenBucketAllows *****/
+	printf("\n\n----- TokenBucketAllows -----\n\n");
+	TokenBucketInit(&bucket, RATE, BURST, now);
+	TESTS(1 == TokenBucketAllows(&bucket, now));
+	TESTS(BURST == (uint64_t)bucket.tokens);
+
+	/* a record longer than what is left passes, and overdraws the bucket */
+	TokenBucketTake(&bucket, BURST + 1000);
+	TESTS(-1000 == bucket.tokens);
+	TESTS(0 == TokenBucketAllows(&bucket, now));
+
+
+	/***** TokenBucketWait *****/
+	printf("\n\n----- TokenBucketWait -----\n\n");
+	wait = TokenBucketWait(&bucket);
+	TESTS(1001000 == wait);
+
+	/* a nanosecond short of the wait the bucket is still empty, at the wait it holds a token */
+	TESTS(0 == TokenBucketAllows(&bucket, now + wait - 1));
+	TESTS(1 == TokenBucketAllows(&bucket, now + wait));
+	TESTS(1 == bucket.tokens);
+	TESTS(0 == TokenBucketWait(&bucket));
+	now += wait;
+
+	/* refilled in steps worth less than a byte, no fraction is lost */
+	for(i = 1; i <= 1000; ++i)
+	{
+		TokenBucketAllows(&bucket, now + i * 999);
+	}
+	TESTS(1 + 999 == bucket.tokens);
+
+	/* a long idle time fills the bucket up to its burst and no further */
+	TESTS(1 == TokenBucketAllows(&bucket, now + 60 * SHAPER_NSEC));
+	TESTS(BURST == (uint64_t)bucket.tokens);
+
+	/* refilled often, the bucket still stops at its burst */
+	now += 60 * SHAPER_NSEC;
+	TokenBucketTake(&bucket, 10);
+	TokenBucketAllows(&bucket, now + 100000);
+	TESTS(BURST == (uint64_t)bucket.tokens);
+
+	/* sending the rate's worth for a second stays within the burst of the rate */
+	now += 100000;
+	TokenBucketInit(&bucket, RATE, BURST, now);
+	sent = 0;
+	for(i = 0; i < SHAPER_NSEC; i += 1000)
+	{
+		if(TokenBucketAllows(&bucket, now + i))
+		{
+			TokenBucketTake(&bucket, 1500);
+			sent += 1500;
+		}
+	}
+	TESTS(RATE <= sent && RATE + BURST + 1500 >= sent);
+
+	/* a rate of 0 caps nothing */
+	TokenBucketInit(&bucket, 0, 0, now);
+	TokenBucketTake(&bucket, 1000000);
+	allowed = TokenBucketAllows(&bucket, now);
+	TESTS(1 == allowed && 0 == TokenBucketWait(&bucket));
+
+
+	/***** DeficitGrant *****/
+	printf("\n\n----- DeficitGrant -----\n\n");
+	TESTS(QUANTUM == DeficitGrant(0, QUANTUM));
+	TESTS(QUANTUM + 100 == DeficitGrant(100, QUANTUM));
+	TESTS(2 * QUANTUM == DeficitGrant(QUANTUM, QUANTUM));
+
+	/* what wasn't used isn't saved up beyond a quantum */
+	TESTS(2 * QUANTUM == DeficitGrant(5 * QUANTUM, QUANTUM));
+
+	/* records that don't divide the quantum still get a quantum per round */
+	deficit = 0;
+	sent = 0;
+	for(i = 0; i < ROUNDS; ++i)
+	{
+		deficit = DeficitGrant(deficit, QUANTUM);
+		while(10000 <= deficit)
+		{
+			deficit -= 10000;
+			sent += 10000;
+		}
+	}
+	TESTS(ROUNDS * QUANTUM >= sent && ROUNDS * QUANTUM - QUANTUM < sent);
+
+	/* a record of a whole quantum always fits a turn */
+	deficit = 0;
+	sent = 0;
+	for(i = 0; i < ROUNDS; ++i)
+	{
+		deficit = DeficitGrant(deficit, QUANTUM);
+		if(QUANTUM <= deficit)
+		{
+			deficit -= QUANTUM;
+			sent += QUANTUM;
+		}
+	}
+	TESTS(ROUNDS * QUANTUM == sent);
+
+
+	return 0 != failures;
+}
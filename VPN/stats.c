@@ -0,0 +1,359 @@
+#include "stats.h"
+#include <stdio.h>		/* vsnprintf 		*/
+#include <stdlib.h>		/* realloc 		*/
+#include <stdarg.h>		/* va_list 		*/
+#include <string.h>		/* strcpy, strerror 	*/
+#include <unistd.h>		/* write, unlink 	*/
+#include <errno.h>		/* EINTR 		*/
+#include <sys/socket.h>	/* socket, accept 	*/
+#include <sys/stat.h>		/* chmod 		*/
+#include <sys/un.h>		/* sockaddr_un 		*/
+#include <sys/time.h>		/* timeval 		*/
+#include <poll.h>		/* poll 		*/
+
+#define STATS_BACKLOG 8
+#define STATS_INITIAL_CAPACITY 4096
+#define STATS_SEND_TIMEOUT 1				/* seconds a reader may take to read the metrics */
+#define STATS_ACCEPT_BACKOFF 100			/* milliseconds to wait before accepting again after a failure */
+
+/* the traffic metrics, in the order of the fields of traffic_counters_t */
+static const struct
+{
+	const char *name;
+	const char *type;
+	const char *help;
+} traffic_metrics[STATS_TRAFFIC_FIELDS] =
+{
+	{"rx_packets_total", "counter", "Packets received from the peer and delivered."},
+	{"rx_bytes_total", "counter", "Bytes of the packets received from the peer."},
+	{"tx_packets_total", "counter", "Packets sent to the peer."},
+	{"tx_bytes_total", "counter", "Bytes of the packets sent to the peer."},
+	{"rx_records_total", "counter", "TLS records (DTLS datagrams) received."},
+	{"tx_records_total", "counter", "TLS records (DTLS datagrams) sent."},
+	{"short_writes_total", "counter", "Writes the socket only took part of at once."},
+	{"drops_total", "counter", "Packets dropped (spoofed, unroutable or a full queue)."},
+	{"errors_total", "counter", "Reads and writes that failed."},
+	{"compression_saved_bytes_total", "counter", "Bytes compression took off the packets sent."},
+	{"queue_bytes", "gauge", "Bytes queued for the peer, waiting for the socket to take them."}
+};
+
+
+/*
+ * Function:  StatsReset
+ * --------------------
+ *  zeroes counters about to be reused, e.g. by the next session leasing the
+ *  same tunnel address
+ *
+ *  counters:	the counters, only written by the calling thread
+ *
+ *  returns:	no return value
+ */
+void StatsReset(traffic_counters_t *counters)
+{
+	uint64_t *fields = (uint64_t *)counters;
+	int i = 0;
+
+	for(i = 0; i < STATS_TRAFFIC_FIELDS; ++i)
+	{
+		STATS_SET(fields[i], 0);
+	}
+}
+
+
+/*
+ * Function:  StatsAccumulate
+ * --------------------
+ *  reads counters another thread keeps updating into a sample; adding to what
+ *  the sample holds lets per-thread counters be aggregated into one
+ *
+ *  sample:	the sample, its values zeroed before the first call
+ *  counters:	the counters
+ *
+ *  returns:	no return value
+ */
+void StatsAccumulate(traffic_sample_t *sample, const traffic_counters_t *counters)
+{
+	const uint64_t *fields = (const uint64_t *)counters;
+	int i = 0;
+
+	for(i = 0; i < STATS_TRAFFIC_FIELDS; ++i)
+	{
+		sample->values[i] += STATS_GET(fields[i]);
+	}
+}
+
+
+/*
+ * Function:  StatsPrintf
+ * --------------------
+ *  appends formatted text to a buffer, growing it as needed
+ *
+ *  buffer:	the buffer
+ *  format:	printf() format
+ *
+ *  returns:	0 if successful, or -1 if no memory was available (the text is lost)
+ */
+int StatsPrintf(stats_buffer_t *buffer, const char *format, ...)
+{
+	va_list args;
+	int length = 0;
+	size_t capacity = 0;
+	char *data = NULL;
+
+	va_start(args, format);
+	length = vsnprintf(buffer->data + buffer->length, buffer->capacity - buffer->length, format, args);
+	va_end(args);
+	if(0 > length)
+	{
+		return -1;
+	}
+
+	if(buffer->length + length + 1 > buffer->capacity)
+	{
+		capacity = 0 == buffer->capacity ? STATS_INITIAL_CAPACITY : buffer->capacity;
+		while(buffer->length + length + 1 > capacity)
+		{
+			capacity *= 2;
+		}
+
+		data = realloc(buffer->data, capacity);
+		if(NULL == data)
+		{
+			return -1;
+		}
+		buffer->data = data;
+		buffer->capacity = capacity;
+
+		va_start(args, format);
+		vsnprintf(buffer->data + buffer->length, buffer->capacity - buffer->length, format, args);
+		va_end(args);
+	}
+
+	buffer->length += length;
+	return 0;
+}
+
+
+/*
+ * Function:  StatsMetric
+ * --------------------
+ *  appends the HELP and TYPE lines that precede a metric's samples in the
+ *  Prometheus text format
+ *
+ *  buffer:	the buffer
+ *  name:	the metric's name
+ *  type:	'counter' or 'gauge'
+ *  help:	what the metric counts
+ *
+ *  returns:	no return value
+ */
+void StatsMetric(stats_buffer_t *buffer, const char *name, const char *type, const char *help)
+{
+	StatsPrintf(buffer, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+
+/*
+ * Function:  StatsWriteTraffic
+ * --------------------
+ *  appends every traffic metric of a family, the samples of a metric grouped
+ *  under its HELP and TYPE lines as the format requires
+ *
+ *  buffer:	the buffer
+ *  family:	prefix of the metric names (e.g. 'vpn_session')
+ *  samples:	the samples, a sample without labels is written as a bare name
+ *  count:	number of samples
+ *
+ *  returns:	no return value
+ */
+void StatsWriteTraffic(stats_buffer_t *buffer, const char *family, const traffic_sample_t *samples, size_t count)
+{
+	char name[STATS_LABELS_LENGTH];
+	size_t i = 0;
+	int field = 0;
+
+	if(0 == count)
+	{
+		return;
+	}
+
+	for(field = 0; field < STATS_TRAFFIC_FIELDS; ++field)
+	{
+		snprintf(name, sizeof(name), "%s_%s", family, traffic_metrics[field].name);
+		StatsMetric(buffer, name, traffic_metrics[field].type, traffic_metrics[field].help);
+
+		for(i = 0; i < count; ++i)
+		{
+			if('\0' == samples[i].labels[0])
+			{
+				StatsPrintf(buffer, "%s %llu\n", name, (unsigned long long)samples[i].values[field]);
+			}
+			else
+			{
+				StatsPrintf(buffer, "%s{%s} %llu\n", name, samples[i].labels, (unsigned long long)samples[i].values[field]);
+			}
+		}
+	}
+}
+
+
+/*
+ * Function:  ServeStats
+ * --------------------
+ *  the endpoint's thread: renders the metrics for every connection, writes
+ *  them and closes it; a reader that doesn't read them in STATS_SEND_TIMEOUT
+ *  is cut short; while accept() fails for want of descriptors or memory it
+ *  waits STATS_ACCEPT_BACKOFF between attempts
+ *
+ *  arg:	the endpoint
+ *
+ *  returns:	NULL once the endpoint is stopped
+ */
+static void *ServeStats(void *arg)
+{
+	stats_endpoint_t *endpoint = arg;
+	stats_buffer_t buffer = {NULL, 0, 0};
+	struct timeval timeout = {STATS_SEND_TIMEOUT, 0};
+	size_t written = 0;
+	ssize_t result = 0;
+	int conn_fd = 0;
+	int failing = 0;
+
+	while(endpoint->running)
+	{
+		conn_fd = accept(endpoint->fd, NULL, NULL);
+		if(-1 == conn_fd && (EINTR == errno || ECONNABORTED == errno))
+		{
+			continue;
+		}
+		if(-1 == conn_fd)
+		{
+			if(!failing)
+			{
+				printf("Error: Failed to accept a statistics connection: %s.\n", strerror(errno));
+				failing = 1;
+			}
+			poll(NULL, 0, STATS_ACCEPT_BACKOFF);
+			continue;
+		}
+		failing = 0;
+		if(!endpoint->running)
+		{
+			close(conn_fd);
+			break;
+		}
+
+		setsockopt(conn_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+		buffer.length = 0;
+		endpoint->render(&buffer, endpoint->arg);
+
+		for(written = 0; written < buffer.length; written += result)
+		{
+			result = send(conn_fd, buffer.data + written, buffer.length - written, MSG_NOSIGNAL);
+			if(-1 == result && EINTR == errno)
+			{
+				result = 0;
+			}
+			else if(-1 == result)
+			{
+				break;
+			}
+		}
+		close(conn_fd);
+	}
+
+	free(buffer.data);
+	return NULL;
+}
+
+
+/*
+ * Function:  StatsStart
+ * --------------------
+ *  starts serving the metrics on a Unix domain socket, readable and writable
+ *  by the owner only (e.g. 'socat - UNIX-CONNECT:<path>'); a stale socket
+ *  left at the path is replaced
+ *
+ *  endpoint:	the endpoint
+ *  path:	where to create the socket
+ *  render:	renders the metrics
+ *  arg:	passed to render
+ *
+ *  returns:	0 if successful, or -1 if an error occurred
+ */
+int StatsStart(stats_endpoint_t *endpoint, const char *path, stats_render_t render, void *arg)
+{
+	struct sockaddr_un addr;
+
+	endpoint->fd = -1;
+	if(strlen(path) >= sizeof(addr.sun_path))
+	{
+		return -1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	strcpy(endpoint->path, path);
+	endpoint->render = render;
+	endpoint->arg = arg;
+	endpoint->running = 1;
+
+	unlink(path);
+	endpoint->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if(-1 == endpoint->fd)
+	{
+		return -1;
+	}
+
+	if(-1 == bind(endpoint->fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+	   -1 == chmod(path, S_IRUSR | S_IWUSR) ||
+	   -1 == listen(endpoint->fd, STATS_BACKLOG) ||
+	   0 != pthread_create(&endpoint->thread, NULL, ServeStats, endpoint))
+	{
+		close(endpoint->fd);
+		unlink(path);
+		endpoint->fd = -1;
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/*
+ * Function:  StatsStop
+ * --------------------
+ *  stops serving the metrics: the thread is woken from accept() by one last
+ *  connection, then the socket is removed
+ *
+ *  endpoint:	the endpoint, started or not
+ *
+ *  returns:	no return value
+ */
+void StatsStop(stats_endpoint_t *endpoint)
+{
+	struct sockaddr_un addr;
+	int wake_fd = 0;
+
+	if(-1 == endpoint->fd)
+	{
+		return;
+	}
+
+	endpoint->running = 0;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, endpoint->path);
+	wake_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(-1 != wake_fd)
+	{
+		connect(wake_fd, (struct sockaddr *)&addr, sizeof(addr));
+		close(wake_fd);
+	}
+
+	pthread_join(endpoint->thread, NULL);
+	close(endpoint->fd);
+	unlink(endpoint->path);
+	endpoint->fd = -1;
+}
@@ -0,0 +1,92 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stddef.h>		/* size_t 	*/
+#include <stdint.h>		/* uint64_t 	*/
+#include <pthread.h>		/* pthread_t 	*/
+
+#define STATS_CACHE_LINE 64
+#define STATS_TRAFFIC_FIELDS 11
+#define STATS_LABELS_LENGTH 128
+#define STATS_PATH_LENGTH 108				/* sun_path */
+
+/*
+ * counters are only written by the thread owning them, so an update is a plain
+ * load and store rather than a locked instruction; readers on other threads
+ * always see whole values
+ */
+#define STATS_ADD(counter, value) __atomic_store_n(&(counter), __atomic_load_n(&(counter), __ATOMIC_RELAXED) + (value), __ATOMIC_RELAXED)
+#define STATS_SET(counter, value) __atomic_store_n(&(counter), (value), __ATOMIC_RELAXED)
+#define STATS_GET(counter) __atomic_load_n(&(counter), __ATOMIC_RELAXED)
+
+/*
+ * the traffic of a session (or of a thread), on its own cache line(s) so that
+ * threads counting side by side don't contend for them
+ */
+typedef struct traffic_counters
+{
+	uint64_t rx_packets;		/* packets received from the peer and delivered */
+	uint64_t rx_bytes;
+	uint64_t tx_packets;		/* packets sent to the peer */
+	uint64_t tx_bytes;
+	uint64_t rx_records;		/* TLS records (DTLS datagrams) received */
+	uint64_t tx_records;		/* TLS records (DTLS datagrams) sent */
+	uint64_t short_writes;		/* writes the socket only took part of at once */
+	uint64_t drops;			/* packets dropped: spoofed, unroutable or a full queue */
+	uint64_t errors;		/* reads and writes that failed */
+	uint64_t compression_saved;	/* bytes compression took off the packets sent */
+	uint64_t queue_bytes;		/* gauge, bytes queued for the peer until the socket takes them */
+} __attribute__((aligned(STATS_CACHE_LINE))) traffic_counters_t;
+
+/* a copy of a traffic_counters_t taken by the reader, with its labels */
+typedef struct traffic_sample
+{
+	char labels[STATS_LABELS_LENGTH];
+	uint64_t values[STATS_TRAFFIC_FIELDS];
+} traffic_sample_t;
+
+/* a growing text buffer the metrics are rendered into */
+typedef struct stats_buffer
+{
+	char *data;
+	size_t length;
+	size_t capacity;
+} stats_buffer_t;
+
+/* renders every metric into the buffer, called on the endpoint's thread */
+typedef void (*stats_render_t)(stats_buffer_t *buffer, void *arg);
+
+/* a Unix domain socket answering every connection with the rendered metrics */
+typedef struct stats_endpoint
+{
+	int fd;				/* the listening socket, -1 when not serving */
+	pthread_t thread;
+	volatile int running;
+	char path[STATS_PATH_LENGTH];
+	stats_render_t render;
+	void *arg;
+} stats_endpoint_t;
+
+
+/* zeroes counters about to be reused */
+void StatsReset(traffic_counters_t *counters);
+
+/* copies counters into a sample, adding to the values already there */
+void StatsAccumulate(traffic_sample_t *sample, const traffic_counters_t *counters);
+
+/* appends formatted text to a buffer */
+int StatsPrintf(stats_buffer_t *buffer, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+/* appends the HELP and TYPE lines of a metric */
+void StatsMetric(stats_buffer_t *buffer, const char *name, const char *type, const char *help);
+
+/* appends every traffic metric of a family (e.g. 'vpn_session'), one line per sample each */
+void StatsWriteTraffic(stats_buffer_t *buffer, const char *family, const traffic_sample_t *samples, size_t count);
+
+/* starts serving the metrics on a Unix domain socket from a thread of its own */
+int StatsStart(stats_endpoint_t *endpoint, const char *path, stats_render_t render, void *arg);
+
+/* stops serving and removes the socket */
+void StatsStop(stats_endpoint_t *endpoint);
+
+#endif  /* STATS_H */
@@ -0,0 +1,1081 @@
+#define _GNU_SOURCE		/* struct ucred, accept4 */
+#include "upgrade.h"
+#include "acceptor.h"		/* StopAccepting 	*/
+#include <stdlib.h>		/* malloc, free 	*/
+#include <stdio.h>		/* printf 		*/
+#include <string.h>		/* strcpy, memcpy 	*/
+#include <unistd.h>		/* close, unlink 	*/
+#include <errno.h>		/* EINTR 		*/
+#include <poll.h>		/* poll 		*/
+#include <arpa/inet.h>		/* inet_ntoa 		*/
+#include <sys/socket.h>	/* sendmsg, recvmsg 	*/
+#include <sys/stat.h>		/* chmod 		*/
+#include <sys/un.h>		/* sockaddr_un 		*/
+#include <sys/time.h>		/* timeval 		*/
+#include <sys/epoll.h>		/* epoll_ctl 		*/
+#include <openssl/rand.h>	/* RAND_bytes 		*/
+
+#define UPGRADE_BACKLOG 1
+#define UPGRADE_VERSION 2					/* of the messages below, both servers must speak the same */
+#define UPGRADE_DRAIN_TIMEOUT 2000				/* milliseconds the clients get to finish the records they are in the middle of */
+
+/*
+ * Struct:  upgrade_hello 
+ * --------------------
+ *  the settings both servers must agree on, since they shape tun0, its queues
+ *  and the listening sockets the new server is handed
+ */
+typedef struct upgrade_hello
+{
+	upgrade_message_type_t type;
+	int version;
+	transport_t transport;
+	in_addr_t network;
+	int prefix_length;
+	int workers;
+	int acceptors;
+	int offload;
+	int mtu;
+	pid_t pid;
+} upgrade_hello_t;
+
+/*
+ * Struct:  upgrade_state_message 
+ * --------------------
+ *  sent with the acceptors' listening sockets followed by the TUN queues
+ *
+ *  sessions:		UPGRADE_SESSION messages that follow
+ *  ticket_keys:	the keys session tickets are encrypted with, so clients resume later on
+ *  cookie_secret:	the DTLS cookie secret, so a cookie handed out just before still verifies
+ */
+typedef struct upgrade_state_message
+{
+	upgrade_message_type_t type;
+	int sessions;
+	unsigned char ticket_keys[TICKET_KEYS_LENGTH];
+	unsigned char cookie_secret[COOKIE_SECRET_LENGTH];
+} upgrade_state_message_t;
+
+/*
+ * Struct:  upgrade_session 
+ * --------------------
+ *  sent with the client's connection, the frame bytes its deframer holds
+ *  and then the unread bytes following as the body; records UPGRADE_RECORD
+ *  messages follow it
+ *
+ *  worker:		the worker that served the client, the new server's takes it on
+ *  seal, open:		the keys the TLS 1.3 session is at each way
+ *  unread:		bytes of a record the client is in the middle of sending, read from
+ *			the connection but not opened yet, that end the body
+ */
+typedef struct upgrade_session
+{
+	upgrade_message_type_t type;
+	int worker;
+	struct sockaddr_in peer_addr;
+	in_addr_t inner_addr;
+	size_t mtu;
+	int offload;
+	int compressed;
+	int records;
+	record_keys_t seal;
+	record_keys_t open;
+	size_t unread;
+} upgrade_session_t;
+
+
+/*
+ * Function:  UpgradeAddress
+ * --------------------
+ *  fills in the address of the socket at a path
+ *
+ *  addr:	the address
+ *  path:	the path
+ *
+ *  returns:	0 if successful, or -1 if the path is too long
+ */
+static int UpgradeAddress(struct sockaddr_un *addr, const char *path)
+{
+	if(strlen(path) >= sizeof(addr->sun_path))
+	{
+		return -1;
+	}
+
+	memset(addr, 0, sizeof(struct sockaddr_un));
+	addr->sun_family = AF_UNIX;
+	strcpy(addr->sun_path, path);
+	return 0;
+}
+
+
+/*
+ * Function:  UpgradeSetTimeouts
+ * --------------------
+ *  bounds how long a send or a receive on a connection blocks, so a stuck
+ *  peer can't hold the other side up
+ *
+ *  fd:		the connection
+ *
+ *  returns:	0 if successful, or -1 if an error occurred
+ */
+static int UpgradeSetTimeouts(int fd)
+{
+	struct timeval timeout;
+
+	timeout.tv_sec = UPGRADE_TIMEOUT;
+	timeout.tv_usec = 0;
+	if(-1 == setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) ||
+	   -1 == setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)))
+	{
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/*
+ * Function:  UpgradeListen
+ * --------------------
+ *  creates the non-blocking socket a new server connects to, readable and
+ *  writable by the owner only; a socket left at the path is replaced
+ *
+ *  path:	where to create the socket
+ *
+ *  returns:	the socket if successful, or -1 if an error occurred
+ */
+int UpgradeListen(const char *path)
+{
+	struct sockaddr_un addr;
+	int fd = 0;
+
+	if(-1 == UpgradeAddress(&addr, path))
+	{
+		return -1;
+	}
+
+	unlink(path);
+	fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if(-1 == fd)
+	{
+		return -1;
+	}
+
+	if(-1 == bind(fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+	   -1 == chmod(path, S_IRUSR | S_IWUSR) ||
+	   -1 == listen(fd, UPGRADE_BACKLOG))
+	{
+		close(fd);
+		unlink(path);
+		return -1;
+	}
+
+	return fd;
+}
+
+
+/*
+ * Function:  UpgradeAccept
+ * --------------------
+ *  accepts a new server's connection, as long as it runs as the same user
+ *  (the socket's mode keeps others out already, this holds when the path's
+ *  directory doesn't)
+ *
+ *  listen_fd:	the socket from UpgradeListen()
+ *
+ *  returns:	the connection, blocking for UPGRADE_TIMEOUT at most, or -1 if
+ *		none was pending, the peer is another user or an error occurred
+ */
+int UpgradeAccept(int listen_fd)
+{
+	struct ucred peer;
+	socklen_t length = sizeof(peer);
+	int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+
+	if(-1 == fd)
+	{
+		return -1;
+	}
+
+	if(-1 == getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &peer, &length) || geteuid() != peer.uid ||
+	   -1 == UpgradeSetTimeouts(fd))
+	{
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+
+/*
+ * Function:  UpgradeConnect
+ * --------------------
+ *  connects to the server running with the socket at a path
+ *
+ *  path:	the path
+ *
+ *  returns:	the connection, blocking for UPGRADE_TIMEOUT at most, or -1 if
+ *		no server listens there (errno ENOENT or ECONNREFUSED) or an
+ *		error occurred
+ */
+int UpgradeConnect(const char *path)
+{
+	struct sockaddr_un addr;
+	int fd = 0;
+	int error = 0;
+
+	if(-1 == UpgradeAddress(&addr, path))
+	{
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+
+	fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if(-1 == fd)
+	{
+		return -1;
+	}
+
+	if(-1 == connect(fd, (struct sockaddr *)&addr, sizeof(addr)) || -1 == UpgradeSetTimeouts(fd))
+	{
+		error = errno;
+		close(fd);
+		errno = error;
+		return -1;
+	}
+
+	return fd;
+}
+
+
+/*
+ * Function:  UpgradeSend
+ * --------------------
+ *  sends one message, a header followed by a body, with file descriptors
+ *  the peer receives duplicates of
+ *
+ *  fd:		the connection
+ *  head:	the header
+ *  head_length:	its length
+ *  body:	the body, or NULL
+ *  body_length:	its length
+ *  fds:	the file descriptors, or NULL
+ *  count:	how many, up to UPGRADE_MAX_FDS
+ *
+ *  returns:	0 if successful, or -1 if an error occurred
+ */
+int UpgradeSend(int fd, const void *head, size_t head_length, const void *body, size_t body_length, const int *fds, int count)
+{
+	union
+	{
+		char buffer[CMSG_SPACE(UPGRADE_MAX_FDS * sizeof(int))];
+		struct cmsghdr align;
+	} control;
+	struct iovec parts[2];
+	struct msghdr message;
+	struct cmsghdr *header = NULL;
+	ssize_t result = 0;
+
+	parts[0].iov_base = (void *)head;
+	parts[0].iov_len = head_length;
+	parts[1].iov_base = (void *)body;
+	parts[1].iov_len = body_length;
+
+	memset(&message, 0, sizeof(message));
+	message.msg_iov = parts;
+	message.msg_iovlen = 0 == body_length ? 1 : 2;
+	if(0 != count)
+	{
+		message.msg_control = control.buffer;
+		message.msg_controllen = CMSG_SPACE(count * sizeof(int));
+		header = CMSG_FIRSTHDR(&message);
+		header->cmsg_level = SOL_SOCKET;
+		header->cmsg_type = SCM_RIGHTS;
+		header->cmsg_len = CMSG_LEN(count * sizeof(int));
+		memcpy(CMSG_DATA(header), fds, count * sizeof(int));
+	}
+
+	do
+	{
+		result = sendmsg(fd, &message, MSG_NOSIGNAL);
+	} while(-1 == result && EINTR == errno);
+
+	return (ssize_t)(head_length + body_length) == result ? 0 : -1;
+}
+
+
+/*
+ * Function:  UpgradeReceive
+ * --------------------
+ *  receives one message and the file descriptors sent along with it; a
+ *  message that doesn't fit, or carries more descriptors than asked for,
+ *  is an error and its descriptors are closed
+ *
+ *  fd:		the connection
+ *  buffer:	where the message goes
+ *  size:	room there
+ *  fds:	where the file descriptors go
+ *  max_fds:	room there, up to UPGRADE_MAX_FDS
+ *  count:	set to how many came
+ *
+ *  returns:	the length of the message, 0 if the peer closed the connection,
+ *		or -1 if an error occurred or the wait timed out
+ */
+ssize_t UpgradeReceive(int fd, void *buffer, size_t size, int *fds, int max_fds, int *count)
+{
+	union
+	{
+		char buffer[CMSG_SPACE(UPGRADE_MAX_FDS * sizeof(int))];
+		struct cmsghdr align;
+	} control;
+	struct iovec part;
+	struct msghdr message;
+	struct cmsghdr *header = NULL;
+	ssize_t result = 0;
+	int received = 0;
+	int i = 0;
+
+	part.iov_base = buffer;
+	part.iov_len = size;
+	memset(&message, 0, sizeof(message));
+	message.msg_iov = &part;
+	message.msg_iovlen = 1;
+	message.msg_control = control.buffer;
+	message.msg_controllen = sizeof(control.buffer);
+
+	*count = 0;
+	do
+	{
+		result = recvmsg(fd, &message, MSG_CMSG_CLOEXEC);
+	} while(-1 == result && EINTR == errno);
+
+	if(-1 == result)
+	{
+		return -1;
+	}
+
+	for(header = CMSG_FIRSTHDR(&message); NULL != header; header = CMSG_NXTHDR(&message, header))
+	{
+		if(SOL_SOCKET != header->cmsg_level || SCM_RIGHTS != header->cmsg_type)
+		{
+			continue;
+		}
+
+		received = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		for(i = 0; i < received; ++i)
+		{
+			if(*count < max_fds)
+			{
+				memcpy(&fds[(*count)++], CMSG_DATA(header) + i * sizeof(int), sizeof(int));
+			}
+			else
+			{
+				close(*(int *)(CMSG_DATA(header) + i * sizeof(int)));
+				result = -1;
+			}
+		}
+	}
+
+	if((MSG_TRUNC | MSG_CTRUNC) & message.msg_flags)
+	{
+		result = -1;
+	}
+
+	if(-1 == result)
+	{
+		while(0 < *count)
+		{
+			close(fds[--(*count)]);
+		}
+	}
+
+	return result;
+}
+
+
+/*
+ * Function:  WaitForConnection
+ * --------------------
+ *  waits for a client's connection to become readable or writable, for as
+ *  long as a deadline allows
+ *
+ *  fd:		the connection
+ *  events:	POLLIN or POLLOUT
+ *  deadline:	when to give up (monotonic milliseconds)
+ *
+ *  returns:	1 if the connection is ready, 0 if the deadline passed first
+ */
+static int WaitForConnection(int fd, short events, uint64_t deadline)
+{
+	struct pollfd ready;
+	uint64_t now = GetMonotonicTime();
+	int result = 0;
+
+	ready.fd = fd;
+	ready.events = events;
+	while(now < deadline)
+	{
+		result = poll(&ready, 1, (int)(deadline - now));
+		if(0 < result)
+		{
+			return 1;
+		}
+		if(0 == result || EINTR != errno)
+		{
+			return 0;
+		}
+		now = GetMonotonicTime();
+	}
+
+	return 0;
+}
+
+
+/*
+ * Function:  QuiesceSession
+ * --------------------
+ *  brings a TLS client's session to a record boundary both ways, so where
+ *  its TLS session is at can be handed over: the record its connection
+ *  took part of is sent in full and the record the client is in the middle
+ *  of sending is received in full, or with a record stream taken as it is
+ *  (RecordStreamUnread()). Runs on the acceptor while the session's
+ *  worker waits (WaitForUpgrade())
+ *
+ *  worker:	the session's worker
+ *  session:	the session
+ *  deadline:	when to give up on the client (monotonic milliseconds)
+ *
+ *  returns:	0 if the session is at a record boundary, 1 if the client didn't get there
+ *		in time, or -1 if it closed or failed and the session must be closed
+ */
+static int QuiesceSession(worker_t *worker, session_t *session, uint64_t deadline)
+{
+	send_queue_t *queue = &session->queue;
+	int result = 0;
+
+	while(queue->started)
+	{
+		result = WriteRecord(session, queue->records[queue->head], &queue->sent);
+		if(-1 == result)
+		{
+			COUNT_TRAFFIC(session, errors, 1);
+			return -1;
+		}
+		if(0 != result)
+		{
+			COUNT_TRAFFIC(session, tx_records, 1);
+			DequeueRecord(worker, session);
+		}
+		else if(!WaitForConnection(session->source.fd, POLLOUT, deadline))
+		{
+			return 1;
+		}
+	}
+
+	/* a record stream's unread bytes go over as they are, what it opened already is forwarded */
+	if(NULL != session->records)
+	{
+		return RecordStreamPending(session->records) && -1 == HandleTrafficFromClient(worker->vnic.fd, session) ? -1 : 0;
+	}
+
+	while(SSL_has_pending(session->ssl))
+	{
+		if(-1 == HandleTrafficFromClient(worker->vnic.fd, session))
+		{
+			return -1;
+		}
+		if(SSL_has_pending(session->ssl) && !WaitForConnection(session->source.fd, POLLIN, deadline))
+		{
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+
+/*
+ * Function:  ExportSession
+ * --------------------
+ *  describes a quiesced session for the new server: the keys its TLS 1.3
+ *  session is at each way, and the rest of what the new server's session
+ *  starts from. The packets waiting for the next record are queued first,
+ *  the queued records go along with the session
+ *
+ *  worker:	the session's worker
+ *  session:	the session
+ *  message:	filled with the description
+ *
+ *  returns:	0 if successful, or -1 if the session can't be carried over: it runs over
+ *		TLS 1.2 or receives through kTLS, or its keys were updated or never seen
+ */
+static int ExportSession(worker_t *worker, session_t *session, upgrade_session_t *message)
+{
+	const unsigned char *unread = NULL;
+
+	memset(message, 0, sizeof(upgrade_session_t));
+	if(NULL != session->records)
+	{
+		message->seal = session->records->seal;
+		message->open = session->records->open;
+		message->unread = RecordStreamUnread(session->records, &unread);
+	}
+	else if(BIO_get_ktls_recv(SSL_get_rbio(session->ssl)) || 
+	        -1 == RecordDeriveKeys(session->ssl, &session->secrets, &message->seal, &message->open))
+	{
+		return -1;
+	}
+
+	if(-1 == FlushToClient(worker, session))
+	{
+		OPENSSL_cleanse(message, sizeof(upgrade_session_t));
+		return -1;
+	}
+
+	message->type = UPGRADE_SESSION;
+	message->worker = worker->index;
+	message->peer_addr = session->peer_addr;
+	message->inner_addr = session->inner_addr;
+	message->mtu = session->mtu;
+	message->offload = session->offload;
+	message->compressed = COMPRESS_OFF != session->compressor.mode;
+	message->records = (int)session->queue.count;
+	return 0;
+}
+
+
+/*
+ * Function:  SendSessions
+ * --------------------
+ *  sends the new server the listening sockets, the TUN queues and the
+ *  session ticket keys, then every exported session with its connection,
+ *  the frame bytes it received so far and its queued records
+ *
+ *  server:	the server state
+ *  conn_fd:	the connection to the new server
+ *  sessions:	the exported sessions
+ *  messages:	their descriptions, from ExportSession()
+ *  count:	number of exported sessions
+ *
+ *  returns:	0 if successful, or -1 if an error occurred
+ */
+static int SendSessions(server_t *server, int conn_fd, session_t **sessions, upgrade_session_t *messages, int count)
+{
+	upgrade_state_message_t state;
+	upgrade_message_type_t type = UPGRADE_RECORD;
+	int fds[MAX_ACCEPTORS + MAX_WORKERS];
+	unsigned char *body = malloc(DEFRAMER_SIZE + RECORD_INPUT_SIZE);
+	const unsigned char *unread = NULL;
+	session_t *session = NULL;
+	frame_batch_t *record = NULL;
+	size_t length = 0;
+	size_t j = 0;
+	int result = 0;
+	int i = 0;
+
+	if(NULL == body)
+	{
+		return -1;
+	}
+
+	memset(&state, 0, sizeof(state));
+	state.type = UPGRADE_STATE;
+	state.sessions = count;
+	memcpy(state.cookie_secret, cookie_secret, COOKIE_SECRET_LENGTH);
+	if(1 != SSL_CTX_get_tlsext_ticket_keys(server->ctx, state.ticket_keys, sizeof(state.ticket_keys)))
+	{
+		free(body);
+		return -1;
+	}
+
+	for(i = 0; i < server->acceptor_count; ++i)
+	{
+		fds[i] = server->acceptors[i].listener.fd;
+	}
+	for(i = 0; i < server->worker_count; ++i)
+	{
+		fds[server->acceptor_count + i] = server->workers[i].vnic.fd;
+	}
+	result = UpgradeSend(conn_fd, &state, sizeof(state), NULL, 0, fds, server->acceptor_count + server->worker_count);
+	OPENSSL_cleanse(&state, sizeof(state));
+
+	for(i = 0; 0 == result && i < count; ++i)
+	{
+		session = sessions[i];
+		length = session->incoming.end - session->incoming.start;
+		memcpy(body, session->incoming.data + session->incoming.start, length);
+		if(NULL != session->records)
+		{
+			RecordStreamUnread(session->records, &unread);
+			memcpy(body + length, unread, messages[i].unread);
+			length += messages[i].unread;
+		}
+		result = UpgradeSend(conn_fd, &messages[i], sizeof(upgrade_session_t), body, length, &session->source.fd, 1);
+
+		for(j = 0; 0 == result && j < session->queue.count; ++j)
+		{
+			record = session->queue.records[(session->queue.head + j) % queue_length];
+			result = UpgradeSend(conn_fd, &type, sizeof(type), record->data, record->length, NULL, 0);
+		}
+	}
+
+	free(body);
+	return result;
+}
+
+
+/*
+ * Function:  HandOver
+ * --------------------
+ *  hands the clients over to the new server while the workers wait: every
+ *  TLS 1.3 session is brought to a record boundary and sent along with its
+ *  connection, then the new server says it took over. The clients taken over
+ *  are then taken off their workers' lists, the workers close only the rest
+ *  as they stop
+ *
+ *  server:	the server state
+ *  conn_fd:	the connection to the new server
+ *
+ *  returns:	0 if the new server took over, or -1 if it didn't and the workers serve on
+ */
+static int HandOver(server_t *server, int conn_fd)
+{
+	uint64_t deadline = GetMonotonicTime() + UPGRADE_DRAIN_TIMEOUT;
+	upgrade_message_type_t type = UPGRADE_REFUSED;
+	upgrade_session_t *messages = NULL;
+	session_t **sessions = NULL;
+	session_t *session = NULL;
+	session_t *next = NULL;
+	worker_t *worker = NULL;
+	size_t total = 0;
+	int count = 0;
+	int received = 0;
+	int result = 0;
+	int i = 0;
+
+	for(i = 0; i < server->worker_count; ++i)
+	{
+		total += server->workers[i].session_count;
+	}
+
+	sessions = malloc((total + 1) * sizeof(session_t *));
+	messages = malloc((total + 1) * sizeof(upgrade_session_t));
+	if(NULL == sessions || NULL == messages)
+	{
+		free(sessions);
+		free(messages);
+		return -1;
+	}
+
+	for(i = 0; i < server->worker_count; ++i)
+	{
+		worker = &server->workers[i];
+		for(session = worker->sessions; NULL != session; session = next)
+		{
+			next = session->next;
+			if(session->datagram || session->kernel_send)
+			{
+				continue;		/* DTLS and kTLS sessions can't be carried over */
+			}
+
+			result = QuiesceSession(worker, session, deadline);
+			if(-1 == result)
+			{
+				CloseConnection(worker, session);
+			}
+			else if(0 == result && 0 == ExportSession(worker, session, &messages[count]))
+			{
+				sessions[count++] = session;
+			}
+		}
+	}
+
+	result = SendSessions(server, conn_fd, sessions, messages, count);
+	OPENSSL_cleanse(messages, (total + 1) * sizeof(upgrade_session_t));
+	free(messages);
+	if(0 == result && (sizeof(type) != UpgradeReceive(conn_fd, &type, sizeof(type), NULL, 0, &received) || UPGRADE_TAKEN != type))
+	{
+		result = -1;
+	}
+
+	/* the sessions taken over live on in the new server, nothing of them is closed or freed here */
+	for(i = 0; 0 == result && i < count; ++i)
+	{
+		session = sessions[i];
+		worker = session->worker;
+		if(NULL != session->prev)
+		{
+			session->prev->next = session->next;
+		}
+		else
+		{
+			worker->sessions = session->next;
+		}
+		if(NULL != session->next)
+		{
+			session->next->prev = session->prev;
+		}
+		__atomic_sub_fetch(&worker->session_count, 1, __ATOMIC_RELAXED);
+	}
+
+	if(0 == result)
+	{
+		printf("Notice: Handed %d clients over, %zu were closed to reconnect.\n", count, total - count);
+	}
+
+	free(sessions);
+	return result;
+}
+
+
+/*
+ * Function:  HandleUpgrade
+ * --------------------
+ *  runs on the first acceptor when a new server connects to the upgrade
+ *  socket: unless its configuration differs where it matters, accepting
+ *  stops, the workers and the other acceptors are paused and everything is
+ *  handed over (HandOver()), after which this server exits. If the new
+ *  server doesn't take over, accepting resumes and the workers serve on.
+ *  The handshakes in progress are dropped either way, the clients start over
+ *
+ *  acceptor:	the first acceptor
+ *
+ *  returns:	no return value, keep_running is cleared once the new server took over
+ */
+void HandleUpgrade(acceptor_t *acceptor)
+{
+	server_t *server = acceptor->server;
+	upgrade_hello_t hello;
+	upgrade_message_type_t refused = UPGRADE_REFUSED;
+	int conn_fd = UpgradeAccept(server->upgrade.fd);
+	int received = 0;
+	int i = 0;
+
+	if(-1 == conn_fd)
+	{
+		return;
+	}
+
+	if(sizeof(hello) != UpgradeReceive(conn_fd, &hello, sizeof(hello), NULL, 0, &received) || UPGRADE_HELLO != hello.type)
+	{
+		close(conn_fd);
+		return;
+	}
+
+	if(UPGRADE_VERSION != hello.version || transport != hello.transport || tunnel_network != hello.network ||
+	   tunnel_prefix_length != hello.prefix_length || server->worker_count != hello.workers ||
+	   server->acceptor_count != hello.acceptors || offload != hello.offload || tunnel_mtu != hello.mtu)
+	{
+		printf("Error: Refused to hand over to the server with pid %d, its WORKERS, ACCEPTORS, TRANSPORT, TUNNEL_NETWORK, OFFLOAD or MTU differ.\n", (int)hello.pid);
+		UpgradeSend(conn_fd, &refused, sizeof(refused), NULL, 0, NULL, 0);
+		close(conn_fd);
+		return;
+	}
+
+	StopAccepting(acceptor);
+	__atomic_store_n(&server->upgrade_state, UPGRADE_PAUSED, __ATOMIC_RELEASE);
+	for(i = 0; i < server->worker_count; ++i)
+	{
+		WakeWorker(&server->workers[i]);
+	}
+	for(i = 1; i < server->acceptor_count; ++i)
+	{
+		WakeAcceptor(&server->acceptors[i]);
+	}
+	pthread_barrier_wait(&server->upgrade_barrier);
+
+	if(0 == HandOver(server, conn_fd))
+	{
+		/* conn_fd closes as this process exits, telling the new server the statistics socket is free */
+		__atomic_store_n(&server->upgrade_state, UPGRADE_HANDED_OVER, __ATOMIC_RELEASE);
+		keep_running = 0;
+		pthread_barrier_wait(&server->upgrade_barrier);
+		printf("Notice: The server with pid %d took over, exiting.\n", (int)hello.pid);
+		return;
+	}
+
+	ResumeAccepting(acceptor);
+	__atomic_store_n(&server->upgrade_state, UPGRADE_NONE, __ATOMIC_RELEASE);
+	pthread_barrier_wait(&server->upgrade_barrier);
+	close(conn_fd);
+	printf("Error: The server with pid %d didn't take over, serving on.\n", (int)hello.pid);
+}
+
+
+/*
+ * Function:  TakeOver
+ * --------------------
+ *  asks the server running on UPGRADE_SOCKET to hand over to this one:
+ *  receives the listening sockets and tun0's queues, and sets up the SSL
+ *  context with the running server's session ticket keys and cookie secret
+ *
+ *  server:	the server state
+ *  conn_fd:	the connection to the running server
+ *  queue_fds:	filled with one file descriptor per queue
+ *
+ *  returns:	the number of clients that follow (ImportSessions()), or -1 if the
+ *		running server refused or an error occurred
+ */
+int TakeOver(server_t *server, int conn_fd, int *queue_fds)
+{
+	upgrade_hello_t hello;
+	upgrade_state_message_t state;
+	int fds[MAX_ACCEPTORS + MAX_WORKERS];
+	ssize_t length = 0;
+	int count = 0;
+	int i = 0;
+
+	memset(&hello, 0, sizeof(hello));
+	hello.type = UPGRADE_HELLO;
+	hello.version = UPGRADE_VERSION;
+	hello.transport = transport;
+	hello.network = tunnel_network;
+	hello.prefix_length = tunnel_prefix_length;
+	hello.workers = worker_count;
+	hello.acceptors = acceptor_count;
+	hello.offload = offload;
+	hello.mtu = tunnel_mtu;
+	hello.pid = getpid();
+	if(-1 == UpgradeSend(conn_fd, &hello, sizeof(hello), NULL, 0, NULL, 0))
+	{
+		return -1;
+	}
+
+	length = UpgradeReceive(conn_fd, &state, sizeof(state), fds, acceptor_count + worker_count, &count);
+	if((ssize_t)sizeof(upgrade_message_type_t) <= length && UPGRADE_REFUSED == state.type)
+	{
+		printf("Error: The running server refused to hand over, WORKERS, ACCEPTORS, TRANSPORT, TUNNEL_NETWORK, OFFLOAD and MTU must match its own.\n");
+	}
+	if(sizeof(state) != length || UPGRADE_STATE != state.type || acceptor_count + worker_count != count)
+	{
+		while(0 < count)
+		{
+			close(fds[--count]);
+		}
+		return -1;
+	}
+
+	server->ctx = CreateContext(TRANSPORT_UDP == transport);
+	if(NULL == server->ctx || 1 != SSL_CTX_set_tlsext_ticket_keys(server->ctx, state.ticket_keys, sizeof(state.ticket_keys)))
+	{
+		OPENSSL_cleanse(&state, sizeof(state));
+		SSL_CTX_free(server->ctx);
+		server->ctx = NULL;
+		while(0 < count)
+		{
+			close(fds[--count]);
+		}
+		return -1;
+	}
+
+	memcpy(cookie_secret, state.cookie_secret, COOKIE_SECRET_LENGTH);
+	count = state.sessions;
+	OPENSSL_cleanse(&state, sizeof(state));
+	for(i = 0; i < acceptor_count; ++i)
+	{
+		server->acceptors[i].listener.fd = fds[i];
+	}
+	memcpy(queue_fds, fds + acceptor_count, worker_count * sizeof(int));
+	return count;
+}
+
+
+/*
+ * Function:  ImportSession
+ * --------------------
+ *  sets up the session of a client the running server handed over, its
+ *  records sealed and opened here from the keys its TLS session is at
+ *
+ *  server:	the server state
+ *  message:	the session's description
+ *  fd:		the client's connection
+ *  body:	the frame bytes and the unread bytes the running server received
+ *		from the client so far
+ *  length:	the body's length
+ *
+ *  returns:	the session, to be handed to session->worker, or NULL if an error occurred
+ */
+static session_t *ImportSession(server_t *server, const upgrade_session_t *message, int fd, const unsigned char *body, size_t length)
+{
+	session_t *session = NULL;
+	size_t frames = length - message->unread;
+	size_t room = 0;
+	int result = -1;
+
+	if(message->unread > length || DEFRAMER_SIZE < frames || NULL == (session = calloc(1, sizeof(session_t))))
+	{
+		return NULL;
+	}
+
+	session->queue.records = calloc(queue_length, sizeof(frame_batch_t *));
+	session->records = RecordStreamCreate(&message->seal, &message->open, body + frames, message->unread);
+	if(NULL != session->queue.records && NULL != session->records)
+	{
+		pthread_mutex_lock(&server->lease_lock);
+		result = LeasePoolReserve(&server->leases, message->inner_addr);
+		pthread_mutex_unlock(&server->lease_lock);
+	}
+
+	if(-1 == result)
+	{
+		RecordStreamFree(session->records);
+		free(session->queue.records);
+		free(session);
+		return NULL;
+	}
+
+	session->source.type = EVENT_SESSION;
+	session->source.fd = fd;
+	session->worker = &server->workers[message->worker % server->worker_count];
+	session->peer_addr = message->peer_addr;
+	session->inner_addr = message->inner_addr;
+	session->mtu = message->mtu;
+	session->offload = message->offload;
+	if(message->compressed && COMPRESS_OFF != compress_mode)
+	{
+		CompressorInit(&session->compressor, compress_mode);
+	}
+	FrameBatchReset(&session->outgoing);
+	DeframerInit(&session->incoming);
+	memcpy(DeframerSpace(&session->incoming, &room), body, frames);
+	DeframerCommit(&session->incoming, frames);
+	return session;
+}
+
+
+/*
+ * Function:  ImportSessions
+ * --------------------
+ *  receives the clients the running server hands over after TakeOver(),
+ *  each with the records it had queued for it (up to QUEUE_LENGTH of them),
+ *  then tells the running server this one took over: from then on tun0 and
+ *  the clients are this server's
+ *
+ *  server:	the server state
+ *  conn_fd:	the connection to the running server
+ *  count:	number of clients to receive
+ *  sessions:	set to the list of the clients' sessions, linked by next
+ *
+ *  returns:	0 if successful, or -1 if an error occurred and the running server serves on
+ */
+int ImportSessions(server_t *server, int conn_fd, int count, session_t **sessions)
+{
+	size_t size = sizeof(upgrade_session_t) + DEFRAMER_SIZE + RECORD_INPUT_SIZE;
+	unsigned char *buffer = malloc(size);
+	upgrade_session_t message;
+	upgrade_message_type_t type = UPGRADE_TAKEN;
+	send_queue_t *queue = NULL;
+	frame_batch_t *record = NULL;
+	session_t *session = NULL;
+	ssize_t length = 0;
+	int fd = -1;
+	int received = 0;
+	int records = 0;
+	int result = NULL == buffer ? -1 : 0;
+	int i = 0;
+	int j = 0;
+
+	*sessions = NULL;
+	for(i = 0; 0 == result && i < count; ++i)
+	{
+		length = UpgradeReceive(conn_fd, buffer, size, &fd, 1, &received);
+		if((ssize_t)sizeof(message) > length || 1 != received)
+		{
+			if(0 < received)
+			{
+				close(fd);
+			}
+			result = -1;
+			break;
+		}
+
+		memcpy(&message, buffer, sizeof(message));
+		records = message.records;
+		session = UPGRADE_SESSION == message.type ? ImportSession(server, &message, fd, buffer + sizeof(message), length - sizeof(message)) : NULL;
+		OPENSSL_cleanse(&message, sizeof(message));
+		if(NULL == session)
+		{
+			close(fd);
+			result = -1;
+			break;
+		}
+		session->next = *sessions;
+		*sessions = session;
+
+		/* the oldest records are sent first, those beyond this server's QUEUE_LENGTH are dropped */
+		queue = &session->queue;
+		for(j = 0; 0 == result && j < records; ++j)
+		{
+			length = UpgradeReceive(conn_fd, buffer, sizeof(type) + FRAME_BATCH_SIZE, NULL, 0, &received);
+			if((ssize_t)sizeof(type) > length || UPGRADE_RECORD != *(upgrade_message_type_t *)buffer)
+			{
+				result = -1;
+			}
+			else if(queue->count < queue_length && NULL != (record = malloc(sizeof(frame_batch_t))))
+			{
+				FrameBatchReset(record);
+				record->length = length - sizeof(type);
+				memcpy(record->data, buffer + sizeof(type), record->length);
+				queue->records[queue->count++] = record;
+				queue->bytes += record->length;
+			}
+		}
+	}
+
+	free(buffer);
+	if(0 == result)
+	{
+		result = UpgradeSend(conn_fd, &type, sizeof(type), NULL, 0, NULL, 0);
+	}
+
+	while(-1 == result && NULL != (session = *sessions))
+	{
+		*sessions = session->next;
+		pthread_mutex_lock(&server->lease_lock);
+		LeasePoolRelease(&server->leases, session->inner_addr);
+		pthread_mutex_unlock(&server->lease_lock);
+		while(0 < session->queue.count)
+		{
+			free(session->queue.records[--session->queue.count]);
+		}
+		free(session->queue.records);
+		RecordStreamFree(session->records);
+		close(session->source.fd);
+		free(session);
+	}
+
+	return result;
+}
+
+
+/*
+ * Function:  ListenForUpgrade
+ * --------------------
+ *  creates the upgrade socket a newer server takes over on and registers it
+ *  with the first acceptor's epoll instance
+ *
+ *  server:	the server state
+ *
+ *  returns:	0 if successful, or -1 if an error occurred
+ */
+int ListenForUpgrade(server_t *server)
+{
+	struct epoll_event event;
+
+	server->upgrade.type = EVENT_UPGRADE;
+	server->upgrade.fd = UpgradeListen(upgrade_path);
+	if(-1 == server->upgrade.fd)
+	{
+		return -1;
+	}
+
+	event.events = EPOLLIN;
+	event.data.ptr = &server->upgrade;
+	if(-1 == epoll_ctl(server->acceptors[0].epoll_fd, EPOLL_CTL_ADD, server->upgrade.fd, &event))
+	{
+		return -1;
+	}
+
+	return 0;
+}
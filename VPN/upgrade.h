@@ -0,0 +1,61 @@
+#ifndef UPGRADE_H
+#define UPGRADE_H
+
+#include <stddef.h>		/* size_t 		*/
+#include <sys/types.h>		/* ssize_t 		*/
+#include "server.h"		/* server_t 		*/
+
+#define UPGRADE_MAX_FDS 128				/* file descriptors a message carries at most */
+#define UPGRADE_TIMEOUT 10				/* seconds either side waits for the other's next message */
+
+/*
+ * Enum:  upgrade_message_type 
+ * --------------------
+ *  the messages a running server and the new server taking over from it
+ *  exchange on the upgrade socket, in this order
+ */
+typedef enum upgrade_message_type
+{
+	UPGRADE_HELLO,		/* new: what it was configured with */
+	UPGRADE_REFUSED,	/* running: the configurations don't match, it keeps serving */
+	UPGRADE_STATE,		/* running: the listening sockets, the TUN queues and what resumption takes */
+	UPGRADE_SESSION,	/* running: a client's connection and where its TLS session is at */
+	UPGRADE_RECORD,		/* running: a record queued for the client of the last UPGRADE_SESSION */
+	UPGRADE_TAKEN		/* new: it serves from now on, the running server exits */
+} upgrade_message_type_t;
+
+/*
+ * the Unix domain socket a running server hands its listening socket, its
+ * TUN queues and its sessions over to a new server on: SOCK_SEQPACKET, so
+ * every message arrives whole and with the file descriptors sent along
+ * with it (SCM_RIGHTS); only a process of the same user may connect
+ */
+
+/* creates the socket at a path, readable and writable by the owner only, replacing a stale one */
+int UpgradeListen(const char *path);
+
+/* accepts a new server, or returns -1 for a peer of another user */
+int UpgradeAccept(int listen_fd);
+
+/* connects to the server running at a path, -1 with errno ENOENT or ECONNREFUSED if none is */
+int UpgradeConnect(const char *path);
+
+/* sends a message of a header and a body with file descriptors */
+int UpgradeSend(int fd, const void *head, size_t head_length, const void *body, size_t body_length, const int *fds, int count);
+
+/* receives a message and the file descriptors sent along with it */
+ssize_t UpgradeReceive(int fd, void *buffer, size_t size, int *fds, int max_fds, int *count);
+
+/* hands over to the new server that connected to the upgrade socket, on the first acceptor */
+void HandleUpgrade(acceptor_t *acceptor);
+
+/* asks the server running on UPGRADE_SOCKET to hand over to this one */
+int TakeOver(server_t *server, int conn_fd, int *queue_fds);
+
+/* receives the clients the running server hands over after TakeOver() */
+int ImportSessions(server_t *server, int conn_fd, int count, session_t **sessions);
+
+/* creates the upgrade socket a newer server takes over on */
+int ListenForUpgrade(server_t *server);
+
+#endif  /* UPGRADE_H */
@@ -0,0 +1,367 @@
+#include "uring.h"
+
+#ifdef WITH_IO_URING
+
+#include <string.h>		/* memset 		*/
+#include <unistd.h>		/* syscall, close 	*/
+#include <errno.h>		/* EINTR 		*/
+#include <poll.h>		/* POLLIN 		*/
+#include <sys/mman.h>		/* mmap 		*/
+#include <sys/syscall.h>	/* __NR_io_uring_setup 	*/
+#include <sys/uio.h>		/* iovec 		*/
+#include <linux/io_uring.h>	/* io_uring_params 	*/
+
+
+/*		
+ * Function:  UringInit 
+ * --------------------
+ *  sets up an io_uring instance and maps its submission and completion queues
+ *
+ *  uring:	the instance
+ *  entries:	the submission queue size
+ *
+ *  returns:	0 if successful, -1 if io_uring is unavailable (the caller falls back)
+ */
+int UringInit(uring_t *uring, unsigned entries)
+{
+	struct io_uring_params params;
+	unsigned char *ring = NULL;
+	size_t sq_size = 0;
+	size_t cq_size = 0;
+
+	memset(uring, 0, sizeof(uring_t));
+	memset(&params, 0, sizeof(params));
+
+	uring->fd = syscall(__NR_io_uring_setup, entries, &params);
+	if(-1 == uring->fd)
+	{
+		return -1;
+	}
+
+	/* one mapping for both queues, every kernel with IORING_OP_READ has it */
+	if(!(params.features & IORING_FEAT_SINGLE_MMAP))
+	{
+		close(uring->fd);
+		uring->fd = -1;
+		return -1;
+	}
+
+	sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	uring->ring_map_size = sq_size > cq_size ? sq_size : cq_size;
+	uring->sqe_map_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+	uring->ring_map = mmap(NULL, uring->ring_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring->fd, IORING_OFF_SQ_RING);
+	uring->sqe_map = mmap(NULL, uring->sqe_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring->fd, IORING_OFF_SQES);
+	if(MAP_FAILED == uring->ring_map || MAP_FAILED == uring->sqe_map)
+	{
+		UringDestroy(uring);
+		return -1;
+	}
+
+	ring = uring->ring_map;
+	uring->sq_head = (unsigned *)(ring + params.sq_off.head);
+	uring->sq_tail = (unsigned *)(ring + params.sq_off.tail);
+	uring->sq_mask = (unsigned *)(ring + params.sq_off.ring_mask);
+	uring->sq_array = (unsigned *)(ring + params.sq_off.array);
+	uring->sqes = uring->sqe_map;
+	uring->cq_head = (unsigned *)(ring + params.cq_off.head);
+	uring->cq_tail = (unsigned *)(ring + params.cq_off.tail);
+	uring->cq_mask = (unsigned *)(ring + params.cq_off.ring_mask);
+	uring->cqes = (struct io_uring_cqe *)(ring + params.cq_off.cqes);
+
+	return 0;
+}
+
+
+/*		
+ * Function:  UringDestroy 
+ * --------------------
+ *  unmaps the queues and closes the instance, which cancels whatever is still posted
+ *
+ *  uring:	the instance
+ *
+ *  returns:	no return value
+ */
+void UringDestroy(uring_t *uring)
+{
+	if(NULL != uring->ring_map && MAP_FAILED != uring->ring_map)
+	{
+		munmap(uring->ring_map, uring->ring_map_size);
+	}
+	if(NULL != uring->sqe_map && MAP_FAILED != uring->sqe_map)
+	{
+		munmap(uring->sqe_map, uring->sqe_map_size);
+	}
+	if(-1 != uring->fd)
+	{
+		close(uring->fd);
+	}
+
+	uring->ring_map = NULL;
+	uring->sqe_map = NULL;
+	uring->fd = -1;
+}
+
+
+/*		
+ * Function:  UringRegisterBuffer 
+ * --------------------
+ *  registers the buffer fixed reads go to, so the kernel maps it once
+ *  instead of on every read
+ *
+ *  uring:	the instance
+ *  base:	the buffer
+ *  length:	buffer length
+ *
+ *  returns:	0 if successful, -1 if refused (e.g. over RLIMIT_MEMLOCK), reads then
+ *		go through plain IORING_OP_READ
+ */
+int UringRegisterBuffer(uring_t *uring, void *base, size_t length)
+{
+	struct iovec buffer;
+
+	buffer.iov_base = base;
+	buffer.iov_len = length;
+	if(-1 == syscall(__NR_io_uring_register, uring->fd, IORING_REGISTER_BUFFERS, &buffer, 1))
+	{
+		return -1;
+	}
+
+	uring->fixed = 1;
+	uring->fixed_base = base;
+	uring->fixed_length = length;
+	return 0;
+}
+
+
+/*		
+ * Function:  UringNextEntry 
+ * --------------------
+ *  claims the next submission queue entry, submitting the prepared ones first
+ *  if the queue is full
+ *
+ *  returns:	the cleared entry, or NULL if the queue stays full
+ */
+static struct io_uring_sqe *UringNextEntry(uring_t *uring)
+{
+	unsigned tail = *uring->sq_tail;
+	unsigned head = __atomic_load_n(uring->sq_head, __ATOMIC_ACQUIRE);
+	struct io_uring_sqe *entry = NULL;
+	int submitted = 0;
+
+	if(tail - head > *uring->sq_mask)
+	{
+		submitted = syscall(__NR_io_uring_enter, uring->fd, uring->sq_prepared, 0, 0, NULL, 0);
+		if(0 >= submitted)
+		{
+			return NULL;
+		}
+		uring->sq_prepared -= submitted;
+	}
+
+	entry = &uring->sqes[tail & *uring->sq_mask];
+	memset(entry, 0, sizeof(struct io_uring_sqe));
+	uring->sq_array[tail & *uring->sq_mask] = tail & *uring->sq_mask;
+	return entry;
+}
+
+
+/*		
+ * Function:  UringCommitEntry 
+ * --------------------
+ *  publishes the entry claimed by UringNextEntry() to the kernel
+ *
+ *  returns:	no return value
+ */
+static void UringCommitEntry(uring_t *uring)
+{
+	__atomic_store_n(uring->sq_tail, *uring->sq_tail + 1, __ATOMIC_RELEASE);
+	++uring->sq_prepared;
+}
+
+
+/*		
+ * Function:  UringPrepareRead 
+ * --------------------
+ *  posts a read, a fixed one when the buffer lies in the registered buffer;
+ *  the fd must be blocking, io_uring fails reads of non-blocking files with -EAGAIN
+ *  instead of waiting for data
+ *
+ *  uring:	the instance
+ *  fd:		the file to read
+ *  buffer:	where the data goes
+ *  length:	buffer length
+ *  tag:	returned with the read's completion
+ *
+ *  returns:	0 if successful, -1 if the submission queue is full
+ */
+int UringPrepareRead(uring_t *uring, int fd, void *buffer, unsigned length, uint64_t tag)
+{
+	struct io_uring_sqe *entry = UringNextEntry(uring);
+	const unsigned char *start = buffer;
+
+	if(NULL == entry)
+	{
+		return -1;
+	}
+
+	entry->opcode = IORING_OP_READ;
+	if(uring->fixed && start >= uring->fixed_base && start + length <= uring->fixed_base + uring->fixed_length)
+	{
+		entry->opcode = IORING_OP_READ_FIXED;
+		entry->buf_index = 0;
+	}
+	entry->fd = fd;
+	entry->addr = (uint64_t)(uintptr_t)buffer;
+	entry->len = length;
+	entry->user_data = tag;
+
+	UringCommitEntry(uring);
+	return 0;
+}
+
+
+/*		
+ * Function:  UringPreparePoll 
+ * --------------------
+ *  posts a one-shot wait for a file to become readable, to be posted again
+ *  after its completion was handled
+ *
+ *  uring:	the instance
+ *  fd:		the file
+ *  tag:	returned with the completion
+ *
+ *  returns:	0 if successful, -1 if the submission queue is full
+ */
+int UringPreparePoll(uring_t *uring, int fd, uint64_t tag)
+{
+	struct io_uring_sqe *entry = UringNextEntry(uring);
+
+	if(NULL == entry)
+	{
+		return -1;
+	}
+
+	entry->opcode = IORING_OP_POLL_ADD;
+	entry->fd = fd;
+	entry->poll32_events = POLLIN;
+	entry->user_data = tag;
+
+	UringCommitEntry(uring);
+	return 0;
+}
+
+
+/*		
+ * Function:  UringWait 
+ * --------------------
+ *  submits every prepared entry and waits for at least one completion,
+ *  in a single io_uring_enter()
+ *
+ *  uring:	the instance
+ *
+ *  returns:	0 if successful (or interrupted), -1 if an error occurred
+ */
+int UringWait(uring_t *uring)
+{
+	int submitted = syscall(__NR_io_uring_enter, uring->fd, uring->sq_prepared, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+
+	if(-1 == submitted)
+	{
+		if(EINTR == errno || EAGAIN == errno || EBUSY == errno)
+		{
+			return 0;
+		}
+		return -1;
+	}
+
+	uring->sq_prepared -= submitted;
+	return 0;
+}
+
+
+/*		
+ * Function:  UringNextCompletion 
+ * --------------------
+ *  takes the next completion off the completion queue
+ *
+ *  uring:	the instance
+ *  tag:	set to the tag of the completed request
+ *  result:	set to its result, a negated errno on failure
+ *
+ *  returns:	1 if a completion was taken, 0 if the queue is empty
+ */
+int UringNextCompletion(uring_t *uring, uint64_t *tag, int *result)
+{
+	unsigned head = *uring->cq_head;
+	struct io_uring_cqe *completion = NULL;
+
+	if(head == __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE))
+	{
+		return 0;
+	}
+
+	completion = &uring->cqes[head & *uring->cq_mask];
+	*tag = completion->user_data;
+	*result = completion->res;
+	__atomic_store_n(uring->cq_head, head + 1, __ATOMIC_RELEASE);
+
+	return 1;
+}
+
+#else	/* WITH_IO_URING */
+
+int UringInit(uring_t *uring, unsigned entries)
+{
+	(void)entries;
+	uring->fd = -1;
+	return -1;
+}
+
+void UringDestroy(uring_t *uring)
+{
+	uring->fd = -1;
+}
+
+int UringRegisterBuffer(uring_t *uring, void *base, size_t length)
+{
+	(void)uring;
+	(void)base;
+	(void)length;
+	return -1;
+}
+
+int UringPrepareRead(uring_t *uring, int fd, void *buffer, unsigned length, uint64_t tag)
+{
+	(void)uring;
+	(void)fd;
+	(void)buffer;
+	(void)length;
+	(void)tag;
+	return -1;
+}
+
+int UringPreparePoll(uring_t *uring, int fd, uint64_t tag)
+{
+	(void)uring;
+	(void)fd;
+	(void)tag;
+	return -1;
+}
+
+int UringWait(uring_t *uring)
+{
+	(void)uring;
+	return -1;
+}
+
+int UringNextCompletion(uring_t *uring, uint64_t *tag, int *result)
+{
+	(void)uring;
+	(void)tag;
+	(void)result;
+	return 0;
+}
+
+#endif	/* WITH_IO_URING */
@@ -0,0 +1,62 @@
+#ifndef URING_H
+#define URING_H
+
+#include <stddef.h>	/* size_t 	*/
+#include <stdint.h>	/* uint64_t 	*/
+
+#define URING_ENTRIES 256
+#define URING_POSTED_READS 8		/* reads kept posted on one file, more only wake up together */
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+/*
+ * an io_uring instance driven through the raw system calls; only compiled in
+ * with WITH_IO_URING (make IO_URING=1), otherwise UringInit() always fails so
+ * callers fall back to their epoll/select loop
+ */
+typedef struct uring
+{
+	int fd;				/* -1 when not set up */
+	int fixed;			/* whether a buffer is registered for fixed reads */
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_array;
+	struct io_uring_sqe *sqes;
+	unsigned sq_prepared;		/* entries prepared since the last submission */
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	struct io_uring_cqe *cqes;
+	void *ring_map;
+	size_t ring_map_size;
+	void *sqe_map;
+	size_t sqe_map_size;
+	const unsigned char *fixed_base;
+	size_t fixed_length;
+} uring_t;
+
+
+/* sets up an io_uring instance, fails when io_uring is unavailable or compiled out */
+int UringInit(uring_t *uring, unsigned entries);
+
+/* tears an instance down, cancelling whatever is still posted */
+void UringDestroy(uring_t *uring);
+
+/* registers the one buffer fixed reads go to, reads fall back to plain ones if refused */
+int UringRegisterBuffer(uring_t *uring, void *base, size_t length);
+
+/* posts a read into the registered buffer (or a plain read) */
+int UringPrepareRead(uring_t *uring, int fd, void *buffer, unsigned length, uint64_t tag);
+
+/* posts a one-shot wait for fd to become readable */
+int UringPreparePoll(uring_t *uring, int fd, uint64_t tag);
+
+/* submits what was prepared and waits for at least one completion */
+int UringWait(uring_t *uring);
+
+/* takes the next completion, if any */
+int UringNextCompletion(uring_t *uring, uint64_t *tag, int *result);
+
+#endif  /* URING_H */
@@ -0,0 +1,9 @@
+#include <stdio.h>
+
+/* the number of TESTS() that failed, the test returns it so 'make test' stops on a failure */
+static int failures = 0;
+
+/* PRINTS BOTH SUCCESS AND FAILURE: 
+example, this will evaluate to true and print success: 
+TESTS(4 == FRAME_HEADER_SIZE); */
+#define TESTS(x) (x) ? printf("SUCCESS\n") : (++failures, printf("\033[0;31mFAILURE: file %s line %d\033[0m\n", __FILE__, __LINE__)) ;
@@ -0,0 +1,141 @@
+#include "wheel.h"
+#include <stddef.h>		/* NULL 		*/
+#include <string.h>		/* memset 		*/
+
+
+/*
+ * Function:  WheelInit
+ * --------------------
+ *  starts an empty wheel at tick 0
+ *
+ *  wheel:	the wheel
+ *
+ *  returns:	no return value
+ */
+void WheelInit(timer_wheel_t *wheel)
+{
+	memset(wheel, 0, sizeof(timer_wheel_t));
+}
+
+
+/*
+ * Function:  Link
+ * --------------------
+ *  files a disarmed timer under the slot of its due tick
+ *
+ *  wheel:	the wheel
+ *  timer:	the timer
+ *
+ *  returns:	no return value
+ */
+static void Link(timer_wheel_t *wheel, wheel_timer_t *timer)
+{
+	wheel_timer_t **slot = &wheel->slots[timer->due % WHEEL_SLOTS];
+
+	timer->prev = NULL;
+	timer->next = *slot;
+	if(NULL != *slot)
+	{
+		(*slot)->prev = timer;
+	}
+	*slot = timer;
+	timer->armed = 1;
+}
+
+
+/*
+ * Function:  WheelCancel
+ * --------------------
+ *  takes a timer out of its slot
+ *
+ *  wheel:	the wheel
+ *  timer:	the timer, armed or not
+ *
+ *  returns:	no return value
+ */
+void WheelCancel(timer_wheel_t *wheel, wheel_timer_t *timer)
+{
+	if(!timer->armed)
+	{
+		return;
+	}
+
+	if(NULL != timer->prev)
+	{
+		timer->prev->next = timer->next;
+	}
+	else
+	{
+		wheel->slots[timer->due % WHEEL_SLOTS] = timer->next;
+	}
+	if(NULL != timer->next)
+	{
+		timer->next->prev = timer->prev;
+	}
+
+	timer->prev = NULL;
+	timer->next = NULL;
+	timer->armed = 0;
+}
+
+
+/*
+ * Function:  WheelSchedule
+ * --------------------
+ *  arms a timer to expire on a tick, moving it if it was armed already;
+ *  a tick that passed (or is the current one) means the next one
+ *
+ *  wheel:	the wheel
+ *  timer:	the timer
+ *  due:	the tick it expires on
+ *
+ *  returns:	no return value
+ */
+void WheelSchedule(timer_wheel_t *wheel, wheel_timer_t *timer, uint64_t due)
+{
+	WheelCancel(wheel, timer);
+	timer->due = due > wheel->tick ? due : wheel->tick + 1;
+	Link(wheel, timer);
+}
+
+
+/*
+ * Function:  WheelAdvance
+ * --------------------
+ *  moves the wheel on by one tick and empties the slot it came to: the
+ *  timers due on it expire, the ones due a turn or more later are filed
+ *  under it again
+ *
+ *  wheel:	the wheel
+ *
+ *  returns:	the expired timers, disarmed and linked by next, or NULL
+ */
+wheel_timer_t *WheelAdvance(timer_wheel_t *wheel)
+{
+	wheel_timer_t **slot = NULL;
+	wheel_timer_t *timer = NULL;
+	wheel_timer_t *next = NULL;
+	wheel_timer_t *expired = NULL;
+
+	++wheel->tick;
+	slot = &wheel->slots[wheel->tick % WHEEL_SLOTS];
+	timer = *slot;
+	*slot = NULL;
+
+	for(; NULL != timer; timer = next)
+	{
+		next = timer->next;
+		timer->armed = 0;
+		if(timer->due > wheel->tick)
+		{
+			Link(wheel, timer);
+			continue;
+		}
+
+		timer->prev = NULL;
+		timer->next = expired;
+		expired = timer;
+	}
+
+	return expired;
+}
@@ -0,0 +1,52 @@
+#ifndef WHEEL_H
+#define WHEEL_H
+
+#include <stdint.h>		/* uint64_t 	*/
+
+#define WHEEL_SLOTS 64						/* ticks one turn of the wheel covers */
+
+/*
+ * a timer, embedded in whatever it times out; while armed it is linked
+ * into the slot of the wheel its due tick falls on
+ *
+ *  prev, next:	links in the slot, next also links the timers WheelAdvance() returns
+ *  due:	the tick it expires on
+ *  armed:	whether it is in the wheel
+ */
+typedef struct wheel_timer
+{
+	struct wheel_timer *prev;
+	struct wheel_timer *next;
+	uint64_t due;
+	int armed;
+} wheel_timer_t;
+
+/*
+ * a hashed timer wheel: a timer is filed under its due tick modulo the
+ * number of slots, so arming and cancelling are O(1) and a tick only visits
+ * the timers filed under it, however many are armed; one due more than a
+ * turn ahead is filed again when its slot comes up early
+ *
+ *  slots:	per slot, the head of its list of timers
+ *  tick:	ticks since the wheel started
+ */
+typedef struct timer_wheel
+{
+	wheel_timer_t *slots[WHEEL_SLOTS];
+	uint64_t tick;
+} timer_wheel_t;
+
+
+/* starts an empty wheel at tick 0 */
+void WheelInit(timer_wheel_t *wheel);
+
+/* arms (or re-arms) a timer to expire on a tick, at the earliest the next one */
+void WheelSchedule(timer_wheel_t *wheel, wheel_timer_t *timer, uint64_t due);
+
+/* disarms a timer, one that isn't armed is left alone */
+void WheelCancel(timer_wheel_t *wheel, wheel_timer_t *timer);
+
+/* moves the wheel one tick on, returns the timers that expired linked by next, disarmed */
+wheel_timer_t *WheelAdvance(timer_wheel_t *wheel);
+
+#endif  /* WHEEL_H */
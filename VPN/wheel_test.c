@@ -0,0 +1,171 @@
+#include <stddef.h>	/* NULL */
+#include "wheel.h"
+#include "utilities.h"
+
+#define TIMERS 1000
+#define HORIZON (8 * WHEEL_SLOTS)
+
+/* advances the wheel to a tick, returns how many timers expired, -1 if one expired off its tick */
+static int AdvanceTo(timer_wheel_t *wheel, uint64_t tick)
+{
+	wheel_timer_t *expired = NULL;
+	int count = 0;
+
+	while(wheel->tick < tick)
+	{
+		for(expired = WheelAdvance(wheel); NULL != expired; expired = expired->next)
+		{
+			if(expired->due != wheel->tick || expired->armed)
+			{
+				return -1;
+			}
+			++count;
+		}
+	}
+
+	return count;
+}
+
+int main()
+{
+	static wheel_timer_t timers[TIMERS];
+	timer_wheel_t wheel;
+	wheel_timer_t first;
+	wheel_timer_t second;
+	wheel_timer_t third;
+	wheel_timer_t *expired = NULL;
+	uint32_t seed = 1;
+	size_t i = 0;
+	int expected = 0;
+	int count = 0;
+
+	WheelInit(&wheel);
+	first.armed = 0;
+	second.armed = 0;
+	third.armed = 0;
+
+
+	/***** WheelAdvance *****/
+	printf("\n\n----- WheelAdvance -----\n\n");
+	WheelSchedule(&wheel, &first, 3);
+	TESTS(NULL == WheelAdvance(&wheel));
+	TESTS(NULL == WheelAdvance(&wheel));
+	expired = WheelAdvance(&wheel);
+	TESTS(&first == expired && NULL == expired->next && 0 == first.armed);
+	TESTS(NULL == WheelAdvance(&wheel));
+
+	/* timers due on the same tick expire together */
+	WheelSchedule(&wheel, &first, 10);
+	WheelSchedule(&wheel, &second, 10);
+	WheelSchedule(&wheel, &third, 10);
+	TESTS(0 == AdvanceTo(&wheel, 9));
+	TESTS(3 == AdvanceTo(&wheel, 10));
+
+	/* a tick that passed, or the current one, means the next one */
+	WheelSchedule(&wheel, &first, 2);
+	WheelSchedule(&wheel, &second, wheel.tick);
+	TESTS(wheel.tick + 1 == first.due && wheel.tick + 1 == second.due);
+	TESTS(2 == AdvanceTo(&wheel, wheel.tick + 1));
+
+
+	/***** WheelAdvance - wrap *****/
+	printf("\n\n----- WheelAdvance - wrap -----\n\n");
+	/* the same slot a turn and two turns apart */
+	WheelSchedule(&wheel, &first, wheel.tick + 5);
+	WheelSchedule(&wheel, &second, first.due + WHEEL_SLOTS);
+	WheelSchedule(&wheel, &third, first.due + 2 * WHEEL_SLOTS);
+	TESTS(1 == AdvanceTo(&wheel, first.due));
+	TESTS(1 == second.armed && 1 == third.armed);
+	TESTS(0 == AdvanceTo(&wheel, second.due - 1));
+	TESTS(1 == AdvanceTo(&wheel, second.due));
+	TESTS(1 == AdvanceTo(&wheel, third.due));
+
+	/* many turns ahead */
+	WheelSchedule(&wheel, &first, wheel.tick + 100 * WHEEL_SLOTS + 1);
+	TESTS(0 == AdvanceTo(&wheel, first.due - 1));
+	TESTS(1 == first.armed);
+	TESTS(1 == AdvanceTo(&wheel, first.due));
+
+
+	/***** WheelSchedule - reschedule *****/
+	printf("\n\n----- WheelSchedule - reschedule -----\n\n");
+	/* later, the old tick passes without it */
+	WheelSchedule(&wheel, &first, wheel.tick + 4);
+	WheelSchedule(&wheel, &first, wheel.tick + 9);
+	TESTS(0 == AdvanceTo(&wheel, wheel.tick + 8));
+	TESTS(1 == AdvanceTo(&wheel, wheel.tick + 1));
+
+	/* earlier */
+	WheelSchedule(&wheel, &first, wheel.tick + 40);
+	WheelSchedule(&wheel, &first, wheel.tick + 2);
+	TESTS(1 == AdvanceTo(&wheel, wheel.tick + 2));
+	TESTS(0 == AdvanceTo(&wheel, wheel.tick + 40));
+
+	/* to the same slot a turn later, as a keepalive pushed back by traffic is */
+	WheelSchedule(&wheel, &first, wheel.tick + 3);
+	WheelSchedule(&wheel, &second, wheel.tick + 3);
+	WheelSchedule(&wheel, &first, first.due + WHEEL_SLOTS);
+	TESTS(1 == AdvanceTo(&wheel, second.due));
+	TESTS(1 == AdvanceTo(&wheel, first.due));
+
+
+	/***** WheelCancel *****/
+	printf("\n\n----- WheelCancel -----\n\n");
+	/* the first, middle and last timer of a slot */
+	WheelSchedule(&wheel, &first, wheel.tick + 7);
+	WheelSchedule(&wheel, &second, wheel.tick + 7);
+	WheelSchedule(&wheel, &third, wheel.tick + 7);
+	WheelCancel(&wheel, &second);
+	TESTS(0 == second.armed);
+	WheelCancel(&wheel, &second);
+	expired = NULL;
+	while(NULL == expired)
+	{
+		expired = WheelAdvance(&wheel);
+	}
+	TESTS(((&first == expired && &third == expired->next) || (&third == expired && &first == expired->next)) && NULL == expired->next->next);
+
+	WheelSchedule(&wheel, &first, wheel.tick + 1);
+	WheelSchedule(&wheel, &second, wheel.tick + 1);
+	WheelSchedule(&wheel, &third, wheel.tick + 1);
+	WheelCancel(&wheel, &first);
+	WheelCancel(&wheel, &third);
+	expired = WheelAdvance(&wheel);
+	TESTS(&second == expired && NULL == expired->next);
+
+
+	/***** WheelAdvance - many timers *****/
+	printf("\n\n----- WheelAdvance - many timers -----\n\n");
+	/* spread over several turns, a third of them rescheduled and a tenth cancelled on the way */
+	for(i = 0; i < TIMERS; ++i)
+	{
+		seed = seed * 1103515245 + 12345;
+		timers[i].armed = 0;
+		WheelSchedule(&wheel, &timers[i], wheel.tick + 1 + (seed >> 8) % HORIZON);
+	}
+	count = AdvanceTo(&wheel, wheel.tick + HORIZON / 2);
+	expected = 0;
+	for(i = 0; i < TIMERS; ++i)
+	{
+		seed = seed * 1103515245 + 12345;
+		if(0 == i % 3)
+		{
+			WheelSchedule(&wheel, &timers[i], wheel.tick + 1 + (seed >> 8) % HORIZON);
+		}
+		else if(0 == i % 10)
+		{
+			WheelCancel(&wheel, &timers[i]);
+		}
+		expected += timers[i].armed;
+	}
+	TESTS(-1 != count);
+	TESTS(expected == AdvanceTo(&wheel, wheel.tick + HORIZON + 1));
+	for(i = 0, count = 0; i < TIMERS; ++i)
+	{
+		count += timers[i].armed;
+	}
+	TESTS(0 == count);
+
+
+	return 0 != failures;
+}